@@ -0,0 +1,832 @@
+//
+//  ArduinoSim.c
+//  Simulates the Arduino film transport on a pseudo-terminal, so the host side of the serial protocol
+//  can be run and measured without the scanner rig
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#define _GNU_SOURCE     // ptsname_r, posix_openpt on Linux
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include "ArduinoResponse.h"
+#include "ArduinoSim.h"
+#include "BinaryProtocol.h"
+#include "Deadline.h"
+#include "ResponseParser.h"
+#include "SensorStream.h"
+
+#define SENSOR_DARK         200     // readings on the film
+#define SENSOR_LIGHT        800     // and through a hole
+#define SENSOR_NOISE        40      // up to this much either way
+#define SENSOR_SWING_MICROS 600     // from one to the other
+#define HOLE_LEAVES_MICROS  2000    // after a NEXTCELL, the hole moves away from the sensor
+#define SIM_HOLES           4       // holes remembered, enough for the batch being made up to see them all
+
+// The commands we understand are the ones in ARDUINO_COMMANDS, matched in that order. The host sends them
+// without a terminator, so we match them against the start of the receive buffer. None is a prefix of another.
+
+struct ArduinoSim
+{
+    ArduinoSimConfig config;
+    int masterFd;
+    int slaveFd;                // kept open so the pty survives the host closing and reopening it
+    int stopPipe[2];
+    char slavePath[128];
+    char received[256];         // command bytes not handled yet
+    size_t receivedLength;
+    bool binary;                // speaking the binary protocol
+    uint8_t sequence;           // sequence number of the binary command being handled, echoed in the replies
+    BinaryDecoder decoder;
+    unsigned int randomState;
+    pthread_mutex_t writeLock;  // arduinoSimSendReady and the stream thread write too
+    pthread_t thread;
+    bool threadStarted;
+    pthread_mutex_t sensorLock; // the holes below, set by moves and read by the stream thread
+    uint64_t holeArrives[SIM_HOLES];    // monotonicNanos() a hole reaches the sensor, UINT64_MAX for none
+    uint64_t holeLeaves[SIM_HOLES];     // and moves away, UINT64_MAX while the film stands at it
+    unsigned int lastHole;      // the one the film is at or moving to
+    pthread_t streamThread;
+    _Atomic bool streaming;
+    unsigned int streamRandomState; // the stream thread's own
+    ArduinoSimStats stats;
+};
+
+// -------------------------------------------------------------------------------------------
+
+void arduinoSimDefaultConfig(ArduinoSimConfig *config)
+{
+    memset(config, 0, sizeof(ArduinoSimConfig));
+    config->logLines = true;
+    config->binary = true;
+    config->telemetryPeriodMicros = 200;
+    config->telemetryBatch = 50;
+    config->sensorLagMicros = 3000;
+    config->sensorLagJitterMicros = 2000;
+    config->seed = 1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static double randomChance(ArduinoSim *sim)
+{
+    return (double)rand_r(&sim->randomState) / ((double)RAND_MAX + 1.0);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void simPause(uint32_t micros)
+{
+    if (micros > 0)
+    {
+        usleep(micros);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Write everything, splitting it into fragments if we've been asked to
+static void simWrite(ArduinoSim *sim, const char *data, size_t length)
+{
+    size_t piece = sim->config.fragmentBytes ? sim->config.fragmentBytes : length;
+    size_t offset = 0;
+    size_t count;
+    ssize_t numBytes;
+
+    pthread_mutex_lock(&sim->writeLock);
+    while (offset < length)
+    {
+        count = length - offset < piece ? length - offset : piece;
+        numBytes = write(sim->masterFd, &data[offset], count);
+        if (numBytes == -1)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+            {
+                continue;
+            }
+            break;
+        }
+
+        offset += numBytes;
+        sim->stats.bytesWritten += numBytes;
+
+        if (offset < length)
+        {
+            simPause(sim->config.fragmentDelayMicros);
+        }
+    }
+    pthread_mutex_unlock(&sim->writeLock);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void simSendLine(ArduinoSim *sim, const char *line)
+{
+    char buffer[160];
+    int length = snprintf(buffer, sizeof(buffer), "%s\n", line);
+
+    simWrite(sim, buffer, (size_t)length);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// randomState is the calling thread's, for the corruption
+static void simSendFrameAs(ArduinoSim *sim, uint8_t opcode, uint8_t sequence, const void *payload, size_t length,
+                           unsigned int *randomState)
+{
+    uint8_t frame[BINARY_MAX_FRAME];
+    size_t frameLength = binaryEncodeFrame(opcode, sequence, payload, length, frame);
+
+    if (sim->config.corruptRate > 0.0 &&
+        (double)rand_r(randomState) / ((double)RAND_MAX + 1.0) < sim->config.corruptRate)
+    {
+        // Anything but the start byte, so the host has to notice through the CRC
+        sim->stats.framesCorrupted++;
+        frame[1 + rand_r(randomState) % (frameLength - 1)] ^= (uint8_t)(1 << (rand_r(randomState) % 8));
+    }
+
+    simWrite(sim, (const char *)frame, frameLength);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void simSendFrame(ArduinoSim *sim, uint8_t opcode, const void *payload, size_t length)
+{
+    simSendFrameAs(sim, opcode, sim->sequence, payload, length, &sim->randomState);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Replies without a payload (OK, READY, ATCELL) in whichever protocol we're speaking
+static void simSendResponse(ArduinoSim *sim, uint8_t opcode, const char *line)
+{
+    if (sim->binary)
+    {
+        simSendFrame(sim, opcode, NULL, 0);
+    }
+    else
+    {
+        simSendLine(sim, line);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void simSendError(ArduinoSim *sim, uint8_t code, const char *text)
+{
+    char buffer[160];
+    int length;
+
+    if (sim->binary)
+    {
+        buffer[0] = (char)code;
+        length = snprintf(&buffer[1], sizeof(buffer) - 1, "%s", text);
+        simSendFrame(sim, OpError, buffer, (size_t)length + 1);
+    }
+    else
+    {
+        snprintf(buffer, sizeof(buffer), "%s%u %s", responseText(Error), code, text);
+        simSendLine(sim, buffer);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void simLog(ArduinoSim *sim, const char *text)
+{
+    char buffer[160];
+
+    if (!sim->config.logLines)
+    {
+        return;
+    }
+
+    if (sim->binary)
+    {
+        simSendFrame(sim, OpLog, text, strlen(text));
+    }
+    else
+    {
+        snprintf(buffer, sizeof(buffer), LOG_PREFIX "%s", text);
+        simSendLine(sim, buffer);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// How much of the hole is in front of the sensor at a time, 0 to 1
+static double holeShowing(uint64_t at, uint64_t arrives, uint64_t leaves)
+{
+    double swing = SENSOR_SWING_MICROS * 1000.0;
+    double showing;
+
+    if (at < arrives)
+    {
+        return 0.0;
+    }
+
+    showing = (double)(at - arrives) / swing;
+    if (at >= leaves && 1.0 - (double)(at - leaves) / swing < showing)
+    {
+        showing = 1.0 - (double)(at - leaves) / swing;
+    }
+
+    return showing < 0.0 ? 0.0 : showing > 1.0 ? 1.0 : showing;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Samples are taken every telemetryPeriodMicros from when streaming started. Each batch goes out as soon as
+// its last sample has been taken, so the host sees it with the latency a real batch would have.
+static void *simStreamThread(void *context)
+{
+    ArduinoSim *sim = context;
+    uint16_t samples[TELEMETRY_MAX_SAMPLES];
+    uint8_t payload[BINARY_MAX_PAYLOAD];
+    uint64_t arrives[SIM_HOLES];
+    uint64_t leaves[SIM_HOLES];
+    uint32_t periodMicros = sim->config.telemetryPeriodMicros;
+    size_t batch = sim->config.telemetryBatch;
+    uint64_t period = (uint64_t)periodMicros * 1000;
+    uint64_t startedAt = monotonicNanos();
+    uint32_t first = 0;
+    uint64_t now;
+    size_t length;
+
+    while (atomic_load(&sim->streaming))
+    {
+        uint64_t due = startedAt + (uint64_t)(first + batch - 1) * period;
+        struct timespec pause;
+
+        now = monotonicNanos();
+        if (due > now)
+        {
+            pause.tv_sec = (time_t)((due - now) / NANOS_PER_SECOND);
+            pause.tv_nsec = (long)((due - now) % NANOS_PER_SECOND);
+            nanosleep(&pause, NULL);
+            continue;
+        }
+
+        pthread_mutex_lock(&sim->sensorLock);
+        memcpy(arrives, sim->holeArrives, sizeof(arrives));
+        memcpy(leaves, sim->holeLeaves, sizeof(leaves));
+        pthread_mutex_unlock(&sim->sensorLock);
+
+        for (size_t i = 0; i < batch; i++)
+        {
+            uint64_t at = startedAt + (uint64_t)(first + i) * period;
+            double showing = 0.0;
+
+            for (int hole = 0; hole < SIM_HOLES; hole++)
+            {
+                double part = holeShowing(at, arrives[hole], leaves[hole]);
+                showing = part > showing ? part : showing;
+            }
+
+            samples[i] = (uint16_t)(SENSOR_DARK + (SENSOR_LIGHT - SENSOR_DARK) * showing - SENSOR_NOISE +
+                                    rand_r(&sim->streamRandomState) % (2 * SENSOR_NOISE + 1));
+        }
+
+        // Telemetry isn't a reply to anything, so it has no sequence number
+        length = telemetryEncode(first, (uint16_t)periodMicros, samples, batch, payload);
+        simSendFrameAs(sim, OpTelemetry, 0, payload, length, &sim->streamRandomState);
+        sim->stats.telemetryFrames++;
+        first += (uint32_t)batch;
+    }
+
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool simStartStream(ArduinoSim *sim)
+{
+    if (atomic_load(&sim->streaming))
+    {
+        return true;
+    }
+
+    if (sim->config.telemetryPeriodMicros == 0 || sim->config.telemetryPeriodMicros > UINT16_MAX ||
+        sim->config.telemetryBatch == 0 || sim->config.telemetryBatch > TELEMETRY_MAX_SAMPLES)
+    {
+        return false;
+    }
+
+    atomic_store(&sim->streaming, true);
+    if (pthread_create(&sim->streamThread, NULL, simStreamThread, sim) != 0)
+    {
+        atomic_store(&sim->streaming, false);
+        return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Waits for the batch being sent, so nothing follows the reply to STREAMOFF
+static void simStopStream(ArduinoSim *sim)
+{
+    if (atomic_exchange(&sim->streaming, false))
+    {
+        pthread_join(sim->streamThread, NULL);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The film starts moving: the hole it's at goes, and the next one arrives lag before the move ends
+static void simMoveHoles(ArduinoSim *sim, uint32_t moveMicros, uint32_t lagMicros)
+{
+    uint64_t now = monotonicNanos();
+
+    pthread_mutex_lock(&sim->sensorLock);
+    if (sim->holeLeaves[sim->lastHole] > now + HOLE_LEAVES_MICROS * 1000ULL)
+    {
+        sim->holeLeaves[sim->lastHole] = now + HOLE_LEAVES_MICROS * 1000ULL;
+    }
+
+    sim->lastHole = (sim->lastHole + 1) % SIM_HOLES;
+    sim->holeArrives[sim->lastHole] = now + (uint64_t)(moveMicros > lagMicros ? moveMicros - lagMicros : 0) * 1000;
+    sim->holeLeaves[sim->lastHole] = UINT64_MAX;
+    pthread_mutex_unlock(&sim->sensorLock);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Replies modelled on what the firmware sends, see kRecordedTraffic in Benchmarks/ResponseParserBench.c
+static void simHandleCommand(ArduinoSim *sim, ArduinoCommand command)
+{
+    char buffer[64];
+    uint32_t moveMicros;
+    uint32_t lagMicros;
+
+    sim->stats.commands++;
+
+    if (sim->config.timeoutRate > 0.0 && randomChance(sim) < sim->config.timeoutRate)
+    {
+        // Say nothing at all, as if the command got lost on the way
+        sim->stats.timeoutsInjected++;
+        return;
+    }
+
+    switch (command)
+    {
+        case CommandNextCell:
+            sim->stats.moves++;
+            simLog(sim, "Moving to next cell.");
+            simLog(sim, "Turning motor on to move to next cell");
+            simLog(sim, "Starting clutch.");
+
+            moveMicros = sim->config.moveLatencyMicros +
+                (sim->config.moveJitterMicros ? (uint32_t)(randomChance(sim) * sim->config.moveJitterMicros) : 0);
+            lagMicros = sim->config.sensorLagMicros +
+                (sim->config.sensorLagJitterMicros ? (uint32_t)(randomChance(sim) * sim->config.sensorLagJitterMicros) : 0);
+            simMoveHoles(sim, moveMicros, lagMicros);
+            simPause(moveMicros);
+
+            if (sim->config.errorRate > 0.0 && randomChance(sim) < sim->config.errorRate)
+            {
+                sim->stats.errorsInjected++;
+                simSendError(sim, 3, "Timeout while moving to next cell");
+            }
+            else
+            {
+                snprintf(buffer, sizeof(buffer), "sensorLowCount: %d", 1 + rand_r(&sim->randomState) % 3);
+                simLog(sim, buffer);
+                simSendResponse(sim, OpAtCell, responseText(AtCell));
+                simLog(sim, "We're at the next cell. Stopping clutch.");
+            }
+            simSendResponse(sim, OpOk, responseText(Ok));
+            break;
+
+        case CommandTestOpto:
+            simPause(sim->config.ackLatencyMicros);
+            snprintf(buffer, sizeof(buffer), "sensorLowCount: %d", rand_r(&sim->randomState) % 4);
+            simLog(sim, buffer);
+            simSendResponse(sim, OpOk, responseText(Ok));
+            break;
+
+        case CommandStreamOn:
+            simPause(sim->config.ackLatencyMicros);
+            if (!sim->binary)
+            {
+                simSendError(sim, 4, "Telemetry needs the binary protocol");
+            }
+            else if (!simStartStream(sim))
+            {
+                simSendError(sim, 5, "Could not start streaming");
+            }
+            simSendResponse(sim, OpOk, responseText(Ok));
+            break;
+
+        case CommandStreamOff:
+            simStopStream(sim);
+            simPause(sim->config.ackLatencyMicros);
+            simSendResponse(sim, OpOk, responseText(Ok));
+            break;
+
+        case CommandRewind:
+        case CommandMotorOn:
+        case CommandMotorOff:
+        case CommandPing:
+        default:
+            simPause(sim->config.ackLatencyMicros);
+            simSendResponse(sim, OpOk, responseText(Ok));
+            break;
+    }
+}
+
+static void simProcessFrames(ArduinoSim *sim);
+
+// -------------------------------------------------------------------------------------------
+
+// CMD_BINARY is the one text command with an argument, so it's the only one that needs its NewLine.
+// Returns the number of bytes it took up, 0 if it isn't complete yet, or -1 if this isn't CMD_BINARY.
+static ssize_t simMatchBinaryCommand(ArduinoSim *sim, const char *start, size_t remaining)
+{
+    size_t prefixLength = strlen(CMD_BINARY);
+    const char *newLine;
+
+    if (memcmp(start, CMD_BINARY, remaining < prefixLength ? remaining : prefixLength) != 0)
+    {
+        return -1;
+    }
+
+    newLine = memchr(start, '\n', remaining);
+    if (newLine == NULL)
+    {
+        return remaining < sizeof(sim->received) / 2 ? 0 : -1;
+    }
+
+    sim->stats.commands++;
+    sim->stats.baudRate = (uint32_t)strtoul(start + prefixLength, NULL, 10);
+
+    simPause(sim->config.ackLatencyMicros);
+    simSendLine(sim, responseText(Ok));
+
+    // Everything after the OK is binary, both ways
+    sim->binary = true;
+    sim->stats.binaryMode = true;
+    return newLine - start + 1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void simProcessReceived(ArduinoSim *sim);
+
+// -------------------------------------------------------------------------------------------
+
+// Handle every complete command at the front of the receive buffer. Bytes that can't be the start of a
+// command are skipped, NewLines included, so terminated and unterminated commands both work.
+static void simProcessReceived(ArduinoSim *sim)
+{
+    size_t consumed = 0;
+    size_t remaining;
+    size_t commandLength;
+    ssize_t switchLength;
+    bool partial;
+    int i;
+
+    while (consumed < sim->receivedLength && !sim->binary)
+    {
+        const char *start = &sim->received[consumed];
+        remaining = sim->receivedLength - consumed;
+        partial = false;
+
+        if (sim->config.binary && (switchLength = simMatchBinaryCommand(sim, start, remaining)) >= 0)
+        {
+            if (switchLength == 0)
+            {
+                break;
+            }
+            consumed += (size_t)switchLength;
+            continue;
+        }
+
+        for (i = 0; i < CommandCount; i++)
+        {
+            commandLength = strlen(commandText(i));
+            if (remaining >= commandLength && memcmp(start, commandText(i), commandLength) == 0)
+            {
+                break;
+            }
+            if (remaining < commandLength && memcmp(start, commandText(i), remaining) == 0)
+            {
+                partial = true;
+            }
+        }
+
+        if (i < CommandCount)
+        {
+            consumed += commandLength;
+            simHandleCommand(sim, (ArduinoCommand)i);
+        }
+        else if (partial)
+        {
+            // Wait for the rest of the command
+            break;
+        }
+        else
+        {
+            if (*start != '\n' && *start != '\r')
+            {
+                sim->stats.unknownBytes++;
+            }
+            consumed++;
+        }
+    }
+
+    memmove(sim->received, &sim->received[consumed], sim->receivedLength - consumed);
+    sim->receivedLength -= consumed;
+
+    if (sim->binary && sim->receivedLength > 0)
+    {
+        // The host sent its first frame straight after the switch
+        binaryDecoderFeed(&sim->decoder, sim->received, sim->receivedLength);
+        sim->receivedLength = 0;
+        simProcessFrames(sim);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Handle every complete frame in the decoder. The command opcodes are numbered in ArduinoCommand order.
+static void simProcessFrames(ArduinoSim *sim)
+{
+    BinaryFrame frame;
+    const uint8_t *rest;
+    size_t restLength;
+
+    while (binaryDecoderNext(&sim->decoder, &frame))
+    {
+        sim->sequence = frame.sequence;
+
+        if (frame.opcode >= OpNextCell && frame.opcode < OpNextCell + CommandCount)
+        {
+            simHandleCommand(sim, (ArduinoCommand)(frame.opcode - OpNextCell));
+        }
+        else if (frame.opcode == OpTextMode)
+        {
+            sim->stats.commands++;
+            simStopStream(sim);
+            simSendFrame(sim, OpOk, NULL, 0);
+
+            sim->binary = false;
+            sim->stats.binaryMode = false;
+            sim->sequence = 0;
+
+            restLength = binaryDecoderTakePending(&sim->decoder, &rest);
+            memcpy(sim->received, rest, restLength);
+            sim->receivedLength = restLength;
+            simProcessReceived(sim);
+            return;
+        }
+        else
+        {
+            sim->stats.unknownBytes += BINARY_HEADER_LENGTH + frame.length + BINARY_CRC_LENGTH;
+        }
+    }
+
+    sim->stats.crcErrors = sim->decoder.crcErrors;
+}
+
+// -------------------------------------------------------------------------------------------
+
+ArduinoSim *arduinoSimCreate(const ArduinoSimConfig *config)
+{
+    ArduinoSim *sim = calloc(1, sizeof(ArduinoSim));
+    struct termios options;
+    int error;
+
+    if (sim == NULL)
+    {
+        return NULL;
+    }
+
+    sim->config = *config;
+    sim->randomState = config->seed;
+    sim->slaveFd = -1;
+    sim->stopPipe[0] = sim->stopPipe[1] = -1;
+    pthread_mutex_init(&sim->writeLock, NULL);
+    pthread_mutex_init(&sim->sensorLock, NULL);
+    atomic_init(&sim->streaming, false);
+    sim->streamRandomState = config->seed * 31 + 7;
+
+    // Standing at a hole, as after a reset
+    for (int hole = 0; hole < SIM_HOLES; hole++)
+    {
+        sim->holeArrives[hole] = UINT64_MAX;
+        sim->holeLeaves[hole] = UINT64_MAX;
+    }
+    sim->holeArrives[0] = 0;
+
+    binaryDecoderInit(&sim->decoder);
+
+    sim->masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (sim->masterFd == -1 || grantpt(sim->masterFd) == -1 || unlockpt(sim->masterFd) == -1 ||
+        ptsname_r(sim->masterFd, sim->slavePath, sizeof(sim->slavePath)) != 0)
+    {
+        goto error;
+    }
+
+    // Hold the slave open ourselves. Otherwise the master reports a hang-up whenever the host closes its end.
+    // Raw mode stops the line discipline echoing our own replies back to us before the host has set it up.
+    sim->slaveFd = open(sim->slavePath, O_RDWR | O_NOCTTY);
+    if (sim->slaveFd == -1 || tcgetattr(sim->slaveFd, &options) == -1)
+    {
+        goto error;
+    }
+    cfmakeraw(&options);
+    if (tcsetattr(sim->slaveFd, TCSANOW, &options) == -1 || pipe(sim->stopPipe) == -1)
+    {
+        goto error;
+    }
+
+    return sim;
+
+error:
+    error = errno;
+    arduinoSimDestroy(sim);
+    errno = error;
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void arduinoSimDestroy(ArduinoSim *sim)
+{
+    if (sim == NULL)
+    {
+        return;
+    }
+
+    arduinoSimStop(sim);
+
+    if (sim->masterFd != -1)
+    {
+        close(sim->masterFd);
+    }
+    if (sim->slaveFd != -1)
+    {
+        close(sim->slaveFd);
+    }
+    if (sim->stopPipe[0] != -1)
+    {
+        close(sim->stopPipe[0]);
+        close(sim->stopPipe[1]);
+    }
+
+    pthread_mutex_destroy(&sim->writeLock);
+    pthread_mutex_destroy(&sim->sensorLock);
+    free(sim);
+}
+
+// -------------------------------------------------------------------------------------------
+
+const char *arduinoSimSlavePath(const ArduinoSim *sim)
+{
+    return sim->slavePath;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void arduinoSimSendReady(ArduinoSim *sim)
+{
+    simSendResponse(sim, OpReady, responseText(Ready));
+}
+
+// -------------------------------------------------------------------------------------------
+
+void arduinoSimRun(ArduinoSim *sim)
+{
+    int maxFd = sim->masterFd > sim->stopPipe[0] ? sim->masterFd : sim->stopPipe[0];
+    fd_set readSet;
+    ssize_t numBytes;
+
+    // The real Arduino announces itself after every reset
+    arduinoSimSendReady(sim);
+
+    while (true)
+    {
+        FD_ZERO(&readSet);
+        FD_SET(sim->masterFd, &readSet);
+        FD_SET(sim->stopPipe[0], &readSet);
+
+        if (select(maxFd + 1, &readSet, NULL, NULL, NULL) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        if (FD_ISSET(sim->stopPipe[0], &readSet))
+        {
+            break;
+        }
+
+        if (sim->binary)
+        {
+            // Commands are tiny, so a read never holds more than the decoder can take
+            uint8_t data[BINARY_MAX_FRAME];
+
+            numBytes = read(sim->masterFd, data, sizeof(data));
+            if (numBytes > 0)
+            {
+                binaryDecoderFeed(&sim->decoder, data, (size_t)numBytes);
+                simProcessFrames(sim);
+                continue;
+            }
+        }
+        else
+        {
+            numBytes = read(sim->masterFd, &sim->received[sim->receivedLength],
+                            sizeof(sim->received) - sim->receivedLength);
+            if (numBytes > 0)
+            {
+                sim->receivedLength += numBytes;
+                simProcessReceived(sim);
+            }
+        }
+
+        if (numBytes <= 0)
+        {
+            if (numBytes == -1 && (errno == EINTR || errno == EAGAIN))
+            {
+                continue;
+            }
+            break;
+        }
+
+        if (sim->receivedLength == sizeof(sim->received))
+        {
+            // Nothing in here can be a command, start again
+            sim->stats.unknownBytes += sim->receivedLength;
+            sim->receivedLength = 0;
+        }
+    }
+
+    // Stopping can't wait for the stream thread, it may be called from a signal handler
+    simStopStream(sim);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void *simThread(void *context)
+{
+    arduinoSimRun(context);
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int arduinoSimStart(ArduinoSim *sim)
+{
+    int result = pthread_create(&sim->thread, NULL, simThread, sim);
+
+    if (result != 0)
+    {
+        errno = result;
+        return -1;
+    }
+
+    sim->threadStarted = true;
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void arduinoSimStop(ArduinoSim *sim)
+{
+    ssize_t ignored = write(sim->stopPipe[1], "", 1);
+    (void)ignored;
+
+    if (sim->threadStarted)
+    {
+        pthread_join(sim->thread, NULL);
+        sim->threadStarted = false;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+void arduinoSimGetStats(ArduinoSim *sim, ArduinoSimStats *stats)
+{
+    *stats = sim->stats;
+}
+
+// -------------------------------------------------------------------------------------------
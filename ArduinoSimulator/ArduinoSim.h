@@ -0,0 +1,90 @@
+//
+//  ArduinoSim.h
+//  Simulates the Arduino film transport on a pseudo-terminal, so the host side of the serial protocol
+//  can be run and measured without the scanner rig
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  The simulator opens a pty and speaks the STC:/CTS: protocol from ArduinoResponse.h on the master side.
+//  Point the host at the slave path (USB_PORT, or --port on the command line) instead of /dev/cu.usbserial-*.
+//  Like the firmware it handles one command at a time, so a slow move holds up everything behind it.
+//  CMD_BINARY switches it to the framed protocol from BinaryProtocol.h, and OpTextMode switches it back.
+//
+//  In binary mode STC:STREAMON streams made up optic sensor readings (see SensorStream.h) from a thread of
+//  its own until STC:STREAMOFF. The sensor reads dark on the film and light through a sprocket hole. A
+//  hole arrives sensorLagMicros (plus up to sensorLagJitterMicros) before the ATCELL that ends the move,
+//  which is the time the firmware takes to notice it, and leaves soon after the next NEXTCELL. The
+//  readings are noisy and take a fraction of a millisecond to swing, like the real sensor's.
+//
+
+#ifndef ArduinoSim_h
+#define ArduinoSim_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    uint32_t ackLatencyMicros;      // delay before acknowledging simple commands (PING, MOTORON, ...)
+    uint32_t moveLatencyMicros;     // how long NEXTCELL takes to reach the next cell
+    uint32_t moveJitterMicros;      // random extra time added to each move, 0 to this value
+    bool logLines;                  // interleave "Log: ..." lines like the real firmware does
+    double errorRate;               // chance (0-1) a move fails with CTS:ERROR:
+    double timeoutRate;             // chance (0-1) a command gets no reply at all
+    size_t fragmentBytes;           // split every write into pieces of this many bytes, 0 to write whole lines
+    uint32_t fragmentDelayMicros;   // pause between the pieces of a fragmented write
+    double corruptRate;             // chance (0-1) a binary frame goes out with a flipped bit
+    bool binary;                    // support CMD_BINARY. Off to act like older firmware that doesn't
+    uint32_t telemetryPeriodMicros; // between optic sensor samples while streaming
+    uint16_t telemetryBatch;        // samples per OpTelemetry frame, up to TELEMETRY_MAX_SAMPLES
+    uint32_t sensorLagMicros;       // from the sprocket hole reaching the sensor to the ATCELL
+    uint32_t sensorLagJitterMicros; // random extra lag, 0 to this value
+    unsigned int seed;              // for the random choices, so runs can be repeated
+} ArduinoSimConfig;
+
+typedef struct
+{
+    uint64_t commands;              // recognised commands received
+    uint64_t unknownBytes;          // bytes that weren't part of any command
+    uint64_t moves;                 // NEXTCELL commands handled
+    uint64_t errorsInjected;
+    uint64_t timeoutsInjected;
+    uint64_t bytesWritten;
+    uint64_t framesCorrupted;
+    uint64_t crcErrors;             // binary commands dropped because the CRC didn't match
+    uint64_t telemetryFrames;       // OpTelemetry frames sent
+    uint32_t baudRate;              // rate asked for by the last CMD_BINARY. A pty doesn't care, so it's only recorded
+    bool binaryMode;                // currently speaking the binary protocol
+} ArduinoSimStats;
+
+typedef struct ArduinoSim ArduinoSim;
+
+// Fill in the defaults: replies without delay, log lines on, binary protocol supported, no faults.
+// Telemetry is a sample every 200 us in batches of 50, with a hole seen 3 to 5 ms before its ATCELL.
+void arduinoSimDefaultConfig(ArduinoSimConfig *config);
+
+// Open the pseudo-terminal. Returns NULL on failure (errno is set).
+ArduinoSim *arduinoSimCreate(const ArduinoSimConfig *config);
+void arduinoSimDestroy(ArduinoSim *sim);
+
+// Path the host should open, e.g. /dev/pts/3
+const char *arduinoSimSlavePath(const ArduinoSim *sim);
+
+// Run the simulator on a background thread. Returns 0 on success or -1 (errno is set).
+int arduinoSimStart(ArduinoSim *sim);
+
+// Run the simulator on the calling thread until arduinoSimStop is called
+void arduinoSimRun(ArduinoSim *sim);
+
+// Stop the simulator, waiting for the background thread if there is one. Safe to call from a signal handler
+// when the simulator runs on the calling thread.
+void arduinoSimStop(ArduinoSim *sim);
+
+// Send CTS:READY, as the Arduino does after a reset
+void arduinoSimSendReady(ArduinoSim *sim);
+
+void arduinoSimGetStats(ArduinoSim *sim, ArduinoSimStats *stats);
+
+#endif /* ArduinoSim_h */
@@ -0,0 +1,155 @@
+//
+//  main.c
+//  Command line front end for the Arduino film transport simulator
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Build (Linux or macOS):
+//      cc -std=gnu11 -O2 -I SerialPortSample -o arduinosim ArduinoSimulator/*.c
+//          SerialPortSample/BinaryProtocol.c SerialPortSample/ResponseParser.c SerialPortSample/SensorStream.c
+//          SerialPortSample/EdgeDetector.c SerialPortSample/LatencyHistogram.c SerialPortSample/Deadline.c -lpthread
+//
+//  Then run the scanner against the printed slave path:
+//      SerialPortSample --port /dev/pts/3
+//
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "ArduinoSim.h"
+
+static ArduinoSim *gSim = NULL;
+
+// ------------------------------------------------------------------------------------------------
+
+static void stopOnSignal(int signal)
+{
+    (void)signal;
+    arduinoSimStop(gSim);
+}
+
+// ------------------------------------------------------------------------------------------------
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --ack-ms N              delay before acknowledging simple commands\n"
+            "  --move-ms N             how long NEXTCELL takes\n"
+            "  --jitter-ms N           random extra time added to each move\n"
+            "  --error-rate F          chance (0-1) a move fails with CTS:ERROR:\n"
+            "  --timeout-rate F        chance (0-1) a command gets no reply\n"
+            "  --fragment N            split writes into N byte pieces\n"
+            "  --fragment-delay-us N   pause between pieces\n"
+            "  --corrupt-rate F        chance (0-1) a binary frame is corrupted\n"
+            "  --no-binary             don't support STC:BINARY:, like older firmware\n"
+            "  --no-log                don't send Log: lines\n"
+            "  --sample-us N           time between optic sensor samples while streaming\n"
+            "  --batch N               samples per telemetry frame\n"
+            "  --lag-ms N              how long before the ATCELL the sprocket hole reaches the sensor\n"
+            "  --lag-jitter-ms N       random extra lag\n"
+            "  --seed N                seed for the random choices\n", name);
+}
+
+// ------------------------------------------------------------------------------------------------
+
+int main(int argc, const char * argv[])
+{
+    ArduinoSimConfig config;
+    ArduinoSimStats stats;
+
+    arduinoSimDefaultConfig(&config);
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(argv[i], "--no-log") == 0)
+        {
+            config.logLines = false;
+            continue;
+        }
+
+        if (strcmp(argv[i], "--no-binary") == 0)
+        {
+            config.binary = false;
+            continue;
+        }
+
+        if (value == NULL)
+        {
+            usage(argv[0]);
+            return EX_USAGE;
+        }
+
+        if (strcmp(argv[i], "--ack-ms") == 0)
+            config.ackLatencyMicros = (uint32_t)atoi(value) * 1000;
+        else if (strcmp(argv[i], "--move-ms") == 0)
+            config.moveLatencyMicros = (uint32_t)atoi(value) * 1000;
+        else if (strcmp(argv[i], "--jitter-ms") == 0)
+            config.moveJitterMicros = (uint32_t)atoi(value) * 1000;
+        else if (strcmp(argv[i], "--error-rate") == 0)
+            config.errorRate = atof(value);
+        else if (strcmp(argv[i], "--timeout-rate") == 0)
+            config.timeoutRate = atof(value);
+        else if (strcmp(argv[i], "--fragment") == 0)
+            config.fragmentBytes = (size_t)atoi(value);
+        else if (strcmp(argv[i], "--fragment-delay-us") == 0)
+            config.fragmentDelayMicros = (uint32_t)atoi(value);
+        else if (strcmp(argv[i], "--corrupt-rate") == 0)
+            config.corruptRate = atof(value);
+        else if (strcmp(argv[i], "--sample-us") == 0)
+            config.telemetryPeriodMicros = (uint32_t)atoi(value);
+        else if (strcmp(argv[i], "--batch") == 0)
+            config.telemetryBatch = (uint16_t)atoi(value);
+        else if (strcmp(argv[i], "--lag-ms") == 0)
+            config.sensorLagMicros = (uint32_t)atoi(value) * 1000;
+        else if (strcmp(argv[i], "--lag-jitter-ms") == 0)
+            config.sensorLagJitterMicros = (uint32_t)atoi(value) * 1000;
+        else if (strcmp(argv[i], "--seed") == 0)
+            config.seed = (unsigned int)atoi(value);
+        else
+        {
+            usage(argv[0]);
+            return EX_USAGE;
+        }
+        i++;
+    }
+
+    gSim = arduinoSimCreate(&config);
+    if (gSim == NULL)
+    {
+        perror("Could not open a pseudo-terminal");
+        return EX_OSERR;
+    }
+
+    printf("%s\n", arduinoSimSlavePath(gSim));
+    fflush(stdout);
+
+    signal(SIGINT, stopOnSignal);
+    signal(SIGTERM, stopOnSignal);
+
+    arduinoSimRun(gSim);
+
+    arduinoSimGetStats(gSim, &stats);
+    fprintf(stderr, "%llu commands, %llu moves, %llu errors and %llu timeouts injected, %llu unknown bytes\n",
+            (unsigned long long)stats.commands, (unsigned long long)stats.moves,
+            (unsigned long long)stats.errorsInjected, (unsigned long long)stats.timeoutsInjected,
+            (unsigned long long)stats.unknownBytes);
+    if (stats.baudRate != 0)
+    {
+        fprintf(stderr, "Binary protocol at %u baud: %llu frames corrupted, %llu bad CRCs received\n",
+                stats.baudRate, (unsigned long long)stats.framesCorrupted, (unsigned long long)stats.crcErrors);
+    }
+    if (stats.telemetryFrames != 0)
+    {
+        fprintf(stderr, "%llu telemetry frames sent\n", (unsigned long long)stats.telemetryFrames);
+    }
+
+    arduinoSimDestroy(gSim);
+    return EX_OK;
+}
@@ -0,0 +1,1116 @@
+//
+//  HostStackBench.c
+//  Micro-benchmarks for the host side of the serial protocol, from classifying a line up to a whole
+//  command round trip, with results saved as JSON to catch regressions
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Build and run (Linux or macOS):
+//      cc -std=gnu11 -O2 -I SerialPortSample -I ArduinoSimulator -o hostbench Benchmarks/HostStackBench.c
+//          ArduinoSimulator/ArduinoSim.c SerialPortSample/LineFramer.c SerialPortSample/ResponseParser.c
+//          SerialPortSample/TraceLog.c SerialPortSample/LatencyHistogram.c SerialPortSample/SerialReader.c
+//          SerialPortSample/ResponseQueue.c SerialPortSample/LinkDecoder.c SerialPortSample/BinaryProtocol.c
+//          SerialPortSample/SerialTransport.c SerialPortSample/PosixSerialBackend.c
+//          SerialPortSample/TrafficCapture.c SerialPortSample/Deadline.c SerialPortSample/CommandWriter.c
+//          SerialPortSample/SensorStream.c SerialPortSample/EdgeDetector.c SerialPortSample/FrameCheck.c
+//          SerialPortSample/FileTailer.c -lpthread -lm
+//      ./hostbench [--filter text] [--min-time seconds] [--repetitions n] [--json file]
+//
+//  Works the way Google Benchmark does: each benchmark runs for more and more iterations until one run
+//  takes at least --min-time, and that many iterations are then run --repetitions times. The JSON file is
+//  in Google Benchmark's format, so its tools/compare.py can compare two runs:
+//      compare.py benchmarks before.json after.json
+//
+//  The Objective-C wrappers can't be built on Linux, so their plain C cores are measured instead:
+//  classifyResponse for translateResponse, traceEscape for logString and LineFramer for SerialBuffer.
+//  The round trips go over a pseudo-terminal to the Arduino simulator, replying without delay, so they
+//  measure the host stack and the kernel's tty layer and nothing else.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ArduinoSim.h"
+#include "BinaryProtocol.h"
+#include "CommandWriter.h"
+#include "Deadline.h"
+#include "EdgeDetector.h"
+#include "FileTailer.h"
+#include "FrameCheck.h"
+#include "LatencyHistogram.h"
+#include "LineFramer.h"
+#include "ResponseParser.h"
+#include "SensorStream.h"
+#include "SerialReader.h"
+#include "SerialTransport.h"
+#include "TraceLog.h"
+
+#define MAX_REPETITIONS     32
+#define ROUND_TRIP_MILLIS   1000    // longest a round trip may take before the benchmark gives up
+#define READ_CHUNK          64      // bytes per read when framing, about what a read off the port brings
+#define SENSOR_SIGNAL       65536   // optic sensor samples run through the edge detector per iteration
+#define SENSOR_HOLE_EVERY   2500    // samples from one sprocket hole to the next, half a second at 200 us
+#define FRAME_WIDTH         4096    // luminance plane of a 12 megapixel capture
+#define FRAME_HEIGHT        3072
+#define TAIL_LINES          100000  // recorded traffic lines in the file the tailer catches up with
+#define TAIL_WAIT_MILLIS    5000    // longest the tailer may take before the benchmark gives up
+
+// What the Arduino sent for a few NEXTCELLs, captured from the rig
+static const char *kRecordedTraffic[] =
+{
+    "Log: Moving to next cell.",
+    "Log: Turning motor on to move to next cell",
+    "Log: Starting clutch.",
+    "Log: sensorLowCount: 2",
+    "CTS:ATCELL",
+    "Log: We're at the next cell. Stopping clutch.",
+    "CTS:OK",
+    "Log: Moving to next cell.",
+    "Log: Turning motor on to move to next cell",
+    "Log: Starting clutch.",
+    "CTS:ERROR: 3 Timeout while moving to next cell",
+    "CTS:OK",
+    "CTS:READY",
+    "CTS:OK",
+    "ERROR: Timeout while waiting for the sensor",
+};
+
+#define TRAFFIC_LINES   (sizeof(kRecordedTraffic) / sizeof(kRecordedTraffic[0]))
+
+typedef struct
+{
+    uint64_t iterations;            // to run
+    uint64_t items;                 // processed, filled in by the benchmark for items_per_second
+    uint64_t bytes;                 // and for bytes_per_second
+    bool failed;                    // set by the benchmark if the run can't be trusted
+    LatencyHistogram latencies;     // of each iteration, for the benchmarks that time them one by one
+} BenchState;
+
+typedef struct
+{
+    const char *name;
+    bool (*setUp)(void);            // NULL if there's nothing to set up. False skips the benchmark
+    void (*tearDown)(void);
+    void (*run)(BenchState *state);
+} Benchmark;
+
+typedef struct
+{
+    uint64_t iterations;
+    double realNanos;               // per iteration
+    double cpuNanos;
+    double itemsPerSecond;
+    double bytesPerSecond;
+    uint64_t p50Nanos;              // 0 unless the benchmark timed its iterations
+    uint64_t p99Nanos;
+} BenchResult;
+
+// Keeps the compiler from throwing the results away
+static volatile unsigned long gSink;
+
+static size_t gTrafficLengths[TRAFFIC_LINES];
+static char gTrafficBlock[2048];    // the recorded traffic as it comes over the wire
+static size_t gTrafficBlockLength;
+static uint16_t gSensorSignal[SENSOR_SIGNAL];  // what the sensor sees while the film moves
+static uint8_t *gFrames[2];         // two cells of film, for the frame check
+static char gTailPath[64];          // the file the tailer follows
+static size_t gTailBytes;
+static _Atomic uint64_t gTailRecords;   // handed out by the tailer so far
+
+// -------------------------------------------------------------------------------------------
+
+static uint64_t threadCpuNanos(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * NANOS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void prepareTraffic(void)
+{
+    gTrafficBlockLength = 0;
+    for (size_t i = 0; i < TRAFFIC_LINES; i++)
+    {
+        gTrafficLengths[i] = strlen(kRecordedTraffic[i]);
+        memcpy(gTrafficBlock + gTrafficBlockLength, kRecordedTraffic[i], gTrafficLengths[i]);
+        gTrafficBlockLength += gTrafficLengths[i];
+        memcpy(gTrafficBlock + gTrafficBlockLength, "\r\n", 2);
+        gTrafficBlockLength += 2;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Dark film with a sprocket hole every SENSOR_HOLE_EVERY samples, and noise, like the simulator streams
+static void prepareSensorSignal(void)
+{
+    unsigned int randomState = 1;
+
+    for (size_t i = 0; i < SENSOR_SIGNAL; i++)
+    {
+        bool hole = i % SENSOR_HOLE_EVERY >= SENSOR_HOLE_EVERY - 100;
+
+        gSensorSignal[i] = (uint16_t)((hole ? 800 : 200) - 40 + rand_r(&randomState) % 81);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// translateResponse: which response a line is
+static void benchClassify(BenchState *state)
+{
+    for (uint64_t n = 0; n < state->iterations; n++)
+    {
+        for (size_t i = 0; i < TRAFFIC_LINES; i++)
+        {
+            gSink += classifyResponse(kRecordedTraffic[i], gTrafficLengths[i]);
+        }
+    }
+
+    state->items = state->iterations * TRAFFIC_LINES;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// What the reader thread does with each line: the response, the error code and the text
+static void benchParse(BenchState *state)
+{
+    ParsedResponse parsed;
+
+    for (uint64_t n = 0; n < state->iterations; n++)
+    {
+        for (size_t i = 0; i < TRAFFIC_LINES; i++)
+        {
+            parseResponse(kRecordedTraffic[i], gTrafficLengths[i], &parsed);
+            gSink += parsed.response + (unsigned long)parsed.errorCode;
+        }
+    }
+
+    state->items = state->iterations * TRAFFIC_LINES;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// logString: a line with its line end escaped, the way traffic is logged
+static void benchEscape(BenchState *state)
+{
+    char escaped[256];
+
+    for (uint64_t n = 0; n < state->iterations; n++)
+    {
+        for (size_t i = 0; i < TRAFFIC_LINES; i++)
+        {
+            gSink += traceEscape(kRecordedTraffic[i], gTrafficLengths[i] + 2, escaped, sizeof(escaped));
+        }
+    }
+
+    state->items = state->iterations * TRAFFIC_LINES;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// SerialBuffer enqueue/dequeue: add a line and its NewLine, take it out again
+static void benchEnqueueDequeue(BenchState *state)
+{
+    LineFramer framer;
+    LineView line;
+    const char *text;
+
+    lineFramerInit(&framer);
+    for (uint64_t n = 0; n < state->iterations; n++)
+    {
+        text = kRecordedTraffic[n % TRAFFIC_LINES];
+        lineFramerAppend(&framer, text, gTrafficLengths[n % TRAFFIC_LINES]);
+        lineFramerAppend(&framer, "\n", 1);
+        if (lineFramerNext(&framer, &line))
+        {
+            gSink += line.length;
+        }
+    }
+
+    state->items = state->iterations;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Mixed Log: and CTS: traffic arriving READ_CHUNK bytes at a time, split into lines and classified
+static void benchFrameTraffic(BenchState *state)
+{
+    LineFramer framer;
+    LineView line;
+    size_t chunk;
+
+    lineFramerInit(&framer);
+    for (uint64_t n = 0; n < state->iterations; n++)
+    {
+        for (size_t offset = 0; offset < gTrafficBlockLength; offset += chunk)
+        {
+            chunk = gTrafficBlockLength - offset < READ_CHUNK ? gTrafficBlockLength - offset : READ_CHUNK;
+            lineFramerAppend(&framer, gTrafficBlock + offset, chunk);
+            while (lineFramerNext(&framer, &line))
+            {
+                gSink += classifyResponse(line.data, line.length);
+            }
+        }
+    }
+
+    state->items = state->iterations * TRAFFIC_LINES;
+    state->bytes = state->iterations * gTrafficBlockLength;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The optic sensor stream, TELEMETRY_MAX_SAMPLES at a time as the batches come
+static void edgeDetect(BenchState *state, bool vector)
+{
+    EdgeDetector detector;
+    SensorEdge edges[64];
+    size_t chunk;
+
+    edgeDetectorInit(&detector, &(EdgeDetectorConfig){ 400, 600, 4, 8 });
+    for (uint64_t n = 0; n < state->iterations; n++)
+    {
+        for (size_t offset = 0; offset < SENSOR_SIGNAL; offset += chunk)
+        {
+            chunk = SENSOR_SIGNAL - offset < TELEMETRY_MAX_SAMPLES ? SENSOR_SIGNAL - offset : TELEMETRY_MAX_SAMPLES;
+            gSink += vector ? edgeDetectorRun(&detector, gSensorSignal + offset, chunk, edges, 64)
+                            : edgeDetectorRunScalar(&detector, gSensorSignal + offset, chunk, edges, 64);
+        }
+    }
+
+    state->items = state->iterations * SENSOR_SIGNAL;
+    state->bytes = state->iterations * sizeof(gSensorSignal);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void benchEdgeVector(BenchState *state)
+{
+    edgeDetect(state, true);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void benchEdgeScalar(BenchState *state)
+{
+    edgeDetect(state, false);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// A picture with grain, and the next cell: the same picture with different grain
+static bool setUpFrames(void)
+{
+    unsigned int randomState = 1;
+
+    for (int i = 0; i < 2; i++)
+    {
+        gFrames[i] = malloc((size_t)FRAME_WIDTH * FRAME_HEIGHT);
+        if (gFrames[i] == NULL)
+        {
+            return false;
+        }
+
+        for (size_t y = 0; y < FRAME_HEIGHT; y++)
+        {
+            for (size_t x = 0; x < FRAME_WIDTH; x++)
+            {
+                int level = 60 + (int)(50 * sin(x / 300.0) + 40 * cos(y / 200.0)) + rand_r(&randomState) % 21;
+
+                gFrames[i][y * FRAME_WIDTH + x] = (uint8_t)level;
+            }
+        }
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void tearDownFrames(void)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        free(gFrames[i]);
+        gFrames[i] = NULL;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// frameCheck on each cell as it's captured, new every time
+static void benchFrameCheck(BenchState *state)
+{
+    FrameChecker checker;
+
+    frameCheckerInit(&checker, FRAME_BLANK_CONTRAST);
+    for (uint64_t n = 0; n < state->iterations; n++)
+    {
+        gSink += frameCheck(&checker, gFrames[n % 2], FRAME_WIDTH, FRAME_HEIGHT, FRAME_WIDTH);
+    }
+
+    state->items = state->iterations;
+    state->bytes = state->iterations * FRAME_WIDTH * FRAME_HEIGHT;
+    state->failed = checker.stats.duplicate + checker.stats.blank + checker.stats.unchecked > 0;
+}
+
+// -------------------------------------------------------------------------------------------
+// Following a file as it's written
+
+static void countRecord(void *context, const char *record, size_t length)
+{
+    (void)context;
+    (void)record;
+    (void)length;
+    atomic_fetch_add_explicit(&gTailRecords, 1, memory_order_release);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool waitForRecords(uint64_t count)
+{
+    uint64_t start = monotonicNanos();
+
+    while (atomic_load_explicit(&gTailRecords, memory_order_acquire) < count)
+    {
+        if (monotonicNanos() - start > TAIL_WAIT_MILLIS * NANOS_PER_MILLI)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// An empty file to follow
+static bool setUpTailFile(void)
+{
+    int file;
+
+    strcpy(gTailPath, "/tmp/hostbench-tail-XXXXXX");
+    file = mkstemp(gTailPath);
+    if (file == -1)
+    {
+        fprintf(stderr, "Could not create %s - %s\n", gTailPath, strerror(errno));
+        return false;
+    }
+
+    close(file);
+    gTailBytes = 0;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// TAIL_LINES of recorded traffic already in the file
+static bool setUpFullTailFile(void)
+{
+    FILE *file;
+
+    if (!setUpTailFile() || (file = fopen(gTailPath, "w")) == NULL)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < TAIL_LINES; i++)
+    {
+        gTailBytes += (size_t)fprintf(file, "%s\n", kRecordedTraffic[i % TRAFFIC_LINES]);
+    }
+
+    fclose(file);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void tearDownTailFile(void)
+{
+    unlink(gTailPath);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Catching up with a file that's already there, e.g. a log written before the scanner started
+static void benchTailCatchUp(BenchState *state)
+{
+    FileTailerConfig config;
+    FileTailer *tailer;
+
+    fileTailerDefaultConfig(&config);
+    config.fromStart = true;
+    config.record = countRecord;
+
+    for (uint64_t n = 0; n < state->iterations; n++)
+    {
+        atomic_store(&gTailRecords, 0);
+        tailer = fileTailerStart(gTailPath, &config);
+        if (tailer == NULL || !waitForRecords(TAIL_LINES))
+        {
+            fileTailerStop(tailer, NULL);
+            state->failed = true;
+            return;
+        }
+        fileTailerStop(tailer, NULL);
+    }
+
+    state->items = state->iterations * TAIL_LINES;
+    state->bytes = state->iterations * gTailBytes;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// From a line being written to the file to the tailer handing it out
+static void benchTailLatency(BenchState *state)
+{
+    static const char kLine[] = "Log: We're at the next cell. Stopping clutch.\n";
+    FileTailerConfig config;
+    FileTailer *tailer;
+    uint64_t start;
+    int file = open(gTailPath, O_WRONLY | O_APPEND);
+
+    fileTailerDefaultConfig(&config);
+    config.record = countRecord;
+    atomic_store(&gTailRecords, 0);
+    tailer = fileTailerStart(gTailPath, &config);
+    if (file == -1 || tailer == NULL)
+    {
+        fileTailerStop(tailer, NULL);
+        if (file != -1)
+        {
+            close(file);
+        }
+        state->failed = true;
+        return;
+    }
+
+    for (uint64_t n = 0; n < state->iterations; n++)
+    {
+        start = monotonicNanos();
+        if (write(file, kLine, sizeof(kLine) - 1) != (ssize_t)sizeof(kLine) - 1 || !waitForRecords(n + 1))
+        {
+            state->failed = true;
+            break;
+        }
+        latencyHistogramRecord(&state->latencies, monotonicNanos() - start);
+    }
+
+    fileTailerStop(tailer, NULL);
+    close(file);
+    state->items = state->iterations;
+}
+
+// -------------------------------------------------------------------------------------------
+// Round trips over a pseudo-terminal to the simulator
+
+typedef struct
+{
+    ArduinoSim *sim;
+    SerialTransport transport;
+    SerialReader *reader;
+    CommandWriter *writer;      // commands go out through it, as they do from SerialComms
+    int fileDescriptor;
+} Loopback;
+
+static Loopback gLoopback;
+
+// -------------------------------------------------------------------------------------------
+
+// Wait for the OK that finishes the command, skipping ATCELL and anything else on the way. Log lines go
+// to their own channel, which is drained so it never fills up.
+static bool waitForOk(void)
+{
+    ResponseEvent event;
+    ResponseEvent log;
+    uint64_t deadline = deadlineAfterMillis(ROUND_TRIP_MILLIS);
+
+    while (serialReaderNext(gLoopback.reader, &event, deadline))
+    {
+        while (serialReaderNextLog(gLoopback.reader, &log))
+        {
+        }
+
+        if (event.response == Ok)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void tearDownLoopback(void)
+{
+    if (gLoopback.reader)
+    {
+        serialReaderDestroy(gLoopback.reader);
+    }
+    if (gLoopback.writer)
+    {
+        commandWriterDestroy(gLoopback.writer);
+    }
+    if (gLoopback.fileDescriptor != -1)
+    {
+        serialTransportClose(&gLoopback.transport);
+    }
+    if (gLoopback.sim)
+    {
+        arduinoSimDestroy(gLoopback.sim);
+    }
+
+    memset(&gLoopback, 0, sizeof(gLoopback));
+    gLoopback.fileDescriptor = -1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool setUpLoopback(bool logLines)
+{
+    ArduinoSimConfig config;
+    SerialPortOptions options;
+
+    memset(&gLoopback, 0, sizeof(gLoopback));
+    gLoopback.fileDescriptor = -1;
+
+    arduinoSimDefaultConfig(&config);
+    config.logLines = logLines;
+    gLoopback.sim = arduinoSimCreate(&config);
+    if (gLoopback.sim == NULL || arduinoSimStart(gLoopback.sim) == -1)
+    {
+        fprintf(stderr, "Could not start the simulator - %s(%d).\n", strerror(errno), errno);
+        tearDownLoopback();
+        return false;
+    }
+
+    serialTransportInit(&gLoopback.transport, &kPosixSerialBackend);
+    serialPortDefaultOptions(&options);
+    gLoopback.fileDescriptor = serialTransportOpen(&gLoopback.transport, arduinoSimSlavePath(gLoopback.sim),
+                                                   &options);
+    if (gLoopback.fileDescriptor == -1)
+    {
+        fprintf(stderr, "Could not open %s - %s\n", arduinoSimSlavePath(gLoopback.sim), gLoopback.transport.lastError);
+        tearDownLoopback();
+        return false;
+    }
+
+    gLoopback.reader = serialReaderCreate(gLoopback.fileDescriptor);
+    if (gLoopback.reader == NULL || serialReaderStart(gLoopback.reader) == -1)
+    {
+        fprintf(stderr, "Could not start the reader - %s(%d).\n", strerror(errno), errno);
+        tearDownLoopback();
+        return false;
+    }
+
+    gLoopback.writer = commandWriterCreate(gLoopback.fileDescriptor);
+    if (gLoopback.writer == NULL || commandWriterStart(gLoopback.writer) == -1)
+    {
+        fprintf(stderr, "Could not start the writer - %s(%d).\n", strerror(errno), errno);
+        tearDownLoopback();
+        return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool setUpQuietLoopback(void)
+{
+    return setUpLoopback(false);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool setUpChattyLoopback(void)
+{
+    return setUpLoopback(true);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool setUpBinaryLoopback(void)
+{
+    static const char kSwitch[] = CMD_BINARY "0\n";
+
+    if (!setUpLoopback(false))
+    {
+        return false;
+    }
+
+    serialReaderSwitchToBinaryAfterOk(gLoopback.reader);
+    if (commandWriterSend(gLoopback.writer, kSwitch, strlen(kSwitch)) != (ssize_t)strlen(kSwitch) || !waitForOk())
+    {
+        fprintf(stderr, "The simulator didn't switch to the binary protocol\n");
+        tearDownLoopback();
+        return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void textRoundTrips(BenchState *state, ArduinoCommand command)
+{
+    const char *text = commandText(command);
+    size_t length = strlen(text);
+    uint64_t start;
+
+    for (uint64_t n = 0; n < state->iterations; n++)
+    {
+        start = monotonicNanos();
+        if (commandWriterSend(gLoopback.writer, text, length) != (ssize_t)length || !waitForOk())
+        {
+            state->failed = true;
+            return;
+        }
+        latencyHistogramRecord(&state->latencies, monotonicNanos() - start);
+    }
+
+    state->items = state->iterations;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void benchPingText(BenchState *state)
+{
+    textRoundTrips(state, CommandPing);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// NEXTCELL with the Log: lines and the ATCELL the firmware sends on the way
+static void benchNextCellText(BenchState *state)
+{
+    textRoundTrips(state, CommandNextCell);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void binaryRoundTrips(BenchState *state, uint8_t opcode)
+{
+    uint8_t frame[BINARY_MAX_FRAME];
+    size_t length;
+    uint64_t start;
+
+    for (uint64_t n = 0; n < state->iterations; n++)
+    {
+        start = monotonicNanos();
+        length = binaryEncodeFrame(opcode, (uint8_t)(n % 255 + 1), NULL, 0, frame);
+        if (commandWriterSend(gLoopback.writer, frame, length) != (ssize_t)length || !waitForOk())
+        {
+            state->failed = true;
+            return;
+        }
+        latencyHistogramRecord(&state->latencies, monotonicNanos() - start);
+    }
+
+    state->items = state->iterations;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void benchPingBinary(BenchState *state)
+{
+    binaryRoundTrips(state, OpPing);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// NEXTCELL with the ATCELL on the way, as frames
+static void benchNextCellBinary(BenchState *state)
+{
+    binaryRoundTrips(state, OpNextCell);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static const Benchmark kBenchmarks[] =
+{
+    { "BM_ClassifyResponse/recorded",   NULL, NULL, benchClassify },
+    { "BM_ParseResponse/recorded",      NULL, NULL, benchParse },
+    { "BM_EscapeLine/recorded",         NULL, NULL, benchEscape },
+    { "BM_LineFramer/enqueue_dequeue",  NULL, NULL, benchEnqueueDequeue },
+    { "BM_LineFramer/mixed_traffic",    NULL, NULL, benchFrameTraffic },
+    { "BM_EdgeDetect/vector",           NULL, NULL, benchEdgeVector },
+    { "BM_EdgeDetect/scalar",           NULL, NULL, benchEdgeScalar },
+    { "BM_FrameCheck/12mp",             setUpFrames, tearDownFrames, benchFrameCheck },
+    { "BM_FileTailer/catch_up",         setUpFullTailFile, tearDownTailFile, benchTailCatchUp },
+    { "BM_FileTailer/append_latency",   setUpTailFile, tearDownTailFile, benchTailLatency },
+    { "BM_RoundTrip/ping_text",         setUpQuietLoopback, tearDownLoopback, benchPingText },
+    { "BM_RoundTrip/nextcell_text",     setUpChattyLoopback, tearDownLoopback, benchNextCellText },
+    { "BM_RoundTrip/ping_binary",       setUpBinaryLoopback, tearDownLoopback, benchPingBinary },
+    { "BM_RoundTrip/nextcell_binary",   setUpBinaryLoopback, tearDownLoopback, benchNextCellBinary },
+};
+
+#define BENCHMARK_COUNT (sizeof(kBenchmarks) / sizeof(kBenchmarks[0]))
+
+// -------------------------------------------------------------------------------------------
+
+static bool runOnce(const Benchmark *benchmark, uint64_t iterations, BenchResult *result, uint64_t *realNanos)
+{
+    BenchState *state = calloc(1, sizeof(BenchState));
+    uint64_t start;
+    uint64_t cpuStart;
+    double seconds;
+
+    if (state == NULL)
+    {
+        return false;
+    }
+
+    state->iterations = iterations;
+    latencyHistogramReset(&state->latencies);
+
+    cpuStart = threadCpuNanos();
+    start = monotonicNanos();
+    benchmark->run(state);
+    *realNanos = monotonicNanos() - start;
+
+    seconds = (double)*realNanos / NANOS_PER_SECOND;
+    result->iterations = iterations;
+    result->realNanos = (double)*realNanos / (double)iterations;
+    result->cpuNanos = (double)(threadCpuNanos() - cpuStart) / (double)iterations;
+    result->itemsPerSecond = seconds > 0 ? (double)state->items / seconds : 0.0;
+    result->bytesPerSecond = seconds > 0 ? (double)state->bytes / seconds : 0.0;
+    result->p50Nanos = latencyHistogramPercentile(&state->latencies, 50);
+    result->p99Nanos = latencyHistogramPercentile(&state->latencies, 99);
+
+    if (state->failed)
+    {
+        free(state);
+        return false;
+    }
+
+    free(state);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Grow the iterations until a run takes minSeconds, then run that many repetitions times. Returns the
+// number of results, 0 if the benchmark failed.
+static int runBenchmark(const Benchmark *benchmark, double minSeconds, int repetitions, BenchResult *results)
+{
+    uint64_t iterations = 1;
+    uint64_t realNanos;
+    uint64_t minNanos = (uint64_t)(minSeconds * NANOS_PER_SECOND);
+    double scale;
+
+    for (;;)
+    {
+        if (!runOnce(benchmark, iterations, &results[0], &realNanos))
+        {
+            return 0;
+        }
+
+        if (realNanos >= minNanos || iterations >= 1000000000ULL)
+        {
+            break;
+        }
+
+        // Aim a bit past the minimum, but never more than ten times further in one go
+        scale = realNanos > 0 ? (double)minNanos * 1.4 / (double)realNanos : 10.0;
+        iterations = (uint64_t)((double)iterations * (scale > 10.0 ? 10.0 : scale)) + 1;
+    }
+
+    for (int i = 1; i < repetitions; i++)
+    {
+        if (!runOnce(benchmark, iterations, &results[i], &realNanos))
+        {
+            return 0;
+        }
+    }
+
+    return repetitions;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double left = *(const double *)a;
+    double right = *(const double *)b;
+
+    return left < right ? -1 : left > right;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Mean, median and standard deviation of one field over the repetitions
+static void aggregate(const BenchResult *results, int count, size_t offset, double *mean, double *median,
+                      double *stddev)
+{
+    double values[MAX_REPETITIONS];
+    double sum = 0;
+    double squares = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        values[i] = *(const double *)((const char *)&results[i] + offset);
+        sum += values[i];
+    }
+
+    *mean = sum / count;
+    for (int i = 0; i < count; i++)
+    {
+        squares += (values[i] - *mean) * (values[i] - *mean);
+    }
+    *stddev = count > 1 ? sqrt(squares / (count - 1)) : 0.0;
+
+    qsort(values, (size_t)count, sizeof(double), compareDoubles);
+    *median = count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void writeJsonEntry(FILE *out, bool *first, const char *name, const char *runName, const char *runType,
+                           const char *aggregateName, int repetitions, int index, const BenchResult *result)
+{
+    fprintf(out, "%s\n    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n      \"run_type\": \"%s\",\n"
+            "      \"repetitions\": %d,\n", *first ? "" : ",", name, runName, runType, repetitions);
+    if (aggregateName)
+    {
+        fprintf(out, "      \"aggregate_name\": \"%s\",\n", aggregateName);
+    }
+    else
+    {
+        fprintf(out, "      \"repetition_index\": %d,\n", index);
+    }
+    fprintf(out, "      \"iterations\": %llu,\n      \"real_time\": %.4f,\n      \"cpu_time\": %.4f,\n"
+            "      \"time_unit\": \"ns\"", (unsigned long long)result->iterations, result->realNanos, result->cpuNanos);
+    if (result->itemsPerSecond > 0)
+    {
+        fprintf(out, ",\n      \"items_per_second\": %.2f", result->itemsPerSecond);
+    }
+    if (result->bytesPerSecond > 0)
+    {
+        fprintf(out, ",\n      \"bytes_per_second\": %.2f", result->bytesPerSecond);
+    }
+    if (result->p50Nanos > 0)
+    {
+        fprintf(out, ",\n      \"p50_ns\": %llu,\n      \"p99_ns\": %llu", (unsigned long long)result->p50Nanos,
+                (unsigned long long)result->p99Nanos);
+    }
+    fprintf(out, "\n    }");
+    *first = false;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void writeJsonResults(FILE *out, const Benchmark *benchmark, const BenchResult *results, int count,
+                             bool *first)
+{
+    static const char *kAggregates[] = { "mean", "median", "stddev" };
+    BenchResult summary[3];
+    char name[128];
+    double values[3];
+
+    for (int i = 0; i < count; i++)
+    {
+        writeJsonEntry(out, first, benchmark->name, benchmark->name, "iteration", NULL, count, i, &results[i]);
+    }
+
+    if (count < 2)
+    {
+        return;
+    }
+
+    memset(summary, 0, sizeof(summary));
+    aggregate(results, count, offsetof(BenchResult, realNanos), &values[0], &values[1], &values[2]);
+    for (int i = 0; i < 3; i++)
+    {
+        summary[i].iterations = results[0].iterations;
+        summary[i].realNanos = values[i];
+    }
+    aggregate(results, count, offsetof(BenchResult, cpuNanos), &values[0], &values[1], &values[2]);
+    for (int i = 0; i < 3; i++)
+    {
+        summary[i].cpuNanos = values[i];
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        snprintf(name, sizeof(name), "%s_%s", benchmark->name, kAggregates[i]);
+        writeJsonEntry(out, first, name, benchmark->name, "aggregate", kAggregates[i], count, 0, &summary[i]);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void writeJsonContext(FILE *out, const char *executable)
+{
+    char host[256] = "";
+    char date[64] = "";
+    time_t now = time(NULL);
+
+    gethostname(host, sizeof(host) - 1);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+
+    fprintf(out, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"host_name\": \"%s\",\n    \"executable\": \"%s\",\n"
+            "    \"num_cpus\": %ld,\n    \"library_build_type\": \"release\"\n  },\n  \"benchmarks\": [", date, host,
+            executable, sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --filter text        only run benchmarks whose name contains text\n"
+            "  --min-time seconds   shortest run to measure (default 0.5)\n"
+            "  --repetitions n      runs to measure per benchmark (default 1, at most %d)\n"
+            "  --json file          also save the results as JSON in Google Benchmark's format\n"
+            "  --list               list the benchmarks and exit\n", name, MAX_REPETITIONS);
+}
+
+// -------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    BenchResult results[MAX_REPETITIONS];
+    const Benchmark *benchmark;
+    const char *filter = NULL;
+    const char *jsonPath = NULL;
+    double minSeconds = 0.5;
+    int repetitions = 1;
+    int count;
+    int failed = 0;
+    bool first = true;
+    FILE *json = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+        {
+            minSeconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc)
+        {
+            repetitions = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+        {
+            jsonPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--list") == 0)
+        {
+            for (size_t b = 0; b < BENCHMARK_COUNT; b++)
+            {
+                printf("%s\n", kBenchmarks[b].name);
+            }
+            return 0;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 64;
+        }
+    }
+
+    if (repetitions < 1 || repetitions > MAX_REPETITIONS || minSeconds <= 0)
+    {
+        usage(argv[0]);
+        return 64;
+    }
+
+    if (jsonPath)
+    {
+        json = fopen(jsonPath, "w");
+        if (json == NULL)
+        {
+            fprintf(stderr, "Could not create %s - %s(%d).\n", jsonPath, strerror(errno), errno);
+            return 73;
+        }
+        writeJsonContext(json, argv[0]);
+    }
+
+    prepareTraffic();
+    prepareSensorSignal();
+    printf("%-34s %14s %14s %12s  %s\n", "Benchmark", "Time", "CPU", "Iterations", "UserCounters...");
+
+    for (size_t b = 0; b < BENCHMARK_COUNT; b++)
+    {
+        benchmark = &kBenchmarks[b];
+        if (filter && strstr(benchmark->name, filter) == NULL)
+        {
+            continue;
+        }
+
+        if (benchmark->setUp && !benchmark->setUp())
+        {
+            printf("%-34s skipped\n", benchmark->name);
+            continue;
+        }
+
+        count = runBenchmark(benchmark, minSeconds, repetitions, results);
+        if (benchmark->tearDown)
+        {
+            benchmark->tearDown();
+        }
+
+        if (count == 0)
+        {
+            printf("%-34s FAILED\n", benchmark->name);
+            failed++;
+            continue;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            printf("%-34s %11.1f ns %11.1f ns %12llu", benchmark->name, results[i].realNanos, results[i].cpuNanos,
+                   (unsigned long long)results[i].iterations);
+            if (results[i].itemsPerSecond > 0)
+            {
+                printf("  items/s=%.4g", results[i].itemsPerSecond);
+            }
+            if (results[i].bytesPerSecond > 0)
+            {
+                printf(" bytes/s=%.4g", results[i].bytesPerSecond);
+            }
+            if (results[i].p50Nanos > 0)
+            {
+                printf(" p50=%.1fus p99=%.1fus", results[i].p50Nanos / 1000.0, results[i].p99Nanos / 1000.0);
+            }
+            printf("\n");
+        }
+
+        if (json)
+        {
+            writeJsonResults(json, benchmark, results, count, &first);
+        }
+    }
+
+    if (json)
+    {
+        fprintf(json, "\n  ]\n}\n");
+        if (fclose(json) != 0)
+        {
+            fprintf(stderr, "Could not write %s - %s(%d).\n", jsonPath, strerror(errno), errno);
+            return 74;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,502 @@
+//
+//  ReelSoak.c
+//  Soak test for long reels: runs a hundred thousand NEXTCELLs through the host's command path to the
+//  simulator and fails if the memory in use grows or the p99 round trip drifts as the reel goes on
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Build and run (Linux or macOS):
+//      cc -std=gnu11 -O2 -I SerialPortSample -I ArduinoSimulator -o reelsoak Benchmarks/ReelSoak.c
+//          ArduinoSimulator/ArduinoSim.c SerialPortSample/LineFramer.c SerialPortSample/ResponseParser.c
+//          SerialPortSample/TraceLog.c SerialPortSample/LatencyHistogram.c SerialPortSample/SerialReader.c
+//          SerialPortSample/ResponseQueue.c SerialPortSample/LinkDecoder.c SerialPortSample/BinaryProtocol.c
+//          SerialPortSample/SerialTransport.c SerialPortSample/PosixSerialBackend.c
+//          SerialPortSample/TrafficCapture.c SerialPortSample/Deadline.c SerialPortSample/CommandWriter.c
+//          SerialPortSample/CommandWindow.c SerialPortSample/CommandMetrics.c SerialPortSample/SensorStream.c
+//          SerialPortSample/EdgeDetector.c -lpthread -lm
+//      ./reelsoak [--cells n] [--window n] [--binary] [--trace-traffic] [--max-growth-kb n] [--max-p99-ratio x]
+//
+//  Each cell goes the way SerialComms sends a command: a slot in the command window, the command through the
+//  writer thread, the replies from the reader thread matched to it, its latencies into the command metrics
+//  and everything through the trace log (to /dev/null). The simulator answers over a pseudo-terminal with its
+//  Log: lines and without delay, so a reel of 100000 cells takes seconds rather than days.
+//
+//  The cells are run in windows. The first window is the warm-up: the rings, the queues and the allocator's
+//  arenas reach their working size there. After it the resident memory and the heap in use must stay within
+//  --max-growth-kb of where they were, and the p99 round trip of every window within --max-p99-ratio of the
+//  second window's (or SOAK_P99_SLACK_MICROS more, for a pty that's quick to begin with). Exits with 0 if
+//  the reel passed, 1 if it didn't.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#include <mach/mach.h>
+#else
+#include <malloc.h>
+#endif
+
+#include "ArduinoSim.h"
+#include "BinaryProtocol.h"
+#include "CommandMetrics.h"
+#include "CommandWindow.h"
+#include "CommandWriter.h"
+#include "Deadline.h"
+#include "LatencyHistogram.h"
+#include "SerialReader.h"
+#include "SerialTransport.h"
+#include "TraceLog.h"
+
+#define SOAK_CELLS              100000
+#define SOAK_WINDOW_CELLS       10000
+#define SOAK_MOVE_MILLIS        1000    // a move that takes longer than this is given up on
+#define SOAK_MAX_GROWTH_KB      512     // resident memory and heap may grow this much after the warm-up
+#define SOAK_MAX_P99_RATIO      2.0     // a window's p99 against the first one after the warm-up
+#define SOAK_P99_SLACK_MICROS   250
+
+typedef struct
+{
+    ArduinoSim *sim;
+    SerialTransport transport;
+    SerialReader *reader;
+    CommandWriter *writer;
+    int fileDescriptor;
+    CommandWindow window;
+    CommandMetrics metrics;
+    bool binary;
+} Soak;
+
+typedef struct
+{
+    LatencyHistogram roundTrips;
+    uint64_t residentBytes;     // at the end of the window
+    uint64_t heapBytes;
+    uint64_t failed;            // moves that timed out or reported an error
+} SoakWindow;
+
+// -------------------------------------------------------------------------------------------
+
+// Memory the process has in RAM. Read without stdio, which would allocate.
+static uint64_t residentBytes(void)
+{
+#ifdef __APPLE__
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+    {
+        return 0;
+    }
+
+    return info.resident_size;
+#else
+    char text[128];
+    unsigned long long pages;
+    ssize_t length;
+    int file = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+
+    if (file == -1)
+    {
+        return 0;
+    }
+
+    length = read(file, text, sizeof(text) - 1);
+    close(file);
+    if (length <= 0)
+    {
+        return 0;
+    }
+
+    // Total program size, then the resident set, in pages
+    text[length] = '\0';
+    if (sscanf(text, "%*u %llu", &pages) != 1)
+    {
+        return 0;
+    }
+
+    return pages * (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Bytes malloc has handed out and not had back, 0 where that can't be found out
+static uint64_t heapBytes(void)
+{
+#ifdef __APPLE__
+    malloc_statistics_t stats;
+
+    malloc_zone_statistics(NULL, &stats);
+    return stats.size_in_use;
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void closeSoak(Soak *soak)
+{
+    if (soak->reader)
+    {
+        serialReaderDestroy(soak->reader);
+    }
+    if (soak->writer)
+    {
+        commandWriterDestroy(soak->writer);
+    }
+    if (soak->fileDescriptor != -1)
+    {
+        serialTransportClose(&soak->transport);
+    }
+    if (soak->sim)
+    {
+        arduinoSimDestroy(soak->sim);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Wait for a reply, or for the move to time out
+static void pumpResponses(Soak *soak)
+{
+    ResponseEvent event;
+    ResponseEvent log;
+    CommandSlot *slot;
+    bool got = serialReaderNext(soak->reader, &event, commandWindowNextDeadline(&soak->window));
+    uint64_t now = monotonicNanos();
+
+    while (serialReaderNextLog(soak->reader, &log))
+    {
+        TRACE_BYTES(log.payload, log.length, "Arduino: %b");
+        commandWindowHeard(&soak->window, log.sequence, log.receivedAt);
+    }
+
+    if (got)
+    {
+        TRACE_BYTES(event.payload, event.length, "Read [%s%b] #%u", TRACE_STR(responseText(event.response)),
+                    event.sequence);
+        soak->metrics.unrecognised += event.response == Unrecognised;
+        commandWindowRecord(&soak->window, event.sequence, event.response, event.errorCode, event.receivedAt);
+    }
+
+    // NEXTCELL is never sent again, it could move the film a cell too far
+    while ((slot = commandWindowExpired(&soak->window, now)) != NULL)
+    {
+        TRACE("Giving up on [%s #%u]", TRACE_STR(commandText(slot->command)), slot->sequence);
+        commandWindowAbandon(&soak->window, slot, now);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// One cell: send NEXTCELL and wait for its OK. The round trip goes into the window's histogram.
+static ArduinoResponse moveToNextCell(Soak *soak, SoakWindow *window)
+{
+    uint8_t frame[BINARY_MAX_FRAME];
+    const void *data;
+    size_t length;
+    CommandSlot *slot;
+
+    slot = commandWindowOpen(&soak->window, CommandNextCell, SOAK_MOVE_MILLIS, 0, monotonicNanos());
+    if (slot == NULL)
+    {
+        return Unrecognised;
+    }
+
+    if (soak->binary)
+    {
+        length = binaryEncodeFrame(binaryOpcodeForCommand(CommandNextCell), slot->sequence, NULL, 0, frame);
+        data = frame;
+    }
+    else
+    {
+        data = commandText(CommandNextCell);
+        length = strlen(data);
+    }
+
+    commandWindowSent(&soak->window, slot, monotonicNanos());
+    if (commandWriterSend(soak->writer, data, length) != (ssize_t)length)
+    {
+        commandWindowAbandon(&soak->window, slot, monotonicNanos());
+    }
+    else
+    {
+        traceLogTraffic(TraceSent, data, length);
+        soak->metrics.bytesSent += length;
+        TRACE("Wrote %d bytes [%s #%u]", length, TRACE_STR(commandText(CommandNextCell)), slot->sequence);
+    }
+
+    while (slot->state == SlotInFlight)
+    {
+        pumpResponses(soak);
+    }
+
+    commandMetricsRecord(&soak->metrics, slot);
+    if (slot->result == Ok)
+    {
+        latencyHistogramRecord(&window->roundTrips, slot->completedAt - slot->firstSentAt);
+    }
+
+    return commandWindowCollect(&soak->window, slot);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool openSoak(Soak *soak, bool binary)
+{
+    static const char kSwitch[] = CMD_BINARY "0\n";
+    ArduinoSimConfig config;
+    SerialPortOptions options;
+    ResponseEvent event;
+
+    memset(soak, 0, sizeof(Soak));
+    soak->fileDescriptor = -1;
+    commandWindowInit(&soak->window, COMMAND_WINDOW_MAX);
+    commandMetricsReset(&soak->metrics, monotonicNanos());
+
+    arduinoSimDefaultConfig(&config);
+    soak->sim = arduinoSimCreate(&config);
+    if (soak->sim == NULL || arduinoSimStart(soak->sim) == -1)
+    {
+        fprintf(stderr, "Could not start the simulator - %s(%d).\n", strerror(errno), errno);
+        return false;
+    }
+
+    serialTransportInit(&soak->transport, &kPosixSerialBackend);
+    serialPortDefaultOptions(&options);
+    soak->fileDescriptor = serialTransportOpen(&soak->transport, arduinoSimSlavePath(soak->sim), &options);
+    if (soak->fileDescriptor == -1)
+    {
+        fprintf(stderr, "Could not open %s - %s\n", arduinoSimSlavePath(soak->sim), soak->transport.lastError);
+        return false;
+    }
+
+    soak->reader = serialReaderCreate(soak->fileDescriptor);
+    soak->writer = commandWriterCreate(soak->fileDescriptor);
+    if (soak->reader == NULL || serialReaderStart(soak->reader) == -1 ||
+        soak->writer == NULL || commandWriterStart(soak->writer) == -1)
+    {
+        fprintf(stderr, "Could not start the reader and writer threads - %s(%d).\n", strerror(errno), errno);
+        return false;
+    }
+
+    if (!binary)
+    {
+        return true;
+    }
+
+    serialReaderSwitchToBinaryAfterOk(soak->reader);
+    if (commandWriterSend(soak->writer, kSwitch, strlen(kSwitch)) != (ssize_t)strlen(kSwitch))
+    {
+        fprintf(stderr, "Could not ask the simulator for the binary protocol - %s(%d).\n", strerror(errno), errno);
+        return false;
+    }
+
+    while (serialReaderNext(soak->reader, &event, deadlineAfterMillis(SOAK_MOVE_MILLIS)))
+    {
+        if (event.response == Ok)
+        {
+            commandWindowSetSequenced(&soak->window, true);
+            soak->binary = true;
+            return true;
+        }
+    }
+
+    fprintf(stderr, "The simulator didn't switch to the binary protocol\n");
+    return false;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --cells n            cells in the reel (default %d)\n"
+            "  --window n           cells per window, the first is the warm-up (default %d)\n"
+            "  --binary             use the binary protocol\n"
+            "  --trace-traffic      trace every byte as well, as TRACE_TRAFFIC does\n"
+            "  --max-growth-kb n    memory growth allowed after the warm-up (default %d)\n"
+            "  --max-p99-ratio x    p99 drift allowed after the warm-up (default %.1f)\n",
+            program, SOAK_CELLS, SOAK_WINDOW_CELLS, SOAK_MAX_GROWTH_KB, SOAK_MAX_P99_RATIO);
+}
+
+// -------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    Soak soak;
+    SoakWindow *windows;
+    SoakWindow *window;
+    const SoakWindow *baseline;
+    unsigned long cells = SOAK_CELLS;
+    unsigned long windowCells = SOAK_WINDOW_CELLS;
+    unsigned long maxGrowthKb = SOAK_MAX_GROWTH_KB;
+    double maxRatio = SOAK_MAX_P99_RATIO;
+    bool binary = false;
+    bool traffic = false;
+    size_t windowCount;
+    uint64_t p99Limit;
+    uint64_t start;
+    int64_t residentGrowth;
+    int64_t heapGrowth;
+    int devNull;
+    int failures = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--cells") == 0 && i + 1 < argc)
+        {
+            cells = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+        {
+            windowCells = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--binary") == 0)
+        {
+            binary = true;
+        }
+        else if (strcmp(argv[i], "--trace-traffic") == 0)
+        {
+            traffic = true;
+        }
+        else if (strcmp(argv[i], "--max-growth-kb") == 0 && i + 1 < argc)
+        {
+            maxGrowthKb = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--max-p99-ratio") == 0 && i + 1 < argc)
+        {
+            maxRatio = atof(argv[++i]);
+        }
+        else
+        {
+            usage(argv[0]);
+            return 64;
+        }
+    }
+
+    // A warm-up, a baseline and at least one window to hold up against it
+    if (windowCells == 0 || cells / windowCells < 3 || maxRatio < 1.0)
+    {
+        usage(argv[0]);
+        return 64;
+    }
+
+    windowCount = cells / windowCells;
+    windows = calloc(windowCount, sizeof(SoakWindow));
+    devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (windows == NULL || devNull == -1 || !traceLogStart(devNull))
+    {
+        fprintf(stderr, "Could not set up - %s(%d).\n", strerror(errno), errno);
+        return 71;
+    }
+    traceLogRegisterThread("soak");
+    traceLogSetTraffic(traffic);
+
+    if (!openSoak(&soak, binary))
+    {
+        closeSoak(&soak);
+        traceLogStop();
+        return 69;
+    }
+
+    printf("%lu cells over a pseudo-terminal, %s protocol, in windows of %lu\n", windowCount * windowCells,
+           binary ? "binary" : "text", windowCells);
+    printf("%8s %10s %10s %10s %12s %12s %8s\n", "cells", "p50 us", "p99 us", "max us", "resident KB", "heap KB",
+           "failed");
+
+    start = monotonicNanos();
+    for (size_t w = 0; w < windowCount; w++)
+    {
+        window = &windows[w];
+        latencyHistogramReset(&window->roundTrips);
+
+        for (unsigned long n = 0; n < windowCells; n++)
+        {
+            if (moveToNextCell(&soak, window) != Ok)
+            {
+                window->failed++;
+            }
+        }
+
+        window->residentBytes = residentBytes();
+        window->heapBytes = heapBytes();
+
+        printf("%8lu %10.1f %10.1f %10.1f %12llu %12llu %8llu%s\n", (w + 1) * windowCells,
+               (double)latencyHistogramPercentile(&window->roundTrips, 50) / 1000,
+               (double)latencyHistogramPercentile(&window->roundTrips, 99) / 1000,
+               (double)latencyHistogramPercentile(&window->roundTrips, 100) / 1000,
+               (unsigned long long)(window->residentBytes / 1024), (unsigned long long)(window->heapBytes / 1024),
+               (unsigned long long)window->failed, w == 0 ? "  warm-up" : "");
+        fflush(stdout);
+    }
+
+    printf("%.0f cells/s. Commands: %llu sent, %llu completed, %llu timed out, %llu stale responses.\n",
+           (double)(windowCount * windowCells) * NANOS_PER_SECOND / (double)(monotonicNanos() - start),
+           (unsigned long long)soak.window.stats.sent, (unsigned long long)soak.window.stats.completed,
+           (unsigned long long)soak.window.stats.timedOut, (unsigned long long)soak.window.stats.staleResponses);
+
+    closeSoak(&soak);
+    traceLogStop();
+    close(devNull);
+
+    // Everything is held up against the end of the warm-up and the first window after it
+    baseline = &windows[1];
+    p99Limit = (uint64_t)(latencyHistogramPercentile(&baseline->roundTrips, 99) * maxRatio);
+    if (p99Limit < latencyHistogramPercentile(&baseline->roundTrips, 99) + SOAK_P99_SLACK_MICROS * 1000ULL)
+    {
+        p99Limit = latencyHistogramPercentile(&baseline->roundTrips, 99) + SOAK_P99_SLACK_MICROS * 1000ULL;
+    }
+
+    for (size_t w = 1; w < windowCount; w++)
+    {
+        if (windows[w].failed > 0)
+        {
+            printf("FAIL: %llu moves failed in the window ending at cell %lu\n", (unsigned long long)windows[w].failed,
+                   (w + 1) * windowCells);
+            failures++;
+        }
+        if (latencyHistogramPercentile(&windows[w].roundTrips, 99) > p99Limit)
+        {
+            printf("FAIL: p99 %.1f us in the window ending at cell %lu, more than %.1f us\n",
+                   (double)latencyHistogramPercentile(&windows[w].roundTrips, 99) / 1000, (w + 1) * windowCells,
+                   (double)p99Limit / 1000);
+            failures++;
+        }
+    }
+
+    residentGrowth = (int64_t)windows[windowCount - 1].residentBytes - (int64_t)windows[0].residentBytes;
+    heapGrowth = (int64_t)windows[windowCount - 1].heapBytes - (int64_t)windows[0].heapBytes;
+    printf("After the warm-up: resident %+lld KB, heap %+lld KB, p99 limit %.1f us\n", (long long)residentGrowth / 1024,
+           (long long)heapGrowth / 1024, (double)p99Limit / 1000);
+
+    if (residentGrowth > (int64_t)maxGrowthKb * 1024)
+    {
+        printf("FAIL: resident memory grew by %lld KB, more than %lu KB\n", (long long)residentGrowth / 1024,
+               maxGrowthKb);
+        failures++;
+    }
+    if (heapGrowth > (int64_t)maxGrowthKb * 1024)
+    {
+        printf("FAIL: the heap grew by %lld KB, more than %lu KB\n", (long long)heapGrowth / 1024, maxGrowthKb);
+        failures++;
+    }
+
+    free(windows);
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
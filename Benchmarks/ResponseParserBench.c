@@ -0,0 +1,158 @@
+//
+//  ResponseParserBench.c
+//  Times the response parser on recorded Arduino traffic against the strncmp chain it replaced
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Build and run (Linux or macOS):
+//      cc -std=gnu11 -O2 -I SerialPortSample -o parserbench Benchmarks/ResponseParserBench.c
+//          SerialPortSample/ResponseParser.c SerialPortSample/Deadline.c
+//      ./parserbench [iterations]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Deadline.h"
+#include "ResponseParser.h"
+
+// What the Arduino sent for a few NEXTCELLs, captured from the rig
+static const char *kRecordedTraffic[] =
+{
+    "Log: Moving to next cell.",
+    "Log: Turning motor on to move to next cell",
+    "Log: Starting clutch.",
+    "Log: sensorLowCount: 2",
+    "CTS:ATCELL",
+    "Log: We're at the next cell. Stopping clutch.",
+    "CTS:OK",
+    "Log: Moving to next cell.",
+    "Log: Turning motor on to move to next cell",
+    "Log: Starting clutch.",
+    "CTS:ERROR: 3 Timeout while moving to next cell",
+    "CTS:OK",
+    "CTS:READY",
+    "CTS:OK",
+    "ERROR: Timeout while waiting for the sensor",
+};
+
+#define TRAFFIC_LINES   (sizeof(kRecordedTraffic) / sizeof(kRecordedTraffic[0]))
+
+// Keeps the compiler from throwing the results away
+static volatile unsigned long gSink;
+
+// -------------------------------------------------------------------------------------------
+
+// The way translateResponse used to do it
+static ArduinoResponse strncmpChain(const char *str)
+{
+    if (strncmp(str, "CTS:OK", strlen("CTS:OK")) == 0)
+    {
+        return Ok;
+    }
+    else if (strncmp(str, "CTS:ERROR: ", strlen("CTS:ERROR: ")) == 0)
+    {
+        return Error;
+    }
+    else if (strncmp(str, "CTS:READY", strlen("CTS:READY")) == 0)
+    {
+        return Ready;
+    }
+    else if (strncmp(str, "CTS:ATCELL", strlen("CTS:ATCELL")) == 0)
+    {
+        return AtCell;
+    }
+
+    return Unrecognised;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Every response in the protocol table has to come back as itself, and the error details have to be found
+static int checkRoundTrip(void)
+{
+    ParsedResponse parsed;
+    const char *text;
+    int failures = 0;
+
+    for (int response = Unrecognised + 1; response < TimedOut; response++)
+    {
+        text = responseText((ArduinoResponse)response);
+        parseResponse(text, strlen(text), &parsed);
+        if ((int)parsed.response != response)
+        {
+            printf("FAIL: [%s] parsed as %d\n", text, (int)parsed.response);
+            failures++;
+        }
+    }
+
+    text = "CTS:ERROR: 3 Timeout while moving to next cell";
+    parseResponse(text, strlen(text), &parsed);
+    if (parsed.response != Error || parsed.errorCode != 3 || parsed.textLength != strlen("Timeout while moving to next cell"))
+    {
+        printf("FAIL: [%s] gave code %d\n", text, parsed.errorCode);
+        failures++;
+    }
+
+    text = "Log: Starting clutch.";
+    parseResponse(text, strlen(text), &parsed);
+    if (parsed.response != LogMessage || strncmp(parsed.text, "Starting clutch.", parsed.textLength) != 0)
+    {
+        printf("FAIL: [%s] parsed as %d\n", text, (int)parsed.response);
+        failures++;
+    }
+
+    return failures;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    size_t lengths[TRAFFIC_LINES];
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+    unsigned long lines = iterations * TRAFFIC_LINES;
+    ParsedResponse parsed;
+    uint64_t start;
+    uint64_t chainNanos;
+    uint64_t parserNanos;
+
+    if (checkRoundTrip() != 0)
+    {
+        return 1;
+    }
+
+    // The reader thread already knows each line's length from framing it
+    for (size_t i = 0; i < TRAFFIC_LINES; i++)
+    {
+        lengths[i] = strlen(kRecordedTraffic[i]);
+    }
+
+    start = monotonicNanos();
+    for (unsigned long n = 0; n < iterations; n++)
+    {
+        for (size_t i = 0; i < TRAFFIC_LINES; i++)
+        {
+            gSink += strncmpChain(kRecordedTraffic[i]);
+        }
+    }
+    chainNanos = monotonicNanos() - start;
+
+    start = monotonicNanos();
+    for (unsigned long n = 0; n < iterations; n++)
+    {
+        for (size_t i = 0; i < TRAFFIC_LINES; i++)
+        {
+            parseResponse(kRecordedTraffic[i], lengths[i], &parsed);
+            gSink += parsed.response + (unsigned long)parsed.errorCode;
+        }
+    }
+    parserNanos = monotonicNanos() - start;
+
+    printf("%lu lines of recorded traffic\n", lines);
+    printf("strncmp chain:   %6.2f ns/line (response kind only)\n", (double)chainNanos / lines);
+    printf("parseResponse:   %6.2f ns/line (kind, error code, text)\n", (double)parserNanos / lines);
+    return 0;
+}
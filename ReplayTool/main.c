@@ -0,0 +1,259 @@
+//
+//  main.c
+//  Command line front end for replaying a serial traffic capture
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Build (Linux or macOS):
+//      cc -std=gnu11 -O2 -I SerialPortSample -o capreplay ReplayTool/main.c SerialPortSample/ReplayEngine.c
+//          SerialPortSample/LinkDecoder.c SerialPortSample/TrafficCapture.c SerialPortSample/LineFramer.c
+//          SerialPortSample/BinaryProtocol.c SerialPortSample/ResponseParser.c SerialPortSample/Deadline.c
+//          SerialPortSample/SensorStream.c SerialPortSample/EdgeDetector.c SerialPortSample/LatencyHistogram.c
+//
+//  Then replay a capture recorded with CAPTURE_FILE or --capture:
+//      capreplay --speed 0 ScanBrain.cap
+//
+//  With --edges the telemetry in the capture goes through the same edge detection and timing as it did
+//  live, on the capture's clock, so detector settings can be tried out on a recorded stream.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sysexits.h>
+
+#include "Deadline.h"
+#include "ReplayEngine.h"
+#include "SensorStream.h"
+
+typedef struct
+{
+    bool print;                     // every response
+    bool edges;                     // run the telemetry through a SensorTracker
+    const ReplayStats *stats;       // of the replay so far, for the record times
+    SensorTracker tracker;
+    SensorBatch batch;
+} Replay;
+
+// ------------------------------------------------------------------------------------------------
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options] capture-file\n"
+            "  --speed F               1 replays at the captured pace, 0 as fast as possible (default 0)\n"
+            "  --quiet                 only print the totals, not every response\n"
+            "  --edges                 find the sprocket hole edges in the telemetry and time the cells by them\n"
+            "  --threshold LOW,HIGH    dark below LOW, light above HIGH (default 400,600)\n"
+            "  --filter N              samples averaged against noise: 1, 2, 4, 8 or 16 (default 4)\n", name);
+}
+
+// ------------------------------------------------------------------------------------------------
+
+static void printResponse(const ParsedResponse *parsed, uint8_t sequence)
+{
+    const char *text = responseText(parsed->response);
+
+    if (parsed->response == LogMessage)
+    {
+        printf("[%3u] Log: %.*s\n", sequence, (int)parsed->textLength, parsed->text);
+    }
+    else if (parsed->response == Error)
+    {
+        printf("[%3u] %s%d %.*s\n", sequence, text, parsed->errorCode, (int)parsed->textLength, parsed->text);
+    }
+    else if (text[0])
+    {
+        printf("[%3u] %s\n", sequence, text);
+    }
+    else
+    {
+        printf("[%3u] response %d\n", sequence, (int)parsed->response);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+// Batches are timed by the record they arrived in, cells by the NEXTCELL and ATCELL records
+static void trackEdges(Replay *replay, const ParsedResponse *parsed)
+{
+    SensorTracker *tracker = &replay->tracker;
+    uint64_t now = replay->stats->recordNanos;
+    uint64_t rising = tracker->stats.detector.rising;
+
+    if (parsed->response == Telemetry)
+    {
+        if (!telemetryDecode(parsed->text, parsed->textLength, &replay->batch))
+        {
+            return;
+        }
+
+        replay->batch.receivedAt = now;
+        sensorTrackerFeed(tracker, &replay->batch);
+
+        rising = tracker->stats.detector.rising - rising;
+        for (unsigned int i = rising < tracker->edgeCount ? tracker->edgeCount - (unsigned int)rising : 0;
+             replay->print && i < tracker->edgeCount; i++)
+        {
+            printf("      sprocket hole at %.3f ms\n", (double)tracker->edges[i] / NANOS_PER_MILLI);
+        }
+    }
+    else if (parsed->response == AtCell)
+    {
+        sensorTrackerCell(tracker, replay->stats->sentNanos[CommandNextCell], now);
+    }
+
+    sensorTrackerUpdate(tracker, NULL, now);
+}
+
+// ------------------------------------------------------------------------------------------------
+
+static void handleResponse(void *context, const ParsedResponse *parsed, uint8_t sequence)
+{
+    Replay *replay = context;
+
+    // With --edges the telemetry shows up as the holes found in it
+    if (replay->print && !(replay->edges && parsed->response == Telemetry))
+    {
+        printResponse(parsed, sequence);
+    }
+
+    if (replay->edges)
+    {
+        trackEdges(replay, parsed);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+static void printEdges(const SensorTracker *tracker)
+{
+    const SensorTrackerStats *stats = &tracker->stats;
+
+    fprintf(stderr, "Telemetry: %llu batches, %llu samples (%llu lost), %llu rising and %llu falling edges, "
+            "%llu suppressed\n", (unsigned long long)stats->batches, (unsigned long long)stats->samples,
+            (unsigned long long)stats->lostSamples, (unsigned long long)stats->detector.rising,
+            (unsigned long long)stats->detector.falling, (unsigned long long)stats->detector.suppressed);
+    fprintf(stderr, "%llu cells: %llu matched (%llu after their ATCELL), %llu missed, %llu abandoned\n",
+            (unsigned long long)stats->cells, (unsigned long long)stats->matched, (unsigned long long)stats->late,
+            (unsigned long long)stats->missed, (unsigned long long)stats->abandoned);
+
+    if (tracker->leads.count > 0)
+    {
+        fprintf(stderr, "Edge to ATCELL: %.3f ms median, %.3f ms p99, %.3f ms mean, %.3f - %.3f ms\n",
+                (double)latencyHistogramPercentile(&tracker->leads, 50) / NANOS_PER_MILLI,
+                (double)latencyHistogramPercentile(&tracker->leads, 99) / NANOS_PER_MILLI,
+                latencyHistogramMean(&tracker->leads) / NANOS_PER_MILLI,
+                (double)tracker->leads.min / NANOS_PER_MILLI, (double)tracker->leads.max / NANOS_PER_MILLI);
+        fprintf(stderr, "NEXTCELL to edge: %.3f ms median, %.3f ms p99, %.3f - %.3f ms\n",
+                (double)latencyHistogramPercentile(&tracker->moves, 50) / NANOS_PER_MILLI,
+                (double)latencyHistogramPercentile(&tracker->moves, 99) / NANOS_PER_MILLI,
+                (double)tracker->moves.min / NANOS_PER_MILLI, (double)tracker->moves.max / NANOS_PER_MILLI);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+int main(int argc, const char * argv[])
+{
+    static Replay replay = { .print = true };
+    ReplayOptions options = { 0, handleResponse, &replay };
+    ReplayStats stats;
+    CaptureFile file;
+    EdgeDetectorConfig config;
+    const char *path = NULL;
+    double seconds;
+    unsigned int low;
+    unsigned int high;
+
+    edgeDetectorDefaultConfig(&config);
+    replay.stats = &stats;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--quiet") == 0)
+        {
+            replay.print = false;
+        }
+        else if (strcmp(argv[i], "--edges") == 0)
+        {
+            replay.edges = true;
+        }
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc && sscanf(argv[++i], "%u,%u", &low, &high) == 2
+                 && low <= high && high < EDGE_SAMPLE_MAX)
+        {
+            config.darkBelow = (uint16_t)low;
+            config.lightAbove = (uint16_t)high;
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            config.filterWidth = (uint8_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+        {
+            options.speed = atof(argv[++i]);
+        }
+        else if (argv[i][0] != '-' && path == NULL)
+        {
+            path = argv[i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return EX_USAGE;
+        }
+    }
+
+    if (path == NULL || options.speed < 0 || !sensorTrackerInit(&replay.tracker, &config))
+    {
+        usage(argv[0]);
+        return EX_USAGE;
+    }
+
+    if (!replay.print && !replay.edges)
+    {
+        options.handler = NULL;
+    }
+
+    if (!captureFileOpen(&file, path))
+    {
+        fprintf(stderr, "Could not open capture %s - %s(%d)\n", path, strerror(errno), errno);
+        return EX_NOINPUT;
+    }
+
+    replayCapture(&file, &options, &stats);
+    captureFileClose(&file);
+
+    fprintf(stderr, "%llu records: %llu bytes received, %llu bytes in %llu commands sent\n",
+            (unsigned long long)stats.records, (unsigned long long)stats.bytesReceived,
+            (unsigned long long)stats.bytesSent, (unsigned long long)stats.commands);
+    fprintf(stderr, "%llu lines, %llu frames (%llu bad CRC), %llu protocol switches\n",
+            (unsigned long long)stats.linesFramed, (unsigned long long)stats.framesDecoded,
+            (unsigned long long)stats.crcErrors, (unsigned long long)stats.switches);
+    fprintf(stderr, "%llu OK, %llu ERROR, %llu READY, %llu ATCELL, %llu Log, %llu telemetry, %llu unrecognised\n",
+            (unsigned long long)stats.responses[Ok], (unsigned long long)stats.responses[Error],
+            (unsigned long long)stats.responses[Ready], (unsigned long long)stats.responses[AtCell],
+            (unsigned long long)stats.responses[LogMessage], (unsigned long long)stats.responses[Telemetry],
+            (unsigned long long)stats.responses[Unrecognised]);
+
+    seconds = (double)stats.decodeNanos / NANOS_PER_SECOND;
+    fprintf(stderr, "Captured over %.3f s, replayed in %.3f s. Decoding took %.3f ms",
+            (double)stats.captureNanos / NANOS_PER_SECOND, (double)stats.elapsedNanos / NANOS_PER_SECOND,
+            seconds * 1000);
+    if (stats.bytesReceived > 0 && stats.decodeNanos > 0)
+    {
+        fprintf(stderr, ", %.1f MB/s, %.1f ns/byte", (double)stats.bytesReceived / seconds / 1e6,
+                (double)stats.decodeNanos / (double)stats.bytesReceived);
+    }
+    fprintf(stderr, "\n");
+
+    if (replay.edges)
+    {
+        sensorTrackerFinish(&replay.tracker);
+        printEdges(&replay.tracker);
+    }
+
+    return EX_OK;
+}
@@ -9,28 +9,65 @@
 #ifndef ArduinoResponse_h
 #define ArduinoResponse_h
 
-// Enum that defines the types of responses we can expect from the Arduino
-typedef enum : NSUInteger {
+// The Arduino protocol in one place. The enums, the command and response strings, the parser's dispatch
+// table and the binary opcodes are all generated from these two lists, so adding a command or response is
+// a single line here.
+
+// String commands to send to the Arduino. All commands are prefixed with 'STC:'. timeout (milliseconds)
+// and attempts are the command's CommandPolicy (see CommandWindow.h). The NEXTCELL timeout is only a
+// fallback, the scan passes CAPTURE_PAUSE. Commands that move the film get one attempt.
+//  X(name, text, opcode, timeout, attempts)
+#define ARDUINO_COMMANDS(X) \
+    X(NextCell,  "STC:NEXTCELL",  0x01, 5000, 1)          /* Instruction to move to the next film cell */ \
+    X(Rewind,    "STC:REWIND",    0x02, 60000, 1)         /* Instruction to rewind the film */ \
+    X(MotorOn,   "STC:MOTORON",   0x03, TIMEOUT_PING, 3)  /* Instruction to turn the main motor on */ \
+    X(MotorOff,  "STC:MOTOROFF",  0x04, TIMEOUT_PING, 3)  /* Instruction to turn the main motor off */ \
+    X(Ping,      "STC:PING",      0x05, TIMEOUT_PING, 3)  /* Connection check sent to test if the Arduino is online */ \
+    X(TestOpto,  "STC:OPTIC",     0x06, TIMEOUT_PING, 3)  /* Run a test function to report the state of the optic sensor */ \
+    X(StreamOn,  "STC:STREAMON",  0x07, TIMEOUT_PING, 3)  /* Start sending the optic sensor's readings as OpTelemetry. Binary only */ \
+    X(StreamOff, "STC:STREAMOFF", 0x08, TIMEOUT_PING, 3)  /* Stop sending them */
+
+// String responses we expect from the Arduino. All responses are prefixed with RESPONSE_PREFIX. The key is
+// the first character after the prefix and has to be different for every response: the parser uses it to
+// go straight to the one entry that can match. A duplicate key shows up as an -Woverride-init warning.
+//  X(name, text, key, opcode)
+#define ARDUINO_RESPONSES(X) \
+    X(Ok,        "CTS:OK",       'O', 0x81)  /* Acknowledgement. To be sent as a response to each command */ \
+    X(Error,     "CTS:ERROR: ",  'E', 0x82)  /* Error response. Followed by an error code and/or text */ \
+    X(Ready,     "CTS:READY",    'R', 0x83)  /* Sent when the Arduino is ready to receive instructions */ \
+    X(AtCell,    "CTS:ATCELL",   'A', 0x84)  /* The film has been positioned and is ready for a photo capture */
+
+#define RESPONSE_PREFIX "CTS:"
+#define LOG_PREFIX      "Log: "         // Progress messages from the firmware. Not responses to anything
+#define CMD_BINARY      "STC:BINARY:"   // Switch to the binary protocol. Followed by the new baud rate and a NewLine
+
+// Enum that defines the types of responses we can expect from the Arduino. Kept as a plain C enum so the
+// C parts of the serial stack (reader thread, framer) can use it without Foundation.
+typedef enum {
     Unrecognised,   // not a valid response
-    Ok,             // CTS:OK\n
-    Error,          // CTS:ERROR \n
-    Ready,          // CTS:READY\n
-    AtCell          // CTS:ATCELL\n
+#define ARDUINO_RESPONSE_ENUM(name, text, key, opcode) name,
+    ARDUINO_RESPONSES(ARDUINO_RESPONSE_ENUM)
+#undef ARDUINO_RESPONSE_ENUM
+    TimedOut,       // nothing arrived before the deadline expired
+    Telemetry,      // batch of sensor readings. Binary protocol only
+    LogMessage,     // a LOG_PREFIX line. Goes to the log channel, not the response queue
+    ResponseCount
 } ArduinoResponse;
 
-// String commands to send to the Arduino. All commands are prefixed with 'STC:'
-#define CMD_NEXTCELL    "STC:NEXTCELL"  // Instruction to move to the next film cell
-#define CMD_REWIND      "STC:REWIND"    // Instruction to rewind the film
-#define CMD_MOTORON     "STC:MOTORON"   // Instruction to turn the main motor on
-#define CMD_MOTOROFF    "STC:MOTOROFF"  // Instruction to turn the main motor off
-#define CMD_PING        "STC:PING"      // Connection check sent to test if the Arduino is online
-#define CMD_TESTOPTO    "STC:OPTIC"     // Run a test function to report the state of the optic sensor
-
-// String responses we expect from the Arduino. All responses are prefixed with 'CTS:'
-#define CMD_OK          "CTS:OK"        // Acknowledgement. To be sent as a response to each command
-#define RSP_ERR         "CTS:ERROR: "   // Error response. Will be followed by an error code or text
-#define CMD_READY       "CTS:READY"     // Sent when the Arduino is ready to receive instructions
-#define CMD_ATCELL      "CTS:ATCELL"    // The film has been positioned and is ready for a photo capture
+// The commands we can send. How they go over the wire depends on the protocol mode: the strings above
+// in text mode, or a binary frame with the matching opcode (see BinaryProtocol.h).
+typedef enum {
+#define ARDUINO_COMMAND_ENUM(name, text, opcode, timeout, attempts) Command##name,
+    ARDUINO_COMMANDS(ARDUINO_COMMAND_ENUM)
+#undef ARDUINO_COMMAND_ENUM
+    CommandCount
+} ArduinoCommand;
+
+// How long (in milliseconds) we wait for a response before giving up. Moving the film has no fixed
+// timeout here, it's bounded by the CAPTURE_PAUSE setting instead.
+#define TIMEOUT_PING    1000            // Reply to STC:PING
+#define TIMEOUT_READ    1000            // Default for a single readSerialCommand
+#define TIMEOUT_SWITCH  500             // Acknowledgement of CMD_BINARY, and the first ping after switching
 
 
 #endif /* ArduinoResponse_h */
@@ -0,0 +1,91 @@
+//
+//  BinaryProtocol.h
+//  Compact binary framing for the Arduino link, used once both sides have switched over from the text
+//  protocol with CMD_BINARY
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Frame layout:
+//
+//      0xA5 | opcode | sequence | length | payload (length bytes) | CRC-16 high | CRC-16 low
+//
+//  The CRC is CRC-16/CCITT-FALSE (polynomial 0x1021, start 0xFFFF) over opcode, sequence, length and
+//  payload. A command's sequence number is echoed back in its responses. Frames with a bad CRC are dropped
+//  and counted, and the decoder looks for the next start byte, so a corrupted frame never turns into a
+//  wrong response.
+//
+
+#ifndef BinaryProtocol_h
+#define BinaryProtocol_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ArduinoResponse.h"
+
+#define BINARY_FRAME_START      0xA5
+#define BINARY_HEADER_LENGTH    4       // start, opcode, sequence, length
+#define BINARY_CRC_LENGTH       2
+#define BINARY_MAX_PAYLOAD      255
+#define BINARY_MAX_FRAME        (BINARY_HEADER_LENGTH + BINARY_MAX_PAYLOAD + BINARY_CRC_LENGTH)
+
+// Host to Arduino opcodes have the top bit clear, Arduino to host opcodes have it set. The ones with a
+// text equivalent come from the protocol table in ArduinoResponse.h: OpNextCell ... OpStreamOff and
+// OpOk, OpError (payload: error code byte, then optional text), OpReady and OpAtCell.
+typedef enum
+{
+#define BINARY_COMMAND_OPCODE(name, text, opcode, timeout, attempts) Op##name = opcode,
+    ARDUINO_COMMANDS(BINARY_COMMAND_OPCODE)
+#undef BINARY_COMMAND_OPCODE
+    OpTextMode      = 0x7F,     // go back to the text protocol at the original baud rate
+
+#define BINARY_RESPONSE_OPCODE(name, text, key, opcode) Op##name = opcode,
+    ARDUINO_RESPONSES(BINARY_RESPONSE_OPCODE)
+#undef BINARY_RESPONSE_OPCODE
+    OpLog           = 0x85,     // payload: log text
+    OpTelemetry     = 0x86      // payload: batch of sensor readings
+} BinaryOpcode;
+
+typedef struct
+{
+    uint8_t opcode;
+    uint8_t sequence;
+    uint8_t length;
+    const uint8_t *payload;     // points into the decoder's buffer, valid until the next binaryDecoderFeed
+} BinaryFrame;
+
+typedef struct
+{
+    uint8_t buffer[2 * BINARY_MAX_FRAME];
+    size_t head;                // first byte not yet decoded
+    size_t tail;                // one past the last byte fed in
+    uint64_t frames;            // good frames decoded
+    uint64_t crcErrors;         // frames dropped because the CRC didn't match
+    uint64_t skippedBytes;      // bytes outside any frame (noise, or the rest of a bad frame)
+} BinaryDecoder;
+
+uint16_t crc16(const uint8_t *data, size_t length);
+
+// Build a frame in out, which must hold at least BINARY_HEADER_LENGTH + length + BINARY_CRC_LENGTH bytes.
+// Returns the frame length, or 0 if the payload is too long.
+size_t binaryEncodeFrame(uint8_t opcode, uint8_t sequence, const void *payload, size_t length, uint8_t *out);
+
+// Opcode for a command, and the response kind an opcode from the Arduino maps to
+uint8_t binaryOpcodeForCommand(ArduinoCommand command);
+ArduinoResponse binaryResponseForOpcode(uint8_t opcode);
+
+void binaryDecoderInit(BinaryDecoder *decoder);
+
+// Add received bytes. Returns how many were taken; less than length means frames need taking out first.
+size_t binaryDecoderFeed(BinaryDecoder *decoder, const void *data, size_t length);
+
+// Take the next complete, CRC-checked frame. Returns false if there isn't one yet.
+bool binaryDecoderNext(BinaryDecoder *decoder, BinaryFrame *frame);
+
+// Hand over the bytes that haven't been decoded yet and empty the decoder. Used when the link switches
+// back to the text protocol. The data stays valid until the next binaryDecoderFeed.
+size_t binaryDecoderTakePending(BinaryDecoder *decoder, const uint8_t **data);
+
+#endif /* BinaryProtocol_h */
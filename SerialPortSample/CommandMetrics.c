@@ -0,0 +1,184 @@
+//
+//  CommandMetrics.c
+//  Latency histograms and counters for every command sent to the Arduino, for tuning timeouts and
+//  pauses from what the link actually does
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <string.h>
+
+#include "CommandMetrics.h"
+#include "Deadline.h"
+#include "ResponseParser.h"
+
+static const char *kPhaseNames[PhaseCount] =
+{
+    "firstReply", "atCell", "acknowledged"
+};
+
+// -------------------------------------------------------------------------------------------
+
+const char *commandPhaseName(CommandPhase phase)
+{
+    return phase < PhaseCount ? kPhaseNames[phase] : "?";
+}
+
+// -------------------------------------------------------------------------------------------
+
+void commandMetricsReset(CommandMetrics *metrics, uint64_t now)
+{
+    memset(metrics, 0, sizeof(CommandMetrics));
+
+    for (int command = 0; command < CommandCount; command++)
+    {
+        for (CommandPhase phase = PhaseFirstReply; phase < PhaseCount; phase++)
+        {
+            latencyHistogramReset(&metrics->commands[command].phases[phase]);
+        }
+    }
+
+    metrics->startedAt = now;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void commandMetricsRecord(CommandMetrics *metrics, const CommandSlot *slot)
+{
+    CommandMetric *metric;
+    uint64_t sentAt = slot->lastSentAt;
+
+    if (slot->command >= CommandCount)
+    {
+        return;
+    }
+
+    metric = &metrics->commands[slot->command];
+    metric->retries += slot->attempts > 1 ? slot->attempts - 1u : 0;
+
+    // Replies from an earlier attempt can arrive after the last one was sent
+    if (slot->firstReplyAt >= sentAt && slot->firstReplyAt != 0)
+    {
+        latencyHistogramRecord(&metric->phases[PhaseFirstReply], slot->firstReplyAt - sentAt);
+    }
+    if (slot->atCellAt >= sentAt && slot->atCellAt != 0)
+    {
+        latencyHistogramRecord(&metric->phases[PhaseAtCell], slot->atCellAt - sentAt);
+    }
+
+    if (slot->result == TimedOut)
+    {
+        metric->timedOut++;
+        return;
+    }
+
+    metric->completed++;
+    metric->errors += slot->result == Error;
+    if (slot->completedAt >= sentAt)
+    {
+        latencyHistogramRecord(&metric->phases[PhaseAcknowledged], slot->completedAt - sentAt);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+static double millis(uint64_t nanos)
+{
+    return (double)nanos / NANOS_PER_MILLI;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool commandMetricsFormat(const CommandMetrics *metrics, ArduinoCommand command, char *buffer, size_t size)
+{
+    const CommandMetric *metric = &metrics->commands[command];
+    const LatencyHistogram *histogram;
+    size_t used;
+
+    if (command >= CommandCount || (metric->completed == 0 && metric->timedOut == 0))
+    {
+        return false;
+    }
+
+    used = (size_t)snprintf(buffer, size, "%s: %llu done, %llu errors, %llu timed out, %llu retries.",
+                            commandText(command), (unsigned long long)metric->completed,
+                            (unsigned long long)metric->errors, (unsigned long long)metric->timedOut,
+                            (unsigned long long)metric->retries);
+
+    for (CommandPhase phase = PhaseFirstReply; phase < PhaseCount && used < size; phase++)
+    {
+        histogram = &metric->phases[phase];
+        if (histogram->count == 0)
+        {
+            continue;
+        }
+
+        used += (size_t)snprintf(buffer + used, size - used, " %s p50 %.1f p90 %.1f p99 %.1f max %.1f ms.",
+                                 commandPhaseName(phase), millis(latencyHistogramPercentile(histogram, 50)),
+                                 millis(latencyHistogramPercentile(histogram, 90)),
+                                 millis(latencyHistogramPercentile(histogram, 99)), millis(histogram->max));
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void writeHistogramJson(const LatencyHistogram *histogram, FILE *out)
+{
+    static const double kPercentiles[] = { 50, 90, 99, 99.9 };
+    static const char *kPercentileNames[] = { "p50", "p90", "p99", "p999" };
+
+    fprintf(out, "{\"count\": %llu", (unsigned long long)histogram->count);
+    if (histogram->count > 0)
+    {
+        fprintf(out, ", \"minMs\": %.3f, \"meanMs\": %.3f", millis(histogram->min),
+                latencyHistogramMean(histogram) / NANOS_PER_MILLI);
+        for (size_t i = 0; i < sizeof(kPercentiles) / sizeof(kPercentiles[0]); i++)
+        {
+            fprintf(out, ", \"%sMs\": %.3f", kPercentileNames[i],
+                    millis(latencyHistogramPercentile(histogram, kPercentiles[i])));
+        }
+        fprintf(out, ", \"maxMs\": %.3f", millis(histogram->max));
+    }
+    fprintf(out, "}");
+}
+
+// -------------------------------------------------------------------------------------------
+
+void commandMetricsWriteJson(const CommandMetrics *metrics, uint64_t bytesReceived, FILE *out)
+{
+    const CommandMetric *metric;
+    bool first = true;
+
+    fprintf(out, "{\"seconds\": %.3f, \"bytesSent\": %llu, \"bytesReceived\": %llu, \"unrecognised\": %llu, "
+            "\"commands\": {", (double)(monotonicNanos() - metrics->startedAt) / NANOS_PER_SECOND,
+            (unsigned long long)metrics->bytesSent, (unsigned long long)bytesReceived,
+            (unsigned long long)metrics->unrecognised);
+
+    for (int command = 0; command < CommandCount; command++)
+    {
+        metric = &metrics->commands[command];
+        if (metric->completed == 0 && metric->timedOut == 0)
+        {
+            continue;
+        }
+
+        fprintf(out, "%s\n    \"%s\": {\"completed\": %llu, \"errors\": %llu, \"timedOut\": %llu, \"retries\": %llu",
+                first ? "" : ",", commandText((ArduinoCommand)command), (unsigned long long)metric->completed,
+                (unsigned long long)metric->errors, (unsigned long long)metric->timedOut,
+                (unsigned long long)metric->retries);
+        for (CommandPhase phase = PhaseFirstReply; phase < PhaseCount; phase++)
+        {
+            fprintf(out, ",\n        \"%s\": ", commandPhaseName(phase));
+            writeHistogramJson(&metric->phases[phase], out);
+        }
+        fprintf(out, "}");
+        first = false;
+    }
+
+    fprintf(out, "%s}}\n", first ? "" : "\n");
+}
+
+// -------------------------------------------------------------------------------------------
@@ -0,0 +1,67 @@
+//
+//  CommandMetrics.h
+//  Latency histograms and counters for every command sent to the Arduino, for tuning timeouts and
+//  pauses from what the link actually does
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Each finished command adds its phases to the histograms of its kind, all measured from the write that
+//  got answered: the first line back (usually a Log: line), the ATCELL (NEXTCELL only, the film is in place)
+//  and the OK that finishes it. This firmware sends the ATCELL before the OK, so the gap between the two is
+//  what the OK costs the scan on top of the move.
+//
+//  Metrics belong to the thread driving the port, like the command window they are fed from.
+//
+
+#ifndef CommandMetrics_h
+#define CommandMetrics_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ArduinoResponse.h"
+#include "CommandWindow.h"
+#include "LatencyHistogram.h"
+
+typedef enum
+{
+    PhaseFirstReply,            // write to the first line back
+    PhaseAtCell,                // write to ATCELL
+    PhaseAcknowledged,          // write to OK
+    PhaseCount
+} CommandPhase;
+
+typedef struct
+{
+    LatencyHistogram phases[PhaseCount];
+    uint64_t completed;         // finished with an OK, errors included
+    uint64_t errors;
+    uint64_t timedOut;
+    uint64_t retries;           // sends after the first
+} CommandMetric;
+
+typedef struct
+{
+    CommandMetric commands[CommandCount];
+    uint64_t bytesSent;
+    uint64_t unrecognised;      // lines that weren't any response we know
+    uint64_t startedAt;         // monotonicNanos() when the metrics were reset
+} CommandMetrics;
+
+void commandMetricsReset(CommandMetrics *metrics, uint64_t now);
+
+// Add a finished command, before its slot is collected
+void commandMetricsRecord(CommandMetrics *metrics, const CommandSlot *slot);
+
+const char *commandPhaseName(CommandPhase phase);
+
+// One line on a command: how many, then the count, p50, p90, p99 and max in milliseconds of every phase
+// that was seen. Returns false if the command was never used.
+bool commandMetricsFormat(const CommandMetrics *metrics, ArduinoCommand command, char *buffer, size_t size);
+
+// The metrics as a JSON object. bytesReceived comes from the reader, which counts them.
+void commandMetricsWriteJson(const CommandMetrics *metrics, uint64_t bytesReceived, FILE *out);
+
+#endif /* CommandMetrics_h */
@@ -0,0 +1,356 @@
+//
+//  CommandWindow.c
+//  Tracks the commands that are in flight to the Arduino, so replies are matched to the command they
+//  belong to by sequence number rather than by guessing
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <string.h>
+
+#include "CommandWindow.h"
+#include "Deadline.h"
+#include "ResponseParser.h"
+
+// Generated from the protocol table, so every command has its policy in the line that adds it
+static const CommandPolicy kCommandPolicies[CommandCount] =
+{
+#define COMMAND_POLICY(name, text, opcode, timeout, attempts) [Command##name] = { timeout, attempts },
+    ARDUINO_COMMANDS(COMMAND_POLICY)
+#undef COMMAND_POLICY
+};
+
+// -------------------------------------------------------------------------------------------
+
+const CommandPolicy *commandPolicy(ArduinoCommand command)
+{
+    return &kCommandPolicies[command < CommandCount ? command : CommandPing];
+}
+
+// -------------------------------------------------------------------------------------------
+
+void commandWindowInit(CommandWindow *window, unsigned int windowSize)
+{
+    memset(window, 0, sizeof(CommandWindow));
+
+    if (windowSize < 1)
+    {
+        windowSize = 1;
+    }
+    else if (windowSize > COMMAND_WINDOW_MAX)
+    {
+        windowSize = COMMAND_WINDOW_MAX;
+    }
+
+    window->windowSize = windowSize;
+    commandWindowSetSequenced(window, false);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void commandWindowSetSequenced(CommandWindow *window, bool sequenced)
+{
+    window->sequenced = sequenced;
+    window->limit = sequenced ? window->windowSize : 1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+uint8_t commandWindowNextSequence(CommandWindow *window)
+{
+    do
+    {
+        if (++window->lastSequence == 0)
+        {
+            window->lastSequence = 1;
+        }
+    } while (commandWindowFind(window, window->lastSequence) != NULL);
+
+    return window->lastSequence;
+}
+
+// -------------------------------------------------------------------------------------------
+
+CommandSlot *commandWindowOpen(CommandWindow *window, ArduinoCommand command, uint32_t timeoutMillis,
+                               uint8_t attempts, uint64_t now)
+{
+    const CommandPolicy *policy = commandPolicy(command);
+    CommandSlot *slot = NULL;
+    int i;
+
+    if (window->inFlight >= window->limit)
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < COMMAND_WINDOW_MAX; i++)
+    {
+        if (window->slots[i].state == SlotFree)
+        {
+            slot = &window->slots[i];
+            break;
+        }
+    }
+
+    if (slot == NULL)
+    {
+        // Everything is taken by finished commands that haven't been collected
+        return NULL;
+    }
+
+    memset(slot, 0, sizeof(CommandSlot));
+    slot->sequence = commandWindowNextSequence(window);
+    slot->state = SlotInFlight;
+    slot->command = command;
+    slot->maxAttempts = attempts ? attempts : policy->attempts;
+    slot->timeoutNanos = (uint64_t)(timeoutMillis ? timeoutMillis : policy->timeoutMillis) * NANOS_PER_MILLI;
+    slot->result = TimedOut;
+    slot->errorCode = NO_ERROR_CODE;
+    slot->firstSentAt = now;
+    slot->deadline = now + slot->timeoutNanos;
+
+    window->inFlight++;
+    window->stats.sent++;
+    if (window->inFlight > window->stats.maxInFlight)
+    {
+        window->stats.maxInFlight = window->inFlight;
+    }
+
+    return slot;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool commandWindowSent(CommandWindow *window, CommandSlot *slot, uint64_t now)
+{
+    if (slot->attempts >= slot->maxAttempts)
+    {
+        return false;
+    }
+
+    if (slot->attempts > 0)
+    {
+        window->stats.retries++;
+    }
+
+    slot->attempts++;
+    slot->lastSentAt = now;
+    slot->deadline = now + slot->timeoutNanos;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void finish(CommandWindow *window, CommandSlot *slot, ArduinoResponse result, uint64_t now)
+{
+    slot->state = SlotDone;
+    slot->result = result;
+    slot->completedAt = now;
+    window->inFlight--;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The command a response belongs to: by sequence number when sequenced, otherwise the oldest in flight
+static CommandSlot *owner(CommandWindow *window, uint8_t sequence)
+{
+    CommandSlot *slot = NULL;
+    int i;
+
+    if (window->sequenced)
+    {
+        // A response without a sequence number (e.g. CTS:READY after a reset) doesn't belong to any command
+        slot = sequence != 0 ? commandWindowFind(window, sequence) : NULL;
+    }
+    else
+    {
+        for (i = 0; i < COMMAND_WINDOW_MAX; i++)
+        {
+            if (window->slots[i].state == SlotInFlight &&
+                (slot == NULL || window->slots[i].firstSentAt < slot->firstSentAt))
+            {
+                slot = &window->slots[i];
+            }
+        }
+    }
+
+    return slot;
+}
+
+// -------------------------------------------------------------------------------------------
+
+CommandSlot *commandWindowRecord(CommandWindow *window, uint8_t sequence, ArduinoResponse response, int errorCode,
+                                 uint64_t now)
+{
+    CommandSlot *slot = owner(window, sequence);
+    uint64_t roundTrip;
+
+    if (slot == NULL || slot->state != SlotInFlight)
+    {
+        window->stats.staleResponses++;
+        return NULL;
+    }
+
+    if (slot->firstReplyAt == 0)
+    {
+        slot->firstReplyAt = now;
+    }
+
+    switch (response)
+    {
+        case Ok:
+            roundTrip = now - slot->firstSentAt;
+            window->stats.completed++;
+            window->stats.roundTripNanos += roundTrip;
+            if (roundTrip > window->stats.maxRoundTripNanos)
+            {
+                window->stats.maxRoundTripNanos = roundTrip;
+            }
+
+            if (slot->sawError)
+            {
+                window->stats.errors++;
+            }
+            finish(window, slot, slot->sawError ? Error : Ok, now);
+            break;
+
+        case Error:
+            // The firmware still finishes the command with an OK after reporting the error
+            slot->sawError = true;
+            slot->errorCode = errorCode;
+            break;
+
+        case AtCell:
+            slot->sawAtCell = true;
+            slot->atCellAt = now;
+            break;
+
+        default:
+            // Log lines and the like. They belong to the command, but don't change anything.
+            break;
+    }
+
+    return slot;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void commandWindowHeard(CommandWindow *window, uint8_t sequence, uint64_t now)
+{
+    CommandSlot *slot = owner(window, sequence);
+
+    if (slot && slot->state == SlotInFlight && slot->firstReplyAt == 0)
+    {
+        slot->firstReplyAt = now;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+CommandSlot *commandWindowExpired(CommandWindow *window, uint64_t now)
+{
+    for (int i = 0; i < COMMAND_WINDOW_MAX; i++)
+    {
+        if (window->slots[i].state == SlotInFlight && window->slots[i].deadline <= now)
+        {
+            return &window->slots[i];
+        }
+    }
+
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool commandWindowExtend(CommandWindow *window, CommandSlot *slot, uint64_t now)
+{
+    if (slot->state != SlotInFlight || slot->late || slot->graceNanos == 0)
+    {
+        return false;
+    }
+
+    slot->late = true;
+    slot->deadline = now + slot->graceNanos;
+    window->stats.late++;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void commandWindowAbandon(CommandWindow *window, CommandSlot *slot, uint64_t now)
+{
+    if (slot->state != SlotInFlight)
+    {
+        return;
+    }
+
+    window->stats.timedOut++;
+    finish(window, slot, TimedOut, now);
+}
+
+// -------------------------------------------------------------------------------------------
+
+uint64_t commandWindowNextDeadline(const CommandWindow *window)
+{
+    uint64_t deadline = UINT64_MAX;
+
+    for (int i = 0; i < COMMAND_WINDOW_MAX; i++)
+    {
+        if (window->slots[i].state == SlotInFlight && window->slots[i].deadline < deadline)
+        {
+            deadline = window->slots[i].deadline;
+        }
+    }
+
+    return deadline;
+}
+
+// -------------------------------------------------------------------------------------------
+
+CommandSlot *commandWindowFind(CommandWindow *window, uint8_t sequence)
+{
+    for (int i = 0; i < COMMAND_WINDOW_MAX; i++)
+    {
+        if (window->slots[i].state != SlotFree && window->slots[i].sequence == sequence)
+        {
+            return &window->slots[i];
+        }
+    }
+
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+ArduinoResponse commandWindowCollect(CommandWindow *window, CommandSlot *slot)
+{
+    ArduinoResponse result = slot->result;
+
+    if (slot->state == SlotInFlight)
+    {
+        window->inFlight--;
+    }
+
+    slot->state = SlotFree;
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+unsigned int commandWindowUsed(const CommandWindow *window)
+{
+    unsigned int used = 0;
+
+    for (int i = 0; i < COMMAND_WINDOW_MAX; i++)
+    {
+        if (window->slots[i].state != SlotFree)
+        {
+            used++;
+        }
+    }
+
+    return used;
+}
+
+// -------------------------------------------------------------------------------------------
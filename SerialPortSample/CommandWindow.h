@@ -0,0 +1,143 @@
+//
+//  CommandWindow.h
+//  Tracks the commands that are in flight to the Arduino, so replies are matched to the command they
+//  belong to by sequence number rather than by guessing
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Each command gets a sequence number when it's sent, and the Arduino echoes it in every response to that
+//  command (binary protocol only). A command is finished by its OK; ATCELL and ERROR responses on the way
+//  are recorded against it. Up to the window limit can be in flight at once, each with its own deadline
+//  and number of attempts. Responses for sequence numbers that aren't in flight (a late reply to a command
+//  we gave up on, or a CTS:READY after a reset) are counted and dropped.
+//
+//  The text protocol has no sequence numbers, so there the window is limited to one command and a
+//  response always belongs to the oldest command in flight.
+//
+
+#ifndef CommandWindow_h
+#define CommandWindow_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ArduinoResponse.h"
+
+#define COMMAND_WINDOW_MAX      8       // most commands that can be in flight at once
+
+typedef enum
+{
+    SlotFree,
+    SlotInFlight,
+    SlotDone            // finished, waiting for the result to be collected
+} CommandSlotState;
+
+// How long to wait for a command and how often to send it. Commands that move the film are never
+// resent: if the first one did arrive, a second would move the film a cell too far.
+typedef struct
+{
+    uint32_t timeoutMillis;
+    uint8_t attempts;
+} CommandPolicy;
+
+typedef struct
+{
+    CommandSlotState state;
+    ArduinoCommand command;
+    uint8_t sequence;
+    uint8_t attempts;           // times sent so far
+    uint8_t maxAttempts;
+    bool sawAtCell;
+    bool sawError;
+    bool late;                  // outlasted its last attempt and is in its grace period
+    int errorCode;              // from the Arduino's ERROR, NO_ERROR_CODE if none
+    ArduinoResponse result;     // Ok, Error or TimedOut once done
+    uint64_t timeoutNanos;      // per attempt
+    uint64_t graceNanos;        // how much longer to wait after the last attempt times out, 0 for none
+    uint64_t firstSentAt;       // monotonicNanos()
+    uint64_t lastSentAt;
+    uint64_t deadline;          // when the current attempt times out
+    uint64_t firstReplyAt;      // when the first line for it arrived, log lines included. 0 until then
+    uint64_t atCellAt;          // when its ATCELL arrived, 0 if none did
+    uint64_t completedAt;
+} CommandSlot;
+
+typedef struct
+{
+    uint64_t sent;              // commands opened, not counting retries
+    uint64_t retries;
+    uint64_t completed;         // finished with an OK
+    uint64_t errors;            // of which reported an ERROR on the way
+    uint64_t timedOut;          // gave up after the last attempt
+    uint64_t late;              // went into their grace period
+    uint64_t staleResponses;    // responses that didn't belong to any command in flight
+    uint64_t maxInFlight;       // most commands in flight at the same time
+    uint64_t roundTripNanos;    // total time from first send to OK, over all completed commands
+    uint64_t maxRoundTripNanos;
+} CommandWindowStats;
+
+typedef struct
+{
+    CommandSlot slots[COMMAND_WINDOW_MAX];
+    unsigned int windowSize;    // commands allowed in flight once responses carry sequence numbers
+    unsigned int limit;         // commands allowed in flight right now
+    bool sequenced;             // responses carry sequence numbers (binary protocol)
+    unsigned int inFlight;
+    uint8_t lastSequence;
+    CommandWindowStats stats;
+} CommandWindow;
+
+// The default timeout and attempts for a command
+const CommandPolicy *commandPolicy(ArduinoCommand command);
+
+// Starts out unsequenced (text protocol), so with a limit of one command in flight
+void commandWindowInit(CommandWindow *window, unsigned int windowSize);
+
+// Switch between the protocols. Sequenced allows windowSize commands in flight, unsequenced only one.
+// Commands already in flight are not affected.
+void commandWindowSetSequenced(CommandWindow *window, bool sequenced);
+
+// Next sequence number to use. Never 0 (that means no sequence number) and never one still in use.
+uint8_t commandWindowNextSequence(CommandWindow *window);
+
+// Take a slot for a command that's about to be sent for the first time. A timeout of 0 uses the command's
+// policy, as do attempts of 0. Returns NULL if the window is full.
+CommandSlot *commandWindowOpen(CommandWindow *window, ArduinoCommand command, uint32_t timeoutMillis,
+                               uint8_t attempts, uint64_t now);
+
+// Record that a slot's command has been sent (again). Returns false if it has no attempts left.
+bool commandWindowSent(CommandWindow *window, CommandSlot *slot, uint64_t now);
+
+// Route a response to the command it belongs to: by sequence number when sequenced, otherwise to the oldest
+// command in flight. Returns the command's slot, or NULL if it didn't belong to any.
+CommandSlot *commandWindowRecord(CommandWindow *window, uint8_t sequence, ArduinoResponse response, int errorCode,
+                                 uint64_t now);
+
+// A log line arrived. It counts as the first sign of life for the command it belongs to, though it
+// doesn't change anything else.
+void commandWindowHeard(CommandWindow *window, uint8_t sequence, uint64_t now);
+
+// The in-flight command whose current attempt has timed out, or NULL if there isn't one
+CommandSlot *commandWindowExpired(CommandWindow *window, uint64_t now);
+
+// A command whose last attempt has timed out gets its grace period, once. Returns false if it has none (left),
+// in which case it's time to give up on it.
+bool commandWindowExtend(CommandWindow *window, CommandSlot *slot, uint64_t now);
+
+// Give up on a command: it's finished with TimedOut
+void commandWindowAbandon(CommandWindow *window, CommandSlot *slot, uint64_t now);
+
+// Earliest deadline of the commands in flight, or UINT64_MAX if none are
+uint64_t commandWindowNextDeadline(const CommandWindow *window);
+
+CommandSlot *commandWindowFind(CommandWindow *window, uint8_t sequence);
+
+// Hand back a finished command's slot. Returns its result.
+ArduinoResponse commandWindowCollect(CommandWindow *window, CommandSlot *slot);
+
+// Slots in use, in flight or waiting to be collected
+unsigned int commandWindowUsed(const CommandWindow *window);
+
+#endif /* CommandWindow_h */
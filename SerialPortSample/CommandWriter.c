@@ -0,0 +1,484 @@
+//
+//  CommandWriter.c
+//  Outbound queue for the serial port: commands are queued without ever blocking the caller and go out
+//  in as few writes as the port allows
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+
+#include "BinaryProtocol.h"
+#include "CommandWriter.h"
+#include "Deadline.h"
+#include "TraceLog.h"
+
+_Static_assert(WRITER_SLOT_SIZE >= BINARY_MAX_FRAME, "A binary frame has to fit in a slot");
+
+typedef struct
+{
+    uint16_t length;
+    uint8_t data[WRITER_SLOT_SIZE];
+} QueuedCommand;
+
+struct CommandWriter
+{
+    pthread_mutex_t lock;           // everything below but the pipes and the thread
+    pthread_cond_t drained;         // the queue has emptied, or writing has failed
+    QueuedCommand slots[WRITER_SLOTS];
+    unsigned int first;             // oldest queued command
+    unsigned int count;
+    size_t written;                 // of the oldest command, by a short write
+    int error;                      // errno that made writing give up
+    bool running;
+    CommandWriterStats stats;
+    char name[16];                  // of the writer thread in the trace log
+    int fileDescriptor;
+    int wakePipe[2];                // senders -> writer thread: something is queued that the port didn't take
+    int stopPipe[2];                // owner -> writer thread: stop now
+    pthread_t thread;
+    bool threadStarted;
+};
+
+// -------------------------------------------------------------------------------------------
+
+static int openNonBlockingPipe(int fds[2])
+{
+    if (pipe(fds) == -1)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void closePipe(int fds[2])
+{
+    if (fds[0] != -1)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        fds[0] = fds[1] = -1;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void emptyPipe(int fd)
+{
+    char drain[64];
+
+    while (read(fd, drain, sizeof(drain)) > 0)
+    {
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Write as much of the queue as the port takes, everything queued in one writev each time round.
+// Returns true once the queue is empty. Called with the lock held; the port is non-blocking, so that's
+// never for longer than a copy into the driver.
+static bool flushQueue(CommandWriter *writer)
+{
+    struct iovec vectors[WRITER_SLOTS];
+    QueuedCommand *command;
+    unsigned int i;
+    unsigned int sent;
+    ssize_t numBytes;
+    size_t left;
+
+    while (writer->count > 0 && writer->error == 0)
+    {
+        for (i = 0; i < writer->count; i++)
+        {
+            command = &writer->slots[(writer->first + i) % WRITER_SLOTS];
+            vectors[i].iov_base = command->data + (i == 0 ? writer->written : 0);
+            vectors[i].iov_len = command->length - (i == 0 ? writer->written : 0);
+        }
+
+        numBytes = writev(writer->fileDescriptor, vectors, (int)writer->count);
+        if (numBytes == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                writer->stats.wouldBlock++;
+                return false;
+            }
+
+            // The port has gone away (EIO, ENXIO) or is broken. Anyone draining needn't wait any longer.
+            writer->error = errno;
+            pthread_cond_broadcast(&writer->drained);
+            return false;
+        }
+
+        writer->stats.writes++;
+        writer->stats.bytes += (uint64_t)numBytes;
+
+        // Take the commands that went out completely off the queue. The rest of a half written one is left
+        // at the front, to carry on from next time.
+        left = (size_t)numBytes;
+        for (sent = 0; writer->count > 0 && left >= vectors[sent].iov_len; sent++)
+        {
+            left -= vectors[sent].iov_len;
+            writer->first = (writer->first + 1) % WRITER_SLOTS;
+            writer->count--;
+            writer->written = 0;
+        }
+        writer->written += left;
+
+        if (writer->count > 0)
+        {
+            writer->stats.partialWrites++;
+        }
+        if (sent + (left > 0) > 1)
+        {
+            writer->stats.coalesced += sent + (left > 0) - 1;
+        }
+    }
+
+    if (writer->count == 0)
+    {
+        pthread_cond_broadcast(&writer->drained);
+    }
+
+    return writer->count == 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Only waits for the port while there's something it didn't take. The rest of the time it waits to be
+// woken, or stopped.
+static void *writerThread(void *context)
+{
+    CommandWriter *writer = context;
+    int maxFd = writer->fileDescriptor;
+    fd_set readSet;
+    fd_set writeSet;
+    bool pending;
+    int result;
+
+    maxFd = writer->wakePipe[0] > maxFd ? writer->wakePipe[0] : maxFd;
+    maxFd = writer->stopPipe[0] > maxFd ? writer->stopPipe[0] : maxFd;
+
+    traceLogRegisterThread(writer->name);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&writer->lock);
+        pending = writer->count > 0 && writer->error == 0;
+        pthread_mutex_unlock(&writer->lock);
+
+        FD_ZERO(&readSet);
+        FD_ZERO(&writeSet);
+        FD_SET(writer->wakePipe[0], &readSet);
+        FD_SET(writer->stopPipe[0], &readSet);
+        if (pending)
+        {
+            FD_SET(writer->fileDescriptor, &writeSet);
+        }
+
+        result = select(maxFd + 1, &readSet, &writeSet, NULL, NULL);
+        if (result == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            pthread_mutex_lock(&writer->lock);
+            writer->error = errno;
+            pthread_cond_broadcast(&writer->drained);
+            pthread_mutex_unlock(&writer->lock);
+            break;
+        }
+
+        if (FD_ISSET(writer->stopPipe[0], &readSet))
+        {
+            break;
+        }
+
+        if (FD_ISSET(writer->wakePipe[0], &readSet))
+        {
+            emptyPipe(writer->wakePipe[0]);
+        }
+
+        if (pending && FD_ISSET(writer->fileDescriptor, &writeSet))
+        {
+            pthread_mutex_lock(&writer->lock);
+            if (!flushQueue(writer) && writer->error == 0)
+            {
+                TRACE("%u commands still queued, the port is busy", writer->count);
+            }
+            pthread_mutex_unlock(&writer->lock);
+        }
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    writer->running = false;
+    pthread_cond_broadcast(&writer->drained);
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+CommandWriter *commandWriterCreate(int fileDescriptor)
+{
+    CommandWriter *writer = calloc(1, sizeof(CommandWriter));
+    int flags;
+
+    if (writer == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    writer->fileDescriptor = fileDescriptor;
+    strcpy(writer->name, "writer");
+    writer->wakePipe[0] = writer->wakePipe[1] = -1;
+    writer->stopPipe[0] = writer->stopPipe[1] = -1;
+
+    flags = fcntl(fileDescriptor, F_GETFL);
+    if (flags == -1 || (fcntl(fileDescriptor, F_SETFL, flags | O_NONBLOCK) == -1) ||
+        openNonBlockingPipe(writer->wakePipe) == -1 || openNonBlockingPipe(writer->stopPipe) == -1)
+    {
+        int error = errno;
+
+        closePipe(writer->wakePipe);
+        free(writer);
+        errno = error;
+        return NULL;
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->drained, NULL);
+    return writer;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int commandWriterStart(CommandWriter *writer)
+{
+    int result;
+
+    if (writer->threadStarted)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    writer->running = true;
+    pthread_mutex_unlock(&writer->lock);
+
+    result = pthread_create(&writer->thread, NULL, writerThread, writer);
+    if (result != 0)
+    {
+        pthread_mutex_lock(&writer->lock);
+        writer->running = false;
+        pthread_mutex_unlock(&writer->lock);
+        errno = result;
+        return -1;
+    }
+
+    writer->threadStarted = true;
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void commandWriterStop(CommandWriter *writer)
+{
+    ssize_t ignored;
+
+    if (!writer->threadStarted)
+    {
+        return;
+    }
+
+    ignored = write(writer->stopPipe[1], "", 1);
+    (void)ignored;
+    pthread_join(writer->thread, NULL);
+    writer->threadStarted = false;
+
+    // Empty the stop pipe so the writer can be started again
+    emptyPipe(writer->stopPipe[0]);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void commandWriterDestroy(CommandWriter *writer)
+{
+    if (writer == NULL)
+    {
+        return;
+    }
+
+    commandWriterStop(writer);
+    closePipe(writer->wakePipe);
+    closePipe(writer->stopPipe);
+    pthread_cond_destroy(&writer->drained);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer);
+}
+
+// -------------------------------------------------------------------------------------------
+
+ssize_t commandWriterSend(CommandWriter *writer, const void *data, size_t length)
+{
+    QueuedCommand *command;
+    bool wake = false;
+    int error;
+
+    if (length > WRITER_SLOT_SIZE)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    if (writer->error == 0 && writer->count == WRITER_SLOTS)
+    {
+        writer->stats.rejected++;
+        pthread_mutex_unlock(&writer->lock);
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    if (writer->error == 0)
+    {
+        command = &writer->slots[(writer->first + writer->count) % WRITER_SLOTS];
+        memcpy(command->data, data, length);
+        command->length = (uint16_t)length;
+        writer->count++;
+        writer->stats.commands++;
+        if (writer->count > writer->stats.maxQueued)
+        {
+            writer->stats.maxQueued = writer->count;
+        }
+
+        // With something ahead of it the writer thread is already waiting for the port, and this goes out
+        // along with the rest. Without the thread there's nobody else to send it.
+        if (writer->count == 1 || !writer->running)
+        {
+            wake = !flushQueue(writer) && writer->running;
+        }
+    }
+
+    error = writer->error;
+    pthread_mutex_unlock(&writer->lock);
+
+    if (wake)
+    {
+        ssize_t ignored = write(writer->wakePipe[1], "", 1);
+        (void)ignored;
+    }
+
+    if (error)
+    {
+        errno = error;
+        return -1;
+    }
+
+    return (ssize_t)length;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int commandWriterDrain(CommandWriter *writer, uint32_t timeoutMillis)
+{
+    uint64_t deadline = deadlineAfterMillis(timeoutMillis);
+    struct timespec until;
+    int result = 0;
+
+    pthread_mutex_lock(&writer->lock);
+    while (writer->count > 0 && writer->error == 0 && monotonicNanos() < deadline)
+    {
+        if (writer->running)
+        {
+            until = wallClockDeadline(deadline);
+            pthread_cond_timedwait(&writer->drained, &writer->lock, &until);
+        }
+        else
+        {
+            // Nobody is watching the port, so do it ourselves
+            pthread_mutex_unlock(&writer->lock);
+            waitWritable(writer->fileDescriptor, deadline);
+            pthread_mutex_lock(&writer->lock);
+            flushQueue(writer);
+        }
+    }
+
+    if (writer->count > 0)
+    {
+        errno = writer->error ? writer->error : ETIMEDOUT;
+        result = -1;
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+unsigned int commandWriterDiscard(CommandWriter *writer)
+{
+    unsigned int discarded;
+
+    pthread_mutex_lock(&writer->lock);
+    discarded = writer->count;
+    writer->stats.discarded += discarded;
+    writer->count = 0;
+    writer->written = 0;
+    pthread_cond_broadcast(&writer->drained);
+    pthread_mutex_unlock(&writer->lock);
+
+    return discarded;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void commandWriterSetName(CommandWriter *writer, const char *name)
+{
+    strncpy(writer->name, name, sizeof(writer->name) - 1);
+    writer->name[sizeof(writer->name) - 1] = '\0';
+}
+
+// -------------------------------------------------------------------------------------------
+
+void commandWriterGetStats(CommandWriter *writer, CommandWriterStats *stats)
+{
+    pthread_mutex_lock(&writer->lock);
+    *stats = writer->stats;
+    stats->queued = writer->count;
+    stats->lastError = writer->error;
+    stats->running = writer->running;
+    pthread_mutex_unlock(&writer->lock);
+}
+
+// -------------------------------------------------------------------------------------------
@@ -0,0 +1,78 @@
+//
+//  CommandWriter.h
+//  Outbound queue for the serial port: commands are queued without ever blocking the caller and go out
+//  in as few writes as the port allows
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  The port is non-blocking. A command sent while nothing is queued is written straight away, so the
+//  usual case costs one write() and no thread switch. Whatever the port doesn't take (a short write or
+//  EAGAIN, because the driver's buffer is full or CTS is down with hardware flow control) stays queued,
+//  and the writer thread sends it once select() says the port is writable again. Everything queued by then
+//  goes out in one writev(), picking up a half written command where it left off.
+//
+//  The queue is a ring of fixed size slots, so queueing is a copy. When it's full, send fails with ENOBUFS
+//  instead of waiting: a slow or wedged device makes commands fail (and time out in the command window)
+//  rather than stall the scan thread.
+//
+
+#ifndef CommandWriter_h
+#define CommandWriter_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define WRITER_SLOTS            32      // commands queued at most
+#define WRITER_SLOT_SIZE        272     // longest command: a binary frame with the largest payload
+
+typedef struct CommandWriter CommandWriter;
+
+typedef struct
+{
+    uint64_t commands;          // queued
+    uint64_t bytes;             // written to the port
+    uint64_t writes;            // writev() calls that wrote something
+    uint64_t coalesced;         // commands that went out in the same write as an earlier one
+    uint64_t partialWrites;     // writes the port took only part of
+    uint64_t wouldBlock;        // writes that got EAGAIN
+    uint64_t rejected;          // sends refused because the queue was full
+    uint64_t discarded;         // commands thrown away unsent by commandWriterDiscard
+    uint32_t maxQueued;         // most commands waiting at once
+    uint32_t queued;            // waiting now
+    int lastError;              // errno that made writing give up, 0 if none
+    bool running;
+} CommandWriterStats;
+
+// Create a writer for an open file descriptor and make the descriptor non-blocking. The descriptor stays
+// owned by the caller. Returns NULL if the writer could not be allocated (errno is set).
+CommandWriter *commandWriterCreate(int fileDescriptor);
+
+// Start and stop the writer thread. Start returns 0 on success or -1 (errno is set). Without the thread,
+// what the port didn't take is only sent by the next send or drain.
+int commandWriterStart(CommandWriter *writer);
+void commandWriterStop(CommandWriter *writer);
+
+// Stops the thread if needed and frees the writer. Anything still queued is lost.
+void commandWriterDestroy(CommandWriter *writer);
+
+// Queue a command, writing it straight away if nothing is ahead of it. Never waits. Returns length, or -1
+// with errno set: ENOBUFS if the queue is full, EMSGSIZE if the command is longer than WRITER_SLOT_SIZE,
+// or the error that made an earlier write fail (e.g. EIO when the port has gone away).
+ssize_t commandWriterSend(CommandWriter *writer, const void *data, size_t length);
+
+// Wait until everything queued has been written to the port, for timeoutMillis at most. Returns 0, or -1
+// with errno set to ETIMEDOUT or the error that made writing fail. The driver may still be sending it.
+int commandWriterDrain(CommandWriter *writer, uint32_t timeoutMillis);
+
+// Throw away everything still queued, e.g. after a drain has timed out. Returns the number of commands.
+unsigned int commandWriterDiscard(CommandWriter *writer);
+
+// What the writer thread is called in the trace log, "writer" unless set. Takes effect on the next start.
+void commandWriterSetName(CommandWriter *writer, const char *name);
+
+void commandWriterGetStats(CommandWriter *writer, CommandWriterStats *stats);
+
+#endif /* CommandWriter_h */
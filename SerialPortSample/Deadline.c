@@ -0,0 +1,109 @@
+//
+//  Deadline.c
+//  Monotonic clock helpers and deadline-based waits on a file descriptor
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/select.h>
+
+#include "Deadline.h"
+
+// -------------------------------------------------------------------------------------------
+
+uint64_t monotonicNanos(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NANOS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+// -------------------------------------------------------------------------------------------
+
+uint64_t deadlineAfterMillis(uint64_t millis)
+{
+    return monotonicNanos() + millis * NANOS_PER_MILLI;
+}
+
+// -------------------------------------------------------------------------------------------
+
+uint64_t deadlineRemainingMillis(uint64_t deadline)
+{
+    uint64_t now = monotonicNanos();
+
+    if (now >= deadline)
+    {
+        return 0;
+    }
+
+    // Round up so we never wake a fraction of a millisecond before the deadline
+    return (deadline - now + NANOS_PER_MILLI - 1) / NANOS_PER_MILLI;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// We use select() rather than poll() here: poll() on macOS does not support character devices,
+// so it can't be used on /dev/cu.* ports.
+static int waitFor(int fileDescriptor, bool writing, uint64_t deadline)
+{
+    fd_set descriptors;
+    struct timeval timeout;
+    uint64_t remaining;
+    int result;
+
+    do
+    {
+        remaining = deadlineRemainingMillis(deadline);
+        timeout.tv_sec = (time_t)(remaining / 1000);
+        timeout.tv_usec = (suseconds_t)((remaining % 1000) * 1000);
+
+        FD_ZERO(&descriptors);
+        FD_SET(fileDescriptor, &descriptors);
+
+        result = select(fileDescriptor + 1, writing ? NULL : &descriptors, writing ? &descriptors : NULL, NULL,
+                        &timeout);
+    } while (result == -1 && errno == EINTR);
+
+    if (result > 0)
+    {
+        return 1;
+    }
+
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int waitReadable(int fileDescriptor, uint64_t deadline)
+{
+    return waitFor(fileDescriptor, false, deadline);
+}
+
+// -------------------------------------------------------------------------------------------
+
+int waitWritable(int fileDescriptor, uint64_t deadline)
+{
+    return waitFor(fileDescriptor, true, deadline);
+}
+
+// -------------------------------------------------------------------------------------------
+
+struct timespec wallClockDeadline(uint64_t deadline)
+{
+    struct timespec until;
+    uint64_t now = monotonicNanos();
+    uint64_t nanos;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    nanos = (uint64_t)until.tv_nsec + (deadline > now ? deadline - now : 0);
+    until.tv_sec += (time_t)(nanos / NANOS_PER_SECOND);
+    until.tv_nsec = (long)(nanos % NANOS_PER_SECOND);
+    return until;
+}
+
+// -------------------------------------------------------------------------------------------
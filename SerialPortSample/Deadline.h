@@ -0,0 +1,37 @@
+//
+//  Deadline.h
+//  Monotonic clock helpers and deadline-based waits on a file descriptor
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#ifndef Deadline_h
+#define Deadline_h
+
+#include <stdint.h>
+#include <time.h>
+
+#define NANOS_PER_MILLI     1000000ULL
+#define NANOS_PER_SECOND    1000000000ULL
+
+// Current value of the monotonic clock in nanoseconds. Not affected by wall clock changes.
+uint64_t monotonicNanos(void);
+
+// Absolute deadline (in monotonicNanos() time) that expires the given number of milliseconds from now.
+uint64_t deadlineAfterMillis(uint64_t millis);
+
+// Milliseconds left before the deadline expires. Returns 0 if the deadline has already passed.
+uint64_t deadlineRemainingMillis(uint64_t deadline);
+
+// Block until the file descriptor has data to read or the deadline expires.
+// Returns 1 if the descriptor is readable, 0 on timeout and -1 on error (errno is set).
+int waitReadable(int fileDescriptor, uint64_t deadline);
+
+// The same for room to write: 1 if the descriptor is writable, 0 on timeout and -1 on error.
+int waitWritable(int fileDescriptor, uint64_t deadline);
+
+// The deadline as wall clock time, which is what pthread_cond_timedwait wants
+struct timespec wallClockDeadline(uint64_t deadline);
+
+#endif /* Deadline_h */
@@ -0,0 +1,121 @@
+//
+//  DeviceManager.h
+//  Drives a farm of scanners from one process: finds every matching serial port and takes each Arduino
+//  through its own state machine on a small pool of worker threads
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Every device has its own SerialComms, and with it its own port, reader thread, command window and
+//  capture, so devices share nothing but the trace log. A worker thread takes the next device that hasn't
+//  run yet through opening, the online check, the protocol negotiation, the scan and closing, then moves
+//  on to the next one. Talking to an Arduino is mostly waiting for its replies, so by default there is a
+//  worker per device; with fewer workers the remaining devices queue up until one is free.
+//
+//  Ports come from a PortRegistry, which keeps watching while the farm runs. When a device's port goes
+//  away mid-reel (its USB adapter reset), the device waits for the same adapter to come back, opens it
+//  wherever it is now and carries on from the cell it was at. The reel isn't restarted.
+//
+
+#ifndef DeviceManager_h
+#define DeviceManager_h
+
+#import <Foundation/Foundation.h>
+
+#import "PortRegistry.h"
+#import "ScanPipeline.h"
+#import "SerialComms.h"
+
+#define MAX_FARM_DEVICES        MAX_SERIAL_PORTS
+#define FARM_PROGRESS_SECONDS   10      // Default time between progress reports while the farm is scanning
+#define RECONNECT_SECONDS       30      // Default time a device waits for its port to come back
+
+typedef enum
+{
+    DeviceIdle,             // found, waiting for a worker
+    DeviceOpening,
+    DeviceConnecting,       // port open, waiting for the Arduino to start up and answer
+    DeviceNegotiating,      // switching to the binary protocol
+    DeviceScanning,
+    DeviceReconnecting,     // the port went away, waiting for it to come back
+    DeviceFinished,
+    DeviceFailed,
+    DeviceStateCount
+} DeviceState;
+
+// Name of a state, for reports
+const char *deviceStateName(DeviceState state);
+
+@interface ScanDevice : NSObject
+
+@property (readonly) int index;             // position in the farm, starting at 0
+@property (readonly) NSString *path;        // where the port is now. Can change when it comes back
+@property (readonly) SerialPortInfo port;   // the port's identity, for finding it again
+@property (readonly) unsigned int reconnects;
+@property (readonly) SerialComms *comms;
+@property (readonly) DeviceState state;
+@property NSString *lastError;              // most recent error message, empty if none
+@property (readonly) int exitStatus;        // sysexits code. EX_OK unless the device failed
+@property ScanPipelineStats scanStats;      // filled in by the scan function
+@property (readonly) uint64_t startedAt;    // monotonicNanos() when a worker picked the device up, 0 before
+@property (readonly) uint64_t finishedAt;   // and when it was done with it, 0 before
+
+// Count a cell for the progress reports. Called by the advance stage, from the device's worker thread.
+- (void) cellScanned;
+- (uint64_t) cellsScanned;
+
+// Log the reason and mark the device as failed. It still gets closed properly.
+- (void) fail:(int)exitStatus reason:(NSString *)reason;
+
+// Call when a command failed. If the port has gone away, wait for it to come back, open it again and get
+// the Arduino back to where it was. Returns true if the command is worth sending again. On false the
+// device has failed.
+- (Boolean) recoverLink;
+
+@end
+
+// Runs the reel once the device is online. Called on the device's worker thread; report problems with
+// [device fail:reason:] or by setting lastError.
+typedef void (*DeviceScanFunction)(ScanDevice *device, void *context);
+
+@interface DeviceManager : NSObject
+
+@property NSInteger workerThreads;      // 0 for one per device
+@property NSInteger binaryBaud;         // Switch to the binary protocol at this baud rate, -1 stays with text
+@property NSInteger startupTimeout;     // Seconds the Arduino gets to start up and answer after the port is opened.
+                                        // Only waited for as long as it takes
+@property NSString *captureFile;        // nil doesn't capture. With several devices each gets its own file
+@property NSInteger progressInterval;   // Seconds between progress reports while scanning, 0 for none
+@property NSInteger reconnectTimeout;   // Seconds a device waits for its port to come back, 0 fails straight away
+@property Boolean hardwareFlowControl;  // RTS/CTS on every port
+@property NSInteger drainTimeout;       // Milliseconds closing a port waits for what's still queued to go out
+@property Boolean telemetry;            // Stream the optic sensor and time its edges against the cells. Binary only
+
+- (instancetype) init;
+- (instancetype) initWithBackend:(const SerialTransportBackend *)backend;
+
+// Only take ports with this USB vendor and product ID (0 for any). Ports whose IDs can't be found out,
+// e.g. pseudo-terminals, are taken as well.
+- (instancetype) initWithBackend:(const SerialTransportBackend *)backend vendorId:(uint16_t)vendorId
+                       productId:(uint16_t)productId;
+
+// Add a port as it is, without looking for it. Returns the device, or nil if the farm is full or the port
+// is already in it.
+- (ScanDevice *) addPort:(NSString *)path;
+
+// Add every port the registry knows about whose path matches the pattern (as in fnmatch, case insensitive).
+// A nil pattern matches them all. Returns the number of ports added.
+- (int) discoverPorts:(NSString *)pattern;
+
+- (NSArray<ScanDevice *> *) devices;
+
+// Take every device through a scan, on workerThreads threads, and wait until they are all done. Returns
+// EX_OK if no device failed, otherwise the exit status of the first that did.
+- (int) runScan:(DeviceScanFunction)scan context:(void *)context;
+
+// Log how each device did and how the farm did as a whole
+- (void) reportStats;
+
+@end
+
+#endif /* DeviceManager_h */
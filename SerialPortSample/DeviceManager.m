@@ -0,0 +1,600 @@
+//
+//  DeviceManager.m
+//  Drives a farm of scanners from one process: finds every matching serial port and takes each Arduino
+//  through its own state machine on a small pool of worker threads
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#import <fnmatch.h>
+#import <pthread.h>
+#import <stdatomic.h>
+#import <sysexits.h>
+
+#import "DeviceManager.h"
+
+static const char *kDeviceStateNames[DeviceStateCount] =
+{
+    "idle", "opening", "connecting", "negotiating", "scanning", "reconnecting", "finished", "failed"
+};
+
+// -------------------------------------------------------------------------------------------
+
+const char *deviceStateName(DeviceState state)
+{
+    return state < DeviceStateCount ? kDeviceStateNames[state] : "?";
+}
+
+// -------------------------------------------------------------------------------------------
+// -------------------------------------------------------------------------------------------
+
+@interface DeviceManager ()
+
+- (Boolean) reconnectDevice:(ScanDevice *)device;
+
+@end
+
+// -------------------------------------------------------------------------------------------
+// -------------------------------------------------------------------------------------------
+
+@interface ScanDevice ()
+
+@property (readwrite) NSString *path;
+@property (readwrite) SerialPortInfo port;
+@property (readwrite) unsigned int reconnects;
+@property (weak) DeviceManager *manager;
+@property (readwrite) DeviceState state;
+@property (readwrite) int exitStatus;
+@property (readwrite) uint64_t startedAt;
+@property (readwrite) uint64_t finishedAt;
+
+@end
+
+@implementation ScanDevice
+{
+    _Atomic uint64_t _cellsScanned;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (instancetype)initWithPath:(NSString *)path index:(int)index backend:(const SerialTransportBackend *)backend
+{
+    self = [super init];
+    if (self)
+    {
+        _index = index;
+        _path = path;
+        _comms = [[SerialComms alloc] init:path backend:backend];
+        _comms.readerName = [NSString stringWithFormat:@"reader %d", index];
+        _comms.writerName = [NSString stringWithFormat:@"writer %d", index];
+        _state = DeviceIdle;
+        _lastError = @"";
+        _exitStatus = EX_OK;
+        atomic_init(&_cellsScanned, 0);
+    }
+    return self;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Every state change is logged, so a device's progress can be followed in a farm's log
+- (void) moveTo:(DeviceState)state
+{
+    NSLog(@"[%d] %@: %s -> %s", _index, _path, deviceStateName(self.state), deviceStateName(state));
+    self.state = state;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (void) cellScanned
+{
+    atomic_fetch_add_explicit(&_cellsScanned, 1, memory_order_relaxed);
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (uint64_t) cellsScanned
+{
+    return atomic_load_explicit(&_cellsScanned, memory_order_relaxed);
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (void) fail:(int)exitStatus reason:(NSString *)reason
+{
+    NSLog(@"[%d] %@: %@", _index, _path, reason);
+    self.lastError = reason;
+    self.exitStatus = exitStatus;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (Boolean) recoverLink
+{
+    // Still connected, so it was the Arduino that didn't answer. Nothing we can do about that here.
+    if ([_comms isConnected])
+    {
+        return false;
+    }
+
+    return [self.manager reconnectDevice:self];
+}
+
+// -------------------------------------------------------------------------------------------
+
+@end
+
+// -------------------------------------------------------------------------------------------
+// -------------------------------------------------------------------------------------------
+
+@implementation DeviceManager
+{
+    const SerialTransportBackend *_backend;
+    PortRegistry *_registry;
+    NSMutableArray<ScanDevice *> *_devices;
+    _Atomic unsigned int _nextDevice;   // next device a worker should take
+    DeviceScanFunction _scan;
+    void *_scanContext;
+    dispatch_semaphore_t _workerDone;   // signalled by each worker as it runs out of devices
+    uint64_t _startedAt;
+    uint64_t _finishedAt;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (instancetype)init
+{
+    return [self initWithBackend:defaultSerialBackend()];
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (instancetype)initWithBackend:(const SerialTransportBackend *)backend
+{
+    return [self initWithBackend:backend vendorId:0 productId:0];
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (instancetype)initWithBackend:(const SerialTransportBackend *)backend vendorId:(uint16_t)vendorId
+                       productId:(uint16_t)productId
+{
+    self = [super init];
+    if (self)
+    {
+        _backend = backend;
+        _registry = portRegistryCreate(backend, vendorId, productId);
+        if (_registry == NULL)
+        {
+            return nil;
+        }
+        _devices = [[NSMutableArray alloc] init];
+        _workerThreads = 0;
+        _binaryBaud = -1;
+        _startupTimeout = HANDSHAKE_TIMEOUT_MILLIS / 1000;
+        _captureFile = nil;
+        _progressInterval = FARM_PROGRESS_SECONDS;
+        _reconnectTimeout = RECONNECT_SECONDS;
+        _hardwareFlowControl = false;
+        _drainTimeout = SERIAL_DRAIN_MILLIS;
+        _telemetry = false;
+    }
+    return self;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (void)dealloc
+{
+    portRegistryDestroy(_registry);
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (ScanDevice *) addPort:(NSString *)path
+{
+    ScanDevice *device;
+    SerialPortInfo port;
+
+    for (ScanDevice *existing in _devices)
+    {
+        if ([existing.path caseInsensitiveCompare:path] == NSOrderedSame)
+        {
+            return nil;
+        }
+    }
+
+    if (_devices.count >= MAX_FARM_DEVICES)
+    {
+        NSLog(@"Can't add %@, a farm can have at most %d devices", path, MAX_FARM_DEVICES);
+        return nil;
+    }
+
+    portRegistryTrack(_registry, [path UTF8String], &port);
+    if (!portRegistryClaim(_registry, &port))
+    {
+        NSLog(@"Can't add %@, the same adapter is in the farm already", path);
+        return nil;
+    }
+
+    device = [[ScanDevice alloc] initWithPath:path index:(int)_devices.count backend:_backend];
+    device.port = port;
+    device.manager = self;
+    [_devices addObject:device];
+    return device;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (int) discoverPorts:(NSString *)pattern
+{
+    SerialPortInfo ports[MAX_SERIAL_PORTS];
+    int found = portRegistryList(_registry, ports, MAX_SERIAL_PORTS);
+    int added = 0;
+
+    if (found > MAX_SERIAL_PORTS)
+    {
+        NSLog(@"Found %d serial ports, only the first %d are used", found, MAX_SERIAL_PORTS);
+        found = MAX_SERIAL_PORTS;
+    }
+
+    for (int i = 0; i < found; i++)
+    {
+        if (pattern && fnmatch([pattern UTF8String], ports[i].path, FNM_CASEFOLD) != 0)
+        {
+            continue;
+        }
+
+        if ([self addPort:[NSString stringWithUTF8String:ports[i].path]])
+        {
+            NSLog(@"Modem found with BSD path: %s (USB %04x:%04x)", ports[i].path, ports[i].vendorId, ports[i].productId);
+            added++;
+        }
+    }
+
+    return added;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (NSArray<ScanDevice *> *) devices
+{
+    return _devices;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// With several devices each capture gets the device number, e.g. ScanBrain-2.cap
+- (NSString *) captureFileFor:(ScanDevice *)device
+{
+    NSString *extension = [_captureFile pathExtension];
+    NSString *base;
+
+    if (_devices.count < 2)
+    {
+        return _captureFile;
+    }
+
+    base = [NSString stringWithFormat:@"%@-%d", [_captureFile stringByDeletingPathExtension], device.index];
+    return extension.length ? [base stringByAppendingPathExtension:extension] : base;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The whole life of one device, from opening its port to closing it again
+- (void) runDevice:(ScanDevice *)device
+{
+    SerialComms *comms = device.comms;
+    SerialPortOptions options = comms.portOptions;
+    char threadName[16];
+
+    snprintf(threadName, sizeof(threadName), "scan %d", device.index);
+    traceLogRegisterThread(threadName);
+    device.startedAt = monotonicNanos();
+
+    // Kept for every reconnect too
+    options.hardwareFlowControl = _hardwareFlowControl;
+    options.drainMillis = (uint32_t)_drainTimeout;
+    comms.portOptions = options;
+
+    [device moveTo:DeviceOpening];
+
+    // Start recording before the port is opened, so the capture has everything the Arduino sends us
+    if (_captureFile && ![comms startCapture:[self captureFileFor:device]])
+    {
+        NSLog(@"[%d] Carrying on without a capture.", device.index);
+    }
+
+    if ([comms openSerialPort] == -1)
+    {
+        [device fail:EX_IOERR reason:@"Failed opening USB port"];
+        [comms stopCapture];
+    }
+    else
+    {
+        [device moveTo:DeviceConnecting];
+
+        if ([comms waitUntilReady:(uint32_t)_startupTimeout * 1000])
+        {
+            NSLog(@"[%d] Arduino is online and ready to receive commands after %.0f ms.", device.index,
+                  (double)[comms handshakeStats].readyNanos / NANOS_PER_MILLI);
+
+            // Falls back to the text protocol by itself if the Arduino doesn't support it
+            if (_binaryBaud >= 0)
+            {
+                [device moveTo:DeviceNegotiating];
+                if ([comms negotiateBinaryMode:(uint32_t)_binaryBaud] && _telemetry)
+                {
+                    [comms startTelemetry];
+                }
+            }
+
+            [device moveTo:DeviceScanning];
+            _scan(device, _scanContext);
+        }
+        else
+        {
+            [device fail:EX_IOERR reason:@"Could not talk to Arduino."];
+        }
+
+        [comms closeSerialPort];
+    }
+
+    device.finishedAt = monotonicNanos();
+    [device moveTo:device.exitStatus == EX_OK ? DeviceFinished : DeviceFailed];
+    traceLogUnregisterThread();
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The port went away under a running scan. Wait for the same adapter to come back, open it wherever it is
+// now and get the Arduino talking again. The scan itself knows which cell it's at, so it carries on from
+// there. Called on the device's worker thread.
+- (Boolean) reconnectDevice:(ScanDevice *)device
+{
+    SerialComms *comms = device.comms;
+    SerialPortInfo identity = device.port;
+    SerialPortInfo found;
+    uint64_t lostAt = monotonicNanos();
+    uint64_t deadline = lostAt + (uint64_t)_reconnectTimeout * NANOS_PER_SECOND;
+
+    [device moveTo:DeviceReconnecting];
+    [comms dropSerialPort];
+    portRegistryRelease(_registry, &identity);
+
+    // A port that has only just appeared may not open yet, so keep trying until the time is up
+    for (;;)
+    {
+        if (_reconnectTimeout <= 0 || !portRegistryWaitFor(_registry, &identity, deadline, &found))
+        {
+            [device fail:EX_IOERR reason:[NSString stringWithFormat:@"Port did not come back within %ld seconds.",
+                                          (long)_reconnectTimeout]];
+            return false;
+        }
+
+        device.port = found;
+        device.path = [NSString stringWithUTF8String:found.path];
+        comms.preferedPath = device.path;
+
+        if ([comms openSerialPort] != -1)
+        {
+            break;
+        }
+
+        portRegistryRelease(_registry, &found);
+        usleep(PORT_RESCAN_MILLIS / 10 * 1000);
+    }
+
+    // Opening resets the Arduino, so wait for it to start up again. It comes back in text mode, so the binary
+    // protocol has to be negotiated again.
+    if (![comms waitUntilReady:(uint32_t)_startupTimeout * 1000])
+    {
+        [device fail:EX_IOERR reason:@"Could not talk to Arduino after the port came back."];
+        return false;
+    }
+
+    if (_binaryBaud >= 0 && [comms negotiateBinaryMode:(uint32_t)_binaryBaud] && _telemetry)
+    {
+        [comms startTelemetry];
+    }
+
+    device.reconnects++;
+    NSLog(@"[%d] Back on %@ after %.0f ms, carrying on after %llu cells.", device.index, device.path,
+          (double)(monotonicNanos() - lostAt) / NANOS_PER_MILLI, [device cellsScanned]);
+    [device moveTo:DeviceScanning];
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (ScanDevice *) takeNextDevice
+{
+    unsigned int next = atomic_fetch_add(&_nextDevice, 1);
+
+    return next < _devices.count ? _devices[next] : nil;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void *deviceWorker(void *context)
+{
+    DeviceManager *manager = (__bridge DeviceManager *)context;
+    ScanDevice *device;
+
+    for (;;)
+    {
+        @autoreleasepool
+        {
+            device = [manager takeNextDevice];
+            if (device == nil)
+            {
+                break;
+            }
+
+            [manager runDevice:device];
+        }
+    }
+
+    dispatch_semaphore_signal(manager->_workerDone);
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// One line on how the farm is getting on: how many devices are in each state and the cells so far
+- (void) reportProgress
+{
+    unsigned int inState[DeviceStateCount] = { 0 };
+    uint64_t cells = 0;
+    double seconds = (double)(monotonicNanos() - _startedAt) / NANOS_PER_SECOND;
+    NSMutableString *states = [[NSMutableString alloc] init];
+
+    for (ScanDevice *device in _devices)
+    {
+        inState[device.state]++;
+        cells += [device cellsScanned];
+    }
+
+    for (DeviceState state = DeviceIdle; state < DeviceStateCount; state++)
+    {
+        if (inState[state])
+        {
+            [states appendFormat:@"%s%u %s", states.length ? ", " : "", inState[state], deviceStateName(state)];
+        }
+    }
+
+    NSLog(@"Farm: %@. %llu cells in %.0f seconds, %.2f cells/s.", states, cells, seconds,
+          seconds > 0 ? (double)cells / seconds : 0.0);
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (int) runScan:(DeviceScanFunction)scan context:(void *)context
+{
+    pthread_t threads[MAX_FARM_DEVICES];
+    unsigned int workers = (unsigned int)_workerThreads;
+    unsigned int started = 0;
+    unsigned int finished = 0;
+    long result;
+
+    if (workers == 0 || workers > _devices.count)
+    {
+        workers = (unsigned int)_devices.count;
+    }
+
+    _scan = scan;
+    _scanContext = context;
+    _workerDone = dispatch_semaphore_create(0);
+    atomic_store(&_nextDevice, 0);
+    _startedAt = monotonicNanos();
+
+    // Watch for ports coming and going while the scan runs, so a device that loses its port finds it again
+    // as soon as it's back. If that can't be done reconnecting still works, it just looks for itself.
+    if (portRegistryStart(_registry) == -1)
+    {
+        NSLog(@"Could not watch for serial ports - %s(%d).", strerror(errno), errno);
+    }
+
+    NSLog(@"Scanning with %lu devices on %u worker threads", (unsigned long)_devices.count, workers);
+    for (unsigned int i = 0; i < workers; i++)
+    {
+        result = pthread_create(&threads[started], NULL, deviceWorker, (__bridge void *)self);
+        if (result != 0)
+        {
+            NSLog(@"Could not start worker thread %u - %s(%ld).", i, strerror((int)result), result);
+            continue;
+        }
+        started++;
+    }
+
+    // The devices that were meant for the missing workers get picked up by the others once they're done
+    while (finished < started)
+    {
+        if (dispatch_semaphore_wait(_workerDone, _progressInterval > 0 ?
+                                    dispatch_time(DISPATCH_TIME_NOW, _progressInterval * (int64_t)NSEC_PER_SEC) :
+                                    DISPATCH_TIME_FOREVER) == 0)
+        {
+            finished++;
+        }
+        else
+        {
+            [self reportProgress];
+        }
+    }
+
+    for (unsigned int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    _finishedAt = monotonicNanos();
+    portRegistryStop(_registry);
+
+    if (started == 0)
+    {
+        return EX_OSERR;
+    }
+
+    for (ScanDevice *device in _devices)
+    {
+        if (device.exitStatus != EX_OK)
+        {
+            return device.exitStatus;
+        }
+    }
+
+    return EX_OK;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (void) reportStats
+{
+    uint64_t cells = 0;
+    uint64_t bytesRead = 0;
+    uint64_t commands = 0;
+    uint64_t timedOut = 0;
+    uint64_t slowestReady = 0;
+    unsigned int reconnects = 0;
+    unsigned int failed = 0;
+    PortRegistryStats ports;
+    double seconds;
+    double farmSeconds = (double)(_finishedAt - _startedAt) / NANOS_PER_SECOND;
+
+    for (ScanDevice *device in _devices)
+    {
+        SerialReaderStats reader = [device.comms readerStats];
+        CommandWindowStats window = [device.comms commandStats];
+        HandshakeStats handshake = [device.comms handshakeStats];
+
+        seconds = (double)(device.finishedAt - device.startedAt) / NANOS_PER_SECOND;
+        NSLog(@"[%d] %@ %s: %llu cells in %.1f seconds, %.2f cells/s. Ready after %.0f ms, %llu commands, %llu timed out, "
+              "%llu bytes read, %u reconnects. %@", device.index, device.path, deviceStateName(device.state),
+              [device cellsScanned], seconds, seconds > 0 ? (double)[device cellsScanned] / seconds : 0.0,
+              (double)handshake.readyNanos / NANOS_PER_MILLI, window.sent, window.timedOut, reader.bytesRead,
+              device.reconnects, device.lastError);
+
+        slowestReady = handshake.readyNanos > slowestReady ? handshake.readyNanos : slowestReady;
+
+        cells += [device cellsScanned];
+        bytesRead += reader.bytesRead;
+        commands += window.sent;
+        timedOut += window.timedOut;
+        reconnects += device.reconnects;
+        failed += device.state == DeviceFailed;
+    }
+
+    NSLog(@"Farm of %lu devices: %llu cells in %.1f seconds, %.2f cells/s combined. Slowest ready after %.0f ms, "
+          "%llu commands, %llu timed out, %llu bytes read. %u devices failed.", (unsigned long)_devices.count, cells,
+          farmSeconds, farmSeconds > 0 ? (double)cells / farmSeconds : 0.0, (double)slowestReady / NANOS_PER_MILLI,
+          commands, timedOut, bytesRead, failed);
+
+    portRegistryGetStats(_registry, &ports);
+    NSLog(@"Ports: %u reconnects. %llu scans, %llu notifications, %llu arrivals, %llu removals.%s", reconnects,
+          ports.scans, ports.notifications, ports.arrivals, ports.removals,
+          ports.watching ? "" : " Not watching, polled instead.");
+}
+
+// -------------------------------------------------------------------------------------------
+
+@end
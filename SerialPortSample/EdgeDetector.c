@@ -0,0 +1,336 @@
+//
+//  EdgeDetector.c
+//  Finds the sprocket hole edges in a stream of optic sensor samples: a box filter against the noise,
+//  then threshold crossings with hysteresis
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Both runs do the same integer arithmetic, a sum of the last filterWidth clamped samples shifted down,
+//  so they find the same edges at the same positions. The vector run only decides differently which
+//  samples it has to look at one by one.
+//
+
+#include <string.h>
+
+#include "EdgeDetector.h"
+
+#define EDGE_RUN    256     // samples clamped and then filtered in one go, a multiple of EDGE_BLOCK
+
+typedef uint16_t EdgeVector __attribute__((vector_size(EDGE_BLOCK * sizeof(uint16_t))));
+typedef int16_t EdgeMask __attribute__((vector_size(EDGE_BLOCK * sizeof(uint16_t))));
+
+_Static_assert(EDGE_FILTER_MAX * EDGE_SAMPLE_MAX <= UINT16_MAX, "The filter sum has to fit in 16 bits");
+_Static_assert(sizeof(EdgeVector) == 2 * sizeof(uint64_t), "The any test reads a vector as two words");
+_Static_assert(EDGE_RUN % EDGE_BLOCK == 0, "A run is whole blocks");
+
+// -------------------------------------------------------------------------------------------
+
+void edgeDetectorDefaultConfig(EdgeDetectorConfig *config)
+{
+    config->darkBelow = 400;
+    config->lightAbove = 600;
+    config->filterWidth = 4;
+    config->minSpacing = 8;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static int filterShift(uint8_t width)
+{
+    for (int shift = 0; (1 << shift) <= EDGE_FILTER_MAX; shift++)
+    {
+        if ((1 << shift) == width)
+        {
+            return shift;
+        }
+    }
+
+    return -1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool edgeDetectorInit(EdgeDetector *detector, const EdgeDetectorConfig *config)
+{
+    memset(detector, 0, sizeof(*detector));
+
+    bool valid = config != NULL && filterShift(config->filterWidth) >= 0 && config->darkBelow <= config->lightAbove
+                 && config->lightAbove < EDGE_SAMPLE_MAX;
+
+    if (valid)
+    {
+        detector->config = *config;
+    }
+    else
+    {
+        edgeDetectorDefaultConfig(&detector->config);
+    }
+
+    detector->shift = (uint8_t)filterShift(detector->config.filterWidth);
+    return valid;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void edgeDetectorRestart(EdgeDetector *detector)
+{
+    detector->started = false;
+    detector->seenRising = false;
+    detector->seenFalling = false;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static inline uint16_t clampSample(uint16_t sample)
+{
+    return sample > EDGE_SAMPLE_MAX ? EDGE_SAMPLE_MAX : sample;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The first sample after init or a restart: the filter starts out as if the signal had always been
+// there, and light or dark is whatever it is now.
+static void start(EdgeDetector *detector, uint16_t first)
+{
+    uint16_t sample = clampSample(first);
+
+    for (int i = 0; i < EDGE_FILTER_MAX; i++)
+    {
+        detector->history[i] = sample;
+    }
+
+    detector->lastFiltered = sample;
+    detector->light = sample > detector->config.lightAbove;
+    detector->started = true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Sample index has filtered value filtered, after previous. Flip the state if it has crossed the threshold
+// on its side, and report the edge unless it's too close to the last one the same way.
+static inline void step(EdgeDetector *detector, uint64_t index, uint16_t previous, uint16_t filtered,
+                        SensorEdge *edges, size_t maxEdges, size_t *found)
+{
+    bool rising;
+    uint16_t threshold;
+
+    if (!detector->light && filtered > detector->config.lightAbove)
+    {
+        rising = true;
+        threshold = detector->config.lightAbove;
+    }
+    else if (detector->light && filtered < detector->config.darkBelow)
+    {
+        rising = false;
+        threshold = detector->config.darkBelow;
+    }
+    else
+    {
+        return;
+    }
+
+    detector->light = rising;
+
+    bool *seen = rising ? &detector->seenRising : &detector->seenFalling;
+    uint64_t *last = rising ? &detector->lastRising : &detector->lastFalling;
+
+    if (*seen && index - *last <= detector->config.minSpacing)
+    {
+        detector->stats.suppressed++;
+        return;
+    }
+
+    *seen = true;
+    *last = index;
+
+    if (rising)
+    {
+        detector->stats.rising++;
+    }
+    else
+    {
+        detector->stats.falling++;
+    }
+
+    if (*found >= maxEdges)
+    {
+        detector->stats.overflow++;
+        return;
+    }
+
+    // previous is on the near side of the threshold (or on it), filtered beyond it
+    double fraction = rising ? (double)(threshold - previous) / (double)(filtered - previous)
+                             : (double)(previous - threshold) / (double)(previous - filtered);
+
+    edges[*found] = (SensorEdge){ .sample = index, .position = (double)index - 1.0 + fraction, .rising = rising };
+    (*found)++;
+}
+
+// -------------------------------------------------------------------------------------------
+
+size_t edgeDetectorRunScalar(EdgeDetector *detector, const uint16_t *samples, size_t count, SensorEdge *edges,
+                             size_t maxEdges)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    if (!detector->started)
+    {
+        start(detector, samples[0]);
+    }
+
+    size_t width = detector->config.filterWidth;
+    size_t found = 0;
+    uint32_t sum = 0;
+
+    for (size_t k = EDGE_FILTER_MAX - width + 1; k < EDGE_FILTER_MAX; k++)
+    {
+        sum += detector->history[k];
+    }
+
+    // A running sum: sample i goes in, the one width back comes out, from history while that's before
+    // these samples
+    for (size_t i = 0; i < count; i++)
+    {
+        sum += clampSample(samples[i]);
+
+        uint16_t filtered = (uint16_t)(sum >> detector->shift);
+        step(detector, detector->next + i, detector->lastFiltered, filtered, edges, maxEdges, &found);
+        detector->lastFiltered = filtered;
+
+        size_t out = i + 1;
+        sum -= out >= width ? clampSample(samples[out - width]) : detector->history[EDGE_FILTER_MAX + out - width];
+    }
+
+    if (count >= EDGE_FILTER_MAX)
+    {
+        for (size_t k = 0; k < EDGE_FILTER_MAX; k++)
+        {
+            detector->history[k] = clampSample(samples[count - EDGE_FILTER_MAX + k]);
+        }
+    }
+    else
+    {
+        memmove(detector->history, detector->history + count, (EDGE_FILTER_MAX - count) * sizeof(uint16_t));
+
+        for (size_t k = 0; k < count; k++)
+        {
+            detector->history[EDGE_FILTER_MAX - count + k] = clampSample(samples[k]);
+        }
+    }
+
+    detector->next += count;
+    detector->stats.samples += count;
+    return found;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static inline bool anyLane(EdgeMask mask)
+{
+    uint64_t words[2];
+
+    memcpy(words, &mask, sizeof(words));
+    return (words[0] | words[1]) != 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+size_t edgeDetectorRun(EdgeDetector *detector, const uint16_t *samples, size_t count, SensorEdge *edges,
+                       size_t maxEdges)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    if (!detector->started)
+    {
+        start(detector, samples[0]);
+    }
+
+    // The history and then a run of samples, clamped, so the filter is width loads at offsets
+    uint16_t window[EDGE_FILTER_MAX + EDGE_RUN];
+    const EdgeVector limit = (EdgeVector){ 0 } + EDGE_SAMPLE_MAX;
+    const EdgeVector lightAbove = (EdgeVector){ 0 } + detector->config.lightAbove;
+    const EdgeVector darkBelow = (EdgeVector){ 0 } + detector->config.darkBelow;
+    unsigned int width = detector->config.filterWidth;
+    size_t found = 0;
+    size_t done = 0;
+
+    memcpy(window, detector->history, sizeof(detector->history));
+
+    while (count - done >= EDGE_BLOCK)
+    {
+        size_t run = count - done < EDGE_RUN ? (count - done) & ~(size_t)(EDGE_BLOCK - 1) : EDGE_RUN;
+
+        for (size_t block = 0; block < run; block += EDGE_BLOCK)
+        {
+            EdgeVector raw;
+
+            memcpy(&raw, samples + done + block, sizeof(raw));
+
+            EdgeVector over = (EdgeVector)(raw > limit);
+            raw = (raw & ~over) | (limit & over);
+            memcpy(window + EDGE_FILTER_MAX + block, &raw, sizeof(raw));
+        }
+
+        for (size_t block = 0; block < run; block += EDGE_BLOCK)
+        {
+            const uint16_t *at = window + EDGE_FILTER_MAX + block;
+            EdgeVector sum;
+
+            memcpy(&sum, at, sizeof(sum));
+            for (unsigned int k = 1; k < width; k++)
+            {
+                EdgeVector earlier;
+
+                memcpy(&earlier, at - k, sizeof(earlier));
+                sum += earlier;
+            }
+
+            EdgeVector filtered = sum >> detector->shift;
+            EdgeMask crossing = detector->light ? (filtered < darkBelow) : (filtered > lightAbove);
+
+            if (anyLane(crossing))
+            {
+                uint16_t values[EDGE_BLOCK];
+
+                memcpy(values, &filtered, sizeof(values));
+
+                for (unsigned int lane = 0; lane < EDGE_BLOCK; lane++)
+                {
+                    step(detector, detector->next + done + block + lane, detector->lastFiltered, values[lane], edges,
+                         maxEdges, &found);
+                    detector->lastFiltered = values[lane];
+                }
+            }
+            else
+            {
+                detector->lastFiltered = filtered[EDGE_BLOCK - 1];
+                detector->stats.blocksSkipped++;
+            }
+        }
+
+        memmove(window, window + run, EDGE_FILTER_MAX * sizeof(uint16_t));
+        done += run;
+    }
+
+    memcpy(detector->history, window, sizeof(detector->history));
+    detector->next += done;
+    detector->stats.samples += done;
+
+    // What's left over is less than a block
+    if (done < count)
+    {
+        found += edgeDetectorRunScalar(detector, samples + done, count - done, edges + found,
+                                       found < maxEdges ? maxEdges - found : 0);
+    }
+
+    return found;
+}
+
+// -------------------------------------------------------------------------------------------
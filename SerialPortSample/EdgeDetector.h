@@ -0,0 +1,96 @@
+//
+//  EdgeDetector.h
+//  Finds the sprocket hole edges in a stream of optic sensor samples: a box filter against the noise,
+//  then threshold crossings with hysteresis
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  The sensor reads dark while it looks at the film and light through a sprocket hole, so a rising edge
+//  (dark to light) is a hole arriving, which is what marks a cell. A filtered sample has to go above
+//  lightAbove to count as light and below darkBelow to count as dark again, so noise around a single
+//  threshold can't make a burst of edges.
+//
+//  The samples are filtered EDGE_BLOCK at a time with the compiler's vector extensions (GCC and clang),
+//  which become SSE2 on x86 and NEON on arm64. A block in which no sample crosses the threshold the
+//  detector is waiting for is passed over with one test, and that's nearly all of them: the edges are a
+//  few samples out of thousands. Only a block with a crossing is walked sample by sample, for the
+//  hysteresis and to place the edge between two samples. edgeDetectorRunScalar gives the same edges one
+//  sample at a time, to check against and for the benchmarks.
+//
+//  No allocation and no threads. A detector belongs to whoever feeds it.
+//
+
+#ifndef EdgeDetector_h
+#define EdgeDetector_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define EDGE_FILTER_MAX     16      // longest box filter
+#define EDGE_SAMPLE_MAX     4095    // samples are clamped to 12 bits, so EDGE_FILTER_MAX of them add up in 16
+#define EDGE_BLOCK          8       // samples per vector
+
+typedef struct
+{
+    uint16_t darkBelow;             // a filtered sample below this is dark
+    uint16_t lightAbove;            // and above this light. In between nothing changes
+    uint8_t filterWidth;            // samples averaged: 1, 2, 4, 8 or EDGE_FILTER_MAX
+    uint32_t minSpacing;            // an edge this many samples or fewer after the last one the same way is noise
+} EdgeDetectorConfig;
+
+typedef struct
+{
+    uint64_t sample;                // index of the first sample past the threshold, counting every sample run
+    double position;                // where the filtered signal crossed the threshold, sample - 1 <= position < sample
+    bool rising;                    // dark to light: a hole arriving
+} SensorEdge;
+
+typedef struct
+{
+    uint64_t samples;
+    uint64_t blocksSkipped;         // blocks passed over without looking at each sample
+    uint64_t rising;
+    uint64_t falling;
+    uint64_t suppressed;            // edges dropped because of minSpacing
+    uint64_t overflow;              // edges found that didn't fit in the caller's array
+} EdgeDetectorStats;
+
+typedef struct
+{
+    EdgeDetectorConfig config;
+    uint8_t shift;                  // log2 of filterWidth
+    bool started;                   // the first sample has set the state
+    bool light;
+    uint16_t history[EDGE_FILTER_MAX];  // the raw samples before the next one, oldest first, for the filter
+    uint16_t lastFiltered;
+    uint64_t next;                  // index of the next sample
+    uint64_t lastRising;            // sample of the last edge each way
+    uint64_t lastFalling;
+    bool seenRising;
+    bool seenFalling;
+    EdgeDetectorStats stats;
+} EdgeDetector;
+
+// For the 10 bit ADC on the Arduino: dark below 400, light above 600, 4 samples averaged, 8 samples apart
+void edgeDetectorDefaultConfig(EdgeDetectorConfig *config);
+
+// Returns false if the config isn't valid (the filter width isn't one of the above, or the thresholds are
+// the wrong way round). The detector is set up with the defaults then.
+bool edgeDetectorInit(EdgeDetector *detector, const EdgeDetectorConfig *config);
+
+// The samples that follow don't carry on from the ones before (some were lost), so start the filter and
+// the state over from the next one. The sample count and the stats carry on.
+void edgeDetectorRestart(EdgeDetector *detector);
+
+// Run the next count samples through the detector. Up to maxEdges edges go into edges, in order; any more
+// are counted as overflow. Returns the number of edges put into edges.
+size_t edgeDetectorRun(EdgeDetector *detector, const uint16_t *samples, size_t count, SensorEdge *edges,
+                       size_t maxEdges);
+
+// The same, a sample at a time
+size_t edgeDetectorRunScalar(EdgeDetector *detector, const uint16_t *samples, size_t count, SensorEdge *edges,
+                             size_t maxEdges);
+
+#endif /* EdgeDetector_h */
@@ -0,0 +1,522 @@
+//
+//  FileTailer.c
+//  Follows a file as it grows, like tail -f, and hands each record (line) to a callback as soon as it's
+//  written
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#ifdef __APPLE__
+#include <sys/event.h>
+#endif
+
+#include "FileTailer.h"
+#include "TraceLog.h"
+
+struct FileTailer
+{
+    char path[PATH_MAX];
+    char folder[PATH_MAX];
+    const char *name;           // the file's name in folder, inside path
+    FileTailerConfig config;
+    char *buffer;               // bufferBytes, and one more for the NUL after a record that fills it
+    size_t used;                // bytes in the buffer, the start of a record that hasn't ended yet
+    size_t searched;            // of those, known to have no separator
+    bool overlong;              // the record in the buffer has already been handed out in part
+    int file;                   // being read, -1 until it exists
+    off_t offset;               // read up to here
+    dev_t device;               // of the file being read, to notice it being replaced
+    ino_t inode;
+    int notifications;          // inotify or kqueue, -1 if there are none
+    int watchedFolder;          // kqueue only: says when the file is replaced or created
+    int stopPipe[2];
+    pthread_t thread;
+    bool threadStarted;
+    FileTailerStats stats;
+};
+
+// -------------------------------------------------------------------------------------------
+
+void fileTailerDefaultConfig(FileTailerConfig *config)
+{
+    memset(config, 0, sizeof(FileTailerConfig));
+    config->bufferBytes = FILE_TAILER_CHUNK;
+    config->separator = '\n';
+    config->fromStart = false;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void handOut(FileTailer *tailer, const char *record, size_t length)
+{
+    tailer->stats.records++;
+    tailer->config.record(tailer->config.context, record, length);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Hand out every complete record in the buffer and move what's left of the last one to its front. With
+// last, that's handed out too.
+static void splitRecords(FileTailer *tailer, bool last)
+{
+    char *buffer = tailer->buffer;
+    size_t start = 0;
+    char *separator;
+
+    while ((separator = memchr(buffer + tailer->searched, tailer->config.separator,
+                               tailer->used - tailer->searched)) != NULL)
+    {
+        size_t end = (size_t)(separator - buffer);
+        size_t length = end - start;
+
+        if (tailer->config.separator == '\n' && length > 0 && buffer[end - 1] == '\r')
+        {
+            length--;
+        }
+
+        buffer[start + length] = '\0';
+        handOut(tailer, buffer + start, length);
+        tailer->overlong = false;
+
+        start = end + 1;
+        tailer->searched = start;
+    }
+
+    // A record as long as the buffer goes out as it is, and the rest of it after
+    if (start == 0 && (tailer->used == tailer->config.bufferBytes || (last && tailer->used > 0)))
+    {
+        if (!tailer->overlong && !last)
+        {
+            tailer->stats.overlong++;
+        }
+        tailer->overlong = !last;
+
+        buffer[tailer->used] = '\0';
+        handOut(tailer, buffer, tailer->used);
+        start = tailer->used;
+    }
+    else if (last && start < tailer->used)
+    {
+        buffer[tailer->used] = '\0';
+        handOut(tailer, buffer + start, tailer->used - start);
+        start = tailer->used;
+        tailer->overlong = false;
+    }
+
+    memmove(buffer, buffer + start, tailer->used - start);
+    tailer->used -= start;
+    tailer->searched = tailer->used;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// kqueue watches the file by descriptor, so the one that's read is watched too
+static void platformWatchFile(FileTailer *tailer)
+{
+#ifdef __APPLE__
+    struct kevent change;
+
+    if (tailer->notifications != -1)
+    {
+        EV_SET(&change, tailer->file, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+               NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME, 0, NULL);
+        kevent(tailer->notifications, &change, 1, NULL, 0, NULL);
+    }
+#else
+    (void)tailer;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool openFile(FileTailer *tailer, bool atEnd)
+{
+    struct stat info;
+
+    tailer->file = open(tailer->path, O_RDONLY | O_CLOEXEC);
+    if (tailer->file == -1)
+    {
+        return false;
+    }
+
+    if (fstat(tailer->file, &info) == -1)
+    {
+        close(tailer->file);
+        tailer->file = -1;
+        return false;
+    }
+
+    tailer->device = info.st_dev;
+    tailer->inode = info.st_ino;
+    tailer->offset = atEnd ? lseek(tailer->file, 0, SEEK_END) : 0;
+    if (tailer->offset == -1)
+    {
+        tailer->offset = 0;
+    }
+
+    platformWatchFile(tailer);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Read up to the end of the file, a buffer at a time
+static void readToEnd(FileTailer *tailer)
+{
+    ssize_t count;
+
+    for (;;)
+    {
+        count = read(tailer->file, tailer->buffer + tailer->used, tailer->config.bufferBytes - tailer->used);
+        if (count == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            break;
+        }
+
+        tailer->stats.reads++;
+        tailer->stats.bytes += (uint64_t)count;
+        tailer->offset += count;
+        tailer->used += (size_t)count;
+        splitRecords(tailer, false);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Catch up with the file: open it if it's been created, start again if it got shorter, read what's new,
+// and move on to a new file if it was replaced
+static void catchUp(FileTailer *tailer)
+{
+    struct stat info;
+
+    if (tailer->file == -1)
+    {
+        if (!openFile(tailer, false))
+        {
+            return;
+        }
+        tailer->stats.reopens++;
+    }
+
+    if (fstat(tailer->file, &info) == 0 && info.st_size < tailer->offset)
+    {
+        lseek(tailer->file, 0, SEEK_SET);
+        tailer->offset = 0;
+        tailer->used = 0;
+        tailer->searched = 0;
+        tailer->stats.truncations++;
+    }
+
+    readToEnd(tailer);
+
+    // Whoever replaced it has finished with the old one, so its last record is complete too
+    if (stat(tailer->path, &info) == 0 && (info.st_dev != tailer->device || info.st_ino != tailer->inode))
+    {
+        splitRecords(tailer, true);
+        close(tailer->file);
+        if (openFile(tailer, false))
+        {
+            tailer->stats.reopens++;
+            readToEnd(tailer);
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Watch the folder, which says when the file is replaced or created. inotify on the folder also says when
+// the file's written to; kqueue is told about the file itself in platformWatchFile.
+static int platformWatchStart(FileTailer *tailer)
+{
+#ifdef __linux__
+    tailer->notifications = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (tailer->notifications == -1)
+    {
+        return -1;
+    }
+
+    if (inotify_add_watch(tailer->notifications, tailer->folder, IN_MODIFY | IN_CREATE | IN_MOVED_TO |
+                          IN_MOVED_FROM | IN_DELETE | IN_ATTRIB) == -1)
+    {
+        int error = errno;
+
+        close(tailer->notifications);
+        tailer->notifications = -1;
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+#elif defined(__APPLE__)
+    struct kevent change;
+
+    tailer->notifications = kqueue();
+    if (tailer->notifications == -1)
+    {
+        return -1;
+    }
+
+    tailer->watchedFolder = open(tailer->folder, O_EVTONLY | O_CLOEXEC);
+    EV_SET(&change, tailer->watchedFolder, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE, 0, NULL);
+    if (tailer->watchedFolder == -1 || kevent(tailer->notifications, &change, 1, NULL, 0, NULL) == -1)
+    {
+        int error = errno;
+
+        if (tailer->watchedFolder != -1)
+        {
+            close(tailer->watchedFolder);
+            tailer->watchedFolder = -1;
+        }
+        close(tailer->notifications);
+        tailer->notifications = -1;
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+#else
+    tailer->notifications = -1;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Take the notifications that are waiting. Returns false if none of them were about the file (inotify says
+// about everything in the folder).
+static bool platformWatchDrain(FileTailer *tailer)
+{
+    bool ours = false;
+
+#ifdef __APPLE__
+    struct kevent events[8];
+    struct timespec now = { 0, 0 };
+
+    while (kevent(tailer->notifications, NULL, 0, events, 8, &now) > 0)
+    {
+        ours = true;
+    }
+#elif defined(__linux__)
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+
+    while ((length = read(tailer->notifications, events, sizeof(events))) > 0)
+    {
+        for (char *at = events; at < events + length;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)at;
+
+            if (event->len > 0 && strcmp(event->name, tailer->name) == 0)
+            {
+                ours = true;
+            }
+            at += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#else
+    (void)tailer;
+#endif
+
+    return ours;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void *tailThread(void *context)
+{
+    FileTailer *tailer = context;
+    struct pollfd fds[2];
+    nfds_t count = tailer->notifications != -1 ? 2 : 1;
+    int ready;
+
+    traceLogRegisterThread("tailer");
+
+    fds[0].fd = tailer->stopPipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = tailer->notifications;
+    fds[1].events = POLLIN;
+
+    catchUp(tailer);
+
+    for (;;)
+    {
+        ready = poll(fds, count, FILE_TAILER_POLL_MILLIS);
+        if (ready == -1 && errno != EINTR)
+        {
+            break;
+        }
+        if (ready > 0 && (fds[0].revents & POLLIN))
+        {
+            break;
+        }
+
+        if (ready > 0 && count == 2 && (fds[1].revents & POLLIN))
+        {
+            if (!platformWatchDrain(tailer))
+            {
+                continue;
+            }
+            tailer->stats.wakeups++;
+        }
+
+        catchUp(tailer);
+    }
+
+    traceLogUnregisterThread();
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+FileTailer *fileTailerStart(const char *path, const FileTailerConfig *config)
+{
+    FileTailer *tailer;
+    char *slash;
+    int result;
+
+    if (config->record == NULL || config->bufferBytes == 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    tailer = calloc(1, sizeof(FileTailer));
+    if (tailer == NULL)
+    {
+        return NULL;
+    }
+
+    tailer->file = -1;
+    tailer->notifications = -1;
+    tailer->watchedFolder = -1;
+    tailer->stopPipe[0] = -1;
+    tailer->stopPipe[1] = -1;
+    tailer->config = *config;
+
+    if ((size_t)snprintf(tailer->path, sizeof(tailer->path), "%s", path) >= sizeof(tailer->path))
+    {
+        fileTailerStop(tailer, NULL);
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    strcpy(tailer->folder, path);
+    slash = strrchr(tailer->folder, '/');
+    if (slash == NULL)
+    {
+        strcpy(tailer->folder, ".");
+        tailer->name = tailer->path;
+    }
+    else
+    {
+        tailer->name = tailer->path + (slash - tailer->folder) + 1;
+        slash[slash == tailer->folder ? 1 : 0] = '\0';
+    }
+
+    tailer->buffer = malloc(config->bufferBytes + 1);
+    if (tailer->buffer == NULL || pipe(tailer->stopPipe) == -1)
+    {
+        fileTailerStop(tailer, NULL);
+        return NULL;
+    }
+    fcntl(tailer->stopPipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(tailer->stopPipe[1], F_SETFD, FD_CLOEXEC);
+
+    // Without notifications the thread still looks at the file, just not as quickly
+    if (platformWatchStart(tailer) == -1)
+    {
+        tailer->notifications = -1;
+    }
+
+    // Opened here, so only what's added from now on counts. If it doesn't exist yet, all of it will.
+    openFile(tailer, !config->fromStart);
+
+    result = pthread_create(&tailer->thread, NULL, tailThread, tailer);
+    if (result != 0)
+    {
+        fileTailerStop(tailer, NULL);
+        errno = result;
+        return NULL;
+    }
+
+    tailer->threadStarted = true;
+    return tailer;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool fileTailerNative(const FileTailer *tailer)
+{
+    return tailer->notifications != -1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void fileTailerStop(FileTailer *tailer, FileTailerStats *stats)
+{
+    ssize_t ignored;
+
+    if (tailer == NULL)
+    {
+        return;
+    }
+
+    if (tailer->threadStarted)
+    {
+        ignored = write(tailer->stopPipe[1], "", 1);
+        (void)ignored;
+        pthread_join(tailer->thread, NULL);
+
+        // Anything written since the last wakeup, and a last record that didn't end
+        catchUp(tailer);
+        splitRecords(tailer, true);
+    }
+
+    if (stats)
+    {
+        *stats = tailer->stats;
+    }
+
+    if (tailer->file != -1)
+    {
+        close(tailer->file);
+    }
+    if (tailer->watchedFolder != -1)
+    {
+        close(tailer->watchedFolder);
+    }
+    if (tailer->notifications != -1)
+    {
+        close(tailer->notifications);
+    }
+    if (tailer->stopPipe[0] != -1)
+    {
+        close(tailer->stopPipe[0]);
+        close(tailer->stopPipe[1]);
+    }
+    free(tailer->buffer);
+    free(tailer);
+}
+
+// -------------------------------------------------------------------------------------------
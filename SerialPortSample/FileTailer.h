@@ -0,0 +1,73 @@
+//
+//  FileTailer.h
+//  Follows a file as it grows, like tail -f, and hands each record (line) to a callback as soon as it's
+//  written
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  A thread of its own sleeps until the file changes (inotify on Linux, kqueue on macOS, and looked at every
+//  FILE_TAILER_POLL_MILLIS as well in case a notification is missed), then reads everything new in reads of
+//  up to a whole buffer and goes back to sleep. Records are split in place in the one buffer and handed out
+//  from there, so nothing is allocated or copied per record, and a file that's already large is caught up
+//  with at disk speed.
+//
+//  The file may not exist yet, and may be truncated (it's read again from the start) or replaced, as a log
+//  is when it's rotated: what's left of the old file is read, then the new one from its start. A record
+//  longer than the buffer is handed out in pieces of a buffer each, and counted.
+//
+//  The reads go into a buffer rather than mapping the file: a growing file would have to be mapped again
+//  every time it grows, and a mapped file that's truncated under the reader raises SIGBUS.
+//
+
+#ifndef FileTailer_h
+#define FileTailer_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FILE_TAILER_CHUNK           (256 * 1024)    // default buffer, and so the largest single read
+#define FILE_TAILER_POLL_MILLIS     1000
+
+// A record, without its separator (or a '\r' in front of a '\n'). The separator is overwritten with a NUL,
+// so record can be used as a C string. It's only valid until the callback returns.
+typedef void (*FileTailerRecord)(void *context, const char *record, size_t length);
+
+typedef struct
+{
+    size_t bufferBytes;         // the largest read, and the longest record handed out whole
+    char separator;             // between records
+    bool fromStart;             // hand out what's already in the file too, not only what's added to it
+    FileTailerRecord record;    // called on the tailer's thread
+    void *context;
+} FileTailerConfig;
+
+typedef struct
+{
+    uint64_t bytes;             // read
+    uint64_t records;           // handed out
+    uint64_t reads;
+    uint64_t wakeups;           // notifications (and polls) the file had changed
+    uint64_t truncations;       // times the file got shorter and was read again from the start
+    uint64_t reopens;           // times it was replaced, or created after the tailer started
+    uint64_t overlong;          // records longer than the buffer, handed out in pieces
+} FileTailerStats;
+
+typedef struct FileTailer FileTailer;
+
+// FILE_TAILER_CHUNK, '\n', from the end of the file
+void fileTailerDefaultConfig(FileTailerConfig *config);
+
+// Start following path. It doesn't have to exist yet. Returns NULL on error (errno is set).
+FileTailer *fileTailerStart(const char *path, const FileTailerConfig *config);
+
+// False if the platform notifications couldn't be set up and the file is only looked at every
+// FILE_TAILER_POLL_MILLIS
+bool fileTailerNative(const FileTailer *tailer);
+
+// Read what's been added since the last wakeup, hand out a last record that has no separator after it,
+// and stop. stats may be NULL.
+void fileTailerStop(FileTailer *tailer, FileTailerStats *stats);
+
+#endif /* FileTailer_h */
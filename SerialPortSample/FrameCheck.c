@@ -0,0 +1,293 @@
+//
+//  FrameCheck.c
+//  Looks at each captured frame before it's encoded and stored: is it blank (leader, or no film in the gate),
+//  or the same as the cell before (the film didn't move)?
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Deadline.h"
+#include "FrameCheck.h"
+
+#define GRID_BLOCKS     (FRAME_GRID * FRAME_GRID)
+#define HASH_BITS       (FRAME_HASH_SIZE * FRAME_HASH_SIZE)
+
+typedef uint8_t LumaVector __attribute__((vector_size(FRAME_LANES)));
+typedef uint16_t SumVector __attribute__((vector_size(FRAME_LANES * sizeof(uint16_t))));
+
+_Static_assert(FRAME_BAND_ROWS * ((FRAME_MAX_WIDTH / FRAME_GRID + FRAME_LANES - 1) / FRAME_LANES) * UINT8_MAX
+               <= UINT16_MAX, "The sums of a block have to fit in 16 bits");
+_Static_assert(HASH_BITS <= 64, "The hash is a uint64_t");
+_Static_assert(2 * FRAME_OUTLIER_BLOCKS < GRID_BLOCKS, "Some blocks have to be left");
+
+// -------------------------------------------------------------------------------------------
+
+void frameCheckerInit(FrameChecker *checker, uint8_t blankContrast)
+{
+    memset(checker, 0, sizeof(FrameChecker));
+    checker->blankContrast = blankContrast;
+
+    for (int k = 0; k < FRAME_HASH_SIZE; k++)
+    {
+        for (int n = 0; n < FRAME_GRID; n++)
+        {
+            checker->cosines[k][n] = (float)cos(M_PI * (2 * n + 1) * k / (2.0 * FRAME_GRID));
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Add up the pixels from x to x + width in each of the rows, FRAME_LANES at a time
+static uint32_t blockSum(const uint8_t *luma, size_t rowBytes, const uint32_t *rows, unsigned int rowCount,
+                         uint32_t x, uint32_t width)
+{
+    SumVector sums = { 0 };
+    uint16_t lanes[FRAME_LANES];
+    uint32_t total = 0;
+
+    for (unsigned int r = 0; r < rowCount; r++)
+    {
+        const uint8_t *pixel = luma + rows[r] * rowBytes + x;
+        uint32_t i = 0;
+
+        for (; i + FRAME_LANES <= width; i += FRAME_LANES)
+        {
+            LumaVector some;
+
+            memcpy(&some, pixel + i, sizeof(some));
+            sums += __builtin_convertvector(some, SumVector);
+        }
+
+        for (; i < width; i++)
+        {
+            total += pixel[i];
+        }
+    }
+
+    memcpy(lanes, &sums, sizeof(lanes));
+    for (int lane = 0; lane < FRAME_LANES; lane++)
+    {
+        total += lanes[lane];
+    }
+
+    return total;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The signs of the lowest frequencies of the grid's DCT, against their median. The DC term is only the
+// brightness, so it's left out.
+static uint64_t gridHash(const FrameChecker *checker, const uint8_t *grid)
+{
+    float across[FRAME_GRID][FRAME_HASH_SIZE];
+    float terms[HASH_BITS];
+    float sorted[HASH_BITS - 1];
+    float median;
+    uint64_t hash = 0;
+
+    for (int y = 0; y < FRAME_GRID; y++)
+    {
+        for (int u = 0; u < FRAME_HASH_SIZE; u++)
+        {
+            float sum = 0.0f;
+
+            for (int x = 0; x < FRAME_GRID; x++)
+            {
+                sum += grid[y * FRAME_GRID + x] * checker->cosines[u][x];
+            }
+            across[y][u] = sum;
+        }
+    }
+
+    for (int v = 0; v < FRAME_HASH_SIZE; v++)
+    {
+        for (int u = 0; u < FRAME_HASH_SIZE; u++)
+        {
+            float sum = 0.0f;
+
+            for (int y = 0; y < FRAME_GRID; y++)
+            {
+                sum += across[y][u] * checker->cosines[v][y];
+            }
+            terms[v * FRAME_HASH_SIZE + u] = sum;
+        }
+    }
+
+    // Insertion sort, there are only 63
+    for (int i = 1; i < HASH_BITS; i++)
+    {
+        int j = i - 1;
+
+        for (; j > 0 && sorted[j - 1] > terms[i]; j--)
+        {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = terms[i];
+    }
+    median = sorted[(HASH_BITS - 1) / 2];
+
+    for (int i = 1; i < HASH_BITS; i++)
+    {
+        if (terms[i] > median)
+        {
+            hash |= (uint64_t)1 << i;
+        }
+    }
+
+    return hash;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool frameSummarise(const FrameChecker *checker, const uint8_t *luma, uint32_t width, uint32_t height,
+                    size_t rowBytes, FrameSummary *summary)
+{
+    uint32_t rows[FRAME_BAND_ROWS];
+    uint64_t total = 0;
+    unsigned int seen;
+
+    if (luma == NULL || width < FRAME_GRID || height < FRAME_GRID || width > FRAME_MAX_WIDTH || rowBytes < width)
+    {
+        return false;
+    }
+
+    memset(summary->histogram, 0, sizeof(summary->histogram));
+
+    for (uint32_t band = 0; band < FRAME_GRID; band++)
+    {
+        uint32_t top = band * height / FRAME_GRID;
+        uint32_t bandHeight = (band + 1) * height / FRAME_GRID - top;
+        unsigned int rowCount = bandHeight < FRAME_BAND_ROWS ? bandHeight : FRAME_BAND_ROWS;
+
+        // Spread through the band, not bunched at its top
+        for (unsigned int r = 0; r < rowCount; r++)
+        {
+            rows[r] = top + r * bandHeight / rowCount;
+        }
+
+        for (uint32_t column = 0; column < FRAME_GRID; column++)
+        {
+            uint32_t left = column * width / FRAME_GRID;
+            uint32_t blockWidth = (column + 1) * width / FRAME_GRID - left;
+            uint32_t sum = blockSum(luma, rowBytes, rows, rowCount, left, blockWidth);
+            uint8_t *probe = &summary->probes[(band * FRAME_GRID + column) * FRAME_PROBES_PER_BLOCK];
+            uint8_t mean = (uint8_t)((sum + rowCount * blockWidth / 2) / (rowCount * blockWidth));
+
+            summary->grid[band * FRAME_GRID + column] = mean;
+            summary->histogram[mean]++;
+            total += mean;
+
+            for (int k = 0; k < FRAME_PROBES_PER_BLOCK; k++)
+            {
+                probe[k] = luma[rows[0] * rowBytes + left + (2 * k + 1) * blockWidth / (2 * FRAME_PROBES_PER_BLOCK)];
+            }
+        }
+    }
+
+    summary->mean = (uint8_t)((total + GRID_BLOCKS / 2) / GRID_BLOCKS);
+
+    seen = 0;
+    for (int level = 0; level < 256; level++)
+    {
+        seen += summary->histogram[level];
+        if (seen > FRAME_OUTLIER_BLOCKS)
+        {
+            summary->low = (uint8_t)level;
+            break;
+        }
+    }
+
+    seen = 0;
+    for (int level = 255; level >= 0; level--)
+    {
+        seen += summary->histogram[level];
+        if (seen > FRAME_OUTLIER_BLOCKS)
+        {
+            summary->high = (uint8_t)level;
+            break;
+        }
+    }
+
+    summary->hash = gridHash(checker, summary->grid);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+unsigned int frameHashDistance(uint64_t a, uint64_t b)
+{
+    return (unsigned int)__builtin_popcountll(a ^ b);
+}
+
+// -------------------------------------------------------------------------------------------
+
+double frameProbeDifference(const FrameSummary *a, const FrameSummary *b)
+{
+    uint32_t total = 0;
+
+    for (int i = 0; i < FRAME_PROBES; i++)
+    {
+        total += (uint32_t)abs(a->probes[i] - b->probes[i]);
+    }
+
+    return (double)total / FRAME_PROBES;
+}
+
+// -------------------------------------------------------------------------------------------
+
+FrameVerdict frameCheck(FrameChecker *checker, const uint8_t *luma, uint32_t width, uint32_t height,
+                        size_t rowBytes)
+{
+    FrameSummary summary;
+    FrameVerdict verdict;
+    uint64_t start = monotonicNanos();
+
+    checker->stats.frames++;
+
+    if (!frameSummarise(checker, luma, width, height, rowBytes, &summary))
+    {
+        checker->stats.unchecked++;
+        verdict = FrameUnchecked;
+    }
+    else if (summary.high - summary.low < checker->blankContrast)
+    {
+        checker->stats.blank++;
+        verdict = FrameBlank;
+    }
+    else if (checker->haveLast && frameHashDistance(summary.hash, checker->last.hash) <= FRAME_DUPLICATE_BITS
+             && frameProbeDifference(&summary, &checker->last) <= FRAME_DUPLICATE_LEVEL)
+    {
+        checker->stats.duplicate++;
+        verdict = FrameDuplicate;
+    }
+    else
+    {
+        verdict = FrameNew;
+    }
+
+    if (verdict == FrameNew || verdict == FrameBlank)
+    {
+        checker->last = summary;
+        checker->haveLast = true;
+    }
+
+    checker->stats.busyNanos += monotonicNanos() - start;
+    return verdict;
+}
+
+// -------------------------------------------------------------------------------------------
+
+const char *frameVerdictName(FrameVerdict verdict)
+{
+    static const char *names[] = { "new", "blank", "duplicate", "unchecked" };
+
+    return verdict <= FrameUnchecked ? names[verdict] : "unknown";
+}
+
+// -------------------------------------------------------------------------------------------
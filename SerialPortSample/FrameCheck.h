@@ -0,0 +1,107 @@
+//
+//  FrameCheck.h
+//  Looks at each captured frame before it's encoded and stored: is it blank (leader, or no film in the gate),
+//  or the same as the cell before (the film didn't move)?
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Only a small part of the frame is read. It's cut into a FRAME_GRID by FRAME_GRID grid of blocks, and the
+//  mean luminance of each block is taken from FRAME_BAND_ROWS rows spread through it. The rows are added up
+//  FRAME_LANES pixels at a time with the compiler's vector extensions (GCC and clang), which become SSE2 on
+//  x86 and NEON on arm64. Everything after that works on the grid alone.
+//
+//  Blank: the histogram of the block means is narrow. Leader, clear or black film and an empty gate are
+//  the same all over, while a picture, even a dark one, has blocks FRAME_BLANK_CONTRAST levels apart.
+//  The darkest and brightest FRAME_OUTLIER_BLOCKS are left out, so dust or the edge of the gate can't make
+//  a blank frame look like a picture.
+//
+//  Duplicate: the perceptual hash (the signs of the lowest frequencies of the grid's DCT against their
+//  median) is within FRAME_DUPLICATE_BITS of the last frame's, and FRAME_PROBES single pixels, a few in
+//  every block, are within FRAME_DUPLICATE_LEVEL of the same pixels in it on average. The hash finds
+//  frames that look alike. The pixels tell a cell the film didn't move from, which is the same frame again
+//  give or take the sensor's noise, from a held shot, where the grain and the registration are different
+//  every cell, so the probes fall on different grain.
+//
+//  A frame is 8 bit luminance, row by row, e.g. the Y plane of what the camera gives. No allocation and
+//  no threads. A checker belongs to whoever captures.
+//
+
+#ifndef FrameCheck_h
+#define FrameCheck_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FRAME_GRID              32      // blocks across and down
+#define FRAME_BAND_ROWS         8       // rows read in each row of blocks
+#define FRAME_LANES             16      // pixels per vector
+#define FRAME_MAX_WIDTH         16384   // so the vector sums of a block fit in 16 bits
+#define FRAME_HASH_SIZE         8       // lowest frequencies each way that make up the hash
+#define FRAME_PROBES_PER_BLOCK  4       // single pixels kept from each block, to compare frames closely
+#define FRAME_PROBES            (FRAME_GRID * FRAME_GRID * FRAME_PROBES_PER_BLOCK)
+#define FRAME_OUTLIER_BLOCKS    10      // at each end of the histogram, left out of the contrast
+#define FRAME_BLANK_CONTRAST    16      // default: blocks closer than this are a blank frame
+#define FRAME_DUPLICATE_BITS    4       // hashes this close may be the same frame
+#define FRAME_DUPLICATE_LEVEL   3       // and then are if the probes differ by this or less on average
+
+typedef enum
+{
+    FrameNew,                   // a picture, and not the last one again
+    FrameBlank,
+    FrameDuplicate,             // the same as the last frame looked at
+    FrameUnchecked              // no pixels, or not a size that can be checked
+} FrameVerdict;
+
+typedef struct
+{
+    uint8_t grid[FRAME_GRID * FRAME_GRID];  // mean luminance of each block, row by row
+    uint8_t probes[FRAME_PROBES];           // pixels across the first row read in each block, block by block
+    uint16_t histogram[256];                // of the block means
+    uint8_t mean;
+    uint8_t low;                            // darkest and brightest block, without the outliers
+    uint8_t high;
+    uint64_t hash;
+} FrameSummary;
+
+typedef struct
+{
+    uint64_t frames;                        // looked at
+    uint64_t blank;
+    uint64_t duplicate;
+    uint64_t unchecked;
+    uint64_t busyNanos;                     // spent looking
+} FrameCheckStats;
+
+typedef struct
+{
+    uint8_t blankContrast;                  // may be changed between frames
+    float cosines[FRAME_HASH_SIZE][FRAME_GRID];     // the DCT's, for the frequencies in the hash
+    FrameSummary last;                      // the last frame that wasn't unchecked or a duplicate
+    bool haveLast;
+    FrameCheckStats stats;
+} FrameChecker;
+
+void frameCheckerInit(FrameChecker *checker, uint8_t blankContrast);
+
+// The next frame, in a different cell from the last one. The summary is kept for the next frame to be
+// compared with, unless this one is a duplicate: a run of duplicates is compared with the frame before it,
+// so it can't creep.
+FrameVerdict frameCheck(FrameChecker *checker, const uint8_t *luma, uint32_t width, uint32_t height,
+                        size_t rowBytes);
+
+// Summarise a frame. Returns false if it's smaller than the grid or wider than FRAME_MAX_WIDTH.
+bool frameSummarise(const FrameChecker *checker, const uint8_t *luma, uint32_t width, uint32_t height,
+                    size_t rowBytes, FrameSummary *summary);
+
+// Bits that differ between two hashes
+unsigned int frameHashDistance(uint64_t a, uint64_t b);
+
+// Mean difference between the probes of two frames, in grey levels
+double frameProbeDifference(const FrameSummary *a, const FrameSummary *b);
+
+// Name of a verdict, for the log
+const char *frameVerdictName(FrameVerdict verdict);
+
+#endif /* FrameCheck_h */
@@ -0,0 +1,369 @@
+//
+//  IOKitSerialBackend.c
+//  macOS serial port backend. Ports are discovered through the IOKit registry and the port is set up with
+//  the IOSSIOSPEED and IOSSDATALAT ioctls on top of termios. IOKit notifications tell when ports come and go.
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#ifdef __APPLE__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <dispatch/dispatch.h>
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/IOBSD.h>
+#include <IOKit/serial/IOSerialKeys.h>
+#include <IOKit/serial/ioss.h>
+
+#include "SerialTransport.h"
+
+// The notifications are delivered on a dispatch queue and passed on through a pipe, so the watch has a
+// descriptor like it has on Linux
+typedef struct
+{
+    IONotificationPortRef notificationPort;
+    dispatch_queue_t queue;
+    io_iterator_t published;
+    io_iterator_t terminated;
+    int pipe[2];
+} IOKitWatch;
+
+// -------------------------------------------------------------------------------------------
+
+// Look up a number property (e.g. idVendor) on the service or the first of its parents that has it. For a
+// USB serial adapter that's the USB device the serial port hangs off.
+static uint16_t searchNumberProperty(io_object_t service, CFStringRef key)
+{
+    CFTypeRef property;
+    int value = 0;
+
+    property = IORegistryEntrySearchCFProperty(service, kIOServicePlane, key, kCFAllocatorDefault,
+                                               kIORegistryIterateRecursively | kIORegistryIterateParents);
+    if (property)
+    {
+        if (CFGetTypeID(property) == CFNumberGetTypeID())
+        {
+            CFNumberGetValue((CFNumberRef)property, kCFNumberIntType, &value);
+        }
+        CFRelease(property);
+    }
+
+    return (uint16_t)value;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool searchStringProperty(io_object_t service, CFStringRef key, bool searchParents, char *value, size_t size)
+{
+    CFTypeRef property;
+    bool result = false;
+
+    property = IORegistryEntrySearchCFProperty(service, kIOServicePlane, key, kCFAllocatorDefault,
+                                               searchParents ? kIORegistryIterateRecursively | kIORegistryIterateParents : 0);
+    if (property)
+    {
+        if (CFGetTypeID(property) == CFStringGetTypeID())
+        {
+            result = CFStringGetCString((CFStringRef)property, value, (CFIndex)size, kCFStringEncodingUTF8);
+        }
+        CFRelease(property);
+    }
+
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Serial devices are instances of class IOSerialBSDClient. Each has a property with key kIOSerialBSDTypeKey
+// and a value that is one of kIOSerialBSDAllTypes, kIOSerialBSDModemType, or kIOSerialBSDRS232Type.
+// USB serial adapters such as the one on the Arduino advertise themselves as modems, so that's what we match.
+static int iokitDiscover(SerialPortInfo *ports, int maxPorts)
+{
+    CFMutableDictionaryRef classesToMatch;
+    io_iterator_t serialPortIterator = IO_OBJECT_NULL;
+    io_object_t modemService;
+    kern_return_t kernResult;
+    int found = 0;
+
+    classesToMatch = IOServiceMatching(kIOSerialBSDServiceValue);
+    if (classesToMatch == NULL)
+    {
+        return -1;
+    }
+
+    // Look for devices that claim to be USB ports
+    CFDictionarySetValue(classesToMatch, CFSTR(kIOSerialBSDTypeKey), CFSTR(kIOSerialBSDModemType));
+
+    // Get an iterator across all matching devices. This consumes the matching dictionary.
+    kernResult = IOServiceGetMatchingServices(kIOMainPortDefault, classesToMatch, &serialPortIterator);
+    if (KERN_SUCCESS != kernResult)
+    {
+        return -1;
+    }
+
+    while ((modemService = IOIteratorNext(serialPortIterator)))
+    {
+        SerialPortInfo info;
+
+        memset(&info, 0, sizeof(info));
+
+        // Get the USB port's device's path (/dev/cu.xxxxx). We will need this to open the port later on
+        if (searchStringProperty(modemService, CFSTR(kIOCalloutDeviceKey), false, info.path, sizeof(info.path)))
+        {
+            info.vendorId = searchNumberProperty(modemService, CFSTR("idVendor"));
+            info.productId = searchNumberProperty(modemService, CFSTR("idProduct"));
+            searchStringProperty(modemService, CFSTR("USB Serial Number"), true, info.serialNumber,
+                                 sizeof(info.serialNumber));
+
+            if (found < maxPorts)
+            {
+                ports[found] = info;
+            }
+            found++;
+        }
+
+        // Release the io_service_t now that we are done with it
+        (void) IOObjectRelease(modemService);
+    }
+
+    IOObjectRelease(serialPortIterator);
+    return found;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static int setSpeed(SerialTransport *transport, uint32_t baudRate)
+{
+    speed_t speed = baudRate;
+
+    if (ioctl(transport->fileDescriptor, IOSSIOSPEED, &speed) == -1)
+    {
+        serialTransportSetError(transport, "Error calling ioctl(..., IOSSIOSPEED, ...) %s - %s(%d).",
+                                transport->path, strerror(errno), errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static int iokitOpen(SerialTransport *transport, const char *path, const SerialPortOptions *options)
+{
+    bool standardBaud;
+    unsigned long mics = 1UL;
+
+    if (serialTransportOpenTermios(transport, path, options, &standardBaud) == -1)
+    {
+        return -1;
+    }
+
+    // The IOSSIOSPEED ioctl can be used to set arbitrary baud rates other than those specified by POSIX.
+    // The driver for the underlying serial hardware ultimately determines which baud rates can be used.
+    // This ioctl sets both the input and output speed.
+    if (!standardBaud && setSpeed(transport, options->baudRate) == -1)
+    {
+        serialTransportClose(transport);
+        return -1;
+    }
+
+    // Set the receive latency in microseconds. Serial drivers use this value to determine how often to
+    // dequeue characters received by the hardware. Pseudo-terminals (e.g. the Arduino simulator) don't
+    // support this, so it's not treated as fatal.
+    if (options->lowLatency && ioctl(transport->fileDescriptor, IOSSDATALAT, &mics) == -1)
+    {
+        serialTransportSetWarning(transport, "Error setting read latency %s - %s(%d).", path, strerror(errno), errno);
+    }
+
+    return transport->fileDescriptor;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// IOSSIOSPEED takes any rate, standard or not, so there's no need to go through termios
+static int iokitSetBaud(SerialTransport *transport, uint32_t baudRate)
+{
+    return setSpeed(transport, baudRate);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Empty the iterator, which is what re-arms the notification
+static void releaseServices(io_iterator_t iterator)
+{
+    io_object_t service;
+
+    while ((service = IOIteratorNext(iterator)))
+    {
+        IOObjectRelease(service);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void portsChanged(void *context, io_iterator_t iterator)
+{
+    IOKitWatch *state = context;
+    ssize_t ignored;
+
+    releaseServices(iterator);
+
+    // If the pipe is full there's a notification pending anyway
+    ignored = write(state->pipe[1], "", 1);
+    (void)ignored;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void iokitWatchStop(SerialPortWatch *watch)
+{
+    IOKitWatch *state = watch->platform;
+
+    if (state == NULL)
+    {
+        return;
+    }
+
+    if (state->notificationPort)
+    {
+        IONotificationPortDestroy(state->notificationPort);
+    }
+    if (state->published)
+    {
+        IOObjectRelease(state->published);
+    }
+    if (state->terminated)
+    {
+        IOObjectRelease(state->terminated);
+    }
+    if (state->queue)
+    {
+        // Wait for a notification that is being delivered right now
+        dispatch_sync(state->queue, ^{});
+#if !OS_OBJECT_USE_OBJC
+        dispatch_release(state->queue);
+#endif
+    }
+    if (state->pipe[0] != -1)
+    {
+        close(state->pipe[0]);
+        close(state->pipe[1]);
+    }
+
+    free(state);
+    watch->platform = NULL;
+    watch->fileDescriptor = -1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Same matching as iokitDiscover: a notification when a modem type serial port is published or terminated
+static int iokitWatchStart(SerialPortWatch *watch)
+{
+    CFMutableDictionaryRef classesToMatch;
+    IOKitWatch *state;
+    kern_return_t kernResult;
+
+    state = calloc(1, sizeof(IOKitWatch));
+    if (state == NULL)
+    {
+        return -1;
+    }
+
+    state->pipe[0] = state->pipe[1] = -1;
+    watch->platform = state;
+    watch->fileDescriptor = -1;
+
+    if (pipe(state->pipe) == -1)
+    {
+        state->pipe[0] = state->pipe[1] = -1;
+        iokitWatchStop(watch);
+        return -1;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(state->pipe[i], F_SETFL, fcntl(state->pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(state->pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    state->notificationPort = IONotificationPortCreate(kIOMainPortDefault);
+    state->queue = dispatch_queue_create("SerialPortWatch", DISPATCH_QUEUE_SERIAL);
+    classesToMatch = IOServiceMatching(kIOSerialBSDServiceValue);
+    if (state->notificationPort == NULL || state->queue == NULL || classesToMatch == NULL)
+    {
+        iokitWatchStop(watch);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    IONotificationPortSetDispatchQueue(state->notificationPort, state->queue);
+    CFDictionarySetValue(classesToMatch, CFSTR(kIOSerialBSDTypeKey), CFSTR(kIOSerialBSDModemType));
+
+    // Each notification consumes a reference to the matching dictionary
+    CFRetain(classesToMatch);
+    kernResult = IOServiceAddMatchingNotification(state->notificationPort, kIOPublishNotification, classesToMatch,
+                                                  portsChanged, state, &state->published);
+    if (kernResult == KERN_SUCCESS)
+    {
+        kernResult = IOServiceAddMatchingNotification(state->notificationPort, kIOTerminatedNotification,
+                                                      classesToMatch, portsChanged, state, &state->terminated);
+    }
+    else
+    {
+        CFRelease(classesToMatch);
+    }
+
+    if (kernResult != KERN_SUCCESS)
+    {
+        iokitWatchStop(watch);
+        errno = EIO;
+        return -1;
+    }
+
+    // The ports that are already there come with the first iteration, and the notifications only start once
+    // the iterators have been emptied. Do that on the queue, where the notifications will arrive.
+    dispatch_sync(state->queue, ^{
+        releaseServices(state->published);
+        releaseServices(state->terminated);
+    });
+
+    watch->fileDescriptor = state->pipe[0];
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void iokitWatchDrain(SerialPortWatch *watch)
+{
+    char pending[64];
+
+    while (read(watch->fileDescriptor, pending, sizeof(pending)) > 0)
+    {
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+const SerialTransportBackend kIOKitSerialBackend =
+{
+    "IOKit",
+    iokitDiscover,
+    iokitOpen,
+    iokitSetBaud,
+    iokitWatchStart,
+    iokitWatchDrain,
+    iokitWatchStop
+};
+
+// -------------------------------------------------------------------------------------------
+
+#endif /* __APPLE__ */
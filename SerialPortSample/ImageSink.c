@@ -0,0 +1,865 @@
+//
+//  ImageSink.c
+//  Writes the scanned frames of a reel to disk on a pool of writer threads, into one container file
+//  per reel, without holding up the film transport
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#define _GNU_SOURCE     // O_DIRECT on Linux
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "Deadline.h"
+#include "ImageSink.h"
+#include "TraceLog.h"
+
+_Static_assert(sizeof(ReelFileHeader) == 64, "ReelFileHeader is part of the file format");
+_Static_assert(sizeof(ReelRecordHeader) == 32, "ReelRecordHeader is part of the file format");
+_Static_assert(sizeof(ReelIndexEntry) == 24, "ReelIndexEntry is part of the file format");
+
+typedef struct
+{
+    uint8_t *memory;            // REEL_ALIGNMENT aligned, the record header followed by the frame
+    size_t length;              // bytes to write, padded
+    uint64_t offset;            // where in the file
+} WriteBuffer;
+
+struct ImageSink
+{
+    int fileDescriptor;
+    ImageSinkConfig config;
+    size_t bufferSize;          // of each buffer, room for the largest record
+    WriteBuffer *buffers;
+    size_t *freeBuffers;        // stack of buffers nobody is using
+    size_t freeCount;
+    size_t *queue;              // ring of buffers waiting to be written, in the order they were filled
+    size_t queueHead;
+    size_t queueCount;
+    size_t writing;             // buffers a writer has taken
+    uint64_t nextOffset;        // where the next record goes
+    uint64_t startedAt;
+    uint64_t wallClockSeconds;
+    ReelIndexEntry *index;
+    size_t indexCount;
+    size_t indexCapacity;
+    uint64_t unsynced;          // frames written since the last sync
+    pthread_mutex_t lock;
+    pthread_cond_t queued;      // a buffer was queued, or the sink is closing
+    pthread_cond_t written;     // a buffer was written and is free again
+    pthread_t threads[IMAGE_SINK_MAX_WRITERS];
+    unsigned int threadCount;
+    bool closing;
+    ImageSinkStats stats;
+};
+
+// -------------------------------------------------------------------------------------------
+
+static size_t aligned(size_t length)
+{
+    return (length + REEL_ALIGNMENT - 1) & ~(size_t)(REEL_ALIGNMENT - 1);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void imageSinkDefaultConfig(ImageSinkConfig *config)
+{
+    config->bufferCount = 4;
+    config->bufferBytes = 32 * 1024 * 1024;
+    config->writerThreads = 2;
+    config->maxBatch = 8;
+    config->sync = ImageSyncAtEnd;
+    config->syncInterval = 0;
+    config->directIO = true;
+    config->expectedFrames = 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// fsync only gets the data as far as the drive's cache on macOS
+static int syncFile(int fileDescriptor)
+{
+#ifdef F_FULLFSYNC
+    if (fcntl(fileDescriptor, F_FULLFSYNC) == 0)
+    {
+        return 0;
+    }
+#endif
+    return fsync(fileDescriptor);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// pwritev may write less than asked, e.g. when interrupted. Carry on from where it stopped.
+static int writeAll(int fileDescriptor, struct iovec *vectors, int count, uint64_t offset)
+{
+    ssize_t written;
+
+    while (count > 0)
+    {
+        written = pwritev(fileDescriptor, vectors, count, (off_t)offset);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (written == 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+
+        offset += (uint64_t)written;
+        while (count > 0 && (size_t)written >= vectors->iov_len)
+        {
+            written -= (ssize_t)vectors->iov_len;
+            vectors++;
+            count--;
+        }
+        if (count > 0)
+        {
+            vectors->iov_base = (uint8_t *)vectors->iov_base + written;
+            vectors->iov_len -= (size_t)written;
+        }
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Write a block that isn't one of the buffers (the header, the index) through an aligned copy, since the
+// file may be open for direct I/O
+static int writeBlock(ImageSink *sink, const void *data, size_t length, uint64_t offset)
+{
+    struct iovec vector;
+    void *block;
+    int result;
+    int error;
+
+    if (posix_memalign(&block, REEL_ALIGNMENT, aligned(length)) != 0)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memset(block, 0, aligned(length));
+    memcpy(block, data, length);
+    vector.iov_base = block;
+    vector.iov_len = aligned(length);
+
+    result = writeAll(sink->fileDescriptor, &vector, 1, offset);
+    error = errno;
+    free(block);
+    errno = error;
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static int writeHeader(ImageSink *sink, uint64_t frames, uint64_t indexOffset)
+{
+    ReelFileHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REEL_MAGIC, sizeof(header.magic));
+    header.version = REEL_VERSION;
+    header.alignment = REEL_ALIGNMENT;
+    header.wallClockSeconds = sink->wallClockSeconds;
+    header.frames = frames;
+    header.indexOffset = indexOffset;
+    header.dataLength = indexOffset ? indexOffset - REEL_ALIGNMENT : 0;
+
+    return writeBlock(sink, &header, sizeof(header), 0);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Take the buffers at the front of the queue that follow on from each other in the file, so they can
+// go in one write. Called with the lock held.
+static int takeBatch(ImageSink *sink, size_t *batch)
+{
+    size_t count = sink->config.bufferCount;
+    WriteBuffer *previous = NULL;
+    WriteBuffer *buffer;
+    int taken = 0;
+
+    while (sink->queueCount > 0 && taken < (int)sink->config.maxBatch)
+    {
+        buffer = &sink->buffers[sink->queue[sink->queueHead]];
+        if (previous && previous->offset + previous->length != buffer->offset)
+        {
+            break;
+        }
+
+        batch[taken++] = sink->queue[sink->queueHead];
+        sink->queueHead = (sink->queueHead + 1) % count;
+        sink->queueCount--;
+        previous = buffer;
+    }
+
+    sink->writing += (size_t)taken;
+    return taken;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void *writerThread(void *context)
+{
+    ImageSink *sink = context;
+    size_t batch[IMAGE_SINK_MAX_BATCH];
+    struct iovec vectors[IMAGE_SINK_MAX_BATCH];
+    uint64_t bytes;
+    uint64_t started;
+    bool sync;
+    int count;
+    int result;
+
+    traceLogRegisterThread("image writer");
+    pthread_mutex_lock(&sink->lock);
+
+    for (;;)
+    {
+        while (sink->queueCount == 0 && !sink->closing)
+        {
+            pthread_cond_wait(&sink->queued, &sink->lock);
+        }
+
+        if (sink->queueCount == 0)
+        {
+            break;
+        }
+
+        count = takeBatch(sink, batch);
+        pthread_mutex_unlock(&sink->lock);
+
+        started = monotonicNanos();
+        bytes = 0;
+        for (int i = 0; i < count; i++)
+        {
+            vectors[i].iov_base = sink->buffers[batch[i]].memory;
+            vectors[i].iov_len = sink->buffers[batch[i]].length;
+            bytes += ((const ReelRecordHeader *)sink->buffers[batch[i]].memory)->length;
+        }
+
+        result = writeAll(sink->fileDescriptor, vectors, count, sink->buffers[batch[0]].offset);
+
+        pthread_mutex_lock(&sink->lock);
+        sink->unsynced += (uint64_t)count;
+        sync = result == 0 && (sink->config.sync == ImageSyncEveryFrame ||
+                               (sink->config.sync == ImageSyncEveryN && sink->unsynced >= sink->config.syncInterval));
+        if (sync)
+        {
+            sink->unsynced = 0;
+        }
+        pthread_mutex_unlock(&sink->lock);
+
+        // The frames only count as written once they're synced, so the buffers aren't handed back before
+        if (sync && syncFile(sink->fileDescriptor) == -1)
+        {
+            result = -1;
+        }
+
+        pthread_mutex_lock(&sink->lock);
+        if (result == -1)
+        {
+            if (sink->stats.error == 0)
+            {
+                sink->stats.error = errno;
+                TRACE("Writing %d frames to the reel failed, errno %d", count, errno);
+            }
+        }
+        else
+        {
+            sink->stats.frames += (uint64_t)count;
+            sink->stats.bytes += bytes;
+            sink->stats.batches++;
+            sink->stats.syncs += sync;
+        }
+        sink->stats.busyNanos += monotonicNanos() - started;
+
+        for (int i = 0; i < count; i++)
+        {
+            sink->freeBuffers[sink->freeCount++] = batch[i];
+        }
+        sink->writing -= (size_t)count;
+        pthread_cond_broadcast(&sink->written);
+    }
+
+    pthread_mutex_unlock(&sink->lock);
+    traceLogUnregisterThread();
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Opens the file, bypassing the page cache if asked to and the file system lets us
+static int openReel(ImageSink *sink, const char *path, bool resume)
+{
+    int flags = resume ? O_RDWR | O_CLOEXEC : O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int fileDescriptor = -1;
+
+#ifdef O_DIRECT
+    if (sink->config.directIO)
+    {
+        // tmpfs and some others refuse O_DIRECT
+        fileDescriptor = open(path, flags | O_DIRECT, 0644);
+        sink->stats.directIO = fileDescriptor != -1;
+    }
+#endif
+
+    if (fileDescriptor == -1)
+    {
+        fileDescriptor = open(path, flags, 0644);
+    }
+
+#ifdef F_NOCACHE
+    if (fileDescriptor != -1 && sink->config.directIO)
+    {
+        sink->stats.directIO = fcntl(fileDescriptor, F_NOCACHE, 1) == 0;
+    }
+#endif
+
+    return fileDescriptor;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void freeSink(ImageSink *sink)
+{
+    if (sink->buffers)
+    {
+        for (size_t i = 0; i < sink->config.bufferCount; i++)
+        {
+            free(sink->buffers[i].memory);
+        }
+    }
+
+    free(sink->buffers);
+    free(sink->freeBuffers);
+    free(sink->queue);
+    free(sink->index);
+    pthread_mutex_destroy(&sink->lock);
+    pthread_cond_destroy(&sink->queued);
+    pthread_cond_destroy(&sink->written);
+    free(sink);
+}
+
+static bool reserveIndex(ImageSink *sink, size_t capacity);
+static bool addToIndex(ImageSink *sink, uint32_t cell, uint64_t offset, size_t length);
+
+// -------------------------------------------------------------------------------------------
+
+// Pick up a reel that was cut short: keep the records before dataEnd, indexed again from their headers,
+// and drop everything after them. The header goes back to saying the reel isn't finished.
+static int reopenReel(ImageSink *sink, uint64_t dataEnd)
+{
+    const ReelFileHeader *header;
+    const ReelRecordHeader *record;
+    uint64_t offset = REEL_ALIGNMENT;
+    void *block;
+    int result = -1;
+
+    if (posix_memalign(&block, REEL_ALIGNMENT, REEL_ALIGNMENT) != 0)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Block sized reads, since the file may be open for direct I/O
+    header = block;
+    if (pread(sink->fileDescriptor, block, REEL_ALIGNMENT, 0) != REEL_ALIGNMENT ||
+        memcmp(header->magic, REEL_MAGIC, sizeof(header->magic)) != 0 || header->version != REEL_VERSION ||
+        header->alignment != REEL_ALIGNMENT || dataEnd < REEL_ALIGNMENT || dataEnd % REEL_ALIGNMENT != 0)
+    {
+        errno = EINVAL;
+        goto done;
+    }
+    sink->wallClockSeconds = header->wallClockSeconds;
+
+    record = block;
+    while (offset < dataEnd)
+    {
+        if (pread(sink->fileDescriptor, block, REEL_ALIGNMENT, (off_t)offset) != REEL_ALIGNMENT ||
+            memcmp(record->magic, REEL_RECORD_MAGIC, sizeof(record->magic)) != 0 ||
+            offset + aligned(sizeof(ReelRecordHeader) + (size_t)record->length) > dataEnd)
+        {
+            errno = EINVAL;
+            goto done;
+        }
+
+        if (!addToIndex(sink, record->cell, offset, (size_t)record->length))
+        {
+            errno = ENOMEM;
+            goto done;
+        }
+        offset += aligned(sizeof(ReelRecordHeader) + (size_t)record->length);
+    }
+
+    if (ftruncate(sink->fileDescriptor, (off_t)dataEnd) == -1)
+    {
+        goto done;
+    }
+
+    sink->nextOffset = dataEnd;
+    result = writeHeader(sink, 0, 0);
+
+done:
+    free(block);
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static ImageSink *openSink(const char *path, const ImageSinkConfig *config, bool resume, uint64_t dataEnd)
+{
+    ImageSink *sink = calloc(1, sizeof(ImageSink));
+    void *memory;
+    int result;
+    int error;
+
+    if (sink == NULL)
+    {
+        return NULL;
+    }
+
+    sink->config = *config;
+    if (sink->config.bufferCount == 0)
+    {
+        sink->config.bufferCount = 1;
+    }
+    if (sink->config.writerThreads == 0 || sink->config.writerThreads > IMAGE_SINK_MAX_WRITERS)
+    {
+        sink->config.writerThreads = sink->config.writerThreads ? IMAGE_SINK_MAX_WRITERS : 1;
+    }
+    if (sink->config.maxBatch == 0 || sink->config.maxBatch > IMAGE_SINK_MAX_BATCH)
+    {
+        sink->config.maxBatch = sink->config.maxBatch ? IMAGE_SINK_MAX_BATCH : 1;
+    }
+    if (sink->config.sync == ImageSyncEveryN && sink->config.syncInterval == 0)
+    {
+        sink->config.syncInterval = 1;
+    }
+
+    pthread_mutex_init(&sink->lock, NULL);
+    pthread_cond_init(&sink->queued, NULL);
+    pthread_cond_init(&sink->written, NULL);
+    sink->fileDescriptor = -1;
+
+    // All the memory the sink needs, up front
+    sink->bufferSize = aligned(sizeof(ReelRecordHeader) + sink->config.bufferBytes);
+    sink->buffers = calloc(sink->config.bufferCount, sizeof(WriteBuffer));
+    sink->freeBuffers = calloc(sink->config.bufferCount, sizeof(size_t));
+    sink->queue = calloc(sink->config.bufferCount, sizeof(size_t));
+    if (sink->buffers == NULL || sink->freeBuffers == NULL || sink->queue == NULL)
+    {
+        freeSink(sink);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    for (size_t i = 0; i < sink->config.bufferCount; i++)
+    {
+        if (posix_memalign(&memory, REEL_ALIGNMENT, sink->bufferSize) != 0)
+        {
+            freeSink(sink);
+            errno = ENOMEM;
+            return NULL;
+        }
+        sink->buffers[i].memory = memory;
+        sink->freeBuffers[sink->freeCount++] = i;
+    }
+
+    // So a long reel doesn't grow the index, copying all of it, while it's being scanned
+    if (sink->config.expectedFrames > 0 && !reserveIndex(sink, sink->config.expectedFrames))
+    {
+        freeSink(sink);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    sink->fileDescriptor = openReel(sink, path, resume);
+    if (sink->fileDescriptor == -1)
+    {
+        error = errno;
+        freeSink(sink);
+        errno = error;
+        return NULL;
+    }
+
+    // With the header written straight away, a reel cut short can still be read
+    sink->startedAt = monotonicNanos();
+    if (resume)
+    {
+        if (reopenReel(sink, dataEnd) == -1)
+        {
+            // Leave the reel as it was, it may still be worth looking at
+            error = errno;
+            close(sink->fileDescriptor);
+            freeSink(sink);
+            errno = error;
+            return NULL;
+        }
+    }
+    else
+    {
+        sink->wallClockSeconds = (uint64_t)time(NULL);
+        sink->nextOffset = REEL_ALIGNMENT;
+        if (writeHeader(sink, 0, 0) == -1)
+        {
+            goto failed;
+        }
+    }
+
+    for (unsigned int i = 0; i < sink->config.writerThreads; i++)
+    {
+        result = pthread_create(&sink->threads[i], NULL, writerThread, sink);
+        if (result != 0)
+        {
+            errno = result;
+            goto failed;
+        }
+        sink->threadCount++;
+    }
+
+    return sink;
+
+failed:
+    // Recorded as a failed write, so closing doesn't try to finish the reel
+    error = errno;
+    sink->stats.error = error;
+    imageSinkClose(sink);
+    if (!resume)
+    {
+        unlink(path);
+    }
+    errno = error;
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+ImageSink *imageSinkOpen(const char *path, const ImageSinkConfig *config)
+{
+    return openSink(path, config, false, 0);
+}
+
+// -------------------------------------------------------------------------------------------
+
+ImageSink *imageSinkResume(const char *path, const ImageSinkConfig *config, uint64_t dataEnd)
+{
+    return openSink(path, config, true, dataEnd);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Make room in the index for capacity records
+static bool reserveIndex(ImageSink *sink, size_t capacity)
+{
+    ReelIndexEntry *index = realloc(sink->index, capacity * sizeof(ReelIndexEntry));
+
+    if (index == NULL)
+    {
+        return false;
+    }
+
+    sink->index = index;
+    sink->indexCapacity = capacity;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Remember where the record went, for the index. Called with the lock held.
+static bool addToIndex(ImageSink *sink, uint32_t cell, uint64_t offset, size_t length)
+{
+    if (sink->indexCount == sink->indexCapacity &&
+        !reserveIndex(sink, sink->indexCapacity ? sink->indexCapacity * 2 : 1024))
+    {
+        return false;
+    }
+
+    sink->index[sink->indexCount].cell = cell;
+    sink->index[sink->indexCount].reserved = 0;
+    sink->index[sink->indexCount].offset = offset;
+    sink->index[sink->indexCount].length = length;
+    sink->indexCount++;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool imageSinkSubmit(ImageSink *sink, uint32_t cell, const void *data, size_t length, uint64_t *offset)
+{
+    ReelRecordHeader *header;
+    WriteBuffer *buffer;
+    size_t slot;
+    size_t recordLength = sizeof(ReelRecordHeader) + length;
+    uint64_t waitStarted;
+
+    if (length > sink->config.bufferBytes)
+    {
+        errno = EMSGSIZE;
+        return false;
+    }
+
+    pthread_mutex_lock(&sink->lock);
+
+    // Every buffer is still waiting for the disk. Hold up the scan until one is free.
+    if (sink->freeCount == 0 && sink->stats.error == 0)
+    {
+        waitStarted = monotonicNanos();
+        while (sink->freeCount == 0 && sink->stats.error == 0)
+        {
+            pthread_cond_wait(&sink->written, &sink->lock);
+        }
+        sink->stats.backPressureNanos += monotonicNanos() - waitStarted;
+        sink->stats.backPressureWaits++;
+    }
+
+    if (sink->stats.error != 0)
+    {
+        errno = sink->stats.error;
+        pthread_mutex_unlock(&sink->lock);
+        return false;
+    }
+
+    if (!addToIndex(sink, cell, sink->nextOffset, length))
+    {
+        pthread_mutex_unlock(&sink->lock);
+        errno = ENOMEM;
+        return false;
+    }
+
+    slot = sink->freeBuffers[--sink->freeCount];
+    buffer = &sink->buffers[slot];
+    buffer->offset = sink->nextOffset;
+    if (offset)
+    {
+        *offset = buffer->offset;
+    }
+    buffer->length = aligned(recordLength);
+    sink->nextOffset += buffer->length;
+    pthread_mutex_unlock(&sink->lock);
+
+    // The copy is done without the lock, so writers and other submitters carry on meanwhile
+    header = (ReelRecordHeader *)buffer->memory;
+    memset(header, 0, sizeof(ReelRecordHeader));
+    memcpy(header->magic, REEL_RECORD_MAGIC, sizeof(header->magic));
+    header->cell = cell;
+    header->length = length;
+    header->offsetNanos = monotonicNanos() - sink->startedAt;
+    memcpy(&header[1], data, length);
+    memset(buffer->memory + recordLength, 0, buffer->length - recordLength);
+
+    pthread_mutex_lock(&sink->lock);
+    sink->queue[(sink->queueHead + sink->queueCount) % sink->config.bufferCount] = slot;
+    sink->queueCount++;
+    if (sink->queueCount + sink->writing > sink->stats.mostQueued)
+    {
+        sink->stats.mostQueued = sink->queueCount + sink->writing;
+    }
+    pthread_cond_signal(&sink->queued);
+    pthread_mutex_unlock(&sink->lock);
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool imageSinkFlush(ImageSink *sink)
+{
+    int error;
+
+    pthread_mutex_lock(&sink->lock);
+    while (sink->freeCount < sink->config.bufferCount)
+    {
+        pthread_cond_wait(&sink->written, &sink->lock);
+    }
+    error = sink->stats.error;
+    pthread_mutex_unlock(&sink->lock);
+
+    if (error != 0)
+    {
+        errno = error;
+        return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void imageSinkGetStats(ImageSink *sink, ImageSinkStats *stats)
+{
+    pthread_mutex_lock(&sink->lock);
+    *stats = sink->stats;
+    pthread_mutex_unlock(&sink->lock);
+}
+
+// -------------------------------------------------------------------------------------------
+
+int imageSinkClose(ImageSink *sink)
+{
+    uint64_t indexOffset;
+    int result = 0;
+    int error = 0;
+
+    if (sink == NULL)
+    {
+        return 0;
+    }
+
+    // The writers finish the queue before they stop
+    pthread_mutex_lock(&sink->lock);
+    sink->closing = true;
+    pthread_cond_broadcast(&sink->queued);
+    pthread_mutex_unlock(&sink->lock);
+
+    for (unsigned int i = 0; i < sink->threadCount; i++)
+    {
+        pthread_join(sink->threads[i], NULL);
+    }
+
+    if (sink->stats.error != 0)
+    {
+        error = sink->stats.error;
+        result = -1;
+    }
+    else if (sink->fileDescriptor != -1)
+    {
+        indexOffset = sink->nextOffset;
+        if ((sink->indexCount > 0 &&
+             writeBlock(sink, sink->index, sink->indexCount * sizeof(ReelIndexEntry), indexOffset) == -1) ||
+            writeHeader(sink, sink->indexCount, indexOffset) == -1 || syncFile(sink->fileDescriptor) == -1)
+        {
+            error = errno;
+            result = -1;
+        }
+    }
+
+    if (sink->fileDescriptor != -1)
+    {
+        close(sink->fileDescriptor);
+    }
+
+    freeSink(sink);
+    errno = error;
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool reelFileOpen(ReelFile *file, const char *path)
+{
+    struct stat info;
+    int fileDescriptor;
+    void *base;
+    const ReelFileHeader *header;
+
+    memset(file, 0, sizeof(ReelFile));
+
+    fileDescriptor = open(path, O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor == -1)
+    {
+        return false;
+    }
+
+    if (fstat(fileDescriptor, &info) == -1)
+    {
+        close(fileDescriptor);
+        return false;
+    }
+
+    if ((size_t)info.st_size < REEL_ALIGNMENT)
+    {
+        close(fileDescriptor);
+        errno = EINVAL;
+        return false;
+    }
+
+    base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    close(fileDescriptor);
+    if (base == MAP_FAILED)
+    {
+        return false;
+    }
+
+    file->base = base;
+    file->mappedLength = (size_t)info.st_size;
+    file->header = header = base;
+
+    if (memcmp(header->magic, REEL_MAGIC, sizeof(header->magic)) != 0 || header->version != REEL_VERSION ||
+        header->alignment != REEL_ALIGNMENT)
+    {
+        reelFileClose(file);
+        errno = EINVAL;
+        return false;
+    }
+
+    // A reel that was never closed has no index, its records are all there is
+    if (header->indexOffset != 0 &&
+        header->indexOffset + header->frames * sizeof(ReelIndexEntry) <= file->mappedLength)
+    {
+        file->index = (const ReelIndexEntry *)&file->base[header->indexOffset];
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void reelFileClose(ReelFile *file)
+{
+    if (file->base)
+    {
+        munmap((void *)file->base, file->mappedLength);
+    }
+
+    memset(file, 0, sizeof(ReelFile));
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool reelFileNext(const ReelFile *file, size_t *position, ReelFrame *frame)
+{
+    size_t offset = REEL_ALIGNMENT + *position;
+    size_t end = file->index ? file->header->indexOffset : file->mappedLength;
+    const ReelRecordHeader *header;
+
+    if (offset + sizeof(ReelRecordHeader) > end)
+    {
+        return false;
+    }
+
+    // Past the last record that made it to disk, the file is zeros
+    header = (const ReelRecordHeader *)&file->base[offset];
+    if (memcmp(header->magic, REEL_RECORD_MAGIC, sizeof(header->magic)) != 0 ||
+        header->length > end - offset - sizeof(ReelRecordHeader))
+    {
+        return false;
+    }
+
+    frame->cell = header->cell;
+    frame->offsetNanos = header->offsetNanos;
+    frame->data = (const uint8_t *)&header[1];
+    frame->length = (size_t)header->length;
+
+    *position += aligned(sizeof(ReelRecordHeader) + (size_t)header->length);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
@@ -0,0 +1,153 @@
+//
+//  ImageSink.h
+//  Writes the scanned frames of a reel to disk on a pool of writer threads, into one container file
+//  per reel, without holding up the film transport
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Submitting a frame copies it into one of a fixed number of write buffers and returns; the writer
+//  threads do the rest. Each frame gets its place in the file when it's submitted, so the file is
+//  written front to back however many writers there are, and a writer that finds several frames waiting
+//  writes them with a single pwritev. When every buffer is waiting to be written, submitting blocks until
+//  one has been, so a disk that falls behind slows the scan down rather than using up memory.
+//
+//  The file is a ReelFileHeader padded to REEL_ALIGNMENT, followed by a record for every frame: a
+//  ReelRecordHeader and the frame's bytes, padded to REEL_ALIGNMENT. Keeping everything aligned lets the
+//  writes bypass the page cache (O_DIRECT on Linux, F_NOCACHE on macOS), which is where scans of this size
+//  would otherwise end up. Closing the sink appends an index of the records and fills in the header;
+//  a reel cut short by a crash can still be read record by record.
+//
+//  All values are in host byte order.
+//
+
+#ifndef ImageSink_h
+#define ImageSink_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define REEL_MAGIC              "SCANREEL"
+#define REEL_RECORD_MAGIC       "CELL"
+#define REEL_VERSION            1
+#define REEL_ALIGNMENT          4096    // records and the index start at multiples of this
+#define IMAGE_SINK_MAX_WRITERS  8
+#define IMAGE_SINK_MAX_BATCH    16
+
+// When the frames written are made durable with fsync (F_FULLFSYNC on macOS)
+typedef enum
+{
+    ImageSyncEveryFrame,        // before a frame's buffer is used again
+    ImageSyncEveryN,            // after every syncInterval frames
+    ImageSyncAtEnd              // only when the reel is closed
+} ImageSyncPolicy;
+
+typedef struct
+{
+    char magic[8];              // REEL_MAGIC, not NUL terminated
+    uint32_t version;
+    uint32_t alignment;         // REEL_ALIGNMENT when written
+    uint64_t wallClockSeconds;  // time() when the reel was opened
+    uint64_t frames;            // 0 until the reel is closed
+    uint64_t indexOffset;       // where the index starts, 0 until the reel is closed
+    uint64_t dataLength;        // bytes of records, i.e. where the index starts less the header
+    uint8_t reserved[16];
+} ReelFileHeader;
+
+typedef struct
+{
+    char magic[4];              // REEL_RECORD_MAGIC
+    uint32_t cell;
+    uint64_t length;            // bytes of the frame following the header
+    uint64_t offsetNanos;       // when it was submitted, since the reel was opened
+    uint8_t reserved[8];
+} ReelRecordHeader;
+
+typedef struct
+{
+    uint32_t cell;
+    uint32_t reserved;
+    uint64_t offset;            // of the record header
+    uint64_t length;            // of the frame
+} ReelIndexEntry;
+
+typedef struct
+{
+    size_t bufferCount;         // frames that can be waiting to be written
+    size_t bufferBytes;         // largest frame that can be submitted
+    unsigned int writerThreads; // up to IMAGE_SINK_MAX_WRITERS
+    unsigned int maxBatch;      // most frames written with one pwritev, up to IMAGE_SINK_MAX_BATCH
+    ImageSyncPolicy sync;
+    unsigned int syncInterval;  // frames between syncs with ImageSyncEveryN
+    bool directIO;              // bypass the page cache where the file system allows
+    size_t expectedFrames;      // the index is allocated for this many up front and only grows past it, 0 for none
+} ImageSinkConfig;
+
+typedef struct
+{
+    uint64_t frames;            // written
+    uint64_t bytes;             // of frames written, not counting headers and padding
+    uint64_t batches;           // pwritev calls
+    uint64_t syncs;
+    uint64_t busyNanos;         // writer time spent writing and syncing
+    uint64_t backPressureNanos; // time submitters waited for a free buffer
+    uint64_t backPressureWaits; // times they had to
+    size_t mostQueued;          // most frames waiting to be written at once
+    bool directIO;              // whether the page cache is actually bypassed
+    int error;                  // errno of the first write that failed, 0 if none did
+} ImageSinkStats;
+
+typedef struct ImageSink ImageSink;
+
+// 4 buffers of 32 MB, 2 writers, batches of up to 8, sync at the end, direct I/O
+void imageSinkDefaultConfig(ImageSinkConfig *config);
+
+// Create (or truncate) the reel file and allocate the buffers. Returns NULL on error (errno is set).
+ImageSink *imageSinkOpen(const char *path, const ImageSinkConfig *config);
+
+// Carry on with a reel that was cut short. The records before dataEnd (a record boundary) are kept and
+// indexed again, anything after them is dropped, and new frames go after them. Returns NULL on error
+// (errno is set, EINVAL if the records don't line up with dataEnd), leaving the file as it was.
+ImageSink *imageSinkResume(const char *path, const ImageSinkConfig *config, uint64_t dataEnd);
+
+// Queue a frame to be written, waiting for a free buffer if they're all in use. Where its record goes in
+// the file is put in offset, if given. Returns false without queueing it if a write has failed (errno is
+// set, see ImageSinkStats.error) or the frame is too large (EMSGSIZE). Safe to call from several threads,
+// the frames are written in the order they were submitted.
+bool imageSinkSubmit(ImageSink *sink, uint32_t cell, const void *data, size_t length, uint64_t *offset);
+
+// Wait until every frame submitted so far is written (and synced, if the policy says so)
+bool imageSinkFlush(ImageSink *sink);
+
+void imageSinkGetStats(ImageSink *sink, ImageSinkStats *stats);
+
+// Write out what's left, add the index, fill in the header, sync and free the sink. Returns 0, or -1 if
+// anything failed to be written (errno is set). Nobody may be submitting any more.
+int imageSinkClose(ImageSink *sink);
+
+// Reader. Maps a closed (or crashed) reel read-only.
+typedef struct
+{
+    const uint8_t *base;
+    size_t mappedLength;
+    const ReelFileHeader *header;
+    const ReelIndexEntry *index;    // NULL if the reel was never closed
+} ReelFile;
+
+typedef struct
+{
+    uint32_t cell;
+    uint64_t offsetNanos;
+    const uint8_t *data;            // points into the mapping
+    size_t length;
+} ReelFrame;
+
+// Returns false if the file can't be mapped or isn't a reel (errno is set, EINVAL for a bad header)
+bool reelFileOpen(ReelFile *file, const char *path);
+void reelFileClose(ReelFile *file);
+
+// Step through the frames. Start with *position set to 0. Returns false after the last one.
+bool reelFileNext(const ReelFile *file, size_t *position, ReelFrame *frame);
+
+#endif /* ImageSink_h */
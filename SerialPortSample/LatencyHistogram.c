@@ -0,0 +1,146 @@
+//
+//  LatencyHistogram.c
+//  Records latencies in a fixed amount of memory, precise enough to read off percentiles
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <string.h>
+
+#include "LatencyHistogram.h"
+
+#define SUB_BUCKETS     (1u << LATENCY_SUB_BUCKET_BITS)
+#define LARGEST_VALUE   ((1ULL << LATENCY_MAX_BITS) - 1)
+
+// -------------------------------------------------------------------------------------------
+
+// Values below SUB_BUCKETS get a bucket each. Above that, the top LATENCY_SUB_BUCKET_BITS + 1 bits of the
+// value pick the bucket within its power of two.
+static unsigned int bucketIndex(uint64_t value)
+{
+    unsigned int shift;
+
+    if (value > LARGEST_VALUE)
+    {
+        value = LARGEST_VALUE;
+    }
+
+    if (value < SUB_BUCKETS)
+    {
+        return (unsigned int)value;
+    }
+
+    shift = (unsigned int)(63 - __builtin_clzll(value)) - LATENCY_SUB_BUCKET_BITS;
+    return ((shift + 1) << LATENCY_SUB_BUCKET_BITS) + (unsigned int)((value >> shift) - SUB_BUCKETS);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Highest value that lands in the bucket
+static uint64_t bucketTop(unsigned int index)
+{
+    unsigned int shift;
+
+    if (index < SUB_BUCKETS)
+    {
+        return index;
+    }
+
+    shift = (index >> LATENCY_SUB_BUCKET_BITS) - 1;
+    return ((uint64_t)((index & (SUB_BUCKETS - 1)) + SUB_BUCKETS + 1) << shift) - 1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void latencyHistogramReset(LatencyHistogram *histogram)
+{
+    memset(histogram, 0, sizeof(LatencyHistogram));
+    histogram->min = UINT64_MAX;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void latencyHistogramRecord(LatencyHistogram *histogram, uint64_t nanos)
+{
+    histogram->buckets[bucketIndex(nanos)]++;
+    histogram->count++;
+    histogram->total += nanos;
+
+    if (nanos < histogram->min)
+    {
+        histogram->min = nanos;
+    }
+    if (nanos > histogram->max)
+    {
+        histogram->max = nanos;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+void latencyHistogramMerge(LatencyHistogram *into, const LatencyHistogram *from)
+{
+    for (unsigned int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        into->buckets[i] += from->buckets[i];
+    }
+
+    into->count += from->count;
+    into->total += from->total;
+    if (from->min < into->min)
+    {
+        into->min = from->min;
+    }
+    if (from->max > into->max)
+    {
+        into->max = from->max;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+uint64_t latencyHistogramPercentile(const LatencyHistogram *histogram, double percentile)
+{
+    uint64_t wanted;
+    uint64_t seen = 0;
+    uint64_t value;
+
+    if (histogram->count == 0)
+    {
+        return 0;
+    }
+
+    if (percentile <= 0)
+    {
+        return histogram->min;
+    }
+
+    wanted = (uint64_t)(percentile / 100.0 * (double)histogram->count + 0.5);
+    if (wanted < 1)
+    {
+        wanted = 1;
+    }
+
+    for (unsigned int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= wanted)
+        {
+            // The bucket's top can't be more than was actually recorded
+            value = bucketTop(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+// -------------------------------------------------------------------------------------------
+
+double latencyHistogramMean(const LatencyHistogram *histogram)
+{
+    return histogram->count ? (double)histogram->total / (double)histogram->count : 0.0;
+}
+
+// -------------------------------------------------------------------------------------------
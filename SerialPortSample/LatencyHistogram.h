@@ -0,0 +1,46 @@
+//
+//  LatencyHistogram.h
+//  Records latencies in a fixed amount of memory, precise enough to read off percentiles
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Buckets are laid out the way HdrHistogram does it: every power of two is split into 2^LATENCY_SUB_BUCKET_BITS
+//  equal buckets, so a value is always known to within about 3% whether it's microseconds or minutes.
+//  Recording is an index calculation and an increment, cheap enough for every command. Values are
+//  nanoseconds; anything beyond 2^LATENCY_MAX_BITS lands in the top bucket, min and max stay exact.
+//
+//  A histogram belongs to one thread. To look at it from another, take a copy on the owner's thread.
+//
+
+#ifndef LatencyHistogram_h
+#define LatencyHistogram_h
+
+#include <stdint.h>
+
+#define LATENCY_SUB_BUCKET_BITS 5       // 32 buckets per power of two
+#define LATENCY_MAX_BITS        40      // about 18 minutes
+#define LATENCY_BUCKETS         ((LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) << LATENCY_SUB_BUCKET_BITS)
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t total;             // of all values, for the mean
+    uint64_t min;               // UINT64_MAX while empty
+    uint64_t max;
+    uint32_t buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+void latencyHistogramReset(LatencyHistogram *histogram);
+void latencyHistogramRecord(LatencyHistogram *histogram, uint64_t nanos);
+
+// Add everything recorded in one histogram to another
+void latencyHistogramMerge(LatencyHistogram *into, const LatencyHistogram *from);
+
+// The value that percentile (0 to 100) of the recorded values are at or below, as the top of its bucket.
+// 0 if nothing was recorded.
+uint64_t latencyHistogramPercentile(const LatencyHistogram *histogram, double percentile);
+
+double latencyHistogramMean(const LatencyHistogram *histogram);
+
+#endif /* LatencyHistogram_h */
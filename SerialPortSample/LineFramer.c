@@ -0,0 +1,195 @@
+//
+//  LineFramer.c
+//  Fixed-capacity receive buffer that read() writes into directly, split into NewLine-terminated lines
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "LineFramer.h"
+
+// -------------------------------------------------------------------------------------------
+
+void lineFramerInit(LineFramer *framer)
+{
+    lineFramerReset(framer);
+    framer->discarded = 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void lineFramerReset(LineFramer *framer)
+{
+    framer->head = 0;
+    framer->tail = 0;
+    framer->lineCount = 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Bytes are appended at the tail until it reaches the end of the storage. Only then do we move the
+// unconsumed bytes (at most one partial line once the caller has taken the complete ones) back to the
+// front. Lines themselves are never copied.
+char *lineFramerWritePointer(LineFramer *framer, size_t *space)
+{
+    if (framer->head == framer->tail)
+    {
+        // Nothing buffered, start again at the front
+        framer->head = 0;
+        framer->tail = 0;
+    }
+    else if (framer->tail == LINE_FRAMER_CAPACITY)
+    {
+        if (framer->head > 0)
+        {
+            memmove(framer->storage, &framer->storage[framer->head], framer->tail - framer->head);
+            framer->tail -= framer->head;
+            framer->head = 0;
+        }
+        else if (framer->lineCount == 0)
+        {
+            // The whole storage is a single line without a NewLine. This isn't something the Arduino
+            // sends, so throw it away rather than stall forever.
+            framer->discarded += framer->tail;
+            framer->tail = 0;
+        }
+    }
+
+    *space = LINE_FRAMER_CAPACITY - framer->tail;
+    return &framer->storage[framer->tail];
+}
+
+// -------------------------------------------------------------------------------------------
+
+void lineFramerCommit(LineFramer *framer, size_t count)
+{
+    const char *next = &framer->storage[framer->tail];
+    const char *end = next + count;
+
+    // Count the NewLines as they come in so lineFramerNext never has to search a partial line twice
+    while ((next = memchr(next, '\n', end - next)) != NULL)
+    {
+        framer->lineCount++;
+        next++;
+    }
+
+    framer->tail += count;
+}
+
+// -------------------------------------------------------------------------------------------
+
+ssize_t lineFramerReadFrom(LineFramer *framer, int fileDescriptor)
+{
+    size_t space;
+    char *writePointer = lineFramerWritePointer(framer, &space);
+    ssize_t numBytes;
+
+    if (space == 0)
+    {
+        // Full of complete lines that haven't been taken yet
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    numBytes = read(fileDescriptor, writePointer, space);
+    if (numBytes > 0)
+    {
+        lineFramerCommit(framer, (size_t)numBytes);
+    }
+
+    return numBytes;
+}
+
+// -------------------------------------------------------------------------------------------
+
+const char *lineFramerLatest(const LineFramer *framer, size_t count)
+{
+    return &framer->storage[framer->tail - (count < framer->tail ? count : framer->tail)];
+}
+
+// -------------------------------------------------------------------------------------------
+
+size_t lineFramerAppend(LineFramer *framer, const char *data, size_t length)
+{
+    size_t taken = 0;
+    size_t space;
+    size_t count;
+    char *writePointer;
+
+    while (taken < length)
+    {
+        writePointer = lineFramerWritePointer(framer, &space);
+        if (space == 0)
+        {
+            break;
+        }
+
+        count = (length - taken < space) ? length - taken : space;
+        memcpy(writePointer, &data[taken], count);
+        lineFramerCommit(framer, count);
+        taken += count;
+    }
+
+    return taken;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool lineFramerNext(LineFramer *framer, LineView *line)
+{
+    char *start;
+    char *newLine;
+
+    if (framer->lineCount == 0)
+    {
+        return false;
+    }
+
+    start = &framer->storage[framer->head];
+    newLine = memchr(start, '\n', framer->tail - framer->head);
+
+    framer->head += newLine - start + 1;
+    framer->lineCount--;
+
+    *newLine = '\0';
+    if (newLine > start && *(newLine - 1) == '\r')
+    {
+        newLine--;
+        *newLine = '\0';
+    }
+
+    line->data = start;
+    line->length = newLine - start;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+size_t lineFramerTakePending(LineFramer *framer, const char **data)
+{
+    size_t length = framer->tail - framer->head;
+
+    *data = &framer->storage[framer->head];
+    lineFramerReset(framer);
+    return length;
+}
+
+// -------------------------------------------------------------------------------------------
+
+size_t lineFramerLineCount(const LineFramer *framer)
+{
+    return framer->lineCount;
+}
+
+// -------------------------------------------------------------------------------------------
+
+size_t lineFramerPending(const LineFramer *framer)
+{
+    return framer->tail - framer->head;
+}
+
+// -------------------------------------------------------------------------------------------
@@ -0,0 +1,74 @@
+//
+//  LineFramer.h
+//  Fixed-capacity receive buffer that read() writes into directly, split into NewLine-terminated lines
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Plain C with no Foundation dependency, so it can be built and benchmarked on Linux too.
+//
+
+#ifndef LineFramer_h
+#define LineFramer_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// The longest line we can hold. Anything longer than this is discarded.
+#define LINE_FRAMER_CAPACITY    4096
+
+// A complete line inside the framer's storage. Nothing is copied: the NewLine (and a '\r' in front of
+// it) is overwritten with a NUL in place, so data can also be used as a C string. The view stays valid
+// until the next call that adds data to the framer.
+typedef struct
+{
+    const char *data;
+    size_t length;          // not including the NewLine
+} LineView;
+
+typedef struct
+{
+    char storage[LINE_FRAMER_CAPACITY];
+    size_t head;            // first byte not yet handed out as a line
+    size_t tail;            // one past the last byte received
+    size_t lineCount;       // complete lines between head and tail
+    uint64_t discarded;     // bytes thrown away because a line didn't fit
+} LineFramer;
+
+void lineFramerInit(LineFramer *framer);
+
+// Drop everything, including partial lines
+void lineFramerReset(LineFramer *framer);
+
+// Free space that read() can write into directly. Pass the number of bytes written to lineFramerCommit.
+// This may move a partial line to the front of the storage, which invalidates earlier LineViews.
+char *lineFramerWritePointer(LineFramer *framer, size_t *space);
+void lineFramerCommit(LineFramer *framer, size_t count);
+
+// Do a single read() from the file descriptor straight into the framer. Returns what read() returned.
+ssize_t lineFramerReadFrom(LineFramer *framer, int fileDescriptor);
+
+// The last count bytes that came in, e.g. what lineFramerReadFrom just read. Only valid until the next
+// call to lineFramerNext, which terminates lines in place.
+const char *lineFramerLatest(const LineFramer *framer, size_t count);
+
+// Copy bytes into the framer. Used when the data doesn't come from a file descriptor. Returns the number
+// of bytes taken, which is only less than length if an overlong line had to be discarded.
+size_t lineFramerAppend(LineFramer *framer, const char *data, size_t length);
+
+// Hand out the next complete line. Returns false if only a partial line (or nothing) is buffered.
+bool lineFramerNext(LineFramer *framer, LineView *line);
+
+// Hand over everything still buffered (complete lines and any partial line) as raw bytes and empty the
+// framer. Used when the link switches to the binary protocol part way through a read.
+size_t lineFramerTakePending(LineFramer *framer, const char **data);
+
+// Number of complete lines waiting to be handed out
+size_t lineFramerLineCount(const LineFramer *framer);
+
+// Number of buffered bytes, including any partial line
+size_t lineFramerPending(const LineFramer *framer);
+
+#endif /* LineFramer_h */
@@ -0,0 +1,229 @@
+//
+//  LinkDecoder.c
+//  Turns the bytes received from the Arduino into parsed responses, in whichever protocol the link is
+//  speaking at the time
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <string.h>
+#include <unistd.h>
+
+#include "LinkDecoder.h"
+
+enum
+{
+    SwitchNone,
+    SwitchToBinary,
+    SwitchToText
+};
+
+static void decodeFrames(LinkDecoder *link);
+static void feedBinary(LinkDecoder *link, const uint8_t *data, size_t length);
+
+// -------------------------------------------------------------------------------------------
+
+void linkDecoderInit(LinkDecoder *link, LinkResponseHandler handler, LinkTrafficTap tap, void *context)
+{
+    lineFramerInit(&link->framer);
+    binaryDecoderInit(&link->decoder);
+    link->handler = handler;
+    link->tap = tap;
+    link->context = context;
+    atomic_init(&link->pendingSwitch, SwitchNone);
+    atomic_init(&link->binary, false);
+    atomic_init(&link->linesFramed, 0);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// True if a switch of this kind was armed. Disarms it.
+static bool takeSwitch(LinkDecoder *link, int kind)
+{
+    int expected = kind;
+
+    return atomic_compare_exchange_strong(&link->pendingSwitch, &expected, SwitchNone);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Hand every complete line to the handler
+static void decodeLines(LinkDecoder *link)
+{
+    LineView line;
+    ParsedResponse parsed;
+    uint8_t pending[LINE_FRAMER_CAPACITY];
+    const char *rest;
+    size_t restLength;
+
+    while (lineFramerNext(&link->framer, &line))
+    {
+        atomic_fetch_add_explicit(&link->linesFramed, 1, memory_order_relaxed);
+        parseResponse(line.data, line.length, &parsed);
+        link->handler(link->context, &parsed, 0);
+
+        if (parsed.response == Ok && takeSwitch(link, SwitchToBinary))
+        {
+            // Everything after this OK is already binary. It can be more than the decoder holds, so it's fed in
+            // the way a read is. It's copied out first: the framer is empty now, and if the link switches back to
+            // text part way through, the rest goes back into it.
+            atomic_store(&link->binary, true);
+            restLength = lineFramerTakePending(&link->framer, &rest);
+            memcpy(pending, rest, restLength);
+            feedBinary(link, pending, restLength);
+            return;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Hand every complete frame to the handler
+static void decodeFrames(LinkDecoder *link)
+{
+    BinaryFrame frame;
+    ParsedResponse parsed;
+    const uint8_t *rest;
+    size_t restLength;
+
+    while (binaryDecoderNext(&link->decoder, &frame))
+    {
+        if (frame.opcode == OpError)
+        {
+            parseBinaryError(frame.payload, frame.length, &parsed);
+        }
+        else
+        {
+            parsed.response = binaryResponseForOpcode(frame.opcode);
+            parsed.errorCode = NO_ERROR_CODE;
+            parsed.text = (const char *)frame.payload;
+            parsed.textLength = frame.length;
+        }
+        link->handler(link->context, &parsed, frame.sequence);
+
+        if (frame.opcode == OpOk && takeSwitch(link, SwitchToText))
+        {
+            atomic_store(&link->binary, false);
+            restLength = binaryDecoderTakePending(&link->decoder, &rest);
+            lineFramerAppend(&link->framer, (const char *)rest, restLength);
+            decodeLines(link);
+            return;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The decoder buffer holds two frames, so whatever doesn't fit is fed in again after the complete frames
+// have been taken out. The link may switch back to text part way through.
+static void feedBinary(LinkDecoder *link, const uint8_t *data, size_t length)
+{
+    size_t taken = 0;
+
+    while (taken < length)
+    {
+        taken += binaryDecoderFeed(&link->decoder, &data[taken], length - taken);
+        decodeFrames(link);
+
+        if (!atomic_load_explicit(&link->binary, memory_order_relaxed))
+        {
+            lineFramerAppend(&link->framer, (const char *)&data[taken], length - taken);
+            decodeLines(link);
+            break;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+ssize_t linkDecoderReadFrom(LinkDecoder *link, int fileDescriptor)
+{
+    uint8_t data[BINARY_MAX_FRAME];
+    ssize_t numBytes;
+
+    if (atomic_load_explicit(&link->binary, memory_order_relaxed))
+    {
+        numBytes = read(fileDescriptor, data, sizeof(data));
+        if (numBytes > 0)
+        {
+            if (link->tap)
+            {
+                link->tap(link->context, data, (size_t)numBytes);
+            }
+            feedBinary(link, data, (size_t)numBytes);
+        }
+    }
+    else
+    {
+        numBytes = lineFramerReadFrom(&link->framer, fileDescriptor);
+        if (numBytes > 0)
+        {
+            if (link->tap)
+            {
+                link->tap(link->context, lineFramerLatest(&link->framer, (size_t)numBytes), (size_t)numBytes);
+            }
+            decodeLines(link);
+        }
+    }
+
+    return numBytes;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void linkDecoderFeed(LinkDecoder *link, const void *data, size_t length)
+{
+    const char *bytes = data;
+    size_t taken;
+
+    if (link->tap && length > 0)
+    {
+        link->tap(link->context, data, length);
+    }
+
+    while (length > 0)
+    {
+        if (atomic_load_explicit(&link->binary, memory_order_relaxed))
+        {
+            feedBinary(link, (const uint8_t *)bytes, length);
+            return;
+        }
+
+        // Take lines out as they come, so more than the framer holds can be fed in one go
+        taken = lineFramerAppend(&link->framer, bytes, length);
+        bytes += taken;
+        length -= taken;
+        decodeLines(link);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+void linkDecoderSwitchToBinaryAfterOk(LinkDecoder *link)
+{
+    atomic_store(&link->pendingSwitch, SwitchToBinary);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void linkDecoderSwitchToTextAfterOk(LinkDecoder *link)
+{
+    atomic_store(&link->pendingSwitch, SwitchToText);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void linkDecoderCancelSwitch(LinkDecoder *link)
+{
+    atomic_store(&link->pendingSwitch, SwitchNone);
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool linkDecoderIsBinary(LinkDecoder *link)
+{
+    return atomic_load(&link->binary);
+}
+
+// -------------------------------------------------------------------------------------------
@@ -0,0 +1,63 @@
+//
+//  LinkDecoder.h
+//  Turns the bytes received from the Arduino into parsed responses, in whichever protocol the link is
+//  speaking at the time
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Used by the reader thread on the live port and by the replay engine on captured traffic, so both go
+//  through exactly the same framing, parsing and protocol switches. No threads and no allocation: the
+//  handler is called for every response as soon as it has been decoded.
+//
+
+#ifndef LinkDecoder_h
+#define LinkDecoder_h
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "BinaryProtocol.h"
+#include "LineFramer.h"
+#include "ResponseParser.h"
+
+// A decoded response. The sequence number is the one the Arduino echoed, 0 in text mode. The parsed
+// text points into the decoder's buffers and is only valid during the call.
+typedef void (*LinkResponseHandler)(void *context, const ParsedResponse *parsed, uint8_t sequence);
+
+// Sees every byte received, before it's decoded
+typedef void (*LinkTrafficTap)(void *context, const void *data, size_t length);
+
+typedef struct
+{
+    LineFramer framer;
+    BinaryDecoder decoder;
+    LinkResponseHandler handler;
+    LinkTrafficTap tap;                 // optional
+    void *context;                      // passed to both
+    _Atomic int pendingSwitch;          // may be armed from another thread
+    _Atomic bool binary;                // may be read from another thread
+    _Atomic uint64_t linesFramed;
+} LinkDecoder;
+
+void linkDecoderInit(LinkDecoder *link, LinkResponseHandler handler, LinkTrafficTap tap, void *context);
+
+// Do a single read() from the file descriptor and decode whatever came in. Text is read straight into
+// the line framer. Returns what read() returned.
+ssize_t linkDecoderReadFrom(LinkDecoder *link, int fileDescriptor);
+
+// Decode bytes that didn't come from a file descriptor, e.g. captured traffic
+void linkDecoderFeed(LinkDecoder *link, const void *data, size_t length);
+
+// Protocol switches take effect straight after the CTS:OK (or binary OpOk) that acknowledges the switch
+// command, so nothing that arrives after it in the same read is decoded the wrong way. Arm the switch
+// before sending the command; cancel it if the command fails.
+void linkDecoderSwitchToBinaryAfterOk(LinkDecoder *link);
+void linkDecoderSwitchToTextAfterOk(LinkDecoder *link);
+void linkDecoderCancelSwitch(LinkDecoder *link);
+bool linkDecoderIsBinary(LinkDecoder *link);
+
+#endif /* LinkDecoder_h */
@@ -0,0 +1,523 @@
+//
+//  PortRegistry.c
+//  Keeps track of the serial ports that are plugged in, and notices when they come and go, so a scanner
+//  whose USB adapter resets can be found again straight away
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Deadline.h"
+#include "PortRegistry.h"
+#include "TraceLog.h"
+
+typedef struct
+{
+    SerialPortInfo info;
+    bool present;               // plugged in right now
+    bool claimed;               // a device is using it, or was until it went away
+    bool discovered;            // found by discover, rather than only given by path
+} RegisteredPort;
+
+struct PortRegistry
+{
+    const SerialTransportBackend *backend;
+    uint16_t vendorId;
+    uint16_t productId;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // broadcast after every scan
+    RegisteredPort ports[PORT_REGISTRY_MAX];
+    int count;
+    SerialPortWatch watch;
+    bool watching;
+    int stopPipe[2];
+    pthread_t thread;
+    bool threadStarted;
+    PortRegistryStats stats;
+};
+
+// -------------------------------------------------------------------------------------------
+
+// Same adapter? With serial numbers on both sides that settles it. Without, all we can go on is the path.
+static bool sameIdentity(const SerialPortInfo *a, const SerialPortInfo *b)
+{
+    if (a->serialNumber[0] && b->serialNumber[0])
+    {
+        return a->vendorId == b->vendorId && a->productId == b->productId &&
+               strcmp(a->serialNumber, b->serialNumber) == 0;
+    }
+
+    return strcmp(a->path, b->path) == 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool wanted(const PortRegistry *registry, const SerialPortInfo *port)
+{
+    // A port whose IDs we can't find out might still be ours
+    if (port->vendorId == 0)
+    {
+        return true;
+    }
+
+    return (registry->vendorId == 0 || port->vendorId == registry->vendorId) &&
+           (registry->productId == 0 || port->productId == registry->productId);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// A free entry, reusing one for a port that has gone away and that nobody is waiting for if we're full
+static RegisteredPort *newEntry(PortRegistry *registry)
+{
+    if (registry->count < PORT_REGISTRY_MAX)
+    {
+        return &registry->ports[registry->count++];
+    }
+
+    for (int i = 0; i < registry->count; i++)
+    {
+        if (!registry->ports[i].present && !registry->ports[i].claimed)
+        {
+            return &registry->ports[i];
+        }
+    }
+
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static RegisteredPort *findEntry(PortRegistry *registry, const SerialPortInfo *identity)
+{
+    for (int i = 0; i < registry->count; i++)
+    {
+        if (sameIdentity(&registry->ports[i].info, identity))
+        {
+            return &registry->ports[i];
+        }
+    }
+
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void setPresent(PortRegistry *registry, RegisteredPort *entry, bool present)
+{
+    if (entry->present == present)
+    {
+        return;
+    }
+
+    entry->present = present;
+    if (present)
+    {
+        registry->stats.arrivals++;
+        TRACE_BYTES(entry->info.path, strlen(entry->info.path), "Port %b arrived (USB %x:%x)", entry->info.vendorId,
+                    entry->info.productId);
+    }
+    else
+    {
+        registry->stats.removals++;
+        TRACE_BYTES(entry->info.path, strlen(entry->info.path), "Port %b went away");
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Enumerate the ports and bring the cache up to date. The enumeration is done without holding the lock,
+// it can take a while. If it fails the discovered ports are left as they were, rather than all going away.
+static void rescan(PortRegistry *registry)
+{
+    SerialPortInfo found[PORT_REGISTRY_MAX];
+    bool seen[PORT_REGISTRY_MAX] = { false };
+    RegisteredPort *entry;
+    int count = registry->backend->discover(found, PORT_REGISTRY_MAX);
+    bool discovered = count >= 0;
+
+    if (count > PORT_REGISTRY_MAX)
+    {
+        count = PORT_REGISTRY_MAX;
+    }
+
+    pthread_mutex_lock(&registry->lock);
+    registry->stats.scans++;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!wanted(registry, &found[i]))
+        {
+            continue;
+        }
+
+        entry = findEntry(registry, &found[i]);
+        if (entry == NULL)
+        {
+            entry = newEntry(registry);
+            if (entry == NULL)
+            {
+                continue;
+            }
+            memset(entry, 0, sizeof(RegisteredPort));
+        }
+
+        // It may have come back under a different path
+        entry->info = found[i];
+        entry->discovered = true;
+        seen[entry - registry->ports] = true;
+        setPresent(registry, entry, true);
+    }
+
+    for (int i = 0; i < registry->count; i++)
+    {
+        entry = &registry->ports[i];
+        if (entry->discovered)
+        {
+            if (discovered)
+            {
+                setPresent(registry, entry, seen[i]);
+            }
+        }
+        else
+        {
+            setPresent(registry, entry, access(entry->info.path, F_OK) == 0);
+        }
+    }
+
+    pthread_cond_broadcast(&registry->changed);
+    pthread_mutex_unlock(&registry->lock);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void *watchThread(void *context)
+{
+    PortRegistry *registry = context;
+    struct pollfd fds[2];
+    nfds_t count;
+
+    traceLogRegisterThread("ports");
+
+    for (;;)
+    {
+        fds[0].fd = registry->stopPipe[0];
+        fds[0].events = POLLIN;
+        count = 1;
+        if (registry->watch.fileDescriptor != -1)
+        {
+            fds[1].fd = registry->watch.fileDescriptor;
+            fds[1].events = POLLIN;
+            count = 2;
+        }
+
+        if (poll(fds, count, PORT_RESCAN_MILLIS) == -1 && errno != EINTR)
+        {
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            break;
+        }
+
+        if (count == 2 && (fds[1].revents & POLLIN))
+        {
+            registry->backend->watchDrain(&registry->watch);
+            pthread_mutex_lock(&registry->lock);
+            registry->stats.notifications++;
+            pthread_mutex_unlock(&registry->lock);
+        }
+
+        rescan(registry);
+    }
+
+    traceLogUnregisterThread();
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+PortRegistry *portRegistryCreate(const SerialTransportBackend *backend, uint16_t vendorId, uint16_t productId)
+{
+    PortRegistry *registry = calloc(1, sizeof(PortRegistry));
+
+    if (registry == NULL)
+    {
+        return NULL;
+    }
+
+    registry->backend = backend;
+    registry->vendorId = vendorId;
+    registry->productId = productId;
+    registry->watch.fileDescriptor = -1;
+    registry->stopPipe[0] = registry->stopPipe[1] = -1;
+    pthread_mutex_init(&registry->lock, NULL);
+    pthread_cond_init(&registry->changed, NULL);
+
+    rescan(registry);
+    return registry;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int portRegistryStart(PortRegistry *registry)
+{
+    int result;
+
+    if (registry->threadStarted)
+    {
+        return 0;
+    }
+
+    if (pipe(registry->stopPipe) == -1)
+    {
+        registry->stopPipe[0] = registry->stopPipe[1] = -1;
+        return -1;
+    }
+    fcntl(registry->stopPipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(registry->stopPipe[1], F_SETFD, FD_CLOEXEC);
+
+    // Without a watch the thread still polls, just not as quickly
+    registry->watching = registry->backend->watchStart && registry->backend->watchStart(&registry->watch) == 0;
+    registry->stats.watching = registry->watching;
+    if (!registry->watching)
+    {
+        registry->watch.fileDescriptor = -1;
+    }
+
+    result = pthread_create(&registry->thread, NULL, watchThread, registry);
+    if (result != 0)
+    {
+        portRegistryStop(registry);
+        errno = result;
+        return -1;
+    }
+
+    registry->threadStarted = true;
+
+    // Anything that changed between creating the registry and watching it
+    rescan(registry);
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void portRegistryStop(PortRegistry *registry)
+{
+    ssize_t ignored;
+
+    if (registry->threadStarted)
+    {
+        ignored = write(registry->stopPipe[1], "", 1);
+        (void)ignored;
+        pthread_join(registry->thread, NULL);
+        registry->threadStarted = false;
+    }
+
+    if (registry->watching)
+    {
+        registry->backend->watchStop(&registry->watch);
+        registry->watching = false;
+    }
+
+    if (registry->stopPipe[0] != -1)
+    {
+        close(registry->stopPipe[0]);
+        close(registry->stopPipe[1]);
+        registry->stopPipe[0] = registry->stopPipe[1] = -1;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+void portRegistryDestroy(PortRegistry *registry)
+{
+    if (registry == NULL)
+    {
+        return;
+    }
+
+    portRegistryStop(registry);
+    pthread_mutex_destroy(&registry->lock);
+    pthread_cond_destroy(&registry->changed);
+    free(registry);
+}
+
+// -------------------------------------------------------------------------------------------
+
+int portRegistryList(PortRegistry *registry, SerialPortInfo *ports, int maxPorts)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&registry->lock);
+    for (int i = 0; i < registry->count; i++)
+    {
+        if (registry->ports[i].present && registry->ports[i].discovered)
+        {
+            if (found < maxPorts)
+            {
+                ports[found] = registry->ports[i].info;
+            }
+            found++;
+        }
+    }
+    pthread_mutex_unlock(&registry->lock);
+
+    return found;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void portRegistryTrack(PortRegistry *registry, const char *path, SerialPortInfo *identity)
+{
+    RegisteredPort *entry;
+
+    memset(identity, 0, sizeof(SerialPortInfo));
+    strncpy(identity->path, path, sizeof(identity->path) - 1);
+
+    pthread_mutex_lock(&registry->lock);
+    entry = findEntry(registry, identity);
+    if (entry)
+    {
+        *identity = entry->info;
+    }
+    else if ((entry = newEntry(registry)) != NULL)
+    {
+        memset(entry, 0, sizeof(RegisteredPort));
+        entry->info = *identity;
+        entry->present = access(path, F_OK) == 0;
+    }
+    pthread_mutex_unlock(&registry->lock);
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool portRegistryClaim(PortRegistry *registry, const SerialPortInfo *identity)
+{
+    RegisteredPort *entry;
+    bool claimed = false;
+
+    pthread_mutex_lock(&registry->lock);
+    entry = findEntry(registry, identity);
+    if (entry && !entry->claimed)
+    {
+        entry->claimed = true;
+        claimed = true;
+    }
+    pthread_mutex_unlock(&registry->lock);
+
+    return claimed;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void portRegistryRelease(PortRegistry *registry, const SerialPortInfo *identity)
+{
+    RegisteredPort *entry;
+
+    pthread_mutex_lock(&registry->lock);
+    entry = findEntry(registry, identity);
+    if (entry)
+    {
+        entry->claimed = false;
+    }
+    pthread_mutex_unlock(&registry->lock);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The port to hand out for the identity, if it's plugged in. An adapter without a serial number that has
+// come back under a new path can only be told apart by its IDs, so any unclaimed lookalike will do.
+static RegisteredPort *findPresent(PortRegistry *registry, const SerialPortInfo *identity)
+{
+    RegisteredPort *entry = findEntry(registry, identity);
+
+    if (entry && entry->present && !entry->claimed)
+    {
+        return entry;
+    }
+
+    if (identity->serialNumber[0] || identity->vendorId == 0)
+    {
+        return NULL;
+    }
+
+    for (int i = 0; i < registry->count; i++)
+    {
+        entry = &registry->ports[i];
+        if (entry->present && !entry->claimed && entry->discovered && entry->info.serialNumber[0] == '\0' &&
+            entry->info.vendorId == identity->vendorId && entry->info.productId == identity->productId)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool portRegistryWaitFor(PortRegistry *registry, const SerialPortInfo *identity, uint64_t deadline,
+                         SerialPortInfo *found)
+{
+    RegisteredPort *entry;
+    struct timespec until;
+    uint64_t slice;
+
+    // The caller has usually just lost the port, which the watch may not have caught up with yet
+    rescan(registry);
+
+    pthread_mutex_lock(&registry->lock);
+    for (;;)
+    {
+        entry = findPresent(registry, identity);
+        if (entry)
+        {
+            entry->claimed = true;
+            *found = entry->info;
+            pthread_mutex_unlock(&registry->lock);
+            return true;
+        }
+
+        if (monotonicNanos() >= deadline)
+        {
+            pthread_mutex_unlock(&registry->lock);
+            return false;
+        }
+
+        if (registry->threadStarted)
+        {
+            until = wallClockDeadline(deadline);
+            pthread_cond_timedwait(&registry->changed, &registry->lock, &until);
+        }
+        else
+        {
+            // Nobody is watching, so look for ourselves every now and then
+            pthread_mutex_unlock(&registry->lock);
+            slice = deadlineRemainingMillis(deadline);
+            usleep((useconds_t)(slice < PORT_RESCAN_MILLIS / 10 ? slice : PORT_RESCAN_MILLIS / 10) * 1000);
+            rescan(registry);
+            pthread_mutex_lock(&registry->lock);
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+void portRegistryGetStats(PortRegistry *registry, PortRegistryStats *stats)
+{
+    pthread_mutex_lock(&registry->lock);
+    *stats = registry->stats;
+    pthread_mutex_unlock(&registry->lock);
+}
+
+// -------------------------------------------------------------------------------------------
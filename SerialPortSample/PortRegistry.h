@@ -0,0 +1,72 @@
+//
+//  PortRegistry.h
+//  Keeps track of the serial ports that are plugged in, and notices when they come and go, so a scanner
+//  whose USB adapter resets can be found again straight away
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  The registry enumerates the ports once when it's created, then a background thread waits on the
+//  backend's watch (IOKit notifications on macOS, inotify on /dev on Linux) and runs discover again
+//  whenever something changes. Without a watch, or if a notification is missed, it rescans every
+//  PORT_RESCAN_MILLIS. Asking for the ports never enumerates anything, it reads the cache.
+//
+//  A port is known by its USB identity: vendor and product ID plus the serial number where the adapter
+//  has one. An adapter that comes back after a reset usually gets a new device path, the identity is
+//  how it's recognised. Adapters without a serial number all look alike, so for those the old path is
+//  preferred and otherwise the first one nobody has claimed is taken. Ports that were given by path and
+//  aren't discovered (e.g. a pseudo-terminal) are tracked by whether their path exists.
+//
+
+#ifndef PortRegistry_h
+#define PortRegistry_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "SerialTransport.h"
+
+#define PORT_REGISTRY_MAX       32      // ports remembered, including ones that have gone away
+#define PORT_RESCAN_MILLIS      1000    // safety net rescan interval
+
+typedef struct
+{
+    uint64_t scans;             // times the ports were enumerated
+    uint64_t notifications;     // times the watch said something changed
+    uint64_t arrivals;          // ports that appeared, including ones coming back
+    uint64_t removals;
+    bool watching;              // false if the backend couldn't watch when started, so we only polled
+} PortRegistryStats;
+
+typedef struct PortRegistry PortRegistry;
+
+// Enumerate the ports with the backend. Only ports with the given vendor and product ID are kept, apart
+// from ones whose IDs can't be found out; 0 accepts any. Returns NULL if the registry could not be
+// allocated (errno is set).
+PortRegistry *portRegistryCreate(const SerialTransportBackend *backend, uint16_t vendorId, uint16_t productId);
+
+// Start and stop watching for changes on a background thread. Start returns 0 or -1 (errno is set).
+int portRegistryStart(PortRegistry *registry);
+void portRegistryStop(PortRegistry *registry);
+void portRegistryDestroy(PortRegistry *registry);
+
+// The ports plugged in right now. Fills at most maxPorts and returns how many there are.
+int portRegistryList(PortRegistry *registry, SerialPortInfo *ports, int maxPorts);
+
+// Track a port that was given by its path. Its identity is taken from the cache if it's a discovered
+// port. Fills in identity either way.
+void portRegistryTrack(PortRegistry *registry, const char *path, SerialPortInfo *identity);
+
+// Mark a port as in use, so a lookalike adapter coming back isn't handed out to two devices. Returns false
+// if it's already claimed. The port is found by its identity, so it can be released after it has moved.
+bool portRegistryClaim(PortRegistry *registry, const SerialPortInfo *identity);
+void portRegistryRelease(PortRegistry *registry, const SerialPortInfo *identity);
+
+// Wait until a port with the identity is plugged in (it may already be) and claim it. Fills in where it is
+// now. Returns false if it hasn't turned up by the deadline (in monotonicNanos() time).
+bool portRegistryWaitFor(PortRegistry *registry, const SerialPortInfo *identity, uint64_t deadline,
+                         SerialPortInfo *found);
+
+void portRegistryGetStats(PortRegistry *registry, PortRegistryStats *stats);
+
+#endif /* PortRegistry_h */
@@ -0,0 +1,346 @@
+//
+//  PosixSerialBackend.c
+//  Serial port backend that only needs POSIX termios, with Linux extras for arbitrary baud rates and
+//  low latency. Ports are discovered through sysfs on Linux, and watched with inotify on /dev.
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <dirent.h>
+#include <errno.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#ifdef __linux__
+#include <asm/ioctls.h>         // TCGETS2 / TCSETS2
+#include <linux/serial.h>       // ASYNC_LOW_LATENCY
+#include <sys/inotify.h>
+#endif
+
+#include "SerialTransport.h"
+
+#ifdef __linux__
+
+// The kernel's termios2. It isn't in glibc's termios.h, and <asm/termbits.h> clashes with it, so we declare
+// our own copy of the layout under the name the TCGETS2/TCSETS2 macros expect.
+struct termios2
+{
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+
+#ifndef BOTHER
+#define BOTHER  0010000
+#endif
+
+// -------------------------------------------------------------------------------------------
+
+// Set any baud rate the UART can do, not just the ones that have a Bxxx constant
+static int setArbitraryBaud(SerialTransport *transport, uint32_t baudRate)
+{
+    struct termios2 attributes;
+
+    if (ioctl(transport->fileDescriptor, TCGETS2, &attributes) == -1)
+    {
+        serialTransportSetError(transport, "Error getting termios2 %s - %s(%d).", transport->path, strerror(errno), errno);
+        return -1;
+    }
+
+    attributes.c_cflag &= ~CBAUD;
+    attributes.c_cflag |= BOTHER;
+    attributes.c_ispeed = baudRate;
+    attributes.c_ospeed = baudRate;
+
+    if (ioctl(transport->fileDescriptor, TCSETS2, &attributes) == -1)
+    {
+        serialTransportSetError(transport, "Error setting %u baud on %s - %s(%d).", baudRate, transport->path,
+                                strerror(errno), errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Ask the driver to push received bytes to us straight away instead of batching them. Not every driver
+// supports this (ptys and cdc-acm don't), so failure is only a warning.
+static void setLowLatency(SerialTransport *transport)
+{
+    struct serial_struct serial;
+
+    if (ioctl(transport->fileDescriptor, TIOCGSERIAL, &serial) == -1)
+    {
+        serialTransportSetWarning(transport, "Error getting serial info %s - %s(%d).", transport->path, strerror(errno), errno);
+        return;
+    }
+
+    serial.flags |= ASYNC_LOW_LATENCY;
+    if (ioctl(transport->fileDescriptor, TIOCSSERIAL, &serial) == -1)
+    {
+        serialTransportSetWarning(transport, "Error setting low latency %s - %s(%d).", transport->path, strerror(errno), errno);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Read a hex ID (idVendor, idProduct) or a string (serial) from a sysfs file
+static bool readSysfsString(const char *directory, const char *name, char *value, size_t size)
+{
+    char path[PATH_MAX];
+    FILE *file;
+    bool result = false;
+
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    if (fgets(value, (int)size, file))
+    {
+        value[strcspn(value, "\n")] = '\0';
+        result = true;
+    }
+
+    fclose(file);
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Every tty backed by a USB device, e.g. ttyUSB0 (FTDI, CP210x, CH340) or ttyACM0 (Arduino Uno)
+static int posixDiscover(SerialPortInfo *ports, int maxPorts)
+{
+    DIR *directory = opendir("/sys/class/tty");
+    struct dirent *entry;
+    char devicePath[PATH_MAX];
+    char usbPath[PATH_MAX];
+    char value[64];
+    char *slash;
+    int found = 0;
+
+    if (directory == NULL)
+    {
+        return -1;
+    }
+
+    while ((entry = readdir(directory)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        // Walk up from the tty's device to the USB device, which is the one with an idVendor
+        snprintf(devicePath, sizeof(devicePath), "/sys/class/tty/%s/device", entry->d_name);
+        if (realpath(devicePath, usbPath) == NULL)
+        {
+            continue;
+        }
+
+        while (!readSysfsString(usbPath, "idVendor", value, sizeof(value)))
+        {
+            slash = strrchr(usbPath, '/');
+            if (slash == NULL || slash == usbPath)
+            {
+                break;
+            }
+            *slash = '\0';
+        }
+
+        if (!readSysfsString(usbPath, "idVendor", value, sizeof(value)))
+        {
+            continue;
+        }
+
+        if (found < maxPorts)
+        {
+            SerialPortInfo *port = &ports[found];
+
+            memset(port, 0, sizeof(SerialPortInfo));
+            snprintf(port->path, sizeof(port->path), "/dev/%s", entry->d_name);
+            port->vendorId = (uint16_t)strtoul(value, NULL, 16);
+            if (readSysfsString(usbPath, "idProduct", value, sizeof(value)))
+            {
+                port->productId = (uint16_t)strtoul(value, NULL, 16);
+            }
+            readSysfsString(usbPath, "serial", port->serialNumber, sizeof(port->serialNumber));
+        }
+        found++;
+    }
+
+    closedir(directory);
+    return found;
+}
+
+#else
+
+// -------------------------------------------------------------------------------------------
+
+// Without sysfs all we can go on is the device names USB serial drivers usually use
+static int posixDiscover(SerialPortInfo *ports, int maxPorts)
+{
+    static const char *patterns[] = { "/dev/ttyUSB*", "/dev/ttyACM*", "/dev/cu.usbserial*", "/dev/cu.usbmodem*" };
+    glob_t matches;
+    int found = 0;
+    size_t i, j;
+
+    for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++)
+    {
+        if (glob(patterns[i], 0, NULL, &matches) != 0)
+        {
+            continue;
+        }
+
+        for (j = 0; j < matches.gl_pathc; j++)
+        {
+            if (found < maxPorts)
+            {
+                memset(&ports[found], 0, sizeof(SerialPortInfo));
+                snprintf(ports[found].path, sizeof(ports[found].path), "%s", matches.gl_pathv[j]);
+            }
+            found++;
+        }
+
+        globfree(&matches);
+    }
+
+    return found;
+}
+
+#endif
+
+// -------------------------------------------------------------------------------------------
+
+static int posixOpen(SerialTransport *transport, const char *path, const SerialPortOptions *options)
+{
+    bool standardBaud;
+
+    if (serialTransportOpenTermios(transport, path, options, &standardBaud) == -1)
+    {
+        return -1;
+    }
+
+#ifdef __linux__
+    if (!standardBaud && setArbitraryBaud(transport, options->baudRate) == -1)
+    {
+        serialTransportClose(transport);
+        return -1;
+    }
+
+    if (options->lowLatency)
+    {
+        setLowLatency(transport);
+    }
+#else
+    if (!standardBaud)
+    {
+        serialTransportSetError(transport, "%u baud is not supported on this platform", options->baudRate);
+        serialTransportClose(transport);
+        return -1;
+    }
+#endif
+
+    return transport->fileDescriptor;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static int posixSetBaud(SerialTransport *transport, uint32_t baudRate)
+{
+    int result = serialTransportSetStandardBaud(transport, baudRate);
+
+    if (result != 0)
+    {
+        return result == 1 ? 0 : -1;
+    }
+
+#ifdef __linux__
+    return setArbitraryBaud(transport, baudRate);
+#else
+    serialTransportSetError(transport, "%u baud is not supported on this platform", baudRate);
+    return -1;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------
+
+// udev creates and removes the device node when the adapter comes and goes, and changes its permissions
+// once it's set up, so that's what to watch. Anything else in /dev changing just costs a discover.
+static int posixWatchStart(SerialPortWatch *watch)
+{
+#ifdef __linux__
+    watch->platform = NULL;
+    watch->fileDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fileDescriptor == -1)
+    {
+        return -1;
+    }
+
+    if (inotify_add_watch(watch->fileDescriptor, "/dev", IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_TO) == -1)
+    {
+        int error = errno;
+
+        close(watch->fileDescriptor);
+        watch->fileDescriptor = -1;
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+#else
+    watch->fileDescriptor = -1;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void posixWatchDrain(SerialPortWatch *watch)
+{
+    char events[4096];
+
+    while (read(watch->fileDescriptor, events, sizeof(events)) > 0)
+    {
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void posixWatchStop(SerialPortWatch *watch)
+{
+    if (watch->fileDescriptor != -1)
+    {
+        close(watch->fileDescriptor);
+        watch->fileDescriptor = -1;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+const SerialTransportBackend kPosixSerialBackend =
+{
+    "POSIX",
+    posixDiscover,
+    posixOpen,
+    posixSetBaud,
+    posixWatchStart,
+    posixWatchDrain,
+    posixWatchStop
+};
+
+// -------------------------------------------------------------------------------------------
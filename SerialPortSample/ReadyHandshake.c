@@ -0,0 +1,132 @@
+//
+//  ReadyHandshake.c
+//  Decides when an Arduino we've just opened the port to is ready for commands, as soon as it is rather
+//  than after a fixed pause
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <string.h>
+
+#include "Deadline.h"
+#include "ReadyHandshake.h"
+
+static const char *kHandshakeStateNames[] =
+{
+    "draining", "waiting", "confirming", "ready", "failed"
+};
+
+// -------------------------------------------------------------------------------------------
+
+const char *handshakeStateName(HandshakeState state)
+{
+    return state <= HandshakeFailed ? kHandshakeStateNames[state] : "?";
+}
+
+// -------------------------------------------------------------------------------------------
+
+void handshakeBegin(ReadyHandshake *handshake, uint64_t openedAt, uint64_t now, uint32_t timeoutMillis)
+{
+    memset(handshake, 0, sizeof(ReadyHandshake));
+
+    handshake->state = HandshakeDraining;
+    handshake->openedAt = openedAt;
+    handshake->deadline = now + timeoutMillis * NANOS_PER_MILLI;
+    handshake->nextPingAt = openedAt + HANDSHAKE_FIRST_PING_MILLIS * NANOS_PER_MILLI;
+    handshake->pingInterval = HANDSHAKE_FIRST_PING_MILLIS;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The Arduino has said it's up, so it's listening: ping it straight away rather than at the next interval
+static void readySeen(ReadyHandshake *handshake, uint64_t now)
+{
+    if (handshake->state != HandshakeConfirming)
+    {
+        handshake->state = HandshakeConfirming;
+        handshake->nextPingAt = now;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+void handshakeBacklog(ReadyHandshake *handshake, ArduinoResponse response, uint64_t now)
+{
+    handshake->stats.backlog++;
+
+    // Whatever else is in there is left over from before, and can't be the answer to anything we sent
+    if (response == Ready)
+    {
+        handshake->stats.staleReady++;
+        readySeen(handshake, now);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+HandshakeAction handshakeNext(ReadyHandshake *handshake, uint64_t now, uint64_t *waitUntil)
+{
+    if (handshake->state == HandshakeDraining)
+    {
+        handshake->state = HandshakeWaiting;
+    }
+
+    if (handshake->state == HandshakeReady || handshake->state == HandshakeFailed)
+    {
+        return HandshakeDone;
+    }
+
+    if (now >= handshake->deadline)
+    {
+        handshake->state = HandshakeFailed;
+        return HandshakeDone;
+    }
+
+    if (now >= handshake->nextPingAt)
+    {
+        return HandshakeSendPing;
+    }
+
+    *waitUntil = handshake->nextPingAt < handshake->deadline ? handshake->nextPingAt : handshake->deadline;
+    return HandshakeWait;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void handshakePingSent(ReadyHandshake *handshake, uint64_t now)
+{
+    handshake->stats.pings++;
+    handshake->nextPingAt = now + handshake->pingInterval * NANOS_PER_MILLI;
+
+    if (handshake->pingInterval < HANDSHAKE_MAX_PING_MILLIS)
+    {
+        handshake->pingInterval *= 2;
+        if (handshake->pingInterval > HANDSHAKE_MAX_PING_MILLIS)
+        {
+            handshake->pingInterval = HANDSHAKE_MAX_PING_MILLIS;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+void handshakeResponse(ReadyHandshake *handshake, ArduinoResponse response, uint64_t now)
+{
+    if (response == Ready)
+    {
+        handshake->stats.readyEvents++;
+        readySeen(handshake, now);
+    }
+    else if (response == Ok && handshake->stats.pings > 0)
+    {
+        handshake->state = HandshakeReady;
+        handshake->stats.readyNanos = now - handshake->openedAt;
+    }
+    else
+    {
+        handshake->stats.skipped++;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
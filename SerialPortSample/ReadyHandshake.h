@@ -0,0 +1,81 @@
+//
+//  ReadyHandshake.h
+//  Decides when an Arduino we've just opened the port to is ready for commands, as soon as it is rather
+//  than after a fixed pause
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Opening the port resets the Arduino, and it sends CTS:READY once it has started up. The handshake first
+//  goes through whatever was already waiting on the port (a READY in there means it's up already), then
+//  waits for the READY. When that comes, one ping confirms the Arduino is listening and the handshake is
+//  done. If no READY comes (the port didn't reset it, or it was missed) the handshake pings anyway, first
+//  after HANDSHAKE_FIRST_PING_MILLIS so the bootloader isn't disturbed, then at doubling intervals. Any OK
+//  to a ping means it's ready. Lines that are neither are counted and skipped.
+//
+//  This only decides what to do next; SerialComms does the reading and writing. Times are monotonicNanos().
+//
+
+#ifndef ReadyHandshake_h
+#define ReadyHandshake_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ArduinoResponse.h"
+
+#define HANDSHAKE_FIRST_PING_MILLIS     250     // after the port was opened, unless a READY comes first
+#define HANDSHAKE_MAX_PING_MILLIS       1000    // the ping interval doubles up to this
+#define HANDSHAKE_TIMEOUT_MILLIS        5000    // default for how long the Arduino gets to answer
+
+typedef enum
+{
+    HandshakeDraining,      // going through what was already waiting on the port
+    HandshakeWaiting,       // for READY, pinging every now and then
+    HandshakeConfirming,    // READY seen, waiting for the OK to a ping
+    HandshakeReady,
+    HandshakeFailed
+} HandshakeState;
+
+typedef enum
+{
+    HandshakeWait,          // read a response, until the time given
+    HandshakeSendPing,
+    HandshakeDone           // the state says how it went
+} HandshakeAction;
+
+typedef struct
+{
+    uint64_t readyNanos;    // from opening the port until the Arduino answered, 0 if it didn't
+    uint32_t backlog;       // lines that were waiting on the port before we started
+    uint32_t staleReady;    // READYs among them
+    uint32_t readyEvents;   // READYs that arrived while we waited
+    uint32_t pings;
+    uint32_t skipped;       // other lines that arrived while we waited (OKs nobody asked for, errors)
+} HandshakeStats;
+
+typedef struct
+{
+    HandshakeState state;
+    uint64_t openedAt;
+    uint64_t deadline;
+    uint64_t nextPingAt;
+    uint32_t pingInterval;  // millis until the ping after the next one
+    HandshakeStats stats;
+} ReadyHandshake;
+
+// The port was opened at openedAt, and the Arduino has until timeoutMillis from now to answer
+void handshakeBegin(ReadyHandshake *handshake, uint64_t openedAt, uint64_t now, uint32_t timeoutMillis);
+
+// A line that was waiting on the port before the handshake started
+void handshakeBacklog(ReadyHandshake *handshake, ArduinoResponse response, uint64_t now);
+
+// What to do now. For HandshakeWait, waitUntil is when to come back if nothing arrives.
+HandshakeAction handshakeNext(ReadyHandshake *handshake, uint64_t now, uint64_t *waitUntil);
+
+void handshakePingSent(ReadyHandshake *handshake, uint64_t now);
+void handshakeResponse(ReadyHandshake *handshake, ArduinoResponse response, uint64_t now);
+
+const char *handshakeStateName(HandshakeState state);
+
+#endif /* ReadyHandshake_h */
@@ -0,0 +1,523 @@
+//
+//  ReelJournal.c
+//  Crash-safe record of how far a reel has got, so a scan that was cut short carries on where it
+//  stopped instead of starting the reel over
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "ReelJournal.h"
+
+_Static_assert(sizeof(JournalHeader) <= REEL_ALIGNMENT, "JournalHeader has to fit in front of the records");
+_Static_assert(sizeof(JournalRecord) == 64, "JournalRecord is part of the file format");
+
+#define JOURNAL_MIN_RECORDS     1024
+
+struct ReelJournal
+{
+    int fileDescriptor;
+    uint8_t *base;              // the whole file, mapped shared
+    size_t mappedLength;
+    size_t capacity;            // records the file has room for
+    size_t count;               // committed
+    size_t pageSize;
+    pthread_mutex_t lock;
+};
+
+// -------------------------------------------------------------------------------------------
+
+static uint32_t crcTable[256];
+
+static void makeTable(void)
+{
+    uint32_t value;
+
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        value = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            value = value & 1 ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+        }
+        crcTable[i] = value;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+uint32_t reelChecksum(uint32_t crc, const void *data, size_t length)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    const uint8_t *bytes = data;
+
+    pthread_once(&once, makeTable);
+
+    crc = ~crc;
+    while (length--)
+    {
+        crc = crcTable[(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static JournalHeader *header(const ReelJournal *journal)
+{
+    return (JournalHeader *)journal->base;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static JournalRecord *record(const ReelJournal *journal, size_t index)
+{
+    return (JournalRecord *)(journal->base + REEL_ALIGNMENT) + index;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool committed(const JournalRecord *entry)
+{
+    return memcmp(entry->magic, JOURNAL_RECORD_MAGIC, sizeof(entry->magic)) == 0 &&
+           entry->kind >= JournalMoved && entry->kind <= JournalReadvanced &&
+           entry->checksum == reelChecksum(0, entry, offsetof(JournalRecord, checksum));
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Make room for more records: the file grows and is mapped again. Called with the lock held.
+static int grow(ReelJournal *journal, size_t capacity)
+{
+    size_t length = REEL_ALIGNMENT + capacity * sizeof(JournalRecord);
+    void *base;
+
+    if (ftruncate(journal->fileDescriptor, (off_t)length) == -1)
+    {
+        return -1;
+    }
+
+    base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fileDescriptor, 0);
+    if (base == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    if (journal->base)
+    {
+        munmap(journal->base, journal->mappedLength);
+    }
+
+    journal->base = base;
+    journal->mappedLength = length;
+    journal->capacity = capacity;
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static ReelJournal *newJournal(const char *path, int flags)
+{
+    ReelJournal *journal = calloc(1, sizeof(ReelJournal));
+
+    if (journal == NULL)
+    {
+        return NULL;
+    }
+
+    journal->fileDescriptor = open(path, flags | O_RDWR | O_CLOEXEC, 0644);
+    if (journal->fileDescriptor == -1)
+    {
+        free(journal);
+        return NULL;
+    }
+
+    journal->pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    pthread_mutex_init(&journal->lock, NULL);
+    return journal;
+}
+
+// -------------------------------------------------------------------------------------------
+
+ReelJournal *reelJournalCreate(const char *path, const char *reelPath, uint32_t cells)
+{
+    ReelJournal *journal;
+    JournalHeader *top;
+    size_t capacity = (size_t)cells * 2 + 64;
+    int error;
+
+    if (strlen(reelPath) >= JOURNAL_PATH_MAX)
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    journal = newJournal(path, O_CREAT | O_TRUNC);
+    if (journal == NULL)
+    {
+        return NULL;
+    }
+
+    if (grow(journal, capacity > JOURNAL_MIN_RECORDS ? capacity : JOURNAL_MIN_RECORDS) == -1)
+    {
+        error = errno;
+        reelJournalClose(journal);
+        unlink(path);
+        errno = error;
+        return NULL;
+    }
+
+    top = header(journal);
+    memcpy(top->magic, JOURNAL_MAGIC, sizeof(top->magic));
+    top->version = JOURNAL_VERSION;
+    top->recordSize = sizeof(JournalRecord);
+    top->createdSeconds = (uint64_t)time(NULL);
+    top->cells = cells;
+    top->sessions = 1;
+    strcpy(top->reelPath, reelPath);
+
+    // Without the header on disk the records can't be found again
+    if (msync(journal->base, REEL_ALIGNMENT, MS_SYNC) == -1)
+    {
+        error = errno;
+        reelJournalClose(journal);
+        unlink(path);
+        errno = error;
+        return NULL;
+    }
+
+    return journal;
+}
+
+// -------------------------------------------------------------------------------------------
+
+ReelJournal *reelJournalOpen(const char *path)
+{
+    ReelJournal *journal = newJournal(path, 0);
+    struct stat info;
+    const JournalHeader *top;
+    int error;
+
+    if (journal == NULL)
+    {
+        return NULL;
+    }
+
+    if (fstat(journal->fileDescriptor, &info) == -1 || (size_t)info.st_size < REEL_ALIGNMENT ||
+        grow(journal, ((size_t)info.st_size - REEL_ALIGNMENT) / sizeof(JournalRecord)) == -1)
+    {
+        error = errno ? errno : EINVAL;
+        reelJournalClose(journal);
+        errno = error;
+        return NULL;
+    }
+
+    top = header(journal);
+    if (memcmp(top->magic, JOURNAL_MAGIC, sizeof(top->magic)) != 0 || top->version != JOURNAL_VERSION ||
+        top->recordSize != sizeof(JournalRecord) || memchr(top->reelPath, '\0', JOURNAL_PATH_MAX) == NULL)
+    {
+        reelJournalClose(journal);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    while (journal->count < journal->capacity && committed(record(journal, journal->count)))
+    {
+        journal->count++;
+    }
+
+    // Anything after the last committed record is a torn write, or records that reached the disk ahead of
+    // one before them. Clear it, so it can't be mistaken for records appended later.
+    memset(record(journal, journal->count), 0, (journal->capacity - journal->count) * sizeof(JournalRecord));
+    msync(journal->base, journal->mappedLength, MS_ASYNC);
+
+    return journal;
+}
+
+// -------------------------------------------------------------------------------------------
+
+const JournalHeader *reelJournalHeader(const ReelJournal *journal)
+{
+    return header(journal);
+}
+
+// -------------------------------------------------------------------------------------------
+
+size_t reelJournalCount(const ReelJournal *journal)
+{
+    return journal->count;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Fill in the record and commit it, the checksum last. Called with the lock held.
+static bool append(ReelJournal *journal, JournalRecord *filled)
+{
+    JournalRecord *entry;
+    struct timeval now;
+    uintptr_t page;
+
+    if (journal->count == journal->capacity && grow(journal, journal->capacity * 2) == -1)
+    {
+        return false;
+    }
+
+    gettimeofday(&now, NULL);
+    memcpy(filled->magic, JOURNAL_RECORD_MAGIC, sizeof(filled->magic));
+    filled->wallClockMicros = (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_usec;
+    filled->checksum = reelChecksum(0, filled, offsetof(JournalRecord, checksum));
+
+    entry = record(journal, journal->count);
+    memcpy(entry, filled, offsetof(JournalRecord, checksum));
+    __atomic_store_n(&entry->checksum, filled->checksum, __ATOMIC_RELEASE);
+    journal->count++;
+
+    // Start the page on its way to the disk without waiting for it
+    page = (uintptr_t)entry & ~(uintptr_t)(journal->pageSize - 1);
+    msync((void *)page, journal->pageSize, MS_ASYNC);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool appendMove(ReelJournal *journal, JournalRecordKind kind, uint32_t cell, uint8_t sequence,
+                       uint8_t response, uint8_t attempts)
+{
+    JournalRecord entry;
+    bool result;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.kind = (uint8_t)kind;
+    entry.cell = cell;
+    entry.sequence = sequence;
+    entry.response = response;
+    entry.attempts = attempts;
+
+    pthread_mutex_lock(&journal->lock);
+    result = append(journal, &entry);
+    pthread_mutex_unlock(&journal->lock);
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool reelJournalMoved(ReelJournal *journal, uint32_t cell, uint8_t sequence, uint8_t response, uint8_t attempts)
+{
+    return appendMove(journal, JournalMoved, cell, sequence, response, attempts);
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool reelJournalReadvanced(ReelJournal *journal, uint32_t cell, uint8_t sequence, uint8_t response,
+                           uint8_t attempts)
+{
+    return appendMove(journal, JournalReadvanced, cell, sequence, response, attempts);
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool reelJournalStored(ReelJournal *journal, uint32_t cell, uint64_t imageOffset, uint64_t imageLength,
+                       uint32_t imageChecksum)
+{
+    JournalRecord entry;
+    bool result;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.kind = JournalStored;
+    entry.cell = cell;
+    entry.imageOffset = imageOffset;
+    entry.imageLength = imageLength;
+    entry.imageChecksum = imageChecksum;
+
+    pthread_mutex_lock(&journal->lock);
+    result = append(journal, &entry);
+    pthread_mutex_unlock(&journal->lock);
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static uint64_t recordEnd(const JournalRecord *stored)
+{
+    uint64_t length = sizeof(ReelRecordHeader) + stored->imageLength;
+
+    return stored->imageOffset + ((length + REEL_ALIGNMENT - 1) & ~(uint64_t)(REEL_ALIGNMENT - 1));
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void keep(JournalResumePoint *point, const JournalRecord *stored)
+{
+    point->stored = true;
+    point->lastStored = stored->cell;
+    point->framesKept++;
+    point->dataEnd = recordEnd(stored);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Whether the frame made it into the reel as it was queued
+static bool inReel(const ReelFile *reel, const JournalRecord *stored)
+{
+    const ReelRecordHeader *frame;
+
+    if (stored->imageOffset < REEL_ALIGNMENT || recordEnd(stored) > reel->mappedLength)
+    {
+        return false;
+    }
+
+    frame = (const ReelRecordHeader *)&reel->base[stored->imageOffset];
+    return memcmp(frame->magic, REEL_RECORD_MAGIC, sizeof(frame->magic)) == 0 && frame->cell == stored->cell &&
+           frame->length == stored->imageLength &&
+           reelChecksum(0, &frame[1], (size_t)stored->imageLength) == stored->imageChecksum;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void reelJournalResumePoint(const ReelJournal *journal, const ReelFile *reel, unsigned int verify,
+                            JournalResumePoint *point)
+{
+    const JournalRecord *newest[JOURNAL_VERIFY_MAX];
+    const JournalRecord *entry;
+    size_t waiting = 0;
+    size_t first;
+    size_t i;
+
+    memset(point, 0, sizeof(JournalResumePoint));
+    point->dataEnd = REEL_ALIGNMENT;
+    verify = verify < 1 ? 1 : verify > JOURNAL_VERIFY_MAX ? JOURNAL_VERIFY_MAX : verify;
+
+    for (i = 0; i < journal->count; i++)
+    {
+        entry = record(journal, i);
+        switch (entry->kind)
+        {
+            case JournalMoved:
+                point->moved = true;
+                point->filmAt = entry->cell;
+                break;
+
+            case JournalReadvanced:
+                // The film is still counted as at the same cell
+                point->readvances++;
+                break;
+
+            case JournalStored:
+                // The oldest one waiting to be checked is old enough to be trusted
+                if (waiting == verify)
+                {
+                    keep(point, newest[0]);
+                    memmove(&newest[0], &newest[1], (verify - 1) * sizeof(newest[0]));
+                    waiting--;
+                }
+                newest[waiting++] = entry;
+                break;
+
+            case JournalResumed:
+                // Everything before it was settled then
+                waiting = 0;
+                point->moved = (entry->flags & JOURNAL_FLAG_MOVED) != 0;
+                point->filmAt = entry->cell;
+                point->stored = (entry->flags & JOURNAL_FLAG_STORED) != 0;
+                point->lastStored = entry->lastStored;
+                point->framesKept = (uint32_t)entry->imageLength;
+                point->dataEnd = entry->imageOffset;
+                break;
+        }
+    }
+
+    for (first = 0; first < waiting && inReel(reel, newest[first]); first++)
+    {
+        keep(point, newest[first]);
+    }
+    point->framesDropped = (uint32_t)(waiting - first);
+
+    // The film is still at the cell it was last moved to, so that one can be captured again. Only the ones
+    // it was moved past without their frames being kept are lost.
+    if (point->moved)
+    {
+        first = point->stored ? point->lastStored + 1 : 0;
+        point->cellsLost = point->filmAt > first ? point->filmAt - (uint32_t)first : 0;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool reelJournalResumed(ReelJournal *journal, const JournalResumePoint *point)
+{
+    JournalRecord entry;
+    bool result;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.kind = JournalResumed;
+    entry.cell = point->filmAt;
+    entry.imageOffset = point->dataEnd;
+    entry.imageLength = point->framesKept;
+    entry.lastStored = point->lastStored;
+    entry.flags = (point->moved ? JOURNAL_FLAG_MOVED : 0) | (point->stored ? JOURNAL_FLAG_STORED : 0);
+
+    pthread_mutex_lock(&journal->lock);
+    header(journal)->sessions++;
+    result = append(journal, &entry);
+    pthread_mutex_unlock(&journal->lock);
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int reelJournalSync(ReelJournal *journal)
+{
+    int result;
+
+    pthread_mutex_lock(&journal->lock);
+    result = msync(journal->base, REEL_ALIGNMENT + journal->count * sizeof(JournalRecord), MS_SYNC);
+    pthread_mutex_unlock(&journal->lock);
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int reelJournalFinish(ReelJournal *journal)
+{
+    pthread_mutex_lock(&journal->lock);
+    header(journal)->finished = 1;
+    pthread_mutex_unlock(&journal->lock);
+
+    return reelJournalSync(journal);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void reelJournalClose(ReelJournal *journal)
+{
+    if (journal == NULL)
+    {
+        return;
+    }
+
+    if (journal->base)
+    {
+        munmap(journal->base, journal->mappedLength);
+    }
+    if (journal->fileDescriptor != -1)
+    {
+        close(journal->fileDescriptor);
+    }
+
+    pthread_mutex_destroy(&journal->lock);
+    free(journal);
+}
+
+// -------------------------------------------------------------------------------------------
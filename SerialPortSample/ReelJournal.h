@@ -0,0 +1,139 @@
+//
+//  ReelJournal.h
+//  Crash-safe record of how far a reel has got, so a scan that was cut short carries on where it
+//  stopped instead of starting the reel over
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  The journal is a file mapped into memory: a JournalHeader in the first REEL_ALIGNMENT bytes, then
+//  fixed size JournalRecords, only ever appended. A record is committed by filling it in and then its
+//  checksum, so after a crash the journal ends at the first record whose checksum doesn't match. The
+//  mapping is shared, so a committed record survives the process dying. msync(MS_ASYNC) after each commit
+//  gets it on its way to the disk without waiting, and reelJournalSync waits.
+//
+//  Every acknowledged NEXTCELL appends a Moved record (sequence number and result), or a Readvanced record
+//  if it was sent again for a cell that looked like the film hadn't moved, and every frame handed
+//  to the image sink a Stored record (where its record starts in the reel, its length and its checksum).
+//  Stored records are appended when a frame is queued, not when it's written, so the last few may not have
+//  made it to the disk. Finding the resume point checks their checksums against the reel. Resuming appends
+//  a Resumed record, which starts the state over from that point, so a journal is never rewritten.
+//
+//  Records may be appended from several threads.
+//
+
+#ifndef ReelJournal_h
+#define ReelJournal_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ImageSink.h"
+
+#define JOURNAL_MAGIC           "SCANJRNL"
+#define JOURNAL_RECORD_MAGIC    "JREC"
+#define JOURNAL_VERSION         1
+#define JOURNAL_PATH_MAX        1024
+#define JOURNAL_VERIFY_MAX      64      // most of the newest Stored records checked against the reel
+
+#define JOURNAL_FLAG_MOVED      0x01    // the film had been moved when the scan was resumed
+#define JOURNAL_FLAG_STORED     0x02    // and frames had been kept
+
+typedef enum
+{
+    JournalMoved = 1,           // the film was moved to cell
+    JournalStored,              // cell's frame was queued for the reel
+    JournalResumed,             // the scan carried on with the film at cell, the reel's good frames ending at
+                                // imageOffset. imageLength is the number of frames kept
+    JournalReadvanced           // the film was moved again for cell, which looked the same as the one before.
+                                // If it had moved the first time, it's now a cell further on than the count
+} JournalRecordKind;
+
+typedef struct
+{
+    char magic[8];              // JOURNAL_MAGIC, not NUL terminated
+    uint32_t version;
+    uint32_t recordSize;        // sizeof(JournalRecord) when written
+    uint64_t createdSeconds;    // time() when the reel was started
+    uint32_t cells;             // the reel is finished after this many
+    uint32_t finished;          // 1 once the reel was closed properly
+    uint32_t sessions;          // times the reel was started or resumed
+    uint32_t reserved;
+    char reelPath[JOURNAL_PATH_MAX];
+} JournalHeader;
+
+typedef struct
+{
+    char magic[4];              // JOURNAL_RECORD_MAGIC
+    uint8_t kind;               // JournalRecordKind
+    uint8_t sequence;           // of the NEXTCELL (Moved, Readvanced)
+    uint8_t response;           // ArduinoResponse it finished with (Moved, Readvanced)
+    uint8_t attempts;           // times it was sent (Moved, Readvanced)
+    uint32_t cell;
+    uint32_t imageChecksum;     // reelChecksum of the frame (Stored)
+    uint64_t imageOffset;       // of the frame's record in the reel (Stored, Resumed)
+    uint64_t imageLength;       // of the frame (Stored), frames kept (Resumed)
+    uint64_t wallClockMicros;   // when the record was appended
+    uint32_t lastStored;        // cell of the last frame kept (Resumed)
+    uint8_t flags;              // JOURNAL_FLAG_ bits (Resumed)
+    uint8_t reserved[15];
+    uint32_t checksum;          // reelChecksum of everything above, written last
+} JournalRecord;
+
+// Where to carry on with a reel
+typedef struct
+{
+    bool moved;                 // the film has been moved at least once. If not, start the reel from cell 0
+    uint32_t filmAt;            // cell the film was last moved to, and is still at
+    uint64_t dataEnd;           // where the reel's good frames end, REEL_ALIGNMENT if there are none
+    uint32_t framesKept;        // in the reel
+    bool stored;                // whether any frame was kept
+    uint32_t lastStored;        // cell of the last frame kept
+    uint32_t framesDropped;     // queued but not (completely) on disk, or not matching their checksum
+    uint32_t cellsLost;         // moved past without a frame: between lastStored and filmAt
+    uint32_t readvances;        // Readvanced records, so the film may be up to this many cells past filmAt
+} JournalResumePoint;
+
+typedef struct ReelJournal ReelJournal;
+
+// CRC-32 (the one zip uses). Start with 0.
+uint32_t reelChecksum(uint32_t crc, const void *data, size_t length);
+
+// Start the journal for a new reel, replacing any journal at path. Returns NULL on error (errno is set).
+ReelJournal *reelJournalCreate(const char *path, const char *reelPath, uint32_t cells);
+
+// Open an existing journal and find where its committed records end. Returns NULL on error (errno is set,
+// ENOENT if there's no journal, EINVAL if it isn't one).
+ReelJournal *reelJournalOpen(const char *path);
+
+// Valid until the next record is appended, which may move the mapping
+const JournalHeader *reelJournalHeader(const ReelJournal *journal);
+size_t reelJournalCount(const ReelJournal *journal);
+
+// Append and commit a record. Return false if the journal couldn't be grown (errno is set).
+bool reelJournalMoved(ReelJournal *journal, uint32_t cell, uint8_t sequence, uint8_t response, uint8_t attempts);
+bool reelJournalReadvanced(ReelJournal *journal, uint32_t cell, uint8_t sequence, uint8_t response,
+                           uint8_t attempts);
+bool reelJournalStored(ReelJournal *journal, uint32_t cell, uint64_t imageOffset, uint64_t imageLength,
+                       uint32_t imageChecksum);
+
+// Work out where to carry on. The newest verify Stored records (up to JOURNAL_VERIFY_MAX) are checked
+// against the reel; the first that doesn't match is dropped along with everything stored after it. Older
+// ones must have been written: the sink can't have more frames waiting than it has buffers.
+void reelJournalResumePoint(const ReelJournal *journal, const ReelFile *reel, unsigned int verify,
+                            JournalResumePoint *point);
+
+// Record that the scan carries on from point, and count the session
+bool reelJournalResumed(ReelJournal *journal, const JournalResumePoint *point);
+
+// The reel was closed properly, there's nothing to resume. Syncs the journal.
+int reelJournalFinish(ReelJournal *journal);
+
+// Wait until everything committed is on the disk. Returns 0 or -1 (errno is set).
+int reelJournalSync(ReelJournal *journal);
+
+// Unmap and close. Committed records are kept whether or not they were synced.
+void reelJournalClose(ReelJournal *journal);
+
+#endif /* ReelJournal_h */
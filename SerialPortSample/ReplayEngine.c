@@ -0,0 +1,171 @@
+//
+//  ReplayEngine.c
+//  Feeds a traffic capture back through the same framing and parsing as the reader thread
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <string.h>
+#include <time.h>
+
+#include "Deadline.h"
+#include "ReplayEngine.h"
+
+typedef struct
+{
+    const ReplayOptions *options;
+    ReplayStats *stats;
+} Replay;
+
+// -------------------------------------------------------------------------------------------
+
+static void countResponse(void *context, const ParsedResponse *parsed, uint8_t sequence)
+{
+    Replay *replay = context;
+
+    if (parsed->response < ResponseCount)
+    {
+        replay->stats->responses[parsed->response]++;
+    }
+
+    if (replay->options->handler)
+    {
+        replay->options->handler(replay->options->context, parsed, sequence);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Arm or cancel a protocol switch the way SerialComms did before it sent this
+static void followCommand(LinkDecoder *link, const CaptureRecord *record)
+{
+    size_t prefixLength = strlen(CMD_BINARY);
+
+    if (linkDecoderIsBinary(link))
+    {
+        if (record->length > 1 && record->data[0] == BINARY_FRAME_START && record->data[1] == OpTextMode)
+        {
+            linkDecoderSwitchToTextAfterOk(link);
+            return;
+        }
+    }
+    else if (record->length >= prefixLength && memcmp(record->data, CMD_BINARY, prefixLength) == 0)
+    {
+        linkDecoderSwitchToBinaryAfterOk(link);
+        return;
+    }
+
+    // A new command means the host has given up on any switch that wasn't acknowledged
+    linkDecoderCancelSwitch(link);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Which command a sent record is, in the protocol the link was speaking when it went out
+static int sentCommand(LinkDecoder *link, const CaptureRecord *record)
+{
+    for (int command = 0; command < CommandCount; command++)
+    {
+        if (linkDecoderIsBinary(link))
+        {
+            if (record->length > 1 && record->data[0] == BINARY_FRAME_START &&
+                record->data[1] == binaryOpcodeForCommand((ArduinoCommand)command))
+            {
+                return command;
+            }
+        }
+        else if (record->length >= strlen(commandText(command)) &&
+                 memcmp(record->data, commandText(command), strlen(commandText(command))) == 0)
+        {
+            return command;
+        }
+    }
+
+    return -1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void sleepUntil(uint64_t deadline)
+{
+    uint64_t now = monotonicNanos();
+    struct timespec pause;
+
+    while (now < deadline)
+    {
+        pause.tv_sec = (time_t)((deadline - now) / NANOS_PER_SECOND);
+        pause.tv_nsec = (long)((deadline - now) % NANOS_PER_SECOND);
+        nanosleep(&pause, NULL);
+        now = monotonicNanos();
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+uint64_t replayCapture(const CaptureFile *file, const ReplayOptions *options, ReplayStats *stats)
+{
+    Replay replay = { options, stats };
+    LinkDecoder link;
+    CaptureRecord record;
+    size_t position = 0;
+    uint64_t startedAt;
+    uint64_t firstOffset = 0;
+    uint64_t decodeStart;
+    bool binary = false;
+    int command;
+
+    memset(stats, 0, sizeof(ReplayStats));
+    linkDecoderInit(&link, countResponse, NULL, &replay);
+
+    startedAt = monotonicNanos();
+    while (captureFileNext(file, &position, &record))
+    {
+        if (stats->records == 0)
+        {
+            firstOffset = record.offsetNanos;
+        }
+        stats->records++;
+        stats->recordNanos = record.offsetNanos;
+        if (record.offsetNanos > firstOffset)
+        {
+            stats->captureNanos = record.offsetNanos - firstOffset;
+        }
+
+        if (options->speed > 0 && record.offsetNanos > firstOffset)
+        {
+            sleepUntil(startedAt + (uint64_t)((double)(record.offsetNanos - firstOffset) / options->speed));
+        }
+
+        if (record.direction == CaptureSent)
+        {
+            stats->commands++;
+            stats->bytesSent += record.length;
+            if ((command = sentCommand(&link, &record)) >= 0)
+            {
+                stats->sentNanos[command] = record.offsetNanos;
+            }
+            followCommand(&link, &record);
+            continue;
+        }
+
+        stats->bytesReceived += record.length;
+        decodeStart = monotonicNanos();
+        linkDecoderFeed(&link, record.data, record.length);
+        stats->decodeNanos += monotonicNanos() - decodeStart;
+
+        if (linkDecoderIsBinary(&link) != binary)
+        {
+            binary = !binary;
+            stats->switches++;
+        }
+    }
+
+    stats->elapsedNanos = monotonicNanos() - startedAt;
+    stats->linesFramed = atomic_load(&link.linesFramed);
+    stats->framesDecoded = link.decoder.frames;
+    stats->crcErrors = link.decoder.crcErrors;
+    return stats->records;
+}
+
+// -------------------------------------------------------------------------------------------
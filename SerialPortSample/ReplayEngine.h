@@ -0,0 +1,54 @@
+//
+//  ReplayEngine.h
+//  Feeds a traffic capture back through the same framing and parsing as the reader thread
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Received bytes go into a LinkDecoder exactly as they came off the port, in the same chunks. Sent
+//  records are only used to follow the protocol: a CMD_BINARY or an OpTextMode frame arms the switch the
+//  host armed before sending it, and any other command cancels a switch that was never acknowledged. So
+//  a capture replays the same responses, in the same order, as the live session saw them.
+//
+//  At a speed of 1 the records are replayed at the pace they were captured; 0 replays them as fast as
+//  possible, which is what to use for benchmarking the parse path.
+//
+
+#ifndef ReplayEngine_h
+#define ReplayEngine_h
+
+#include <stdint.h>
+
+#include "LinkDecoder.h"
+#include "TrafficCapture.h"
+
+typedef struct
+{
+    double speed;                   // 1 for the original pace, 2 for twice as fast, 0 for as fast as possible
+    LinkResponseHandler handler;    // optional, gets every response
+    void *context;
+} ReplayOptions;
+
+typedef struct
+{
+    uint64_t records;
+    uint64_t bytesReceived;
+    uint64_t bytesSent;
+    uint64_t commands;              // sent records
+    uint64_t linesFramed;
+    uint64_t framesDecoded;
+    uint64_t crcErrors;
+    uint64_t switches;              // protocol switches that took effect
+    uint64_t responses[ResponseCount];
+    uint64_t recordNanos;           // offset of the record being replayed, as captured, to time responses by
+    uint64_t sentNanos[CommandCount];   // offset of the last record that sent each command, 0 if none has
+    uint64_t captureNanos;          // time from the first record to the last, as captured
+    uint64_t elapsedNanos;          // time the replay took
+    uint64_t decodeNanos;           // of which decoding the received bytes
+} ReplayStats;
+
+// Replay the whole capture. Returns the number of records replayed. stats is kept up to date as the replay
+// goes, so the handler can look at it too.
+uint64_t replayCapture(const CaptureFile *file, const ReplayOptions *options, ReplayStats *stats);
+
+#endif /* ReplayEngine_h */
@@ -0,0 +1,154 @@
+//
+//  ResponseParser.c
+//  Classifies lines received from the Arduino. Plain C so it can be used from the reader thread.
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <string.h>
+
+#include "ResponseParser.h"
+
+// Length of a string literal, worked out at compile time
+#define LITERAL_LENGTH(str)     (sizeof(str) - 1)
+
+// True if the line starts with the given response string
+#define HAS_PREFIX(line, length, str) \
+    ((length) >= LITERAL_LENGTH(str) && memcmp((line), (str), LITERAL_LENGTH(str)) == 0)
+
+typedef struct
+{
+    const char *text;
+    size_t length;
+} ProtocolString;
+
+static const ProtocolString kCommands[CommandCount] =
+{
+#define COMMAND_STRING(name, text, opcode, timeout, attempts) [Command##name] = { text, LITERAL_LENGTH(text) },
+    ARDUINO_COMMANDS(COMMAND_STRING)
+#undef COMMAND_STRING
+};
+
+static const ProtocolString kResponses[ResponseCount] =
+{
+    [Unrecognised] = { "", 0 },
+#define RESPONSE_STRING(name, text, key, opcode) [name] = { text, LITERAL_LENGTH(text) },
+    ARDUINO_RESPONSES(RESPONSE_STRING)
+#undef RESPONSE_STRING
+};
+
+// The only response that can match, by the first character after RESPONSE_PREFIX. Unrecognised (0) for
+// every other character.
+static const unsigned char kResponseByKey[256] =
+{
+#define RESPONSE_KEY(name, text, key, opcode) [(unsigned char)(key)] = name,
+    ARDUINO_RESPONSES(RESPONSE_KEY)
+#undef RESPONSE_KEY
+};
+
+// -------------------------------------------------------------------------------------------
+
+// "3 Timeout while moving" -> code 3, text "Timeout while moving". Text without a code is left as it is.
+static void parseErrorDetails(ParsedResponse *parsed)
+{
+    const char *next = parsed->text;
+    const char *end = parsed->text + parsed->textLength;
+    int code = 0;
+
+    if (next == end || *next < '0' || *next > '9')
+    {
+        return;
+    }
+
+    while (next < end && *next >= '0' && *next <= '9' && code < 100000)
+    {
+        code = code * 10 + (*next++ - '0');
+    }
+
+    while (next < end && *next == ' ')
+    {
+        next++;
+    }
+
+    parsed->errorCode = code;
+    parsed->text = next;
+    parsed->textLength = end - next;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void parseResponse(const char *line, size_t length, ParsedResponse *parsed)
+{
+    const size_t prefixLength = LITERAL_LENGTH(RESPONSE_PREFIX);
+    const ProtocolString *match;
+    ArduinoResponse response;
+
+    parsed->response = Unrecognised;
+    parsed->errorCode = NO_ERROR_CODE;
+    parsed->text = line;
+    parsed->textLength = length;
+
+    if (length > prefixLength && memcmp(line, RESPONSE_PREFIX, prefixLength) == 0)
+    {
+        response = kResponseByKey[(unsigned char)line[prefixLength]];
+        match = &kResponses[response];
+
+        if (response != Unrecognised && length >= match->length &&
+            memcmp(&line[prefixLength], &match->text[prefixLength], match->length - prefixLength) == 0)
+        {
+            parsed->response = response;
+            parsed->text = &line[match->length];
+            parsed->textLength = length - match->length;
+
+            if (response == Error)
+            {
+                parseErrorDetails(parsed);
+            }
+        }
+    }
+    else if (HAS_PREFIX(line, length, LOG_PREFIX))
+    {
+        parsed->response = LogMessage;
+        parsed->text = &line[LITERAL_LENGTH(LOG_PREFIX)];
+        parsed->textLength = length - LITERAL_LENGTH(LOG_PREFIX);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+ArduinoResponse classifyResponse(const char *line, size_t length)
+{
+    ParsedResponse parsed;
+
+    parseResponse(line, length, &parsed);
+    return parsed.response;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void parseBinaryError(const void *payload, size_t length, ParsedResponse *parsed)
+{
+    const unsigned char *bytes = payload;
+
+    parsed->response = Error;
+    parsed->errorCode = length > 0 ? bytes[0] : NO_ERROR_CODE;
+    parsed->text = length > 0 ? (const char *)&bytes[1] : (const char *)bytes;
+    parsed->textLength = length > 0 ? length - 1 : 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+const char *commandText(ArduinoCommand command)
+{
+    return command < CommandCount ? kCommands[command].text : "";
+}
+
+// -------------------------------------------------------------------------------------------
+
+const char *responseText(ArduinoResponse response)
+{
+    return response < ResponseCount && kResponses[response].text ? kResponses[response].text : "";
+}
+
+// -------------------------------------------------------------------------------------------
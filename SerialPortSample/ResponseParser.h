@@ -0,0 +1,45 @@
+//
+//  ResponseParser.h
+//  Classifies lines received from the Arduino. Plain C so it can be used from the reader thread.
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  The dispatch table is generated at compile time from the protocol table in ArduinoResponse.h. A line
+//  is classified with one prefix compare, one table lookup on the character after the prefix and one
+//  compare against the single response that can match. Nothing is allocated or copied: the text in the
+//  result points into the line.
+//
+
+#ifndef ResponseParser_h
+#define ResponseParser_h
+
+#include <stddef.h>
+
+#include "ArduinoResponse.h"
+
+#define NO_ERROR_CODE   -1
+
+typedef struct
+{
+    ArduinoResponse response;
+    int errorCode;          // the number after CTS:ERROR:, NO_ERROR_CODE if there isn't one
+    const char *text;       // what follows the response: error text, log text. Points into the line
+    size_t textLength;
+} ParsedResponse;
+
+// Work out which response a single line (without its NewLine) is, and pick out its details
+void parseResponse(const char *line, size_t length, ParsedResponse *parsed);
+
+// Just the response kind
+ArduinoResponse classifyResponse(const char *line, size_t length);
+
+// Split a binary OpError payload (code byte, then text) the same way
+void parseBinaryError(const void *payload, size_t length, ParsedResponse *parsed);
+
+// The protocol strings, e.g. "STC:PING" for CommandPing and "CTS:OK" for Ok. Empty for anything that
+// doesn't have one.
+const char *commandText(ArduinoCommand command);
+const char *responseText(ArduinoResponse response);
+
+#endif /* ResponseParser_h */
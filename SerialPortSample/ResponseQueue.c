@@ -0,0 +1,117 @@
+//
+//  ResponseQueue.c
+//  Lock-free single producer / single consumer queue of classified Arduino responses
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <string.h>
+
+#include "ResponseQueue.h"
+
+#define SLOT_MASK   (RESPONSE_QUEUE_SLOTS - 1)
+
+_Static_assert((RESPONSE_QUEUE_SLOTS & SLOT_MASK) == 0, "RESPONSE_QUEUE_SLOTS must be a power of two");
+
+// -------------------------------------------------------------------------------------------
+
+void responseQueueInit(ResponseQueue *queue)
+{
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->dropped = 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool responseQueuePush(ResponseQueue *queue, const ParsedResponse *parsed, uint8_t sequence, uint64_t receivedAt)
+{
+    size_t length = parsed->textLength;
+    uint64_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    ResponseEvent *slot;
+
+    if (tail - head == RESPONSE_QUEUE_SLOTS)
+    {
+        queue->dropped++;
+        return false;
+    }
+
+    if (length > RESPONSE_PAYLOAD_MAX - 1)
+    {
+        length = RESPONSE_PAYLOAD_MAX - 1;
+    }
+
+    slot = &queue->slots[tail & SLOT_MASK];
+    slot->response = parsed->response;
+    slot->receivedAt = receivedAt;
+    slot->sequence = sequence;
+    slot->errorCode = parsed->errorCode;
+    slot->length = (uint32_t)length;
+    memcpy(slot->payload, parsed->text, length);
+    slot->payload[length] = '\0';
+
+    // Publish the slot. The release pairs with the acquire in the consumer so it sees the whole event.
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+const ResponseEvent *responseQueuePeek(ResponseQueue *queue)
+{
+    uint64_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if (head == tail)
+    {
+        return NULL;
+    }
+
+    return &queue->slots[head & SLOT_MASK];
+}
+
+// -------------------------------------------------------------------------------------------
+
+void responseQueueRelease(ResponseQueue *queue)
+{
+    uint64_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    // Hand the slot back to the producer once we're done reading it
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool responseQueuePop(ResponseQueue *queue, ResponseEvent *event)
+{
+    const ResponseEvent *slot = responseQueuePeek(queue);
+
+    if (slot == NULL)
+    {
+        return false;
+    }
+
+    event->response = slot->response;
+    event->receivedAt = slot->receivedAt;
+    event->sequence = slot->sequence;
+    event->errorCode = slot->errorCode;
+    event->length = slot->length;
+    memcpy(event->payload, slot->payload, slot->length + 1);
+
+    responseQueueRelease(queue);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+size_t responseQueueSize(ResponseQueue *queue)
+{
+    uint64_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    uint64_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    return (size_t)(tail - head);
+}
+
+// -------------------------------------------------------------------------------------------
@@ -0,0 +1,66 @@
+//
+//  ResponseQueue.h
+//  Lock-free single producer / single consumer queue of classified Arduino responses
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  The reader thread is the only producer and the scan controller the only consumer. Slots are
+//  fixed size and live inside the queue, so nothing is allocated once the queue exists.
+//
+
+#ifndef ResponseQueue_h
+#define ResponseQueue_h
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ArduinoResponse.h"
+#include "ResponseParser.h"
+
+#define RESPONSE_QUEUE_SLOTS    256     // must be a power of two
+#define RESPONSE_PAYLOAD_MAX    256     // longer lines are truncated. Holds any binary frame payload
+
+#define CACHE_LINE_SIZE         64
+
+typedef struct
+{
+    ArduinoResponse response;
+    uint64_t receivedAt;                    // monotonicNanos() when the line was framed
+    uint8_t sequence;                       // sequence number echoed by the Arduino, 0 if it didn't send one
+    int errorCode;                          // for Error, NO_ERROR_CODE if the Arduino didn't send one
+    uint32_t length;                        // length of payload, without the NUL
+    char payload[RESPONSE_PAYLOAD_MAX];     // what followed the response (error or log text), NUL terminated.
+                                            // The whole line if it wasn't recognised
+} ResponseEvent;
+
+typedef struct
+{
+    // The producer and consumer indexes are kept on separate cache lines so the two threads don't
+    // keep invalidating each other's cache
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t head;    // next slot to read, only written by the consumer
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t tail;    // next slot to write, only written by the producer
+    _Alignas(CACHE_LINE_SIZE) uint64_t dropped;         // events lost because the queue was full (producer only)
+    ResponseEvent slots[RESPONSE_QUEUE_SLOTS];
+} ResponseQueue;
+
+void responseQueueInit(ResponseQueue *queue);
+
+// Producer side. Copies the parsed response, including its text, into the next free slot. Returns false
+// (and counts the drop) if full.
+bool responseQueuePush(ResponseQueue *queue, const ParsedResponse *parsed, uint8_t sequence, uint64_t receivedAt);
+
+// Consumer side. Returns the oldest event without removing it, or NULL if the queue is empty.
+// The event stays valid until responseQueueRelease is called.
+const ResponseEvent *responseQueuePeek(ResponseQueue *queue);
+void responseQueueRelease(ResponseQueue *queue);
+
+// Consumer side. Copies the oldest event out and removes it. Returns false if the queue is empty.
+bool responseQueuePop(ResponseQueue *queue, ResponseEvent *event);
+
+// Approximate number of queued events. Exact only when called from the producer or consumer thread.
+size_t responseQueueSize(ResponseQueue *queue);
+
+#endif /* ResponseQueue_h */
@@ -0,0 +1,394 @@
+//
+//  ScanPipeline.c
+//  Runs a reel as a pipeline: the film moves to the next cell while the previous frame is still
+//  being encoded and stored on worker threads
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Deadline.h"
+#include "ScanPipeline.h"
+
+// Bounded blocking queue of frames between two stages. Its capacity is the size of the frame pool,
+// so a push never has to wait: only pops block.
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    ScanFrame **frames;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool closed;            // no more frames will be pushed
+} FrameQueue;
+
+struct ScanPipeline
+{
+    ScanPipelineConfig config;
+    ScanStages stages;
+    ScanFrame *frames;          // the pool itself
+    FrameQueue freeFrames;      // store -> capture
+    FrameQueue toEncode;        // capture -> encode
+    FrameQueue toStore;         // encode -> store
+    ScanPipelineStats stats;    // each stage only updates its own entry
+    atomic_bool stopping;       // encode or store failed, so no more cells are advanced to
+};
+
+// -------------------------------------------------------------------------------------------
+
+static int frameQueueInit(FrameQueue *queue, size_t capacity)
+{
+    queue->frames = calloc(capacity, sizeof(ScanFrame *));
+    if (queue->frames == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->notEmpty, NULL);
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->closed = false;
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void frameQueueDestroy(FrameQueue *queue)
+{
+    if (queue->frames)
+    {
+        pthread_mutex_destroy(&queue->lock);
+        pthread_cond_destroy(&queue->notEmpty);
+        free(queue->frames);
+        queue->frames = NULL;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void frameQueueReopen(FrameQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = false;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void frameQueuePush(FrameQueue *queue, ScanFrame *frame)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->frames[(queue->head + queue->count) % queue->capacity] = frame;
+    queue->count++;
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void frameQueueClose(FrameQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Wait for the next frame. Returns NULL once the queue is closed and empty. The time spent waiting
+// is added to waitNanos.
+static ScanFrame *frameQueuePop(FrameQueue *queue, uint64_t *waitNanos)
+{
+    ScanFrame *frame = NULL;
+    uint64_t start = monotonicNanos();
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->closed)
+    {
+        pthread_cond_wait(&queue->notEmpty, &queue->lock);
+    }
+
+    if (queue->count > 0)
+    {
+        frame = queue->frames[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    *waitNanos += monotonicNanos() - start;
+    return frame;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void *encodeThread(void *context)
+{
+    ScanPipeline *pipeline = context;
+    ScanStageStats *stats = &pipeline->stats.stages[StageEncode];
+    ScanFrame *frame;
+    uint64_t start;
+
+    while ((frame = frameQueuePop(&pipeline->toEncode, &stats->waitNanos)) != NULL)
+    {
+        if (!frame->skip && pipeline->stages.encode)
+        {
+            start = monotonicNanos();
+            if (!pipeline->stages.encode(pipeline->stages.context, frame))
+            {
+                frame->skip = true;
+                atomic_store(&pipeline->stopping, true);
+            }
+            stats->busyNanos += monotonicNanos() - start;
+            stats->items++;
+        }
+
+        frameQueuePush(&pipeline->toStore, frame);
+    }
+
+    frameQueueClose(&pipeline->toStore);
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void *storeThread(void *context)
+{
+    ScanPipeline *pipeline = context;
+    ScanStageStats *stats = &pipeline->stats.stages[StageStore];
+    ScanFrame *frame;
+    uint64_t start;
+
+    while ((frame = frameQueuePop(&pipeline->toStore, &stats->waitNanos)) != NULL)
+    {
+        if (frame->skip)
+        {
+            pipeline->stats.framesSkipped++;
+        }
+        else
+        {
+            start = monotonicNanos();
+            if (pipeline->stages.store(pipeline->stages.context, frame))
+            {
+                pipeline->stats.framesStored++;
+            }
+            else
+            {
+                // A full or failing disk fails every frame after this one too, so stop moving the film
+                atomic_store(&pipeline->stopping, true);
+            }
+            stats->busyNanos += monotonicNanos() - start;
+            stats->items++;
+        }
+
+        // Hand the frame back to the capture stage
+        frameQueuePush(&pipeline->freeFrames, frame);
+    }
+
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+ScanPipeline *scanPipelineCreate(const ScanPipelineConfig *config, const ScanStages *stages)
+{
+    ScanPipeline *pipeline = calloc(1, sizeof(ScanPipeline));
+    size_t i;
+
+    if (pipeline == NULL || config->frameCount == 0)
+    {
+        free(pipeline);
+        return NULL;
+    }
+
+    pipeline->config = *config;
+    pipeline->stages = *stages;
+    pipeline->frames = calloc(config->frameCount, sizeof(ScanFrame));
+
+    if (pipeline->frames == NULL ||
+        frameQueueInit(&pipeline->freeFrames, config->frameCount) == -1 ||
+        frameQueueInit(&pipeline->toEncode, config->frameCount) == -1 ||
+        frameQueueInit(&pipeline->toStore, config->frameCount) == -1)
+    {
+        scanPipelineDestroy(pipeline);
+        return NULL;
+    }
+
+    // Allocate every frame up front. Nothing else is allocated while the reel runs.
+    for (i = 0; i < config->frameCount; i++)
+    {
+        ScanFrame *frame = &pipeline->frames[i];
+
+        frame->pixelCapacity = config->pixelBytes;
+        frame->encodedCapacity = config->encodedBytes;
+        frame->pixels = config->pixelBytes ? malloc(config->pixelBytes) : NULL;
+        frame->encoded = config->encodedBytes ? malloc(config->encodedBytes) : NULL;
+
+        if ((config->pixelBytes && frame->pixels == NULL) || (config->encodedBytes && frame->encoded == NULL))
+        {
+            scanPipelineDestroy(pipeline);
+            return NULL;
+        }
+
+        frameQueuePush(&pipeline->freeFrames, frame);
+    }
+
+    return pipeline;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void scanPipelineDestroy(ScanPipeline *pipeline)
+{
+    size_t i;
+
+    if (pipeline == NULL)
+    {
+        return;
+    }
+
+    if (pipeline->frames)
+    {
+        for (i = 0; i < pipeline->config.frameCount; i++)
+        {
+            free(pipeline->frames[i].pixels);
+            free(pipeline->frames[i].encoded);
+        }
+        free(pipeline->frames);
+    }
+
+    frameQueueDestroy(&pipeline->freeFrames);
+    frameQueueDestroy(&pipeline->toEncode);
+    frameQueueDestroy(&pipeline->toStore);
+    free(pipeline);
+}
+
+// -------------------------------------------------------------------------------------------
+
+uint32_t scanPipelineRun(ScanPipeline *pipeline, uint32_t cells)
+{
+    return scanPipelineRunFrom(pipeline, 0, cells);
+}
+
+// -------------------------------------------------------------------------------------------
+
+uint32_t scanPipelineRunFrom(ScanPipeline *pipeline, uint32_t firstCell, uint32_t cells)
+{
+    ScanStageStats *advanceStats = &pipeline->stats.stages[StageAdvance];
+    ScanStageStats *captureStats = &pipeline->stats.stages[StageCapture];
+    pthread_t encoder;
+    pthread_t storer;
+    ScanFrame *frame;
+    uint64_t runStart = monotonicNanos();
+    uint64_t start;
+    uint32_t cell;
+    bool ok;
+    int error;
+
+    memset(&pipeline->stats, 0, sizeof(pipeline->stats));
+    atomic_store(&pipeline->stopping, false);
+    pipeline->stats.cellsRequested = cells > firstCell ? cells - firstCell : 0;
+    frameQueueReopen(&pipeline->toEncode);
+    frameQueueReopen(&pipeline->toStore);
+
+    if ((error = pthread_create(&encoder, NULL, encodeThread, pipeline)) != 0)
+    {
+        pipeline->stats.threadError = error;
+        return 0;
+    }
+    if ((error = pthread_create(&storer, NULL, storeThread, pipeline)) != 0)
+    {
+        pipeline->stats.threadError = error;
+        frameQueueClose(&pipeline->toEncode);
+        pthread_join(encoder, NULL);
+        return 0;
+    }
+
+    for (cell = firstCell; cell < cells; cell++)
+    {
+        if (atomic_load(&pipeline->stopping))
+        {
+            break;
+        }
+
+        start = monotonicNanos();
+        ok = pipeline->stages.advance(pipeline->stages.context, cell);
+        advanceStats->busyNanos += monotonicNanos() - start;
+        if (!ok)
+        {
+            break;
+        }
+        advanceStats->items++;
+
+        // Blocks here if encode or store have fallen behind and every frame is in use
+        frame = frameQueuePop(&pipeline->freeFrames, &captureStats->waitNanos);
+
+        frame->cell = cell;
+        frame->pixelLength = 0;
+        frame->width = 0;
+        frame->height = 0;
+        frame->rowBytes = 0;
+        frame->encodedLength = 0;
+        frame->skip = false;
+
+        start = monotonicNanos();
+        ok = pipeline->stages.capture(pipeline->stages.context, frame);
+        captureStats->busyNanos += monotonicNanos() - start;
+        captureStats->items++;
+        if (!ok)
+        {
+            frameQueuePush(&pipeline->freeFrames, frame);
+            break;
+        }
+
+        frameQueuePush(&pipeline->toEncode, frame);
+    }
+
+    // Let the workers finish off what's already captured
+    frameQueueClose(&pipeline->toEncode);
+    pthread_join(encoder, NULL);
+    pthread_join(storer, NULL);
+
+    pipeline->stats.elapsedNanos = monotonicNanos() - runStart;
+    return cell > firstCell ? cell - firstCell : 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void scanPipelineGetStats(ScanPipeline *pipeline, ScanPipelineStats *stats)
+{
+    *stats = pipeline->stats;
+}
+
+// -------------------------------------------------------------------------------------------
+
+const char *scanStageName(ScanStage stage)
+{
+    static const char *names[StageCount] = { "advance", "capture", "encode", "store" };
+
+    return stage < StageCount ? names[stage] : "unknown";
+}
+
+// -------------------------------------------------------------------------------------------
+
+double scanStageRate(const ScanStageStats *stats)
+{
+    if (stats->items == 0 || stats->busyNanos == 0)
+    {
+        return 0.0;
+    }
+
+    return (double)stats->items * NANOS_PER_SECOND / (double)stats->busyNanos;
+}
+
+// -------------------------------------------------------------------------------------------
@@ -0,0 +1,103 @@
+//
+//  ScanPipeline.h
+//  Runs a reel as a pipeline: the film moves to the next cell while the previous frame is still
+//  being encoded and stored on worker threads
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Advance and capture run on the calling thread, because the film has to stand still for the capture.
+//  Encode and store each get their own thread. Frames come from a fixed pool, so memory use doesn't grow
+//  with the reel length: when all frames are in use the scan waits for the store stage to hand one back.
+//
+
+#ifndef ScanPipeline_h
+#define ScanPipeline_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+    StageAdvance,
+    StageCapture,
+    StageEncode,
+    StageStore,
+    StageCount
+} ScanStage;
+
+typedef struct
+{
+    uint32_t cell;              // film cell this frame belongs to, starting at 0
+    uint8_t *pixels;            // raw capture
+    size_t pixelCapacity;
+    size_t pixelLength;
+    uint32_t width;             // of the luminance plane at the start of pixels, set by capture. 0 if unknown
+    uint32_t height;
+    size_t rowBytes;
+    uint8_t *encoded;           // encoded image, ready to be stored
+    size_t encodedCapacity;
+    size_t encodedLength;
+    bool skip;                  // set by any stage to drop the frame without storing it
+} ScanFrame;
+
+// The work done in each stage. Any stage may return false to stop the reel; frames already captured are
+// still encoded and stored. A frame that fails encode isn't stored, and once encode or store has failed the
+// film isn't advanced to another cell. Encode may be NULL, in which case the raw pixels are stored.
+typedef struct
+{
+    void *context;
+    bool (*advance)(void *context, uint32_t cell);
+    bool (*capture)(void *context, ScanFrame *frame);
+    bool (*encode)(void *context, ScanFrame *frame);
+    bool (*store)(void *context, const ScanFrame *frame);
+} ScanStages;
+
+typedef struct
+{
+    size_t frameCount;          // frames in the pool, i.e. how far capture may run ahead of store
+    size_t pixelBytes;          // size of each raw frame buffer
+    size_t encodedBytes;        // size of each encoded frame buffer
+} ScanPipelineConfig;
+
+typedef struct
+{
+    uint64_t items;             // frames that went through the stage. For advance, cells the film got to
+    uint64_t busyNanos;         // time spent doing the stage's work
+    uint64_t waitNanos;         // time spent waiting for a free frame or for the previous stage
+} ScanStageStats;
+
+typedef struct
+{
+    ScanStageStats stages[StageCount];
+    uint64_t cellsRequested;
+    uint64_t framesStored;
+    uint64_t framesSkipped;
+    uint64_t elapsedNanos;      // wall time of the whole run
+    int threadError;            // why the encode and store threads couldn't be started, 0 if they were
+} ScanPipelineStats;
+
+typedef struct ScanPipeline ScanPipeline;
+
+// Returns NULL if the frame pool could not be allocated
+ScanPipeline *scanPipelineCreate(const ScanPipelineConfig *config, const ScanStages *stages);
+void scanPipelineDestroy(ScanPipeline *pipeline);
+
+// Scan the given number of cells. Blocks until every captured frame has been stored.
+// Returns the number of cells that were captured. The reel was cut short if fewer frames were stored and
+// skipped than cells were requested.
+uint32_t scanPipelineRun(ScanPipeline *pipeline, uint32_t cells);
+
+// The same, for a reel that was started before: cells firstCell up to (not including) cells
+uint32_t scanPipelineRunFrom(ScanPipeline *pipeline, uint32_t firstCell, uint32_t cells);
+
+void scanPipelineGetStats(ScanPipeline *pipeline, ScanPipelineStats *stats);
+
+// Name of a stage, for reports
+const char *scanStageName(ScanStage stage);
+
+// Frames per second a stage could sustain on its own, based on its busy time. Zero if it did no work.
+double scanStageRate(const ScanStageStats *stats);
+
+#endif /* ScanPipeline_h */
@@ -0,0 +1,355 @@
+//
+//  SensorStream.c
+//  The optic sensor telemetry stream: batches of raw samples from the Arduino, the queue they wait in for
+//  the scan thread, and timing the sprocket hole edges found in them against the cells
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <string.h>
+
+#include "Deadline.h"
+#include "SensorStream.h"
+
+#define SLOT_MASK   (SENSOR_RING_SLOTS - 1)
+#define NO_OFFSET   INT64_MAX
+
+_Static_assert((SENSOR_RING_SLOTS & SLOT_MASK) == 0, "SENSOR_RING_SLOTS must be a power of two");
+_Static_assert(TELEMETRY_HEADER_LENGTH + 2 * TELEMETRY_MAX_SAMPLES <= BINARY_MAX_PAYLOAD,
+               "A batch has to fit in a frame");
+
+// -------------------------------------------------------------------------------------------
+
+size_t telemetryEncode(uint32_t firstSample, uint16_t periodMicros, const uint16_t *samples, size_t count,
+                       uint8_t *payload)
+{
+    if (count > TELEMETRY_MAX_SAMPLES)
+    {
+        return 0;
+    }
+
+    payload[0] = (uint8_t)firstSample;
+    payload[1] = (uint8_t)(firstSample >> 8);
+    payload[2] = (uint8_t)(firstSample >> 16);
+    payload[3] = (uint8_t)(firstSample >> 24);
+    payload[4] = (uint8_t)periodMicros;
+    payload[5] = (uint8_t)(periodMicros >> 8);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        payload[TELEMETRY_HEADER_LENGTH + 2 * i] = (uint8_t)samples[i];
+        payload[TELEMETRY_HEADER_LENGTH + 2 * i + 1] = (uint8_t)(samples[i] >> 8);
+    }
+
+    return TELEMETRY_HEADER_LENGTH + 2 * count;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool telemetryDecode(const void *payload, size_t length, SensorBatch *batch)
+{
+    const uint8_t *bytes = payload;
+    size_t count;
+
+    if (length < TELEMETRY_HEADER_LENGTH || (length - TELEMETRY_HEADER_LENGTH) % 2 != 0)
+    {
+        return false;
+    }
+
+    count = (length - TELEMETRY_HEADER_LENGTH) / 2;
+    if (count > TELEMETRY_MAX_SAMPLES)
+    {
+        return false;
+    }
+
+    batch->firstSample = (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16
+                         | (uint32_t)bytes[3] << 24;
+    batch->periodMicros = (uint16_t)(bytes[4] | bytes[5] << 8);
+    batch->count = (uint16_t)count;
+
+    if (batch->periodMicros == 0)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *sample = &bytes[TELEMETRY_HEADER_LENGTH + 2 * i];
+        batch->samples[i] = (uint16_t)(sample[0] | sample[1] << 8);
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void sensorRingInit(SensorRing *ring)
+{
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->dropped = 0;
+    ring->malformed = 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool sensorRingPush(SensorRing *ring, const void *payload, size_t length, uint64_t receivedAt)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    SensorBatch *slot;
+
+    if (tail - head == SENSOR_RING_SLOTS)
+    {
+        ring->dropped++;
+        return false;
+    }
+
+    slot = &ring->slots[tail & SLOT_MASK];
+    if (!telemetryDecode(payload, length, slot))
+    {
+        ring->malformed++;
+        return false;
+    }
+    slot->receivedAt = receivedAt;
+
+    // Publish the slot. The release pairs with the acquire in the consumer so it sees the whole batch.
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+const SensorBatch *sensorRingPeek(SensorRing *ring)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head == tail)
+    {
+        return NULL;
+    }
+
+    return &ring->slots[head & SLOT_MASK];
+}
+
+// -------------------------------------------------------------------------------------------
+
+void sensorRingRelease(SensorRing *ring)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool sensorTrackerInit(SensorTracker *tracker, const EdgeDetectorConfig *config)
+{
+    EdgeDetectorConfig defaults;
+    bool valid;
+
+    memset(tracker, 0, sizeof(SensorTracker));
+
+    if (config == NULL)
+    {
+        edgeDetectorDefaultConfig(&defaults);
+        config = &defaults;
+    }
+
+    valid = edgeDetectorInit(&tracker->detector, config);
+    tracker->offset = NO_OFFSET;
+    latencyHistogramReset(&tracker->leads);
+    latencyHistogramReset(&tracker->moves);
+    return valid;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void noteEdge(SensorTracker *tracker, uint64_t at)
+{
+    if (tracker->edgeCount == SENSOR_EDGES_KEPT)
+    {
+        memmove(tracker->edges, tracker->edges + 1, (SENSOR_EDGES_KEPT - 1) * sizeof(uint64_t));
+        tracker->edgeCount--;
+    }
+
+    tracker->edges[tracker->edgeCount++] = at;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void sensorTrackerFeed(SensorTracker *tracker, const SensorBatch *batch)
+{
+    SensorEdge edges[TELEMETRY_MAX_SAMPLES];
+    int64_t periodNanos = (int64_t)batch->periodMicros * 1000;
+    uint64_t first = tracker->detector.next;
+    int64_t arrival;
+    int64_t offset;
+    size_t found;
+
+    tracker->stats.batches++;
+    tracker->stats.samples += batch->count;
+
+    if (!tracker->streaming || batch->firstSample != tracker->nextSample || batch->periodMicros != tracker->periodMicros)
+    {
+        // Anything before this doesn't carry on into it, so the filter and the clock start over
+        if (tracker->streaming)
+        {
+            uint32_t missing = batch->firstSample - tracker->nextSample;
+
+            if (batch->periodMicros == tracker->periodMicros && missing < UINT32_MAX / 2)
+            {
+                tracker->stats.lostSamples += missing;
+            }
+            tracker->stats.gaps++;
+        }
+
+        edgeDetectorRestart(&tracker->detector);
+        tracker->streaming = true;
+        tracker->periodMicros = batch->periodMicros;
+        tracker->offset = NO_OFFSET;
+        tracker->windowBatches = 0;
+    }
+    tracker->nextSample = batch->firstSample + batch->count;
+
+    if (batch->count == 0)
+    {
+        return;
+    }
+
+    // Where sample 0 would be if the last sample in this batch had been read the moment it was taken
+    arrival = (int64_t)batch->receivedAt - (int64_t)(first + batch->count - 1) * periodNanos;
+    if (tracker->windowBatches == 0 || arrival < tracker->windowOffset)
+    {
+        tracker->windowOffset = arrival;
+    }
+    offset = tracker->windowOffset < tracker->offset ? tracker->windowOffset : tracker->offset;
+
+    if (++tracker->windowBatches == SENSOR_CLOCK_BATCHES)
+    {
+        tracker->offset = tracker->windowOffset;
+        tracker->windowBatches = 0;
+    }
+
+    found = edgeDetectorRun(&tracker->detector, batch->samples, batch->count, edges, TELEMETRY_MAX_SAMPLES);
+    for (size_t i = 0; i < found; i++)
+    {
+        if (edges[i].rising)
+        {
+            noteEdge(tracker, (uint64_t)(offset + (int64_t)(edges[i].position * (double)periodNanos)));
+        }
+    }
+
+    tracker->coveredUntil = (uint64_t)(offset + (int64_t)(first + batch->count - 1) * periodNanos);
+    tracker->stats.detector = tracker->detector.stats;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Time the cell by the last rising edge between its NEXTCELL and a little after its ATCELL
+static void settleCell(SensorTracker *tracker, const SensorCell *cell)
+{
+    uint64_t latest = cell->atCellAt + SENSOR_MATCH_SLACK_MILLIS * NANOS_PER_MILLI;
+
+    for (unsigned int i = tracker->edgeCount; i-- > 0;)
+    {
+        uint64_t edge = tracker->edges[i];
+
+        if (edge > latest)
+        {
+            continue;
+        }
+
+        if (edge < cell->sentAt)
+        {
+            break;
+        }
+
+        tracker->stats.matched++;
+        latencyHistogramRecord(&tracker->moves, edge - cell->sentAt);
+
+        if (edge > cell->atCellAt)
+        {
+            tracker->stats.late++;
+        }
+        else
+        {
+            latencyHistogramRecord(&tracker->leads, cell->atCellAt - edge);
+        }
+        return;
+    }
+
+    tracker->stats.missed++;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void removeFirstCell(SensorTracker *tracker)
+{
+    tracker->cellCount--;
+    memmove(tracker->cells, tracker->cells + 1, tracker->cellCount * sizeof(SensorCell));
+}
+
+// -------------------------------------------------------------------------------------------
+
+void sensorTrackerCell(SensorTracker *tracker, uint64_t sentAt, uint64_t atCellAt)
+{
+    tracker->stats.cells++;
+
+    if (tracker->cellCount == SENSOR_CELLS_PENDING)
+    {
+        tracker->stats.abandoned++;
+        removeFirstCell(tracker);
+    }
+
+    tracker->cells[tracker->cellCount++] = (SensorCell){ sentAt, atCellAt };
+}
+
+// -------------------------------------------------------------------------------------------
+
+void sensorTrackerUpdate(SensorTracker *tracker, SensorRing *ring, uint64_t now)
+{
+    const SensorBatch *batch;
+
+    while (ring && (batch = sensorRingPeek(ring)) != NULL)
+    {
+        sensorTrackerFeed(tracker, batch);
+        sensorRingRelease(ring);
+    }
+
+    // The cells are in the order their ATCELLs came, so the first one still waiting holds up the rest
+    while (tracker->cellCount > 0)
+    {
+        const SensorCell *cell = &tracker->cells[0];
+
+        if (tracker->streaming && tracker->coveredUntil >= cell->atCellAt + SENSOR_MATCH_SLACK_MILLIS * NANOS_PER_MILLI)
+        {
+            settleCell(tracker, cell);
+        }
+        else if (now >= cell->atCellAt + SENSOR_CELL_TIMEOUT_MILLIS * NANOS_PER_MILLI)
+        {
+            tracker->stats.abandoned++;
+        }
+        else
+        {
+            break;
+        }
+
+        removeFirstCell(tracker);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+void sensorTrackerFinish(SensorTracker *tracker)
+{
+    while (tracker->cellCount > 0)
+    {
+        settleCell(tracker, &tracker->cells[0]);
+        removeFirstCell(tracker);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
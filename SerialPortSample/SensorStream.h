@@ -0,0 +1,149 @@
+//
+//  SensorStream.h
+//  The optic sensor telemetry stream: batches of raw samples from the Arduino, the queue they wait in for
+//  the scan thread, and timing the sprocket hole edges found in them against the cells
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  In binary mode STC:STREAMON makes the Arduino send the optic sensor's readings as they're taken, in
+//  OpTelemetry frames of up to TELEMETRY_MAX_SAMPLES, until STC:STREAMOFF. The payload is the number of
+//  the first sample in the batch (uint32), the time between samples in microseconds (uint16), then the
+//  samples (uint16), all little-endian.
+//
+//  The reader thread puts every batch in a SensorRing and gets on with the port: decoding the samples
+//  is all it does. The scan thread takes them out when it has time, runs them through an EdgeDetector and
+//  times every rising edge (a sprocket hole arriving) on the host's clock. A cell's edge is the last one
+//  after its NEXTCELL went out and before its ATCELL arrived, give or take SENSOR_MATCH_SLACK_MILLIS for
+//  a batch that was still on its way. What comes out is how long before the ATCELL the film was really
+//  in place, and how long the move really took, as histograms: the jitter the firmware's own detection
+//  and the trip over the port add to every cell.
+//
+//  Sample times: samples are taken every periodMicros, so only where the run of samples sits on the
+//  host's clock has to be worked out. Each batch arrived some time after its last sample was taken; the
+//  quickest arrival in the last SENSOR_CLOCK_BATCHES batches is taken as the one with no delay. That
+//  keeps a batch that sat in a buffer from moving the edges in it, and still follows the two clocks
+//  drifting apart. A gap in the sample numbers (batches lost on the port or in a full ring) starts the
+//  detector and the clock over.
+//
+//  Offline: nothing here reads a clock. Give it the capture's record times and a recorded stream times
+//  the same way it did live (see capreplay --edges).
+//
+
+#ifndef SensorStream_h
+#define SensorStream_h
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "BinaryProtocol.h"
+#include "EdgeDetector.h"
+#include "LatencyHistogram.h"
+#include "ResponseQueue.h"
+
+#define TELEMETRY_HEADER_LENGTH     6
+#define TELEMETRY_MAX_SAMPLES       ((BINARY_MAX_PAYLOAD - TELEMETRY_HEADER_LENGTH) / 2)
+
+#define SENSOR_RING_SLOTS           512     // batches, must be a power of two. Seconds of samples at the usual rate
+#define SENSOR_CLOCK_BATCHES        64      // batches the quickest arrival is looked for in
+#define SENSOR_EDGES_KEPT           32      // recent rising edges, to match cells against
+#define SENSOR_CELLS_PENDING        8       // cells waiting for the samples around their ATCELL
+#define SENSOR_MATCH_SLACK_MILLIS   20      // an edge this long after the ATCELL still counts
+#define SENSOR_CELL_TIMEOUT_MILLIS  250     // give up on the samples around a cell after this long
+
+typedef struct
+{
+    uint64_t receivedAt;                    // when the batch was read off the port
+    uint32_t firstSample;                   // the Arduino's number for the first sample
+    uint16_t periodMicros;
+    uint16_t count;
+    uint16_t samples[TELEMETRY_MAX_SAMPLES];
+} SensorBatch;
+
+// Single producer (the reader thread) / single consumer (the scan thread) queue of batches, like
+// ResponseQueue
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t head;    // next slot to read, only written by the consumer
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t tail;    // next slot to write, only written by the producer
+    _Alignas(CACHE_LINE_SIZE) uint64_t dropped;         // batches lost because the ring was full (producer only)
+    uint64_t malformed;                                 // payloads that weren't a batch (producer only)
+    SensorBatch slots[SENSOR_RING_SLOTS];
+} SensorRing;
+
+typedef struct
+{
+    uint64_t batches;
+    uint64_t samples;
+    uint64_t lostSamples;           // missing from the sample numbers: dropped here or never arrived
+    uint64_t gaps;                  // times the detector had to start over
+    uint64_t cells;                 // cells given to sensorTrackerCell
+    uint64_t matched;               // with an edge
+    uint64_t missed;                // no edge between the NEXTCELL and the ATCELL
+    uint64_t late;                  // the edge came after the ATCELL, within the slack
+    uint64_t abandoned;             // cells pending when the tracker was full, or the samples never came
+    EdgeDetectorStats detector;
+} SensorTrackerStats;
+
+typedef struct
+{
+    uint64_t sentAt;                // NEXTCELL went out
+    uint64_t atCellAt;              // ATCELL arrived
+} SensorCell;
+
+typedef struct
+{
+    EdgeDetector detector;
+    bool streaming;                 // a batch has been seen since the last gap
+    uint32_t nextSample;            // the Arduino's number of the sample expected next
+    uint16_t periodMicros;
+    int64_t offset;                 // host time of detector sample 0, from the quickest arrival
+    int64_t windowOffset;           // quickest in the batches so far in this window
+    unsigned int windowBatches;
+    uint64_t coveredUntil;          // host time of the last sample run through the detector
+    uint64_t edges[SENSOR_EDGES_KEPT];  // host times of the recent rising edges, oldest first
+    unsigned int edgeCount;
+    SensorCell cells[SENSOR_CELLS_PENDING];
+    unsigned int cellCount;
+    SensorTrackerStats stats;
+    LatencyHistogram leads;         // rising edge to ATCELL
+    LatencyHistogram moves;         // NEXTCELL sent to rising edge
+} SensorTracker;
+
+// Build an OpTelemetry payload. Returns its length, or 0 if count is more than TELEMETRY_MAX_SAMPLES.
+size_t telemetryEncode(uint32_t firstSample, uint16_t periodMicros, const uint16_t *samples, size_t count,
+                       uint8_t *payload);
+
+// Unpack an OpTelemetry payload into batch, apart from receivedAt. Returns false if it isn't one.
+bool telemetryDecode(const void *payload, size_t length, SensorBatch *batch);
+
+void sensorRingInit(SensorRing *ring);
+
+// Producer side. Decodes the payload into the next free slot. Returns false (and counts it) if the
+// payload isn't a batch or the ring is full.
+bool sensorRingPush(SensorRing *ring, const void *payload, size_t length, uint64_t receivedAt);
+
+// Consumer side. The oldest batch, or NULL if there is none. It stays valid until sensorRingRelease.
+const SensorBatch *sensorRingPeek(SensorRing *ring);
+void sensorRingRelease(SensorRing *ring);
+
+// config may be NULL for edgeDetectorDefaultConfig. Returns false if it wasn't valid and the defaults
+// are used instead.
+bool sensorTrackerInit(SensorTracker *tracker, const EdgeDetectorConfig *config);
+
+// Run one batch through the detector and note its rising edges
+void sensorTrackerFeed(SensorTracker *tracker, const SensorBatch *batch);
+
+// A cell to find the edge of: its NEXTCELL was sent at sentAt and its ATCELL arrived at atCellAt
+void sensorTrackerCell(SensorTracker *tracker, uint64_t sentAt, uint64_t atCellAt);
+
+// Feed everything waiting in the ring, then settle the cells whose samples are all in, or that have
+// waited SENSOR_CELL_TIMEOUT_MILLIS past now. ring may be NULL to only settle them.
+void sensorTrackerUpdate(SensorTracker *tracker, SensorRing *ring, uint64_t now);
+
+// Settle every pending cell with the samples there are, e.g. at the end of a stream or a replay
+void sensorTrackerFinish(SensorTracker *tracker);
+
+#endif /* SensorStream_h */
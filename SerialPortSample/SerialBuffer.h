@@ -7,12 +7,22 @@
 //
 #import <Foundation/Foundation.h>
 
+#import "LineFramer.h"
+
+// Thin Objective-C wrapper around LineFramer. Bytes are read straight into a fixed-size buffer and
+// handed out again as complete lines without allocating anything per line.
 @interface SerialBuffer : NSObject
-@property (nonatomic, strong) NSMutableArray<NSString *> *buffer;
 
-- (void)enqueue:(NSString *)string;  // Add a string to the end
-- (NSString *)dequeue;              // Remove and return the string at the front
-- (NSUInteger)size;                 // Get the number of elements in the buffer
+- (ssize_t)readFrom:(int)fileDescriptor;    // Do a single read() from the port into the buffer
+- (const char *)latestBytes:(size_t)count;  // The last count bytes appended, e.g. by the last readFrom
+- (void)appendBytes:(const char *)bytes length:(size_t)length;
+- (BOOL)nextLine:(LineView *)line;          // Take the next complete line, without copying it
+- (void)clear;                              // Drop everything, including partial lines
+
+- (void)enqueue:(NSString *)string;  // Add a string to the end as a complete line
+- (NSString *)dequeue;              // Remove and return the line at the front
+- (NSUInteger)size;                 // Get the number of complete lines in the buffer
+- (NSUInteger)pendingBytes;         // Number of buffered bytes, including a partial line
 - (BOOL)isEmpty;
 
 @end
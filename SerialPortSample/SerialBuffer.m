@@ -7,8 +7,12 @@
 //
 
 #import "SerialBuffer.h"
+#import "TraceLog.h"
 
 @implementation SerialBuffer
+{
+    LineFramer _framer;
+}
 
 // -------------------------------------------------------------------------------------------
 
@@ -17,44 +21,99 @@
     self = [super init];
     if (self)
     {
-        _buffer = [NSMutableArray array];
+        lineFramerInit(&_framer);
     }
     return self;
 }
 
 // -------------------------------------------------------------------------------------------
 
+- (ssize_t)readFrom:(int)fileDescriptor
+{
+    ssize_t numBytes = lineFramerReadFrom(&_framer, fileDescriptor);
+
+    if (numBytes > 0)
+    {
+        traceLogTraffic(TraceReceived, lineFramerLatest(&_framer, (size_t)numBytes), (size_t)numBytes);
+    }
+
+    return numBytes;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (const char *)latestBytes:(size_t)count
+{
+    return lineFramerLatest(&_framer, count);
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (void)appendBytes:(const char *)bytes length:(size_t)length
+{
+    if (lineFramerAppend(&_framer, bytes, length) < length)
+    {
+        NSLog(@"SerialBuffer is full. Dropped %zu bytes", length);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (BOOL)nextLine:(LineView *)line
+{
+    return lineFramerNext(&_framer, line);
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (void)clear
+{
+    lineFramerReset(&_framer);
+}
+
+// -------------------------------------------------------------------------------------------
+
 - (void)enqueue:(NSString *)string
 {
-    [self.buffer addObject:string];
+    const char *bytes = [string UTF8String];
+
+    [self appendBytes:bytes length:strlen(bytes)];
+    [self appendBytes:"\n" length:1];
 }
 
 // -------------------------------------------------------------------------------------------
 
 - (NSString *)dequeue
 {
-    if ([self isEmpty])
+    LineView line;
+
+    if (!lineFramerNext(&_framer, &line))
     {
         return nil; // Return nil if the buffer is empty
     }
     
-    NSString *firstString = self.buffer[0];
-    [self.buffer removeObjectAtIndex:0];
-    return firstString;
+    return [[NSString alloc] initWithBytes:line.data length:line.length encoding:NSUTF8StringEncoding];
 }
 
 // -------------------------------------------------------------------------------------------
 
 - (NSUInteger)size
 {
-    return self.buffer.count;
+    return lineFramerLineCount(&_framer);
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (NSUInteger)pendingBytes
+{
+    return lineFramerPending(&_framer);
 }
 
 // -------------------------------------------------------------------------------------------
 
 - (BOOL)isEmpty
 {
-    return self.buffer.count == 0;
+    return lineFramerLineCount(&_framer) == 0;
 }
 
 // -------------------------------------------------------------------------------------------
@@ -14,25 +14,40 @@
 #import <Foundation/Foundation.h>
 #import <CoreFoundation/CoreFoundation.h>
 #import <IOKit/IOKitLib.h>
-#import <IOKit/serial/IOSerialKeys.h>
-#import <IOKit/serial/ioss.h>
-#import <IOKit/IOBSD.h>
-#import <IOKit/usb/IOUSBLib.h>
-#import <IOKit/IOCFPlugIn.h>
 
 #import "Utilities.h"
 #import "ArduinoResponse.h"
+#import "BinaryProtocol.h"
+#import "CommandMetrics.h"
+#import "CommandWindow.h"
+#import "CommandWriter.h"
+#import "Deadline.h"
+#import "ReadyHandshake.h"
+#import "ResponseParser.h"
+#import "SerialBuffer.h"
+#import "SensorStream.h"
+#import "SerialReader.h"
+#import "SerialTransport.h"
+#import "TrafficCapture.h"
+#import "TraceLog.h"
+
+#define MAX_SERIAL_PORTS    16      // Most ports findSerialPorts will remember
+#define COMMAND_WINDOW_SIZE 4       // Commands in flight at once with the binary protocol. The text protocol allows one
+#define TELEMETRY_UPDATE_MILLIS 100 // How often the sensor samples are taken in while waiting for a reply
 
 @interface SerialComms : NSObject
 
-// Hold the original termios attributes so we can reset them
-@property struct termios gOriginalTTYAttrs;
-@property io_iterator_t serialPortIterator;
 @property NSString *preferedPath;       // configured USB port. If not found, the app will try the first one available
 @property int fileDescriptor;           // the file descriptor that we're using to read/write through
+@property SerialPortOptions portOptions;    // baud rate, flow control etc. used by openSerialPort. Defaults to 9600 baud
+@property NSString *readerName;         // what the reader thread is called in the trace log. Defaults to "reader"
+@property NSString *writerName;         // and the writer thread. Defaults to "writer"
 
 - (id)init:(NSString *)preferedPath;
 
+// Use a different backend for discovering and opening ports. The default is IOKit on macOS and POSIX elsewhere.
+- (id)init:(NSString *)preferedPath backend:(const SerialTransportBackend *)backend;
+
 // Function prototypes
 //- (kern_return_t) findSerialPorts:(io_iterator_t *)matchingServices;
 - (kern_return_t) findSerialPorts;
@@ -47,10 +62,111 @@
 
 - (void)closeSerialPort;
 
+// Close a port that has gone away (e.g. the USB adapter was reset) without trying to talk to the Arduino,
+// so it can be opened again, possibly under a different path
+- (void) dropSerialPort;
+
+// False once the port has gone away: the reader thread has stopped with an error
+- (Boolean) isConnected;
+
+// Start the background thread that drains the port into a queue of classified responses. This is done by
+// openSerialPort. While it's running, all reads are taken from that queue instead of the port.
+- (Boolean) startReader;
+- (void) stopReader;
+
+// How much the reader threads have read so far, every time the port was open added up
+- (SerialReaderStats) readerStats;
+
+// Everything written goes through a CommandWriter, which openSerialPort starts and closeSerialPort stops
+// after giving what's still queued portOptions.drainMillis to go out. These are its stats, added up the
+// same way.
+- (CommandWriterStats) writerStats;
+
+// Record every byte sent and received, with timestamps, until stopCapture (or closeSerialPort). The file
+// can be replayed with ReplayEngine.h. Returns false if the file couldn't be created.
+- (Boolean) startCapture:(NSString *)path;
+- (void) stopCapture;
+
+// Wait until the Arduino, which has just been reset by opening the port, is ready for commands: for its
+// CTS:READY, pinging in case that doesn't come (see ReadyHandshake.h). Returns as soon as a ping has been
+// answered, or false if none was within timeoutMillis. Only for the text protocol.
+- (Boolean) waitUntilReady:(uint32_t)timeoutMillis;
+
+// How the last handshake went, including how long after opening the port the Arduino was ready
+- (HandshakeStats) handshakeStats;
+
+// waitUntilReady with HANDSHAKE_TIMEOUT_MILLIS
 - (Boolean) isArduinoOnline;
 
+// Send a command in whichever protocol the link is using, without tracking it. Returns the number of bytes
+// queued or -1, without waiting for the port. Use submitCommand or runCommand to have the reply matched to
+// the command.
+- (ssize_t) sendCommand:(ArduinoCommand)command;
+
+// Send a command and track it in the command window. Returns its sequence number, or -1 if it could not be
+// sent. Waits for room if the window is full. A timeout or attempts of 0 use the command's policy
+// (see CommandWindow.c); a command that times out is sent again until it runs out of attempts.
+- (int) submitCommand:(ArduinoCommand)command timeout:(uint32_t)timeoutMillis attempts:(uint8_t)attempts;
+
+// Wait for a submitted command to finish. Returns Ok, Error (the Arduino reported an error before its OK)
+// or TimedOut (no OK after the last attempt).
+- (ArduinoResponse) waitForCommand:(int)sequence;
+
+// Submit and wait in one go
+- (ArduinoResponse) runCommand:(ArduinoCommand)command timeout:(uint32_t)timeoutMillis;
+
+// The same, but a command whose attempts have all timed out gets graceMillis more to finish before it's given
+// up on. Its slot (see lastCommand) says whether it needed them.
+- (ArduinoResponse) runCommand:(ArduinoCommand)command timeout:(uint32_t)timeoutMillis grace:(uint32_t)graceMillis;
+
+// The last command waited for, as it finished: its result and when each reply arrived
+- (CommandSlot) lastCommand;
+
+// Send a batch of commands without waiting for each reply before sending the next, as far as the window
+// allows, then wait for all of them. Each result goes into results. Returns true if they all succeeded.
+- (Boolean) runCommands:(const ArduinoCommand *)commands count:(int)count results:(ArduinoResponse *)results;
+
+- (CommandWindowStats) commandStats;
+
+// Latency histograms of every command since the port object was created, reconnects included. Only to be
+// read on the thread driving the port.
+- (const CommandMetrics *) commandMetrics;
+- (void) logCommandMetrics;
+
+// Write the command metrics to a file as JSON
+- (Boolean) writeCommandMetrics:(NSString *)path;
+
+// Ask the Arduino to switch to the binary protocol at the given baud rate (0 keeps the current one).
+// Returns true once a binary ping has been answered at the new rate. On failure the link is put back to
+// the text protocol at the original rate, so the scan can carry on either way. Needs the reader thread.
+- (Boolean) negotiateBinaryMode:(uint32_t)baudRate;
+
+// Go back to the text protocol at the original baud rate. Done by closeSerialPort too.
+- (void) leaveBinaryMode;
+
+- (Boolean) isBinaryMode;
+
+// Have the Arduino stream its optic sensor readings (see SensorStream.h), and time the sprocket hole edges in
+// them against each NEXTCELL's ATCELL while commands are waited for. Needs the binary protocol. Stopped by
+// closeSerialPort, which logs how the edges lined up with the ATCELLs; a dropped port keeps what it has so
+// far for when telemetry is started again.
+- (Boolean) startTelemetry;
+- (void) stopTelemetry;
+
+// Edges, cells matched and missed since telemetry was started. Only to be read on the thread driving the port.
+- (SensorTrackerStats) telemetryStats;
+- (const SensorTracker *) sensorTracker;
+
 - (ArduinoResponse) readSerialCommand;
 
+// Read the next response, waiting no longer than the deadline (in monotonicNanos() time).
+// Returns TimedOut if no complete line arrived in time.
+- (ArduinoResponse) readSerialCommandBefore:(uint64_t)deadline;
+
+// Wait until the expected response (or an Error) arrives. Any other responses received in the
+// meantime are logged and skipped. Returns TimedOut if nothing matched within timeoutMillis.
+- (ArduinoResponse) waitForResponse:(ArduinoResponse)expected timeout:(uint64_t)timeoutMillis;
+
 
 /*
  I'll try to explain what you have here,
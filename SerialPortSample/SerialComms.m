@@ -8,269 +8,471 @@
 
 #import "SerialComms.h"
 
+// The reader is started afresh every time the port is opened or the protocol falls back, so add up what
+// each one did
+static void addReaderStats(SerialReaderStats *total, const SerialReaderStats *reader)
+{
+    total->bytesRead += reader->bytesRead;
+    total->linesFramed += reader->linesFramed;
+    total->logMessages += reader->logMessages;
+    total->responsesDropped += reader->responsesDropped;
+    total->logDropped += reader->logDropped;
+    total->bytesDiscarded += reader->bytesDiscarded;
+    total->framesDecoded += reader->framesDecoded;
+    total->crcErrors += reader->crcErrors;
+    total->telemetryFrames += reader->telemetryFrames;
+    total->lastError = reader->lastError;
+    total->running = reader->running;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Likewise for the writers
+static void addWriterStats(CommandWriterStats *total, const CommandWriterStats *writer)
+{
+    total->commands += writer->commands;
+    total->bytes += writer->bytes;
+    total->writes += writer->writes;
+    total->coalesced += writer->coalesced;
+    total->partialWrites += writer->partialWrites;
+    total->wouldBlock += writer->wouldBlock;
+    total->rejected += writer->rejected;
+    total->discarded += writer->discarded;
+    total->maxQueued = writer->maxQueued > total->maxQueued ? writer->maxQueued : total->maxQueued;
+    total->queued = writer->queued;
+    total->lastError = writer->lastError;
+    total->running = writer->running;
+}
+
+// -------------------------------------------------------------------------------------------
+
 @implementation SerialComms
+{
+    SerialBuffer *_receiveBuffer;   // Bytes read from the port, handed out again line by line
+    SerialReader *_reader;          // Background reader thread. NULL if we're reading the port directly
+    CommandWriter *_writer;         // Everything written to the port is queued here. NULL while the port is closed
+    SerialTransport _transport;     // Backend that discovers and opens the port
+    SerialPortInfo _ports[MAX_SERIAL_PORTS];    // Ports found by findSerialPorts
+    int _portCount;
+    uint32_t _textBaudRate;         // Baud rate the text protocol runs at, which is what we go back to
+    CommandWindow _window;          // Commands in flight, so replies can be matched to them
+    TrafficCapture *_capture;       // Every byte sent and received goes in here while capturing. NULL otherwise
+    SerialReaderStats _readerStats; // What the reader threads that have been stopped did between them
+    CommandWriterStats _writerStats; // And the writers
+    uint64_t _openedAt;             // monotonicNanos() when the port was last opened
+    HandshakeStats _handshakeStats; // How the last waitUntilReady went
+    CommandMetrics *_metrics;       // Latencies of every command sent. Allocated, it's too big to embed
+    CommandSlot _lastCommand;       // The last command waited for, as it finished
+    SensorRing *_sensorRing;        // Telemetry batches on their way from the reader thread. NULL without telemetry
+    SensorTracker *_sensorTracker;  // Times the edges in them against the cells
+    Boolean _streaming;             // The Arduino has been asked to send telemetry
+    Boolean _hungUp;                // Reading the port directly found it gone (EOF), until it's opened again
+}
 
 // -------------------------------------------------------------------------------------------
 
 - (instancetype)init:(NSString *)preferredPort
 {
+    return [self init:preferredPort backend:defaultSerialBackend()];
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (instancetype)init:(NSString *)preferredPort backend:(const SerialTransportBackend *)backend
+{
+    SerialPortOptions options;
+
     self = [super init];
     if (self)
     {
         _preferedPath = preferredPort;
         _fileDescriptor = -1;
-        //IOObjectRelease(serialPortIterator);  // I doubt this is needed
+        _receiveBuffer = [[SerialBuffer alloc] init];
+        _reader = NULL;
+        _writer = NULL;
+        _capture = NULL;
+        _portCount = 0;
+        serialTransportInit(&_transport, backend);
+        commandWindowInit(&_window, COMMAND_WINDOW_SIZE);
+        _metrics = malloc(sizeof(CommandMetrics));
+        if (_metrics == NULL)
+        {
+            return nil;
+        }
+        commandMetricsReset(_metrics, monotonicNanos());
+
+        // For the time being I'm just using 9600 Baud, because that's what the Arduino defaults to
+        serialPortDefaultOptions(&options);
+        options.lowLatency = true;
+        _portOptions = options;
     }
     return self;
 }
 
 // -------------------------------------------------------------------------------------------
 
+- (void)dealloc
+{
+    [self stopReader];
+    [self stopWriter:false];
+    free(_sensorRing);
+    free(_sensorTracker);
+    free(_metrics);
+}
+
+// -------------------------------------------------------------------------------------------
+
 // After running 'findSerialPorts' and 'getUsbPath' we should have a valid USB serial path.
-// This function opens that port for reading and writing.
+// This function opens that port for reading and writing. The termios set up (raw mode, baud rate,
+// handshake lines) and any platform specific tuning is done by the transport backend.
 // Return the file descriptor associated with the device.
 /// - Tag: openSerialPortFunction
-// PTO : For the time being I'm just using 9600 Baud, because that's what the Arduino defaults to
 - (int)openSerialPort
-//- (int)openSerialPort:(NSString *)portPath
 {
-    int handshake;
-    struct termios options;
-    NSString *lastError = @"";
-    
+    SerialPortOptions options = _portOptions;
+
     if (_fileDescriptor != -1)
     {
-        NSLog(@"Error. Port [%@] appears to be open already. Close it before opening - %s(%d).\n", _preferedPath, strerror(errno), errno);
-        goto error;
+        NSLog(@"Error. Port [%@] appears to be open already. Close it before opening.\n", _preferedPath);
+        return -1;
     }
-    
+
     // The port functions require a char array, so convert the NSString
     const char *cPortPath = [_preferedPath UTF8String];
-    
-    // Open the serial port read/write, with no controlling terminal, and don't wait for a connection.
-    // The O_NONBLOCK flag also causes subsequent I/O on the device to be non-blocking.
-    // See open(2) <x-man-page://2/open> for details.
-    _fileDescriptor = open(cPortPath, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    NSLog(@"Opening %@ at %u baud using the %s backend", _preferedPath, options.baudRate, _transport.backend->name);
+    _fileDescriptor = serialTransportOpen(&_transport, cPortPath, &options);
+    _openedAt = monotonicNanos();
+    _hungUp = false;
+    if (_transport.lastWarning[0])
+    {
+        NSLog(@"%s", _transport.lastWarning);
+    }
     if (_fileDescriptor == -1)
     {
-        NSLog(@"Error opening serial port %@ - %s(%d).\n", _preferedPath, strerror(errno), errno);
-        goto error;
-    }
-
-    // Note that open() follows POSIX semantics: multiple open() calls to the same file will succeed
-    // unless the TIOCEXCL ioctl is issued. This will prevent additional opens except by root-owned
-    // processes.
-    // See tty(4) <x-man-page//4/tty> and ioctl(2) <x-man-page//2/ioctl> for details.
-    if (ioctl(_fileDescriptor, TIOCEXCL) == -1)
-    {
-        NSLog(@"Error setting TIOCEXCL on %@ - %s(%d).\n", _preferedPath, strerror(errno), errno);
-        goto error;
-    }
-    
-    // Now that the device is open, clear the O_NONBLOCK flag so subsequent I/O will block.
-    // See fcntl(2) <x-man-page//2/fcntl> for details.
-    if (fcntl(_fileDescriptor, F_SETFL, 0) == -1)
-    {
-        NSLog(@"Error clearing O_NONBLOCK %@ - %s(%d).\n", _preferedPath, strerror(errno), errno);
-        goto error;
-    }
-    
-    // Get the current options and save them so we can restore the default settings later.
-    if (tcgetattr(_fileDescriptor, &_gOriginalTTYAttrs) == -1)
-    {
-        NSLog(@"Error getting tty attributes %@ - %s(%d).\n", _preferedPath, strerror(errno), errno);
-        goto error;
-    }
-    
-    // The serial port attributes such as timeouts and baud rate are set by modifying the termios
-    // structure and then calling tcsetattr() to cause the changes to take effect. Note that the
-    // changes will not become effective without the tcsetattr() call.
-    // See tcsetattr(4) <x-man-page://4/tcsetattr> for details.
-    options = _gOriginalTTYAttrs;
-    
-    // Print the current input and output baud rates.
-    // See tcsetattr(4) <x-man-page://4/tcsetattr> for details.
-    
-    NSLog(@"Current input baud rate is %d\n", (int) cfgetispeed(&options));
-    NSLog(@"Current output baud rate is %d\n", (int) cfgetospeed(&options));
-    
-    // Set raw input (non-canonical) mode, with reads blocking until either a single character
-    // has been received or a one second timeout expires.
-    // See tcsetattr(4) <x-man-page://4/tcsetattr> and termios(4) <x-man-page://4/termios> for details.
-    cfmakeraw(&options);
-    options.c_cc[VMIN] = 0;     // minimum characters to read
-    options.c_cc[VTIME] = 10;   // time out (10 = 1sec) before we give up
-    
-    // The baud rate, word length, and handshake options can be set as follows:
-    cfsetspeed(&options, B9600);        // Set 9600 baud
-/*    options.c_cflag |= (CS8        |     // Use 8 bit words
-                        PARENB       |     // Parity enable (even parity if PARODD not also set)
-                        CCTS_OFLOW |     // CTS flow control of output
-                        CRTS_IFLOW);    // RTS flow control of input
- */
-    /*
-     PTO: Disabled. I only want 9600 baud for the moment
-    
-    // The IOSSIOSPEED ioctl can be used to set arbitrary baud rates
-    // other than those specified by POSIX. The driver for the underlying serial hardware
-    // ultimately determines which baud rates can be used. This ioctl sets both the input
-    // and output speed.
-    speed_t speed = 14400; // Set 14400 baud
-    if (ioctl(fileDescriptor, IOSSIOSPEED, &speed) == -1)
-    {
-        printf("Error calling ioctl(..., IOSSIOSPEED, ...) %s - %s(%d).\n",
-               bsdPath, strerror(errno), errno);
-    }
-    */
-    
-    // Print the new input and output baud rates. Note that the IOSSIOSPEED ioctl interacts with the serial driver
-    // directly bypassing the termios struct. This means that the following two calls will not be able to read
-    // the current baud rate if the IOSSIOSPEED ioctl was used but will instead return the speed set by the last call
-    // to cfsetspeed.
-    NSLog(@"Input baud rate changed to %d\n", (int) cfgetispeed(&options));
-    NSLog(@"Output baud rate changed to %d\n", (int) cfgetospeed(&options));
-    
-    // Cause the new options to take effect immediately.
-    if (tcsetattr(_fileDescriptor, TCSANOW, &options) == -1)
-    {
-        lastError = [NSString stringWithFormat:@"Error setting tty attributes %@ - %s(%d).", _preferedPath, strerror(errno), errno];
-        NSLog(@"%@", lastError);
-        goto error;
-    }
-    
-    // To set the modem handshake lines, use the following ioctls.
-    // See tty(4) <x-man-page//4/tty> and ioctl(2) <x-man-page//2/ioctl> for details.
-    
-    // Assert Data Terminal Ready (DTR)
-    if (ioctl(_fileDescriptor, TIOCSDTR) == -1)
-    {
-        lastError = [NSString stringWithFormat:@"Error asserting DTR %@ - %s(%d).", _preferedPath, strerror(errno), errno];
-        NSLog(@"%@", lastError);
-    }
-    
-    // Clear Data Terminal Ready (DTR)
-    if (ioctl(_fileDescriptor, TIOCCDTR) == -1)
-    {
-        lastError = [NSString stringWithFormat:@"Error clearing DTR %@ - %s(%d).", _preferedPath, strerror(errno), errno];
-        NSLog(@"%@", lastError);
-    }
-    
-    // Set the modem lines depending on the bits set in handshake
-    handshake = TIOCM_DTR | TIOCM_RTS | TIOCM_CTS | TIOCM_DSR;
-    if (ioctl(_fileDescriptor, TIOCMSET, &handshake) == -1)
-    {
-        lastError = [NSString stringWithFormat:@"Error setting handshake lines %@ - %s(%d).", _preferedPath, strerror(errno), errno];
-        NSLog(@"%@", lastError);
-    }
-    
-    // To read the state of the modem lines, use the following ioctl.
-    // See tty(4) <x-man-page//4/tty> and ioctl(2) <x-man-page//2/ioctl> for details.
-    
-    // Store the state of the modem lines in handshake
-    if (ioctl(_fileDescriptor, TIOCMGET, &handshake) == -1)
-    {
-        lastError = [NSString stringWithFormat:@"Error getting handshake lines %@ - %s(%d).", _preferedPath, strerror(errno), errno];
-        NSLog(@"%@", lastError);
-    }
-    
-    NSLog(@"Handshake lines currently set to %d\n", handshake);
-    
-    unsigned long mics = 1UL;
-    
-    // Set the receive latency in microseconds. Serial drivers use this value to determine how often to
-    // dequeue characters received by the hardware. Most applications don't need to set this value: if an
-    // app reads lines of characters, the app can't do anything until the line termination character has been
-    // received anyway. The most common applications which are sensitive to read latency are MIDI and IrDA
-    // applications.
-    if (ioctl(_fileDescriptor, IOSSDATALAT, &mics) == -1)
-    {
-        // set latency to 1 microsecond
-        lastError = [NSString stringWithFormat:@"Error setting read latency %@ - %s(%d).", _preferedPath, strerror(errno), errno];
-        NSLog(@"%@", lastError);
-        goto error;
-    }
-    
-    // Success
-    return _fileDescriptor;
-    
-    // Failure path
-error:
-    if (_fileDescriptor != -1)
+        NSLog(@"%s", _transport.lastError);
+        return -1;
+    }
+
+    // Commands are written from here on without waiting for the port. What it can't take straight away is
+    // sent by the writer thread as soon as it can, so a busy or wedged device never holds up the scan.
+    if (![self startWriter])
+    {
+        serialTransportClose(&_transport);
+        _fileDescriptor = -1;
+        return -1;
+    }
+
+    // Drain the port on a background thread from now on, so nothing is lost while the main thread is busy.
+    // If that fails we can still read the port directly, just not in the background.
+    if (![self startReader])
     {
-        close(_fileDescriptor);
+        NSLog(@"Could not start the reader thread for %@. Reading the port directly instead.", _preferedPath);
     }
-    
-    return -1;
+
+    return _fileDescriptor;
 }
 
 // -------------------------------------------------------------------------------------------
 
-// Given the file descriptor for a serial device, close that device.
+// Close the port we opened, after waiting for written output to be sent (for portOptions.drainMillis at
+// most, a wedged device doesn't get to hold us up). The port is put back into the state in which we found it.
 - (void)closeSerialPort
 {
-    // Block until all written output has been sent from the device.
-    // Note that this call is simply passed on to the serial device driver.
-    // See tcsendbreak(3) <x-man-page://3/tcsendbreak> for details.
-    if (tcdrain(_fileDescriptor) == -1)
+    // Leave the Arduino the way it expects to be found when the next session opens the port
+    [self stopTelemetry];
+    if ([self isBinaryMode])
     {
-        NSLog(@"Error waiting for drain - %s(%d).", strerror(errno), errno);
+        [self leaveBinaryMode];
     }
-    
-    // Traditionally it is good practice to reset a serial port back to
-    // the state in which you found it. This is why the original termios struct
-    // was saved.
-    if (tcsetattr(_fileDescriptor, TCSANOW, &_gOriginalTTYAttrs) == -1)
+
+    // What's still queued gets portOptions.drainMillis to go out, then the transport gives the driver as long
+    // again to send it
+    [self stopWriter:true];
+    [self stopReader];
+    [self logCommandStats];
+    [self logCommandMetrics];
+    [self stopCapture];
+
+    _transport.lastWarning[0] = '\0';
+    serialTransportClose(&_transport);
+    if (_transport.lastWarning[0])
     {
-        NSLog(@"Error resetting tty attributes - %s(%d).", strerror(errno), errno);
+        NSLog(@"%s", _transport.lastWarning);
     }
 
-    close(_fileDescriptor);
+    _fileDescriptor = -1;
+    [_receiveBuffer clear];
 }
 
 // ------------------------------------------------------------------------------------------------
 
+// The port has gone away under us (e.g. the USB adapter was reset). Tidy up without talking to the Arduino,
+// which can't hear us any more, so the port can be opened again. Opening the port resets the Arduino, so
+// it will be back on the text protocol at the text baud rate. The capture carries on.
+- (void) dropSerialPort
+{
+    [self stopReader];
+    [self stopWriter:false];
+    _streaming = false;
+
+    if (_window.sequenced)
+    {
+        commandWindowSetSequenced(&_window, false);
+        _portOptions.baudRate = _textBaudRate;
+    }
 
-//- (kern_return_t) findSerialPorts:(io_iterator_t *)matchingServices
-- (kern_return_t) findSerialPorts
+    _transport.lastWarning[0] = '\0';
+    serialTransportClose(&_transport);
+
+    _fileDescriptor = -1;
+    [_receiveBuffer clear];
+}
+
+// ------------------------------------------------------------------------------------------------
+
+- (Boolean) isConnected
 {
-    kern_return_t kernResult;
-    CFMutableDictionaryRef classesToMatch;
-    
-    // Serial devices are instances of class IOSerialBSDClient.
-    // Create a matching dictionary to find those instances.
-
-    // Each serial device object has a property with key
-    // kIOSerialBSDTypeKey and a value that is one of kIOSerialBSDAllTypes,
-    // kIOSerialBSDModemType, or kIOSerialBSDRS232Type. You can experiment with the
-    // matching by changing the last parameter in the above call to CFDictionarySetValue.
-    
-    // As shipped, this sample is only interested in modems,
-    // so add this property to the CFDictionary we're matching on.
-    // This will find devices that advertise themselves as modems,
-    // such as built-in and USB modems. However, this match won't find serial modems.
-    classesToMatch = IOServiceMatching(kIOSerialBSDServiceValue);
-    if (classesToMatch == NULL)
-    {
-        NSLog(@"IOServiceMatching returned a NULL dictionary.");
+    SerialReaderStats stats;
+
+    if (_fileDescriptor == -1 || _hungUp)
+    {
+        return false;
     }
-    else
+
+    if (_reader)
+    {
+        serialReaderGetStats(_reader, &stats);
+        return stats.running;
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+- (Boolean) startReader
+{
+    if (_reader)
+    {
+        return true;
+    }
+
+    _reader = serialReaderCreate(_fileDescriptor);
+    if (_reader && _readerName)
+    {
+        serialReaderSetName(_reader, [_readerName UTF8String]);
+    }
+    if (_reader == NULL || serialReaderStart(_reader) == -1)
+    {
+        NSLog(@"Error starting reader thread - %s(%d).", strerror(errno), errno);
+        serialReaderDestroy(_reader);
+        _reader = NULL;
+        return false;
+    }
+
+    serialReaderSetCapture(_reader, _capture);
+    serialReaderSetSensorRing(_reader, _sensorRing);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+- (void) stopReader
+{
+    SerialReaderStats stats;
+
+    if (_reader == NULL)
+    {
+        return;
+    }
+
+    serialReaderGetStats(_reader, &stats);
+    addReaderStats(&_readerStats, &stats);
+    NSLog(@"Reader thread read %llu bytes, %llu lines, %llu frames (%llu bad CRC), dropped %llu responses and %llu "
+          "log lines.", stats.bytesRead, stats.linesFramed, stats.framesDecoded, stats.crcErrors,
+          stats.responsesDropped, stats.logDropped);
+
+    serialReaderDestroy(_reader);
+    _reader = NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+- (Boolean) startWriter
+{
+    _writer = commandWriterCreate(_fileDescriptor);
+    if (_writer == NULL)
+    {
+        NSLog(@"Error creating the command writer - %s(%d).", strerror(errno), errno);
+        return false;
+    }
+
+    if (_writerName)
+    {
+        commandWriterSetName(_writer, [_writerName UTF8String]);
+    }
+
+    // Without the thread, whatever the port doesn't take straight away goes out with the next command
+    if (commandWriterStart(_writer) == -1)
+    {
+        NSLog(@"Error starting writer thread - %s(%d). Writing from the calling thread instead.", strerror(errno), errno);
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+// With drain, wait for what's still queued to be written first, for portOptions.drainMillis at most.
+// Whatever is left after that is thrown away.
+- (void) stopWriter:(Boolean)drain
+{
+    CommandWriterStats stats;
+
+    if (_writer == NULL)
+    {
+        return;
+    }
+
+    if (drain && commandWriterDrain(_writer, _portOptions.drainMillis) == -1 && errno == ETIMEDOUT)
+    {
+        NSLog(@"Gave up waiting for queued commands to go out to %@ after %u ms.", _preferedPath,
+              _portOptions.drainMillis);
+    }
+    commandWriterDiscard(_writer);
+
+    commandWriterGetStats(_writer, &stats);
+    addWriterStats(&_writerStats, &stats);
+    NSLog(@"Writer thread sent %llu commands, %llu bytes in %llu writes (%llu commands coalesced), %llu partial "
+          "writes, port busy %llu times, up to %u queued. %llu rejected, %llu discarded.", stats.commands,
+          stats.bytes, stats.writes, stats.coalesced, stats.partialWrites, stats.wouldBlock, stats.maxQueued,
+          stats.rejected, stats.discarded);
+
+    commandWriterDestroy(_writer);
+    _writer = NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+// Before the baud rate changes, so the command that announced it goes out at the old one
+- (void) drainWriter
+{
+    if (_writer && commandWriterDrain(_writer, _portOptions.drainMillis) == -1)
+    {
+        NSLog(@"Commands still queued for %@ before changing the baud rate - %s(%d).", _preferedPath,
+              strerror(errno), errno);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+- (SerialReaderStats) readerStats
+{
+    SerialReaderStats stats = _readerStats;
+    SerialReaderStats current;
+
+    if (_reader)
+    {
+        serialReaderGetStats(_reader, &current);
+        addReaderStats(&stats, &current);
+    }
+
+    return stats;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+- (CommandWriterStats) writerStats
+{
+    CommandWriterStats stats = _writerStats;
+    CommandWriterStats current;
+
+    if (_writer)
+    {
+        commandWriterGetStats(_writer, &current);
+        addWriterStats(&stats, &current);
+    }
+
+    return stats;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+- (Boolean) startCapture:(NSString *)path
+{
+    if (_capture)
+    {
+        return true;
+    }
+
+    _capture = trafficCaptureOpen([path fileSystemRepresentation], CAPTURE_DEFAULT_CAPACITY);
+    if (_capture == NULL)
+    {
+        NSLog(@"Could not create capture file %@ - %s(%d).", path, strerror(errno), errno);
+        return false;
+    }
+
+    if (_reader)
+    {
+        serialReaderSetCapture(_reader, _capture);
+    }
+
+    NSLog(@"Capturing serial traffic to %@", path);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+- (void) stopCapture
+{
+    TrafficCaptureStats stats;
+
+    if (_capture == NULL)
+    {
+        return;
+    }
+
+    // The reader thread has to let go of it first
+    if (_reader)
+    {
+        serialReaderStop(_reader);
+        serialReaderSetCapture(_reader, NULL);
+        serialReaderStart(_reader);
+    }
+
+    trafficCaptureGetStats(_capture, &stats);
+    NSLog(@"Captured %llu records, %llu bytes of traffic. %llu records didn't fit.", stats.records, stats.bytes,
+          stats.dropped);
+
+    trafficCaptureClose(_capture);
+    _capture = NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+
+// Ask the transport backend for all the serial ports that could have an Arduino on them. On macOS these
+// are the IOKit serial devices that advertise themselves as modems, which includes USB serial adapters.
+- (kern_return_t) findSerialPorts
+{
+    int found = _transport.backend->discover(_ports, MAX_SERIAL_PORTS);
+
+    if (found < 0)
     {
-        // Look for devices that claim to be USB ports.
-        CFDictionarySetValue(classesToMatch,
-                             CFSTR(kIOSerialBSDTypeKey),
-                             CFSTR(kIOSerialBSDModemType));
+        NSLog(@"Discovering serial ports with the %s backend failed", _transport.backend->name);
+        _portCount = 0;
+        return KERN_FAILURE;
     }
-    
-    // Get an iterator across all matching devices.
-    kernResult = IOServiceGetMatchingServices(kIOMainPortDefault, classesToMatch, &_serialPortIterator);
-    if (KERN_SUCCESS != kernResult)
+
+    if (found > MAX_SERIAL_PORTS)
     {
-        NSLog(@"IOServiceGetMatchingServices returned %d", kernResult);
-        goto exit;
+        NSLog(@"Found %d serial ports, only the first %d are used", found, MAX_SERIAL_PORTS);
+        found = MAX_SERIAL_PORTS;
     }
-    
-exit:
-    return kernResult;
+
+    _portCount = found;
+    return found > 0 ? KERN_SUCCESS : KERN_FAILURE;
 }
 
 // -------------------------------------------------------------------------------------------
@@ -278,66 +480,24 @@ exit:
 // Find the modem path. If we have been passed in a preferredPort value then we check the available paths
 // to see if it exists and return success if so. If no preferredPort has been passed then we simply
 // return the first path found and assign the value to preferredPort.
-// If no valid ports are found the path name is set to an empty string.
-// We assume that 'findSerialPorts' has been run before which has initialised '_serialPortIterator'
-//- (kern_return_t) getModemPath:(io_iterator_t) serialPortIterator defaultPath:(NSString **)preferredPort
+// We assume that 'findSerialPorts' has been run before which has filled in the list of ports.
 - (kern_return_t) findUsbPath
 {
-    io_object_t modemService;
-    kern_return_t kernResult = KERN_FAILURE;
-    Boolean modemFound = false;
-       
-    // Iterate across all modems found. In this example, we bail after finding the first modem.
-    while ((modemService = IOIteratorNext(_serialPortIterator)) && !modemFound)
-    {
-        CFTypeRef bsdPathAsCFString;
-        
-        // Get the USB port's device's path (/dev/cu.xxxxx). We will need this to open the port later on
-        bsdPathAsCFString = IORegistryEntryCreateCFProperty(modemService,
-                                                            CFSTR(kIOCalloutDeviceKey),
-                                                            kCFAllocatorDefault,
-                                                            0);
-        if (bsdPathAsCFString)
-        {
-            // [MyClass aClassMethod];
-            
-            NSString *discoveredPort = [Utilities convertCFTypeRefToNSString:bsdPathAsCFString];
-            Boolean result = false;
-
-            if (_preferedPath)
-            {
-                if( [discoveredPort caseInsensitiveCompare:_preferedPath] == NSOrderedSame )
-                {
-                    // Assign the preferredPort name with the one we've found, just in case the case of the passed in string
-                    // was incorrect. Then break out of loop
-                    _preferedPath = discoveredPort;
-                    result = true;
-                }
-            }
-            else
-            {
-                // No preferred port, we just return the first one we've found
-                _preferedPath = [Utilities convertCFTypeRefToNSString:bsdPathAsCFString];
-                result = true;
-            }
-            
-            CFRelease(bsdPathAsCFString);
+    for (int i = 0; i < _portCount; i++)
+    {
+        NSString *discoveredPort = [NSString stringWithUTF8String:_ports[i].path];
 
-            if (result)
-            {
-                NSLog(@"Modem found with BSD path: %@", discoveredPort);
-                modemFound = true;
-                kernResult = KERN_SUCCESS;
-            }
+        if (_preferedPath == nil || [discoveredPort caseInsensitiveCompare:_preferedPath] == NSOrderedSame)
+        {
+            // Assign the preferredPort name with the one we've found, just in case the case of the passed in string
+            // was incorrect.
+            _preferedPath = discoveredPort;
+            NSLog(@"Modem found with BSD path: %@ (USB %04x:%04x)", discoveredPort, _ports[i].vendorId, _ports[i].productId);
+            return KERN_SUCCESS;
         }
-        
-        // Release the io_service_t now that we are done with it.
-        (void) IOObjectRelease(modemService);
     }
-    
-    IOObjectRelease(_serialPortIterator);
-    
-    return kernResult;
+
+    return KERN_FAILURE;
 }
 
 // -------------------------------------------------------------------------------------------
@@ -352,112 +512,806 @@ exit:
 // Given the file descriptor for the USB port where the Arduino is plugged in, check if we can
 // communicate with it. If comms has been established and the Arduino is ready to receive
 // instructions, return true.
-- (Boolean) isArduinoOnline
+- (Boolean) waitUntilReady:(uint32_t)timeoutMillis
 {
-    char buffer[256];    // Input buffer
-    char *bufPtr;        // Current char in buffer
-    ssize_t numBytes;        // Number of bytes read or written
-    int tries;            // Number of tries so far
-    Boolean  result = false;
-    const int retries = 3;      // Number of attemps we make to try and talk to the Arduino
-    ArduinoResponse response = Unrecognised;
-
-    // First check if there is anything in the buffer. This is likely the case. After opening the USB port, the
-    // Arduino sends at least a CMD_READY notification
-    bufPtr = buffer;
-    numBytes = read(_fileDescriptor, bufPtr, &buffer[sizeof(buffer)] - bufPtr - 1);
-    
-    if (numBytes == -1)
-    {
-        NSLog(@"%@", [NSString stringWithFormat:@"Error reading from Arduino - %s(%d).", strerror(errno), errno]);
-    }
-    else if (numBytes > 0)
+    ReadyHandshake handshake;
+    ArduinoResponse response;
+    uint64_t until = 0;
+
+    handshakeBegin(&handshake, _openedAt, monotonicNanos(), timeoutMillis);
+
+    // First take what has already arrived, without waiting for more. After opening the USB port the Arduino
+    // sends at least a CTS:READY notification, and there may be lines left over from before.
+    while ((response = [self readSerialCommandBefore:monotonicNanos()]) != TimedOut)
     {
-        NSLog(@"Buffer cleared. Contained [%s]", [Utilities logString:buffer]);
+        handshakeBacklog(&handshake, response, monotonicNanos());
     }
-    
-    for (tries = 1; tries <= retries; tries++)
+
+    for (;;)
     {
-        NSLog(@"Try #%d", tries);
-        
-        // Send a ping to the Arduino
-        numBytes = write(_fileDescriptor, CMD_PING, strlen(CMD_PING));
-        if (numBytes == -1)
+        HandshakeAction action = handshakeNext(&handshake, monotonicNanos(), &until);
+
+        if (action == HandshakeDone)
         {
-            NSLog(@"%@", [NSString stringWithFormat:@"Error writing to Arduino - %s(%d).", strerror(errno), errno]);
-            continue;
+            break;
         }
-        else
+        else if (action == HandshakeSendPing)
         {
-            NSLog(@"Wrote %ld bytes [%s]", numBytes, [Utilities logString:CMD_PING]);
+            [self sendCommand:CommandPing];
+            handshakePingSent(&handshake, monotonicNanos());
         }
-        
-        if (numBytes < strlen(CMD_PING))
+        else if (![self isConnected])
         {
-            continue;
+            handshake.state = HandshakeFailed;
+            break;
         }
-        
-        // TODO: this is not good. We should really use the read command with a timeout
-        usleep(1000000);    // Give the Arduino time to respond
-        
-        NSLog(@"Looking for [%s]", [Utilities logString:CMD_OK]);
-        
-        ///TODO: Normally we still have the CTS:READY in our buffer first, which the Arduino sends after opening the port.
-        ///So most buffers on first read look something like "CTS:READY\nCTS:READY\nCTS:OK\n". We need to decipher this properly.
-
-        response = [self readSerialCommand];
-        if (response == Ok)
+        else if ((response = [self readSerialCommandBefore:until]) != TimedOut)
         {
-            result = true;
-            break;
+            handshakeResponse(&handshake, response, monotonicNanos());
         }
     }
-    
-    return result;
+
+    _handshakeStats = handshake.stats;
+    TRACE("Handshake %s: %u backlog lines (%u READY), %u READY, %u pings, %u skipped",
+          TRACE_STR(handshakeStateName(handshake.state)), handshake.stats.backlog, handshake.stats.staleReady, handshake.stats.readyEvents, handshake.stats.pings,
+          handshake.stats.skipped);
+
+    return handshake.state == HandshakeReady;
 }
 
 // -------------------------------------------------------------------------------------------
 
-// Read a command from the USB port. Commands (or responses) are terminated by a NewLine character.
-// We assume that the port has been opened successfully by this stage.
--(ArduinoResponse) readSerialCommand
+- (HandshakeStats) handshakeStats
 {
-    char buffer[256];       // Input buffer
-    char *bufPtr;           // Current char in buffer
-    ssize_t numBytes;       // Number of bytes read or written
-    ArduinoResponse response = Unrecognised;
-    
-    // Read characters into our buffer until we get a newline
-    bufPtr = buffer;
-    do
+    return _handshakeStats;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (Boolean) isArduinoOnline
+{
+    return [self waitUntilReady:HANDSHAKE_TIMEOUT_MILLIS];
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (ssize_t) sendCommand:(ArduinoCommand)command
+{
+    return [self writeCommand:command sequence:commandWindowNextSequence(&_window)];
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Every write to the Arduino goes through here, so traffic mode sees all of it. The bytes are queued
+// whole or not at all, and are traced and captured as they're queued: they go out in that order, if a
+// little later when the port is busy.
+- (ssize_t) writeBytes:(const void *)data length:(size_t)length
+{
+    ssize_t numBytes;
+
+    if (_writer == NULL)
     {
-        numBytes = read(_fileDescriptor, bufPtr, &buffer[sizeof(buffer)] - bufPtr - 1);
-        if (numBytes == -1)
-        {
-            NSLog(@"%@", [NSString stringWithFormat:@"Error reading from port - %s(%d).", strerror(errno), errno]);
-        }
-        else if (numBytes > 0)
-        {
-            bufPtr += numBytes;
-            // NewLine indicates end of the Arduino response, we have received a full response
-            if (*(bufPtr - 1) == '\n' || *(bufPtr - 1) == '\r')
-            {
-                // exit do-while loop
-                break;
-            }
-        }
-        else
+        errno = EBADF;
+        return -1;
+    }
+
+    numBytes = commandWriterSend(_writer, data, length);
+    if (numBytes > 0)
+    {
+        traceLogTraffic(TraceSent, data, (size_t)numBytes);
+        _metrics->bytesSent += (uint64_t)numBytes;
+        if (_capture)
         {
-            NSLog(@"Nothing read.");
+            trafficCaptureRecord(_capture, CaptureSent, data, (size_t)numBytes);
         }
-    } while (numBytes > 0);
-    
-    // NUL terminate the string and find out which response we've received
-    *bufPtr = '\0';
-    NSLog(@"Read [%s]", [Utilities logString:buffer]);
-    
-    response = [Utilities translateResponse:buffer];
-    return response;
+    }
+
+    return numBytes;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The sequence number only goes over the wire with the binary protocol
+- (ssize_t) writeCommand:(ArduinoCommand)command sequence:(uint8_t)sequence
+{
+    uint8_t frame[BINARY_MAX_FRAME];
+    const void *data;
+    size_t length;
+    ssize_t numBytes;
+
+    if (command >= CommandCount)
+    {
+        return -1;
+    }
+
+    if ([self isBinaryMode])
+    {
+        length = binaryEncodeFrame(binaryOpcodeForCommand(command), sequence, NULL, 0, frame);
+        data = frame;
+    }
+    else
+    {
+        data = commandText(command);
+        length = strlen(commandText(command));
+    }
+
+    numBytes = [self writeBytes:data length:length];
+    if (numBytes == -1)
+    {
+        NSLog(@"%@", [NSString stringWithFormat:@"Error writing to Arduino - %s(%d).", strerror(errno), errno]);
+    }
+    else if ([self isBinaryMode])
+    {
+        TRACE("Wrote %zd bytes [%s #%u]", numBytes, TRACE_STR(commandText(command)), sequence);
+    }
+    else
+    {
+        TRACE("Wrote %zd bytes [%s]", numBytes, TRACE_STR(commandText(command)));
+    }
+
+    return numBytes < (ssize_t)length ? -1 : numBytes;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (int) submitCommand:(ArduinoCommand)command timeout:(uint32_t)timeoutMillis attempts:(uint8_t)attempts
+{
+    CommandSlot *slot;
+
+    if (command >= CommandCount)
+    {
+        return -1;
+    }
+
+    // With the window full, take in replies until one of the commands in it finishes (or gives up)
+    while ((slot = commandWindowOpen(&_window, command, timeoutMillis, attempts, monotonicNanos())) == NULL)
+    {
+        if (_window.inFlight == 0)
+        {
+            NSLog(@"Command window is full of results nobody has collected");
+            return -1;
+        }
+
+        [self pumpResponsesBefore:commandWindowNextDeadline(&_window)];
+    }
+
+    commandWindowSent(&_window, slot, monotonicNanos());
+    if ([self writeCommand:command sequence:slot->sequence] == -1)
+    {
+        commandWindowCollect(&_window, slot);
+        return -1;
+    }
+
+    return slot->sequence;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (ArduinoResponse) waitForCommand:(int)sequence
+{
+    CommandSlot *slot = sequence > 0 ? commandWindowFind(&_window, (uint8_t)sequence) : NULL;
+
+    if (slot == NULL)
+    {
+        return TimedOut;
+    }
+
+    while (slot->state == SlotInFlight)
+    {
+        [self pumpResponsesBefore:commandWindowNextDeadline(&_window)];
+    }
+
+    commandMetricsRecord(_metrics, slot);
+    if (_sensorTracker && slot->command == CommandNextCell && slot->atCellAt != 0)
+    {
+        sensorTrackerCell(_sensorTracker, slot->lastSentAt, slot->atCellAt);
+    }
+    _lastCommand = *slot;
+    return commandWindowCollect(&_window, slot);
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (ArduinoResponse) runCommand:(ArduinoCommand)command timeout:(uint32_t)timeoutMillis
+{
+    return [self runCommand:command timeout:timeoutMillis grace:0];
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (ArduinoResponse) runCommand:(ArduinoCommand)command timeout:(uint32_t)timeoutMillis grace:(uint32_t)graceMillis
+{
+    int sequence = [self submitCommand:command timeout:timeoutMillis attempts:0];
+
+    if (sequence == -1)
+    {
+        return Unrecognised;
+    }
+
+    commandWindowFind(&_window, (uint8_t)sequence)->graceNanos = (uint64_t)graceMillis * NANOS_PER_MILLI;
+    return [self waitForCommand:sequence];
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (CommandSlot) lastCommand
+{
+    return _lastCommand;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (Boolean) runCommands:(const ArduinoCommand *)commands count:(int)count results:(ArduinoResponse *)results
+{
+    int sequences[count];
+    Boolean result = true;
+
+    // submitCommand only waits when the window is full, so this keeps the window as full as it can be
+    for (int i = 0; i < count; i++)
+    {
+        sequences[i] = [self submitCommand:commands[i] timeout:0 attempts:0];
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        results[i] = sequences[i] == -1 ? Unrecognised : [self waitForCommand:sequences[i]];
+        if (results[i] != Ok)
+        {
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Take in the next response and hand it to the command it belongs to. When nothing arrives before the
+// deadline, the commands that have timed out are sent again or given up on.
+- (void) pumpResponsesBefore:(uint64_t)deadline
+{
+    ArduinoResponse response;
+    ResponseEvent event;
+    CommandSlot *slot;
+    uint64_t wait = deadline;
+    uint64_t now;
+
+    // The telemetry batches don't wake us, so take them in at least every TELEMETRY_UPDATE_MILLIS or a long
+    // wait (a rewind) would let the ring fill up
+    if (_sensorTracker)
+    {
+        now = monotonicNanos();
+        sensorTrackerUpdate(_sensorTracker, _sensorRing, now);
+        if (deadline > now + TELEMETRY_UPDATE_MILLIS * NANOS_PER_MILLI)
+        {
+            wait = now + TELEMETRY_UPDATE_MILLIS * NANOS_PER_MILLI;
+        }
+    }
+
+    response = [self readResponseBefore:wait event:&event];
+    now = monotonicNanos();
+
+    if (response == TimedOut || _hungUp)
+    {
+        if (![self isConnected])
+        {
+            // Nothing more can arrive: the reader thread has stopped, or the port hung up, so the port is gone
+            TRACE("Lost the port with %u commands in flight", _window.inFlight);
+            while ((slot = commandWindowExpired(&_window, UINT64_MAX)) != NULL)
+            {
+                commandWindowAbandon(&_window, slot, now);
+            }
+            return;
+        }
+
+        // Woken before the deadline with nothing to show for it (a signal, or rounding). Our callers wait again.
+        if (now < wait)
+        {
+            return;
+        }
+    }
+
+    if (response != TimedOut)
+    {
+        _metrics->unrecognised += response == Unrecognised;
+        slot = commandWindowRecord(&_window, event.sequence, response, event.errorCode, event.receivedAt);
+        if (slot == NULL && response != Unrecognised)
+        {
+            TRACE("Response %d #%u doesn't belong to any command in flight. Skipped.", response, event.sequence);
+        }
+        else if (slot && response == Error)
+        {
+            TRACE_BYTES(event.payload, event.length, "Arduino reported error %d [%b] for [%s #%u]", event.errorCode,
+                        TRACE_STR(commandText(slot->command)), slot->sequence);
+        }
+    }
+
+    while ((slot = commandWindowExpired(&_window, now)) != NULL)
+    {
+        if (commandWindowSent(&_window, slot, now))
+        {
+            TRACE("No reply to [%s #%u], sending it again (attempt %u of %u)", TRACE_STR(commandText(slot->command)),
+                  slot->sequence, slot->attempts, slot->maxAttempts);
+            if ([self writeCommand:slot->command sequence:slot->sequence] != -1)
+            {
+                continue;
+            }
+        }
+        else if (commandWindowExtend(&_window, slot, now))
+        {
+            TRACE("[%s #%u] is late, waiting %u ms more for it", TRACE_STR(commandText(slot->command)), slot->sequence,
+                  slot->graceNanos / NANOS_PER_MILLI);
+            continue;
+        }
+
+        TRACE("Giving up on [%s #%u] after %u attempts", TRACE_STR(commandText(slot->command)), slot->sequence,
+              slot->attempts);
+        commandWindowAbandon(&_window, slot, now);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (CommandWindowStats) commandStats
+{
+    return _window.stats;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (void) logCommandStats
+{
+    CommandWindowStats stats = _window.stats;
+
+    if (stats.sent == 0)
+    {
+        return;
+    }
+
+    NSLog(@"Commands: %llu sent, %llu completed (%llu with errors), %llu timed out, %llu late, %llu retries, "
+          "%llu stale responses, up to %llu in flight. Round trip %.1f ms average, %.1f ms max.",
+          stats.sent, stats.completed, stats.errors, stats.timedOut, stats.late, stats.retries, stats.staleResponses,
+          stats.maxInFlight, stats.completed ? (double)stats.roundTripNanos / stats.completed / NANOS_PER_MILLI : 0.0,
+          (double)stats.maxRoundTripNanos / NANOS_PER_MILLI);
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (const CommandMetrics *) commandMetrics
+{
+    return _metrics;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (void) logCommandMetrics
+{
+    char line[512];
+
+    for (int command = 0; command < CommandCount; command++)
+    {
+        if (commandMetricsFormat(_metrics, (ArduinoCommand)command, line, sizeof(line)))
+        {
+            NSLog(@"%s", line);
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (Boolean) writeCommandMetrics:(NSString *)path
+{
+    FILE *out = fopen([path UTF8String], "w");
+    Boolean result;
+
+    if (out == NULL)
+    {
+        NSLog(@"%@", [NSString stringWithFormat:@"Error creating metrics file %@ - %s(%d).", path, strerror(errno), errno]);
+        return false;
+    }
+
+    commandMetricsWriteJson(_metrics, [self readerStats].bytesRead, out);
+    result = ferror(out) == 0;
+    if (fclose(out) != 0 || !result)
+    {
+        NSLog(@"%@", [NSString stringWithFormat:@"Error writing metrics file %@ - %s(%d).", path, strerror(errno), errno]);
+        return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The switch is acknowledged with a CTS:OK at the old baud rate. The reader thread decodes everything after
+// that OK as binary frames, so there's no gap in which a response could be misread. Only then do we change
+// our baud rate, and a binary ping proves both ends agree before we rely on it.
+- (Boolean) negotiateBinaryMode:(uint32_t)baudRate
+{
+    char command[32];
+    int length;
+    ArduinoResponse response;
+
+    if (_reader == NULL)
+    {
+        NSLog(@"The binary protocol needs the reader thread. Staying with the text protocol.");
+        return false;
+    }
+
+    if ([self isBinaryMode])
+    {
+        return true;
+    }
+
+    _textBaudRate = _portOptions.baudRate;
+    if (baudRate == 0)
+    {
+        baudRate = _textBaudRate;
+    }
+
+    length = snprintf(command, sizeof(command), "%s%u\n", CMD_BINARY, baudRate);
+
+    serialReaderSwitchToBinaryAfterOk(_reader);
+    if ([self writeBytes:command length:(size_t)length] != length)
+    {
+        NSLog(@"%@", [NSString stringWithFormat:@"Error writing to Arduino - %s(%d).", strerror(errno), errno]);
+        serialReaderCancelSwitch(_reader);
+        return false;
+    }
+
+    TRACE_BYTES(command, (size_t)length, "Wrote [%b]");
+
+    response = [self waitForResponse:Ok timeout:TIMEOUT_SWITCH];
+    if (response != Ok)
+    {
+        // The Arduino doesn't know CMD_BINARY (older firmware) or didn't hear it. Nothing has changed.
+        serialReaderCancelSwitch(_reader);
+        NSLog(@"Arduino did not accept the binary protocol (response %d). Staying with the text protocol.", (int)response);
+        return false;
+    }
+
+    [self drainWriter];
+    if (baudRate != _textBaudRate && serialTransportSetBaud(&_transport, baudRate) == -1)
+    {
+        NSLog(@"%s", _transport.lastError);
+        [self leaveBinaryMode];
+        return false;
+    }
+
+    commandWindowSetSequenced(&_window, true);
+    if ([self waitForCommand:[self submitCommand:CommandPing timeout:TIMEOUT_SWITCH attempts:1]] != Ok)
+    {
+        NSLog(@"No reply to a binary ping at %u baud. Going back to the text protocol.", baudRate);
+        [self leaveBinaryMode];
+        return false;
+    }
+
+    _portOptions.baudRate = baudRate;
+    NSLog(@"Switched to the binary protocol at %u baud.", baudRate);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (void) leaveBinaryMode
+{
+    uint8_t frame[BINARY_MAX_FRAME];
+    size_t length;
+
+    if (![self isBinaryMode])
+    {
+        return;
+    }
+
+    serialReaderSwitchToTextAfterOk(_reader);
+    length = binaryEncodeFrame(OpTextMode, commandWindowNextSequence(&_window), NULL, 0, frame);
+    if ([self writeBytes:frame length:length] != (ssize_t)length ||
+        [self waitForResponse:Ok timeout:TIMEOUT_SWITCH] != Ok)
+    {
+        NSLog(@"Arduino did not acknowledge the switch back to the text protocol.");
+    }
+
+    [self drainWriter];
+    if (_textBaudRate != 0 && serialTransportSetBaud(&_transport, _textBaudRate) == -1)
+    {
+        NSLog(@"%s", _transport.lastError);
+    }
+    _portOptions.baudRate = _textBaudRate;
+    commandWindowSetSequenced(&_window, false);
+
+    // Without the acknowledgement the reader is still decoding frames. Start it afresh in text mode.
+    if (serialReaderIsBinary(_reader))
+    {
+        [self stopReader];
+        [self startReader];
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (Boolean) isBinaryMode
+{
+    return _reader != NULL && serialReaderIsBinary(_reader);
+}
+
+// -------------------------------------------------------------------------------------------
+
+// The ring and the tracker are allocated the first time and kept until the port object goes, so a reconnect
+// carries on adding to the same figures. The Arduino numbers its samples afresh after the reset, which the
+// tracker takes as a gap.
+- (Boolean) startTelemetry
+{
+    if (![self isBinaryMode])
+    {
+        NSLog(@"Sensor telemetry needs the binary protocol.");
+        return false;
+    }
+
+    if (_streaming)
+    {
+        return true;
+    }
+
+    if (_sensorTracker == NULL)
+    {
+        _sensorTracker = malloc(sizeof(SensorTracker));
+        if (_sensorTracker == NULL || posix_memalign((void **)&_sensorRing, CACHE_LINE_SIZE, sizeof(SensorRing)) != 0)
+        {
+            NSLog(@"Could not allocate the sensor telemetry buffers.");
+            free(_sensorTracker);
+            _sensorTracker = NULL;
+            return false;
+        }
+
+        sensorTrackerInit(_sensorTracker, NULL);
+    }
+
+    // Anything left from before a reconnect is no use, the reader is new
+    sensorRingInit(_sensorRing);
+    serialReaderSetSensorRing(_reader, _sensorRing);
+
+    if ([self runCommand:CommandStreamOn timeout:0] != Ok)
+    {
+        NSLog(@"Arduino did not start streaming its sensor readings.");
+        serialReaderSetSensorRing(_reader, NULL);
+        return false;
+    }
+
+    _streaming = true;
+    NSLog(@"Streaming optic sensor readings.");
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (void) stopTelemetry
+{
+    SensorTrackerStats stats;
+    const SensorTracker *tracker = _sensorTracker;
+
+    if (tracker == NULL)
+    {
+        return;
+    }
+
+    if (_streaming && [self runCommand:CommandStreamOff timeout:0] != Ok)
+    {
+        NSLog(@"Arduino did not stop streaming its sensor readings.");
+    }
+    _streaming = false;
+
+    // The reader thread has to let go of the ring before it's freed. It may be part way through a push, and if
+    // STREAMOFF failed the batches are still coming. Stopping it waits for that, as it does for the capture.
+    if (_reader)
+    {
+        serialReaderStop(_reader);
+        serialReaderSetSensorRing(_reader, NULL);
+        serialReaderStart(_reader);
+    }
+
+    // Whatever arrived before the OK still counts
+    sensorTrackerUpdate(_sensorTracker, _sensorRing, monotonicNanos());
+    sensorTrackerFinish(_sensorTracker);
+
+    stats = tracker->stats;
+    NSLog(@"Telemetry: %llu batches, %llu samples (%llu lost, %llu batches dropped), %llu rising edges. %llu cells: "
+          "%llu matched (%llu after their ATCELL), %llu missed, %llu abandoned.", stats.batches, stats.samples,
+          stats.lostSamples, _sensorRing->dropped, stats.detector.rising, stats.cells, stats.matched, stats.late,
+          stats.missed, stats.abandoned);
+    if (tracker->leads.count > 0)
+    {
+        NSLog(@"Edge to ATCELL %.2f ms median, %.2f ms p99, %.2f - %.2f ms. NEXTCELL to edge %.1f ms median, "
+              "%.1f ms p99.", (double)latencyHistogramPercentile(&tracker->leads, 50) / NANOS_PER_MILLI,
+              (double)latencyHistogramPercentile(&tracker->leads, 99) / NANOS_PER_MILLI,
+              (double)tracker->leads.min / NANOS_PER_MILLI, (double)tracker->leads.max / NANOS_PER_MILLI,
+              (double)latencyHistogramPercentile(&tracker->moves, 50) / NANOS_PER_MILLI,
+              (double)latencyHistogramPercentile(&tracker->moves, 99) / NANOS_PER_MILLI);
+    }
+
+    free(_sensorRing);
+    free(_sensorTracker);
+    _sensorRing = NULL;
+    _sensorTracker = NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (SensorTrackerStats) telemetryStats
+{
+    SensorTrackerStats stats = { 0 };
+
+    return _sensorTracker ? _sensorTracker->stats : stats;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (const SensorTracker *) sensorTracker
+{
+    return _sensorTracker;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Read a command from the USB port. Commands (or responses) are terminated by a NewLine character.
+// We assume that the port has been opened successfully by this stage.
+-(ArduinoResponse) readSerialCommand
+{
+    return [self readSerialCommandBefore:deadlineAfterMillis(TIMEOUT_READ)];
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Read from the port until we have a complete line or the deadline expires. Anything received after the
+// first NewLine stays in the receive buffer for the next call, so several responses arriving in a single
+// read are not lost.
+- (ArduinoResponse) readSerialCommandBefore:(uint64_t)deadline
+{
+    ResponseEvent event;
+
+    return [self readResponseBefore:deadline event:&event];
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Show what the firmware has logged since we last looked
+- (void) logArduinoMessages
+{
+    ResponseEvent event;
+
+    while (_reader && serialReaderNextLog(_reader, &event))
+    {
+        TRACE_BYTES(event.payload, event.length, "Arduino: %b");
+        commandWindowHeard(&_window, event.sequence, event.receivedAt);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Fills in the whole event: the sequence number the Arduino echoed with the binary protocol (0 otherwise),
+// the error code and the text that came with the response.
+- (ArduinoResponse) readResponseBefore:(uint64_t)deadline event:(ResponseEvent *)event
+{
+    LineView line;          // Next complete line, pointing into the receive buffer
+    ParsedResponse parsed;
+    ssize_t numBytes;       // Number of bytes read
+    int ready;
+
+    if (_reader)
+    {
+        // The reader thread has already framed and parsed everything for us
+        if (!serialReaderNext(_reader, event, deadline))
+        {
+            [self logArduinoMessages];
+            event->response = TimedOut;
+            return TimedOut;
+        }
+
+        [self logArduinoMessages];
+        if (event->sequence != 0)
+        {
+            TRACE_BYTES(event->payload, event->length, "Read [%s%b] #%u", TRACE_STR(responseText(event->response)),
+                        event->sequence);
+        }
+        else
+        {
+            TRACE_BYTES(event->payload, event->length, "Read [%s%b]", TRACE_STR(responseText(event->response)));
+        }
+
+        return event->response;
+    }
+
+    // Errors return before a line is parsed, so the event mustn't be left uninitialised
+    event->sequence = 0;
+    event->errorCode = NO_ERROR_CODE;
+    event->length = 0;
+    event->receivedAt = monotonicNanos();
+
+    if (_hungUp)
+    {
+        return Unrecognised;
+    }
+
+    do
+    {
+        while (![_receiveBuffer nextLine:&line])
+        {
+            ready = waitReadable(_fileDescriptor, deadline);
+            if (ready == 0)
+            {
+                return TimedOut;
+            }
+            else if (ready == -1)
+            {
+                NSLog(@"%@", [NSString stringWithFormat:@"Error waiting for port - %s(%d).", strerror(errno), errno]);
+                return Unrecognised;
+            }
+
+            // The port is non-blocking, and select() can say it's readable when there's nothing to read after all
+            numBytes = [_receiveBuffer readFrom:_fileDescriptor];
+            if (numBytes == -1 && errno == EAGAIN)
+            {
+                continue;
+            }
+            else if (numBytes == -1)
+            {
+                NSLog(@"%@", [NSString stringWithFormat:@"Error reading from port - %s(%d).", strerror(errno), errno]);
+                return Unrecognised;
+            }
+            else if (numBytes == 0)
+            {
+                // Readable but nothing to read means the other end has gone away (e.g. USB unplugged), as the
+                // reader thread takes it. The port stays readable, so waiting on it again would only spin until
+                // the deadline: give up now, and isConnected says so, so recoverLink goes straight to reconnecting.
+                NSLog(@"Port %@ hung up.", _preferedPath);
+                _hungUp = true;
+                return Unrecognised;
+            }
+            else if (numBytes > 0 && _capture)
+            {
+                trafficCaptureRecord(_capture, CaptureReceived, [_receiveBuffer latestBytes:(size_t)numBytes],
+                                     (size_t)numBytes);
+            }
+        }
+
+        // The line is NUL terminated in place, find out which response we've received. Log messages are
+        // shown straight away and skipped, as the reader thread would.
+        parseResponse(line.data, line.length, &parsed);
+        if (parsed.response == LogMessage)
+        {
+            TRACE_BYTES(parsed.text, parsed.textLength, "Arduino: %b");
+            commandWindowHeard(&_window, 0, monotonicNanos());
+        }
+    } while (parsed.response == LogMessage);
+
+    TRACE_BYTES(line.data, line.length, "Read [%b]");
+    event->response = parsed.response;
+    event->receivedAt = monotonicNanos();
+    event->errorCode = parsed.errorCode;
+    event->length = (uint32_t)(parsed.textLength < RESPONSE_PAYLOAD_MAX ? parsed.textLength : RESPONSE_PAYLOAD_MAX - 1);
+    memcpy(event->payload, parsed.text, event->length);
+    event->payload[event->length] = '\0';
+    return parsed.response;
+}
+
+// -------------------------------------------------------------------------------------------
+
+- (ArduinoResponse) waitForResponse:(ArduinoResponse)expected timeout:(uint64_t)timeoutMillis
+{
+    uint64_t deadline = deadlineAfterMillis(timeoutMillis);
+    ArduinoResponse response = TimedOut;
+
+    do
+    {
+        response = [self readSerialCommandBefore:deadline];
+        if (response == expected || response == Error || response == TimedOut)
+        {
+            return response;
+        }
+
+        TRACE("Skipping response %d while waiting for %d", response, expected);
+    } while (monotonicNanos() < deadline);
+
+    return TimedOut;
 }
 
 // -------------------------------------------------------------------------------------------
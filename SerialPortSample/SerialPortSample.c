@@ -11,64 +11,92 @@ Command line tool that demonstrates how to use IOKitLib to find all serial ports
 #include <fcntl.h>
 #include <errno.h>
 #include <paths.h>
+#include <pthread.h>
 #include <sysexits.h>
 #include <sys/param.h>
 #include <sys/select.h>
 #include <sys/time.h>
 #include <time.h>
+#include <mach/mach.h>
 #include <Foundation/Foundation.h>
 #include <CoreFoundation/CoreFoundation.h>
 
 #import "SerialBuffer.h"
 #import "SerialComms.h"
 #import "ArduinoResponse.h"
-
-// The file that holds the instructions and configuration for our app
-#define SETTINGS_FILE "/Users/Pius/dev/XCode/ModemCommTest/settings.xcconfig"
+#import "DeviceManager.h"
+#import "FileTailer.h"
+#import "FrameCheck.h"
+#import "ImageSink.h"
+#import "ReelJournal.h"
+#import "ScanPipeline.h"
+#import "Settings.h"
+#import "TimingProfile.h"
+#import "TraceLog.h"
 
 // -------------------------------------------------------------------------------------------------
 
-// Arduino Vendor and Product ID. These are identifier we can use to open the appropriate port that
-// the Arduino is currently plugged in.
-// TODO: These are probably not needed. This only works for Custom USB devices, not serial port ones like the Arduino
+// Vendor and Product ID of the USB serial adapter the Arduino is plugged in with. Only ports with these IDs are
+// scanned with, and they (with the adapter's serial number) are how a port is recognised when it comes back after
+// a reset.
 #define kMyVendorID         0x10c4
 #define kMyProductID        0xea60
+
+// Frames that can be in flight between capture and store, and the size of each frame buffer. This is all the
+// memory the scan pipeline uses, however long the reel is.
+#define SCAN_FRAME_BUFFERS  4
+#define SCAN_FRAME_BYTES    (32 * 1024 * 1024)
+
+// Encoded frames that can be waiting for the disk. When they're all waiting, the scan waits too.
+#define IMAGE_WRITE_BUFFERS 4
  
 
 // ------------------------------------------------------------------------------------------------
-// Background thread that reads data from the USB serial (i.e. the Arduino) and populates a buffer
+// Follows a file as it's written, e.g. the log of an external control script, and hands each line over as soon as
+// it's there (see FileTailer.h). Without a lineHandler the lines go to the trace log.
 @interface FileReader : NSObject
-@property (nonatomic, strong) dispatch_queue_t backgroundQueue;
-@property (nonatomic, assign) BOOL shouldContinueReading;
 @property (nonatomic, strong) NSString *filePath;
+@property (nonatomic, assign) BOOL fromStart;       // the lines already in the file too, not only new ones
+@property (nonatomic, copy) void (^lineHandler)(const char *line, size_t length);    // on the reader's own thread
 - (instancetype)initWithFilePath:(NSString *)filePath;
-- (void)startReading;
+- (BOOL)startReading;
 - (void)stopReading;
 @end
 
 // ------------------------------------------------------------------------------------------------
 
-static int gCurrentState;               // the current state of the port.
-static NSString *gLastError = @"";      // most recent error message
 
-// settings values, initialised to default but can be overridden by values found in the SETTINGS_FILE
-static NSInteger gCellsToRead = 10;             // how many film cells to scan. This is just used for testing during development
-static NSString *gUsbPort = @"/dev/cu.usbserial-0001";  // USB port to communicate with the Arduino
+// The settings, their defaults from the schema in Settings.c, then the settings file, then the command line. Scanning
+// threads only read the live ones through their ReelScan, which picks up a reload between cells. The others don't change
+// once the scan has started.
+static Settings gSettings;
+static pthread_mutex_t gSettingsLock = PTHREAD_MUTEX_INITIALIZER;     // held while the live settings change
+static uint32_t gSettingsGeneration = 0;        // counts the reloads that changed a live setting
+static char gSettingsPath[PATH_MAX];            // the settings file that was read, and is watched
+static const char *gSettingsGiven = NULL;       // --settings, if given
 
-static NSString *gLogName = @"ScanBrain.log";           // Log file to use. Filename only. Log file will be in the Documents folder
+// NAME=value from the command line. They're applied over the file again whenever it's reloaded.
+#define SETTINGS_OVERRIDES_MAX  32
 
-static NSString *gImageLocation = @"~/ScanBrain/Images";    // Location of where to store the captured photos
+typedef struct
+{
+    char name[32];
+    const char *value;
+} SettingOverride;
 
-static NSInteger gCapturePause = 2;     // How long to pause (in seconds) after sending Arduino instructions. This gives the
-                                        // Arduino time to process what has been received. But I'm also using this during development
-                                        // to simulate a delay during the photo capture
+static SettingOverride gOverrides[SETTINGS_OVERRIDES_MAX];
+static int gOverrideCount = 0;
 
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
 
-// Interface implementation. This runs the background thread reading serial data received from the
-// Arduino via USB
+// Interface implementation. The tailer's thread waits for the file to change and reads it, so nothing here polls or
+// sleeps.
 @implementation FileReader
+{
+    FileTailer *_tailer;
+    void (^_handler)(const char *line, size_t length);      // lineHandler as it was when reading started
+}
 
 - (instancetype)initWithFilePath:(NSString *)filePath
 {
@@ -76,59 +104,77 @@ static NSInteger gCapturePause = 2;     // How long to pause (in seconds) after
     if (self)
     {
         _filePath = filePath;
-        _shouldContinueReading = YES;
-        _backgroundQueue = dispatch_queue_create("com.example.filereader", DISPATCH_QUEUE_CONCURRENT);
     }
     return self;
 }
 
 // ------------------------------------------------------------------------------------------------
 
-- (void)startReading
+- (void)dealloc
 {
-    // TODO: This is currently attempting to read from a file. Change this to read from the USB serial port
-    // TODO: Also create a buffer that we'll write the data to.
-    // TODO: Add another function to clear the buffer. This needs to be accessed (and probably defined) outside
-    //       of this interface. But make sure we don't clash with any current writes.
-    dispatch_async(self.backgroundQueue, ^{
-        @autoreleasepool {
-            // Open the file for reading
-            NSFileHandle *fileHandle = [NSFileHandle fileHandleForReadingAtPath:self.filePath];
-            if (!fileHandle)
-            {
-                NSLog(@"Failed to open file at path: %@", self.filePath);
-                return;
-            }
+    [self stopReading];
+}
 
-            // Continuously read data from the file
-            while (self.shouldContinueReading)
-            {
-                NSData *data = [fileHandle readDataOfLength:1024]; // Read 1 KB at a time
-                if (data.length == 0)
-                {
-                    [NSThread sleepForTimeInterval:0.1]; // Pause if EOF is reached
-                    continue;
-                }
-
-                // Process the data (or store it in a buffer)
-                NSString *stringData = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
-                NSLog(@"Read data: %@", stringData);
-                
-                // Simulate processing delay
-                [NSThread sleepForTimeInterval:0.1];
-            }
+// ------------------------------------------------------------------------------------------------
 
-            // Close the file when done
-            [fileHandle closeFile];
-        }
-    });
+/// Called by the tailer for every line. The line is only valid until this returns.
+static void fileReaderLine(void *context, const char *line, size_t length)
+{
+    FileReader *reader = (__bridge FileReader *)context;
+
+    if (reader->_handler)
+    {
+        reader->_handler(line, length);
+    }
+    else
+    {
+        TRACE_BYTES(line, length, "Followed: %b");
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+- (BOOL)startReading
+{
+    FileTailerConfig config;
+
+    if (_tailer)
+    {
+        return YES;
+    }
+
+    fileTailerDefaultConfig(&config);
+    config.fromStart = _fromStart;
+    config.record = fileReaderLine;
+    config.context = (__bridge void *)self;
+    _handler = _lineHandler;
+
+    _tailer = fileTailerStart([[_filePath stringByExpandingTildeInPath] fileSystemRepresentation], &config);
+    if (_tailer == NULL)
+    {
+        NSLog(@"Could not follow %@ - %s(%d).", _filePath, strerror(errno), errno);
+        return NO;
+    }
+
+    NSLog(@"Following %@%s", _filePath, fileTailerNative(_tailer) ? "" : ", looking at it every second");
+    return YES;
 }
 
 // ------------------------------------------------------------------------------------------------
 
 - (void)stopReading
 {
-    self.shouldContinueReading = NO;
+    FileTailerStats stats;
+
+    if (_tailer == NULL)
+    {
+        return;
+    }
+
+    fileTailerStop(_tailer, &stats);
+    _tailer = NULL;
+    NSLog(@"Followed %@: %llu lines, %llu bytes in %llu reads, %llu changes. Started over %llu times, new file %llu "
+          "times.", _filePath, stats.records, stats.bytes, stats.reads, stats.wakeups, stats.truncations, stats.reopens);
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -138,151 +184,982 @@ static NSInteger gCapturePause = 2;     // How long to pause (in seconds) after
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
 
-/// Load the configuration settings. If no file is defined, or the file could not be opened, we just use default values.
-static void readSettings(void)
+/// Log what's wrong with the settings, with the line of the file it's on
+static void logSettingsErrors(const SettingsErrors *errors)
 {
-    NSError *error = nil;
-    NSString *fileContents = [NSString stringWithContentsOfFile:@SETTINGS_FILE encoding:NSUTF8StringEncoding error:&error];
+    for (unsigned int i = 0; i < errors->count && i < SETTINGS_ERRORS_MAX; i++)
+    {
+        if (errors->errors[i].line > 0)
+        {
+            NSLog(@"%s line %u: %s", gSettingsPath, errors->errors[i].line, errors->errors[i].message);
+        }
+        else
+        {
+            NSLog(@"Command line: %s", errors->errors[i].message);
+        }
+    }
 
-    if (error)
+    if (errors->count > SETTINGS_ERRORS_MAX)
     {
-        NSLog(@"Error reading config file: [%@] - using default configurations instead", error.localizedDescription);
-        return;
+        NSLog(@"... and %u more problems with the settings", errors->count - SETTINGS_ERRORS_MAX);
     }
+}
 
-    // split all lines into an array
-    NSArray *configLines = [fileContents componentsSeparatedByString:@"\n"];
-    
-    for (int i = 0; i < configLines.count; i++)
+// ------------------------------------------------------------------------------------------------
+
+/// Apply the settings given on the command line over the file's
+static void applyOverrides(Settings *settings, SettingsErrors *errors)
+{
+    for (int i = 0; i < gOverrideCount; i++)
     {
-        if ([configLines[i] hasPrefix:@"//"])
+        settingsSet(settings, gOverrides[i].name, gOverrides[i].value, 0, errors);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Load the configuration settings: the defaults, then the settings file, then the command line. Without a file, the
+/// defaults are used. Returns false if any setting isn't valid, after logging each one with its line.
+static Boolean readSettings(void)
+{
+    SettingsErrors errors;
+    SettingsSource source = settingsResolvePath(gSettingsGiven, gSettingsPath, sizeof(gSettingsPath));
+    const SettingSpec *schema;
+    size_t count;
+    char value[SETTINGS_TEXT_MAX + 2];
+
+    settingsDefaults(&gSettings);
+    settingsClearErrors(&errors);
+    if (settingsLoad(&gSettings, gSettingsPath, &errors) == -1 && errno != EINVAL)
+    {
+        NSLog(@"Error reading config file %s from %s: [%s] - using default configurations instead", gSettingsPath,
+              settingsSourceName(source), strerror(errno));
+    }
+    else
+    {
+        NSLog(@"Settings from %s (found through %s)", gSettingsPath, settingsSourceName(source));
+    }
+
+    applyOverrides(&gSettings, &errors);
+    logSettingsErrors(&errors);
+
+    schema = settingsSchema(&count);
+    for (size_t i = 0; i < count; i++)
+    {
+        settingsFormat(&schema[i], &gSettings, value, sizeof(value));
+        NSLog(@"Setting: %s, Value: %s%s", schema[i].name, value, schema[i].live ? " (live)" : "");
+    }
+
+    return errors.count == 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// The settings file changed. If it's still valid, the live settings go to the running scans: timing is picked up at
+/// the next cell, the trace and reconnect settings straight away. The rest are only read at startup, so changes to them
+/// are logged and wait for the next run. If the file has errors, nothing changes.
+static void reloadSettings(DeviceManager *farm)
+{
+    Settings fresh;
+    SettingsErrors errors;
+    const SettingSpec *schema;
+    size_t count;
+    char before[SETTINGS_TEXT_MAX + 2];
+    char after[SETTINGS_TEXT_MAX + 2];
+    Boolean changed = false;
+
+    settingsDefaults(&fresh);
+    settingsClearErrors(&errors);
+    if (settingsLoad(&fresh, gSettingsPath, &errors) == -1)
+    {
+        if (errno == EINVAL)
         {
-            // Comment line, ignore it
+            logSettingsErrors(&errors);
+            NSLog(@"Keeping the settings as they were until %s is fixed", gSettingsPath);
         }
-        else
+        else if (errno != EAGAIN)
         {
-            NSArray *components = [configLines[i] componentsSeparatedByString:@"="];
-            
-            // Ensure there are exactly two components
-            if (components.count == 2)
+            NSLog(@"Could not read %s again - %s(%d). Keeping the settings as they were.", gSettingsPath,
+                  strerror(errno), errno);
+        }
+        return;
+    }
+    applyOverrides(&fresh, &errors);
+
+    schema = settingsSchema(&count);
+    pthread_mutex_lock(&gSettingsLock);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (settingsDiffer(&schema[i], &gSettings, &fresh))
+        {
+            settingsFormat(&schema[i], &gSettings, before, sizeof(before));
+            settingsFormat(&schema[i], &fresh, after, sizeof(after));
+            if (schema[i].live)
             {
-                NSString *settingName = [components[0] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
-                NSString *valueWithQuotes = components[1];
-                
-                // Strip the single quotes and line end from the value
-                NSString *settingValue = [valueWithQuotes stringByTrimmingCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@"'\n"]];
-                
-                NSLog(@"Setting: %@, Value: %@\n", settingName, settingValue);
-                if ([settingName isEqualToString:@"CELLS_TO_READ"])
-                {
-                    gCellsToRead = [Utilities getNumberFromString:settingValue];
-                }
-                else if ([settingName isEqualToString:@"CAPTURE_PAUSE"])
-                {
-                    gCapturePause = [Utilities getNumberFromString:settingValue];
-                }
-                else if ([settingName isEqualToString:@"USB_PORT"])
-                {
-                    gUsbPort = settingValue;
-                }
-                else if ([settingName isEqualToString:@"LOGFILE_NAME"])
-                {
-                    gLogName = settingValue;
-                }
-                else if ([settingName isEqualToString:@"IMAGE_LOCATION"])
-                {
-                    gImageLocation = settingValue;
-                }
+                NSLog(@"%s is now %s, was %s", schema[i].name, after, before);
+                changed = true;
             }
             else
             {
-                //NSLog(@"The input string [%@] is invalid", configLine);
+                NSLog(@"%s is %s in the settings file, but stays %s until the next run", schema[i].name, after, before);
             }
         }
     }
+
+    settingsCopyLive(&gSettings, &fresh);
+    if (changed)
+    {
+        __atomic_add_fetch(&gSettingsGeneration, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&gSettingsLock);
+
+    if (changed)
+    {
+        traceLogSetTraffic(fresh.traceTraffic != 0);
+        farm.startupTimeout = fresh.startupTimeout;
+        farm.reconnectTimeout = fresh.reconnectTimeout;
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
 
-// Function to continually read data from the serial port and store it in a buffer array. This
-// is running in a separate thread
-static void readToSerialBuffer(int fileDescriptor)
+/// Called by the settings watch, on its own thread
+static void settingsChanged(void *context)
 {
-    
+    @autoreleasepool
+    {
+        reloadSettings((__bridge DeviceManager *)context);
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
 
+/// Memory the process has in RAM right now, 0 if it can't be found out
+static uint64_t residentBytes(void)
+{
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+    {
+        return 0;
+    }
+
+    return info.resident_size;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+
+/// Send one NEXTCELL. The move gets the timeout the rig's timing profile has learned, and what's left of CAPTURE_PAUSE
+/// as grace, so a slow move is only late, not lost. Without a profile it gets CAPTURE_PAUSE.
+static ArduinoResponse moveToNextCell(ScanDevice *device, TimingProfile *timing, long capturePause)
+{
+    ArduinoResponse response;
+    CommandSlot move;
+
+    if (timing == NULL)
+    {
+        return [device.comms runCommand:CommandNextCell timeout:(uint32_t)capturePause * 1000];
+    }
+
+    response = [device.comms runCommand:CommandNextCell timeout:timingProfileTimeout(timing)
+                                  grace:timingProfileGrace(timing)];
+    move = [device.comms lastCommand];
+    if (response == Ok && timingProfileRecord(timing, move.completedAt - move.lastSentAt))
+    {
+        NSLog(@"[%d] Move took %.0f ms, longer than the %u ms expected. Back to %ld seconds for the next %d moves.",
+              device.index, (double)(move.completedAt - move.lastSentAt) / NANOS_PER_MILLI,
+              (uint32_t)(move.timeoutNanos / NANOS_PER_MILLI), capturePause, TIMING_BACKOFF_MOVES);
+    }
+    else if (response == TimedOut)
+    {
+        timingProfileFailed(timing);
+    }
+
+    return response;
+}
+
+// ------------------------------------------------------------------------------------------------
 
-/// Run a single scan of a film cell. We first move the film to the NEXTCELL and then run the capture and store the image
-void scanPhoto(int fileDescriptor, SerialComms *serialComms)
+/// The NEXTCELL round trip, getting the link back if it goes away under the move. Returns true once the Arduino has
+/// acknowledged the move, and sets lastError if it hasn't. The cell isn't counted, see scanPhoto.
+static Boolean nextCellRoundTrip(ScanDevice *device, TimingProfile *timing, long capturePause)
 {
-    char        buffer[256];    // Input buffer
-    char        *bufPtr;        // Current char in buffer
-    ssize_t        numBytes;        // Number of bytes read or written
     Boolean        result = false;
     ArduinoResponse response = Unrecognised;
 
-    // First check if there is anything in the buffer. This is likely the case. After opening the USB port, the
-    // Arduino sends at least a CMD_READY notification
-    bufPtr = buffer;
-/*    numBytes = read(fileDescriptor, bufPtr, &buffer[sizeof(buffer)] - bufPtr - 1);
+    // Return as soon as the Arduino acknowledges the move. CAPTURE_PAUSE is only the upper bound now.
+    response = moveToNextCell(device, timing, capturePause);
+
+    // If the port went away under the move, get it back and move again. The Arduino restarted when the port was
+    // opened again, so it doesn't know it was ever asked.
+    if (response != Ok && [device recoverLink])
+    {
+        response = moveToNextCell(device, timing, capturePause);
+    }
+
+    if (response == Ok)
+    {
+        result = true;
+    }
+    else if (response == TimedOut)
+    {
+        device.lastError = [NSString stringWithFormat:@"No acknowledgement for [%s] within %ld seconds", commandText(CommandNextCell), capturePause];
+        NSLog(@"[%d] %@", device.index, device.lastError);
+    }
+    else if (response == Error)
+    {
+        device.lastError = [NSString stringWithFormat:@"Arduino reported an error for [%s]", commandText(CommandNextCell)];
+        NSLog(@"[%d] %@", device.index, device.lastError);
+    }
+    else if (device.exitStatus == EX_OK)
+    {
+        // The port went and didn't come back. If reconnecting gave up, it has already said why.
+        device.lastError = [NSString stringWithFormat:@"Lost the Arduino during [%s]", commandText(CommandNextCell)];
+        NSLog(@"[%d] %@", device.index, device.lastError);
+    }
     
-    if (numBytes == -1)
+    return result;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Move the film to the NEXTCELL. Returns true once the Arduino has acknowledged the move. Capturing and storing the
+/// image is done by the capture and store stages of the scan pipeline (see runScanning).
+Boolean scanPhoto(ScanDevice *device, TimingProfile *timing, long capturePause)
+{
+    if (!nextCellRoundTrip(device, timing, capturePause))
     {
-        gLastError = [NSString stringWithFormat:@"Error reading from Arduino - %s(%d).", strerror(errno), errno];
-        NSLog(@"%@", gLastError);
+        return false;
     }
-    else if (numBytes > 0)
+
+    [device cellScanned];
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+// Scan pipeline stages. The context is the reel being scanned.
+// The device's worker thread has one autorelease pool for the whole reel, and the encode and store threads have none,
+// so each stage drains its own pool every cell. Otherwise every string made for a log line or an error would be kept
+// until the reel ends, and a reel of many thousand cells would grow without bound.
+
+typedef struct
+{
+    __unsafe_unretained ScanDevice *device;
+    ImageSink *sink;
+    ReelJournal *journal;       // how far the reel has got, NULL if that isn't kept
+    char path[PATH_MAX];        // of the reel's file. The command metrics go next to it
+    uint64_t metricsLoggedAt;   // monotonicNanos() when the command latencies were last logged
+    TimingProfile timing;       // how long this rig's moves take
+    uint32_t firstCell;         // the scan starts here, 0 unless the reel was cut short before
+    uint32_t cells;             // and the reel is finished after this many
+    bool filmAtFirstCell;       // the film is still at firstCell, so it isn't moved there again
+    uint32_t settingsGeneration;    // of the live settings below, as last picked up
+    long capturePause;              // CAPTURE_PAUSE
+    bool adaptiveTiming;            // ADAPTIVE_TIMING
+    long metricsInterval;           // METRICS_INTERVAL
+    bool frameCheck;                // FRAME_CHECK
+    long frameReadvances;           // FRAME_READVANCES
+    FrameChecker checker;           // blank and duplicate frames, BLANK_CONTRAST is in here
+    uint32_t blankSince;            // first of the blank cells just captured, UINT32_MAX if the last wasn't blank
+    uint32_t blankUntil;            // and the last
+    uint64_t readvances;            // moves made again because the film looked like it hadn't moved
+    uint64_t framesNotStored;       // blank and duplicate frames
+    uint64_t bytesNotStored;        // their raw captures
+    bool storeFailed;               // a frame couldn't be stored or journalled, which stopped the reel
+    bool advanceFailed;             // the film couldn't be moved, or the move couldn't be journalled
+} ReelScan;
+
+/// Pick up the live settings if they were reloaded since the reel last looked. Called before each cell, so a move never
+/// has its timeout changed under it.
+static void refreshSettings(ReelScan *reel, uint32_t cell)
+{
+    long capturePause;
+
+    if (__atomic_load_n(&gSettingsGeneration, __ATOMIC_ACQUIRE) == reel->settingsGeneration)
     {
-        NSLog(@"Buffer cleared. Contained [%s]", logString(buffer));
+        return;
     }
-  */
-    // Tell the Arduino to move to the next cell
-    numBytes = write(fileDescriptor, CMD_NEXTCELL, strlen(CMD_NEXTCELL));
-    if (numBytes == -1)
+
+    pthread_mutex_lock(&gSettingsLock);
+    reel->settingsGeneration = gSettingsGeneration;
+    capturePause = gSettings.capturePause;
+    reel->adaptiveTiming = gSettings.adaptiveTiming != 0;
+    reel->metricsInterval = gSettings.metricsInterval;
+    reel->frameCheck = gSettings.frameCheck != 0;
+    reel->frameReadvances = gSettings.frameReadvances;
+    reel->checker.blankContrast = (uint8_t)gSettings.blankContrast;
+    pthread_mutex_unlock(&gSettingsLock);
+
+    if (capturePause != reel->capturePause)
     {
-        gLastError = [NSString stringWithFormat:@"Error writing to Arduino - %s(%d).", strerror(errno), errno];
-        NSLog(@"%@", gLastError);
+        if (reel->capturePause != 0)
+        {
+            NSLog(@"[%d] From cell %u, moves get up to %ld seconds instead of %ld", reel->device.index, cell,
+                  capturePause, reel->capturePause);
+        }
+        reel->capturePause = capturePause;
+        timingProfileSetCeiling(&reel->timing, (uint32_t)capturePause * 1000);
+    }
+}
+
+/// Move the film on to cell, and record it in the journal. Moving it again for the same cell (readvance) doesn't count
+/// as another cell scanned, and is journalled as such: if the film had moved the first time, it's now a cell further on.
+static bool moveFilm(ReelScan *reel, uint32_t cell, bool readvance)
+{
+    TimingProfile *timing = reel->adaptiveTiming ? &reel->timing : NULL;
+    CommandSlot move;
+    bool recorded;
+
+    if (readvance ? !nextCellRoundTrip(reel->device, timing, reel->capturePause)
+                  : !scanPhoto(reel->device, timing, reel->capturePause))
+    {
+        reel->advanceFailed = true;
+        return false;
+    }
+
+    move = [reel->device.comms lastCommand];
+    recorded = reel->journal == NULL ||
+               (readvance ? reelJournalReadvanced(reel->journal, cell, move.sequence, move.result, move.attempts)
+                          : reelJournalMoved(reel->journal, cell, move.sequence, move.result, move.attempts));
+    if (!recorded)
+    {
+        // The film is somewhere the journal doesn't know about, so it mustn't be resumed from
+        reelJournalFinish(reel->journal);
+        reel->device.lastError = [NSString stringWithFormat:@"Could not record the move to cell %u - %s(%d).", cell,
+                                  strerror(errno), errno];
+        NSLog(@"[%d] %@", reel->device.index, reel->device.lastError);
+        reel->advanceFailed = true;
+        return false;
+    }
+
+    return true;
+}
+
+static bool advanceStage(void *context, uint32_t cell)
+{
+    ReelScan *reel = context;
+    uint64_t now;
+    bool result = true;
+
+    @autoreleasepool
+    {
+        refreshSettings(reel, cell);
+
+        // A resumed reel stopped with the film here and its frame lost, so it only needs capturing again
+        if (cell != reel->firstCell || !reel->filmAtFirstCell)
+        {
+            result = moveFilm(reel, cell, false);
+        }
+
+        // The metrics belong to the port, and this is the thread driving it. The memory in use should stay the same
+        // however long the reel gets.
+        now = monotonicNanos();
+        if (reel->metricsInterval > 0 &&
+            now - reel->metricsLoggedAt >= (uint64_t)reel->metricsInterval * NANOS_PER_SECOND)
+        {
+            NSLog(@"[%d] Command latencies after %u cells, %.1f MB resident:", reel->device.index, cell + 1,
+                  (double)residentBytes() / 1e6);
+            [reel->device.comms logCommandMetrics];
+            reel->metricsLoggedAt = now;
+        }
+    }
+
+    return result;
+}
+
+/// Capture the cell the film is at
+static bool captureFrame(ReelScan *reel, ScanFrame *frame)
+{
+    // TODO :  Ok, now we can run the photo capture into frame->pixels, with the width, height and rowBytes of
+    //         its luminance plane for the frame check....
+    frame->pixelLength = 0;
+    return true;
+}
+
+/// Log the blank cells just captured, once there's one that isn't
+static void endBlankRun(ReelScan *reel)
+{
+    if (reel->blankSince == UINT32_MAX)
+    {
+        return;
+    }
+
+    if (reel->blankSince == reel->blankUntil)
+    {
+        NSLog(@"[%d] Cell %u is blank, not storing it", reel->device.index, reel->blankSince);
     }
     else
     {
-        NSLog(@"Wrote %ld bytes [%s]", numBytes, [Utilities logString:CMD_NEXTCELL]);
+        NSLog(@"[%d] Cells %u to %u are blank, not storing them", reel->device.index, reel->blankSince, reel->blankUntil);
     }
-        
-        
-        // TODO: this is not good. We should really use the read command with a timeout
-        usleep((int)gCapturePause * 1000000);    // Give the Arduino time to respond
-        
-        NSLog(@"Looking for [%s]", [Utilities logString:CMD_OK]);
-        
-        ///TODO: Normally we still have the CTS:READY in our buffer first, which the Arduino sends after opening the port.
-        ///So most buffers on first read look something like "CTS:READY\nCTS:READY\nCTS:OK\n". We need to decipher this properly.
-/*
- Read [Log: Moving to next cell.\nLog: Turning motor on to move to next cell\nLog: Starting clutch.\nERROR: Timeout while moving to next cell. Stopping clutch.\nCTS:OK\n]
- 
- Read [Log: sensorLowCount: 2\nCTS:ATCELL\nLog: We're at the next cell. Stopping clutch.\nCTS:OK\nLog: Moving to next cell.\nLog: Turning motor on to move to next cell\nLog: Starting clutch.\n]
- */
-    
-    response = [serialComms readSerialCommand];
-        if (response == Ok)
+    reel->blankSince = UINT32_MAX;
+}
+
+/// Look at the frame before it's encoded. A blank one isn't stored. One that's the same as the cell before most likely
+/// means the film didn't move (the firmware can time out mid-move and still say OK), so the film is moved again and
+/// the cell captured again, up to FRAME_READVANCES times. If it's still the same, it isn't stored either.
+static bool checkFrame(ReelScan *reel, ScanFrame *frame)
+{
+    FrameVerdict verdict = frameCheck(&reel->checker, frame->pixels, frame->width, frame->height, frame->rowBytes);
+
+    for (long again = 0; verdict == FrameDuplicate && again < reel->frameReadvances; again++)
+    {
+        NSLog(@"[%d] Cell %u looks the same as the one before, the film may not have moved. Moving it again.",
+              reel->device.index, frame->cell);
+        reel->readvances++;
+        if (!moveFilm(reel, frame->cell, true) || !captureFrame(reel, frame))
         {
-            result = true;
-            // TODO :  Ok, now we can run the photo capture....
+            return false;
         }
+        verdict = frameCheck(&reel->checker, frame->pixels, frame->width, frame->height, frame->rowBytes);
+    }
+
+    if (verdict == FrameBlank)
+    {
+        if (reel->blankSince == UINT32_MAX)
+        {
+            reel->blankSince = frame->cell;
+        }
+        reel->blankUntil = frame->cell;
+    }
+    else
+    {
+        endBlankRun(reel);
+    }
+
+    if (verdict == FrameDuplicate)
+    {
+        NSLog(@"[%d] Cell %u is still the same as the one before, not storing it", reel->device.index, frame->cell);
+    }
+
+    if (verdict == FrameBlank || verdict == FrameDuplicate)
+    {
+        frame->skip = true;
+        reel->framesNotStored++;
+        reel->bytesNotStored += frame->pixelLength;
+    }
+
+    return true;
+}
+
+static bool captureStage(void *context, ScanFrame *frame)
+{
+    ReelScan *reel = context;
+
+    @autoreleasepool
+    {
+        if (!captureFrame(reel, frame))
+        {
+            return false;
+        }
+
+        if (!reel->frameCheck)
+        {
+            endBlankRun(reel);
+            return true;
+        }
+
+        return checkFrame(reel, frame);
+    }
+}
+
+static bool encodeStage(void *context, ScanFrame *frame)
+{
+    // TODO :  Encode the raw capture. Until then we store the pixels as they are
+    memcpy(frame->encoded, frame->pixels, frame->pixelLength);
+    frame->encodedLength = frame->pixelLength;
+    return true;
+}
+
+static bool storeStage(void *context, const ScanFrame *frame)
+{
+    ReelScan *reel = context;
+    uint32_t checksum = 0;
+    uint64_t offset;
+
+    // Lets a resumed reel tell whether the frame made it to the disk
+    if (reel->journal)
+    {
+        checksum = reelChecksum(0, frame->encoded, frame->encodedLength);
+    }
+
+    @autoreleasepool
+    {
+        // Only waits if the disk has fallen behind, which holds up the film until it catches up
+        if (!imageSinkSubmit(reel->sink, frame->cell, frame->encoded, frame->encodedLength, &offset))
+        {
+            reel->device.lastError = [NSString stringWithFormat:@"Could not store cell %u - %s(%d).", frame->cell,
+                                      strerror(errno), errno];
+            NSLog(@"[%d] %@", reel->device.index, reel->device.lastError);
+            reel->storeFailed = true;
+            return false;
+        }
+
+        if (reel->journal && !reelJournalStored(reel->journal, frame->cell, offset, frame->encodedLength, checksum))
+        {
+            reel->device.lastError = [NSString stringWithFormat:@"Could not record cell %u in the journal - %s(%d).",
+                                      frame->cell, strerror(errno), errno];
+            NSLog(@"[%d] %@", reel->device.index, reel->device.lastError);
+            reel->storeFailed = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// How the reel's photos are written, from IMAGE_SYNC and IMAGE_WRITERS. The index has room for every cell of the reel
+/// from the start.
+static void reelSinkConfig(ImageSinkConfig *config, uint32_t cells)
+{
+    imageSinkDefaultConfig(config);
+    config->bufferCount = IMAGE_WRITE_BUFFERS;
+    config->bufferBytes = SCAN_FRAME_BYTES;
+    config->expectedFrames = cells;
+    config->writerThreads = (unsigned int)gSettings.imageWriters;
+    if (strcasecmp(gSettings.imageSync, "frame") == 0)
+    {
+        config->sync = ImageSyncEveryFrame;
+    }
+    else if (atol(gSettings.imageSync) > 0)
+    {
+        config->sync = ImageSyncEveryN;
+        config->syncInterval = (unsigned int)atol(gSettings.imageSync);
+    }
+    else
+    {
+        config->sync = ImageSyncAtEnd;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Open the file the reel's photos go into: one per reel and device, in IMAGE_LOCATION
+static Boolean openReel(ScanDevice *device, ReelScan *reel)
+{
+    ImageSinkConfig config;
+    NSString *folder = [[NSString stringWithUTF8String:gSettings.imageLocation] stringByExpandingTildeInPath];
+    NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
+    NSString *path;
+    NSError *error = nil;
+
+    reelSinkConfig(&config, reel->cells);
+    if (![[NSFileManager defaultManager] createDirectoryAtPath:folder withIntermediateDirectories:YES attributes:nil
+                                                         error:&error])
+    {
+        NSLog(@"[%d] Could not create %@ - %@", device.index, folder, error.localizedDescription);
+        return false;
+    }
+
+    formatter.dateFormat = @"yyyyMMdd-HHmmss";
+    path = [folder stringByAppendingPathComponent:[NSString stringWithFormat:@"reel-%@-%d.reel",
+                                                   [formatter stringFromDate:[NSDate date]], device.index]];
+
+    reel->sink = imageSinkOpen([path fileSystemRepresentation], &config);
+    if (reel->sink == NULL)
+    {
+        NSLog(@"[%d] Could not create %@ - %s(%d).", device.index, path, strerror(errno), errno);
+        return false;
+    }
+
+    strlcpy(reel->path, [path fileSystemRepresentation], sizeof(reel->path));
+    NSLog(@"[%d] Storing the reel in %@", device.index, path);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Finish the reel's file and log how the disk kept up. Back pressure is time the scan spent waiting for it.
+/// The command latencies so far are written next to it, with .json in place of .reel.
+static Boolean closeReel(ScanDevice *device, ReelScan *reel)
+{
+    ImageSinkStats stats;
+    NSString *metricsPath = [[[NSString stringWithUTF8String:reel->path] stringByDeletingPathExtension]
+                             stringByAppendingPathExtension:@"json"];
+
+    if ([device.comms writeCommandMetrics:metricsPath])
+    {
+        NSLog(@"[%d] Command metrics are in %@", device.index, metricsPath);
+    }
+
+    imageSinkGetStats(reel->sink, &stats);
+    if (imageSinkClose(reel->sink) == -1)
+    {
+        device.lastError = [NSString stringWithFormat:@"Could not finish the reel - %s(%d).", strerror(errno), errno];
+        NSLog(@"[%d] %@", device.index, device.lastError);
+        return false;
+    }
+
+    NSLog(@"[%d] Stored %llu frames, %.1f MB in %llu writes, %llu syncs%s. Writing took %.3f s, the scan waited %.3f s "
+          "for the disk %llu times.", device.index, stats.frames, (double)stats.bytes / 1e6, stats.batches, stats.syncs,
+          stats.directIO ? ", bypassing the page cache" : "", (double)stats.busyNanos / NANOS_PER_SECOND,
+          (double)stats.backPressureNanos / NANOS_PER_SECOND, stats.backPressureWaits);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Where a file belonging to a rig is kept. Rigs are known by their adapter's serial number, so the file follows the
+/// rig to whichever port it's plugged into. Without one, by its position in the farm.
+static NSString *rigFilePath(ScanDevice *device, NSString *folder, NSString *extension)
+{
+    SerialPortInfo port = device.port;
+    NSString *name = port.serialNumber[0] ? [NSString stringWithFormat:@"rig-%s", port.serialNumber]
+                                          : [NSString stringWithFormat:@"rig-%d", device.index];
+
+    return [[[folder stringByExpandingTildeInPath] stringByAppendingPathComponent:name]
+            stringByAppendingPathExtension:extension];
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Where a rig's timing profile is kept
+static NSString *timingProfilePath(ScanDevice *device)
+{
+    return rigFilePath(device, [NSString stringWithUTF8String:gSettings.timingProfiles], @"timing");
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Carry on with the reel the rig was scanning when the last run stopped, if its journal says it wasn't finished.
+/// Frames that didn't make it to the disk are cut off the end of the reel. The film is still at the cell it was last
+/// moved to, so if that one's frame was lost it's captured again without moving. Cells the film was moved past without
+/// their frames being kept can't be got back, they're logged. Returns false if there's no reel to carry on with.
+static Boolean resumeReel(ScanDevice *device, ReelScan *reel)
+{
+    NSString *path = rigFilePath(device, [NSString stringWithUTF8String:gSettings.imageLocation], @"journal");
+    ReelJournal *journal = reelJournalOpen([path fileSystemRepresentation]);
+    ImageSinkConfig config;
+    JournalResumePoint point;
+    ReelFile file;
+    char reelPath[PATH_MAX];
+    uint32_t sessions;
+
+    if (journal == NULL)
+    {
+        if (errno != ENOENT)
+        {
+            NSLog(@"[%d] Could not open the journal %@ - %s(%d). Starting a new reel.", device.index, path,
+                  strerror(errno), errno);
+        }
+        return false;
+    }
+
+    if (reelJournalHeader(journal)->finished)
+    {
+        reelJournalClose(journal);
+        return false;
+    }
+
+    strlcpy(reelPath, reelJournalHeader(journal)->reelPath, sizeof(reelPath));
+    reel->cells = reelJournalHeader(journal)->cells;
+    if (!reelFileOpen(&file, reelPath))
+    {
+        NSLog(@"[%d] Could not open %s to carry on with it - %s(%d). Starting a new reel.", device.index, reelPath,
+              strerror(errno), errno);
+        reelJournalClose(journal);
+        return false;
+    }
+
+    // Frames in the page cache can be lost along with the machine, so check more than the sink can have waiting
+    reelJournalResumePoint(journal, &file, JOURNAL_VERIFY_MAX, &point);
+    reelFileClose(&file);
+
+    reelSinkConfig(&config, reel->cells);
+    reel->sink = imageSinkResume(reelPath, &config, point.dataEnd);
+    if (reel->sink == NULL)
+    {
+        NSLog(@"[%d] Could not carry on with %s - %s(%d). Starting a new reel.", device.index, reelPath,
+              strerror(errno), errno);
+        reelJournalClose(journal);
+        return false;
+    }
+
+    if (!reelJournalResumed(journal, &point))
+    {
+        NSLog(@"[%d] Could not record carrying on with %s - %s(%d). Starting a new reel.", device.index, reelPath,
+              strerror(errno), errno);
+        imageSinkClose(reel->sink);
+        reel->sink = NULL;
+        reelJournalClose(journal);
+        return false;
+    }
+
+    if (!point.moved)
+    {
+        reel->firstCell = 0;
+    }
+    else if (point.stored && point.lastStored >= point.filmAt)
+    {
+        reel->firstCell = point.filmAt + 1;
+    }
+    else
+    {
+        reel->firstCell = point.filmAt;
+        reel->filmAtFirstCell = true;
+    }
+
+    sessions = reelJournalHeader(journal)->sessions;
+    reel->journal = journal;
+    strlcpy(reel->path, reelPath, sizeof(reel->path));
+
+    NSLog(@"[%d] Carrying on with %s from cell %u of %u, session %u. Kept %u frames, dropped %u that weren't on the disk.",
+          device.index, reelPath, reel->firstCell, reel->cells, sessions, point.framesKept, point.framesDropped);
+    if (point.cellsLost > 0)
+    {
+        NSLog(@"[%d] The film was moved past %u cells whose frames were lost, cells %u to %u.", device.index,
+              point.cellsLost, point.filmAt - point.cellsLost, point.filmAt - 1);
+    }
+    if (point.readvances > 0)
+    {
+        NSLog(@"[%d] The film was moved again %u times for cells that looked unmoved, so it may be up to %u cells "
+              "further on than cell %u.", device.index, point.readvances, point.readvances, point.filmAt);
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Start the journal for a new reel, so it can be carried on with if the scan is cut short. The scan goes ahead
+/// without one if it can't be created.
+static void startJournal(ScanDevice *device, ReelScan *reel)
+{
+    NSString *path = rigFilePath(device, [NSString stringWithUTF8String:gSettings.imageLocation], @"journal");
+
+    reel->journal = reelJournalCreate([path fileSystemRepresentation], reel->path, reel->cells);
+    if (reel->journal == NULL)
+    {
+        NSLog(@"[%d] Could not create the journal %@ - %s(%d). The reel can't be carried on with if it's cut short.",
+              device.index, path, strerror(errno), errno);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Start the rig's timing profile, already set to CAPTURE_PAUSE, from the one saved by the last run if there is one
+static void loadTiming(ScanDevice *device, TimingProfile *timing)
+{
+    NSString *path = timingProfilePath(device);
+
+    uint32_t ceilingMillis = timing->ceilingMillis;
+
+    if (timingProfileLoad(timing, [path fileSystemRepresentation]) == -1)
+    {
+        if (errno != ENOENT)
+        {
+            NSLog(@"[%d] Could not load the timing profile %@ - %s(%d). Starting from %u seconds.", device.index, path,
+                  strerror(errno), errno, ceilingMillis / 1000);
+        }
+        timingProfileInit(timing, ceilingMillis);
+        return;
+    }
+
+    NSLog(@"[%d] Moves get %u ms to start with, learned from %u saved moves (p%d %u ms).", device.index,
+          timing->timeoutMillis, timing->count, TIMING_PERCENTILE, timing->percentileMillis);
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Save what the reel taught us about the rig's moves, for the next run
+static void saveTiming(ScanDevice *device, const TimingProfile *timing)
+{
+    NSString *path = timingProfilePath(device);
+    NSError *error = nil;
+
+    NSLog(@"[%d] Moves now get %u ms (p%d %u ms) of %u seconds. %llu were late and %llu never finished. A stuck move "
+          "is noticed %.1f s sooner on average.", device.index, timingProfileTimeout(timing), TIMING_PERCENTILE,
+          timing->percentileMillis, timing->ceilingMillis / 1000, timing->stats.late, timing->stats.failed,
+          timing->stats.moves ? (double)timing->stats.savedNanos / timing->stats.moves / NANOS_PER_SECOND : 0.0);
+
+    if (![[NSFileManager defaultManager] createDirectoryAtPath:[path stringByDeletingLastPathComponent]
+                                   withIntermediateDirectories:YES attributes:nil error:&error])
+    {
+        NSLog(@"[%d] Could not create %@ - %@", device.index, [path stringByDeletingLastPathComponent],
+              error.localizedDescription);
+        return;
+    }
+
+    if (timingProfileSave(timing, [path fileSystemRepresentation]) == -1)
+    {
+        NSLog(@"[%d] Could not save the timing profile %@ - %s(%d).", device.index, path, strerror(errno), errno);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Log how fast each stage of the pipeline ran. A reel can't go faster than its slowest stage, so that's the one to work on.
+static void reportScanStats(int device, const ScanPipelineStats *stats)
+{
+    ScanStage slowest = StageAdvance;
+    double rate;
+
+    NSLog(@"[%d] Scanned %llu of %llu cells in %.2f seconds. Stored %llu, skipped %llu.", device,
+          stats->stages[StageAdvance].items, stats->cellsRequested, (double)stats->elapsedNanos / NANOS_PER_SECOND,
+          stats->framesStored, stats->framesSkipped);
+
+    for (ScanStage stage = StageAdvance; stage < StageCount; stage++)
+    {
+        rate = scanStageRate(&stats->stages[stage]);
+        NSLog(@"[%d]   %-8s %6llu frames  busy %8.3fs  waiting %8.3fs  %8.2f frames/s", device,
+              scanStageName(stage), stats->stages[stage].items, (double)stats->stages[stage].busyNanos / NANOS_PER_SECOND,
+              (double)stats->stages[stage].waitNanos / NANOS_PER_SECOND, rate);
+
+        if (stats->stages[stage].busyNanos > stats->stages[slowest].busyNanos)
+        {
+            slowest = stage;
+        }
+    }
+
+    NSLog(@"[%d] Slowest stage is [%s]", device, scanStageName(slowest));
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Log what the frame check found, and what not storing the blank and duplicate frames saved. A frame that isn't stored
+/// saves what encoding and storing one took on average on this reel.
+static void reportFrameCheck(int device, const ReelScan *reel, const ScanPipelineStats *stats)
+{
+    const FrameCheckStats *check = &reel->checker.stats;
+    double savedNanos = 0.0;
+
+    if (check->frames == 0)
+    {
+        return;
+    }
+
+    for (ScanStage stage = StageEncode; stage <= StageStore; stage++)
+    {
+        if (stats->stages[stage].items > 0)
+        {
+            savedNanos += (double)stats->stages[stage].busyNanos / stats->stages[stage].items * reel->framesNotStored;
+        }
+    }
+
+    NSLog(@"[%d] Checked %llu frames in %.3f s, %.2f ms each: %llu blank, %llu the same as the cell before, %llu not "
+          "checked. Moved on again %llu times.", device, check->frames, (double)check->busyNanos / NANOS_PER_SECOND,
+          (double)check->busyNanos / check->frames / NANOS_PER_MILLI, check->blank, check->duplicate, check->unchecked,
+          reel->readvances);
+    NSLog(@"[%d] Not storing %llu frames saved %.1f MB and about %.3f s of encoding and storing.", device,
+          reel->framesNotStored, (double)reel->bytesNotStored / 1e6, savedNanos / NANOS_PER_SECOND);
 }
 
 // ------------------------------------------------------------------------------------------------
 
 /// Function that handles the scanning of film cells. We do this by issuing a NEXTCELL command to the Arduino to move
 /// the film to the next cell, then do a photo capture and store the image.
-/// We assume that the Arduino is available to receive commands at this point and that the camera has been initalised
-void runScanning(int fileDescriptor, SerialComms *serialComms)
+/// Encoding and storing run on worker threads, so the film is already moving to the next cell while the previous
+/// image is being written.
+/// We assume that the Arduino is available to receive commands at this point and that the camera has been initalised.
+/// The device manager calls this on each device's own worker thread, so everything it touches belongs to the device.
+void runScanning(ScanDevice *device, void *context)
 {
-    for(int i = 0; i < gCellsToRead; i++)
+    ScanPipelineConfig config = { SCAN_FRAME_BUFFERS, SCAN_FRAME_BYTES, SCAN_FRAME_BYTES };
+    ReelScan reel = { .device = device, .metricsLoggedAt = monotonicNanos(), .cells = (uint32_t)gSettings.cellsToRead,
+                      .settingsGeneration = UINT32_MAX, .blankSince = UINT32_MAX };
+    ScanStages stages = { &reel, advanceStage, captureStage, encodeStage, storeStage };
+    ScanPipelineStats stats;
+    ScanPipeline *pipeline;
+
+    if (!gSettings.resumeReels || !resumeReel(device, &reel))
     {
-        scanPhoto(fileDescriptor, serialComms);
+        if (!openReel(device, &reel))
+        {
+            [device fail:EX_CANTCREAT reason:@"Could not create the file to store the reel in"];
+            return;
+        }
+
+        if (gSettings.resumeReels)
+        {
+            startJournal(device, &reel);
+        }
+    }
+
+    // The live settings as they are now. The timing profile is kept even without ADAPTIVE_TIMING, which can be
+    // turned on mid-reel.
+    frameCheckerInit(&reel.checker, FRAME_BLANK_CONTRAST);
+    refreshSettings(&reel, reel.firstCell);
+    if (reel.adaptiveTiming)
+    {
+        loadTiming(device, &reel.timing);
+    }
+
+    pipeline = scanPipelineCreate(&config, &stages);
+    if (pipeline == NULL)
+    {
+        [device fail:EX_OSERR reason:@"Could not allocate the scan pipeline"];
+        imageSinkClose(reel.sink);
+        reelJournalClose(reel.journal);
+        return;
+    }
+
+    scanPipelineRunFrom(pipeline, reel.firstCell, reel.cells);
+    scanPipelineGetStats(pipeline, &stats);
+    if (stats.threadError != 0)
+    {
+        device.lastError = [NSString stringWithFormat:@"Could not start the scan pipeline - %s(%d).",
+                            strerror(stats.threadError), stats.threadError];
+    }
+    device.scanStats = stats;
+    reportScanStats(device.index, &stats);
+    endBlankRun(&reel);
+    reportFrameCheck(device.index, &reel, &stats);
+
+    scanPipelineDestroy(pipeline);
+
+    if (reel.timing.count > 0)
+    {
+        saveTiming(device, &reel.timing);
     }
+
+    // Whatever cut the reel short, a move or a frame that couldn't be stored, left the reason in lastError
+    if (stats.framesStored + stats.framesSkipped != stats.cellsRequested)
+    {
+        NSString *reason = device.lastError;
+
+        if (stats.stages[StageAdvance].items == 0)
+        {
+            NSLog(@"[%d] Stopped the reel before cell %u.", device.index, reel.firstCell);
+        }
+        else
+        {
+            NSLog(@"[%d] Stopped the reel after cell %u%s.", device.index,
+                  reel.firstCell + (uint32_t)stats.stages[StageAdvance].items - 1,
+                  reel.storeFailed ? ", frames can't be stored" :
+                  reel.advanceFailed ? ", the film can't be moved" : "");
+        }
+        closeReel(device, &reel);
+        [device fail:EX_IOERR reason:reason];
+    }
+    else if (!closeReel(device, &reel))
+    {
+        [device fail:EX_IOERR reason:device.lastError];
+    }
+    else if (reel.journal)
+    {
+        // Every cell is in the reel, so there's nothing to carry on with next time
+        reelJournalFinish(reel.journal);
+    }
+
+    reelJournalClose(reel.journal);
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Write out what's left in the trace log and say whether it kept up
+static void stopTraceLog(void)
+{
+    TraceLogStats stats;
+
+    traceLogStop();
+    traceLogGetStats(&stats);
+    NSLog(@"Trace log wrote %llu messages from %u threads, dropped %llu. Traffic %llu bytes.",
+          stats.records, stats.threads, stats.dropped, stats.trafficBytes);
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -292,26 +1169,107 @@ void redirectConsoleLogToDocumentFolder(void)
 {
     NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
     NSString *documentsDirectory = [paths objectAtIndex:0];
-    NSString *logPath = [documentsDirectory stringByAppendingPathComponent:gLogName];
+    NSString *logPath = [documentsDirectory stringByAppendingPathComponent:
+                         [NSString stringWithUTF8String:gSettings.logName]];
     freopen([logPath fileSystemRepresentation],"a+",stderr);
 }
 
 // ------------------------------------------------------------------------------------------------
 
+/// Keep a setting given on the command line, to go over the settings file's
+static void addOverride(const char *name, size_t length, const char *value)
+{
+    SettingOverride *override;
+
+    if (gOverrideCount == SETTINGS_OVERRIDES_MAX || length >= sizeof(override->name))
+    {
+        NSLog(@"Ignoring [%.*s=%s], too many settings or too long a name", (int)length, name, value);
+        return;
+    }
+
+    override = &gOverrides[gOverrideCount++];
+    memcpy(override->name, name, length);
+    override->name[length] = '\0';
+    override->value = value;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/// Command line options override the settings file. --set NAME=value sets any setting, the other options are short for
+/// the settings they're named after. --settings reads a different settings file. Every --port given is added to ports,
+/// and opened as is rather than looked for among the USB serial ports (e.g. the slave side of the Arduino simulator).
+/// Give it more than once to scan with several devices.
+static void readCommandLine(int argc, const char * argv[], NSMutableArray<NSString *> *ports)
+{
+    const char *equals;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+        {
+            [ports addObject:[NSString stringWithUTF8String:argv[++i]]];
+        }
+        else if (strcmp(argv[i], "--settings") == 0 && i + 1 < argc)
+        {
+            gSettingsGiven = argv[++i];
+        }
+        else if (strcmp(argv[i], "--set") == 0 && i + 1 < argc && (equals = strchr(argv[i + 1], '=')) != NULL)
+        {
+            addOverride(argv[i + 1], (size_t)(equals - argv[i + 1]), equals + 1);
+            i++;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            addOverride("FARM_THREADS", strlen("FARM_THREADS"), argv[++i]);
+        }
+        else if (strcmp(argv[i], "--binary") == 0 && i + 1 < argc)
+        {
+            addOverride("BINARY_BAUD", strlen("BINARY_BAUD"), argv[++i]);
+        }
+        else if (strcmp(argv[i], "--trace-traffic") == 0)
+        {
+            addOverride("TRACE_TRAFFIC", strlen("TRACE_TRAFFIC"), "1");
+        }
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+        {
+            addOverride("CAPTURE_FILE", strlen("CAPTURE_FILE"), argv[++i]);
+        }
+        else
+        {
+            NSLog(@"Ignoring unknown option [%s]", argv[i]);
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
 int main(int argc, const char * argv[])
 {
-    int             fileDescriptor;
-    kern_return_t	kernResult;
+    int             status;
+    NSMutableArray<NSString *> *ports = [[NSMutableArray alloc] init];
+    NSString *usbPort;
+    SettingsWatch *watch;
+    FileReader *follower = nil;
     //NSString *preferedPath = gUsbPort;      // configured USB port. If not found, the app will try the first one available
     
     // Uncomment this to use a log file instead of the console log
     //redirectConsoleLogToDocumentFolder();
     
-    readSettings();     // load the configurations
+    readCommandLine(argc, argv, ports);
+    if (!readSettings())     // load the configurations
+    {
+        NSLog(@"Not scanning until the settings are fixed");
+        return EX_CONFIG;
+    }
 
-    // clear error string buffer
-    gLastError = @"";
-    gCurrentState = 0;   // TODO : work out error and success state values
+    // Per-command and per-byte messages go through the trace log, so logging never holds up the serial link.
+    // It writes to stderr like NSLog, so it ends up in the same place when that's redirected.
+    if (!traceLogStart(STDERR_FILENO))
+    {
+        NSLog(@"Could not start the trace log. Hot path messages will be lost.");
+    }
+    traceLogRegisterThread("main");
+    traceLogSetTraffic(gSettings.traceTraffic != 0);
 
     /* Remove me
     @autoreleasepool
@@ -334,67 +1292,71 @@ int main(int argc, const char * argv[])
     
     @autoreleasepool
     {
-        SerialComms *serialComms = [[SerialComms alloc] init: gUsbPort];
-        
-        //kernResult = [serialComms findSerialPorts: &serialPortIterator];
-        kernResult = [serialComms findSerialPorts];
-        if (KERN_SUCCESS != kernResult)
+        // Every scanner gets its own SerialComms and state, so one process can drive as many as are plugged in
+        DeviceManager *farm = [[DeviceManager alloc] initWithBackend:defaultSerialBackend() vendorId:kMyVendorID
+                                                           productId:kMyProductID];
+
+        farm.workerThreads = gSettings.farmThreads;
+        farm.binaryBaud = gSettings.binaryBaud;
+        farm.startupTimeout = gSettings.startupTimeout;
+        farm.captureFile = gSettings.captureFile[0] ?
+            [[NSString stringWithUTF8String:gSettings.captureFile] stringByExpandingTildeInPath] : nil;
+        farm.reconnectTimeout = gSettings.reconnectTimeout;
+        farm.hardwareFlowControl = gSettings.hardwareFlowControl != 0;
+        farm.drainTimeout = gSettings.drainTimeout;
+        farm.telemetry = gSettings.telemetry != 0;
+        usbPort = [NSString stringWithUTF8String:gSettings.usbPort];
+
+        if (ports.count > 0)
         {
-            gCurrentState = EX_UNAVAILABLE;
-            gLastError = @"No USB ports were found";
-            NSLog(@"%@", gLastError);
+            for (NSString *port in ports)
+            {
+                [farm addPort:port];
+            }
         }
-        
-        NSLog(@"Before: %@", [serialComms usbPath]);
-        //kernResult = [serialComms getModemPath: serialPortIterator defaultPath: &preferedPath];
-        kernResult = [serialComms findUsbPath];
-        NSLog(@"After: %@", [serialComms usbPath]);
-        if (KERN_SUCCESS != kernResult)
+        else if ([farm discoverPorts:usbPort] <= 0 && [usbPort rangeOfCharacterFromSet:
+                     [NSCharacterSet characterSetWithCharactersInString:@"*?["]].location == NSNotFound)
         {
-            gCurrentState = EX_UNAVAILABLE;
-            gLastError = @"Could not get path for USB";
-            NSLog(@"%@", gLastError);
+            // Not found among the USB serial ports, but it might still open
+            NSLog(@"Could not get path for USB. Trying [%@] anyway.", usbPort);
+            [farm addPort:usbPort];
         }
 
-        if (![serialComms usbPath])
+        if ([farm devices].count == 0)
         {
-            gLastError = @"No USB port found";
-            NSLog(@"%@", gLastError);
-            gCurrentState = EX_UNAVAILABLE;
+            NSLog(@"No USB port found");
+            stopTraceLog();
             return EX_UNAVAILABLE;
         }
-        
-        // Now open the port we found and check whether we have an Arduino responding
-        fileDescriptor = [serialComms openSerialPort];
-        if (-1 == fileDescriptor)
+
+        // Timing changes in the settings file reach the scans while they run
+        watch = settingsWatchStart(gSettingsPath, settingsChanged, (__bridge void *)farm);
+        if (watch == NULL)
         {
-            gCurrentState = EX_IOERR;
-            gLastError = @"Failed opening USB port";
-            NSLog(@"%@", gLastError);
-            return EX_IOERR;
+            NSLog(@"Could not watch %s - %s(%d). Changes to it need a restart.", gSettingsPath, strerror(errno), errno);
         }
-
-        // TODO: replace this with a loop where we wait for CTS:READY
-        NSLog(@"Sleeping for [%ld] seconds to allow Arduino to initialise.", gCapturePause);
-        usleep((int)gCapturePause * 1000000);
-        
-        if ([serialComms isArduinoOnline])
+        else if (!settingsWatchNative(watch))
         {
-            NSLog(@"Arduino is online and ready to receive commands.");
-            runScanning(fileDescriptor, serialComms);  // We're ready to go, start scanning
+            NSLog(@"Looking at %s for changes every %d ms", gSettingsPath, SETTINGS_POLL_MILLIS);
         }
-        else
+
+        // An external control script's log, say, in the same log as the scan
+        if (gSettings.followFile[0])
         {
-            gLastError = @"Could not talk to Arduino.";
-            NSLog(@"%@", gLastError);
-            gCurrentState = EX_IOERR;
+            follower = [[FileReader alloc] initWithFilePath:[NSString stringWithUTF8String:gSettings.followFile]];
+            [follower startReading];
         }
-        
-        [serialComms closeSerialPort];
-        NSLog(@"Modem port closed.");
+
+        // Now open the ports we found, check whether we have an Arduino responding on each and scan
+        status = [farm runScan:runScanning context:NULL];
+        [follower stopReading];
+        settingsWatchStop(watch);
+        [farm reportStats];
+        NSLog(@"Modem ports closed.");
     }
-    
-    return 0;
+
+    stopTraceLog();
+    return status;
      /*
     ////// testing 2
     ///test reading a file in a background thread while we do other things
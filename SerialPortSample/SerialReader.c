@@ -0,0 +1,416 @@
+//
+//  SerialReader.c
+//  Background thread that drains the serial port, frames and classifies lines and queues them up
+//  for the scan controller
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include "Deadline.h"
+#include "LinkDecoder.h"
+#include "SerialReader.h"
+#include "TraceLog.h"
+
+struct SerialReader
+{
+    ResponseQueue queue;            // first, so the aligned indexes line up with the allocation
+    ResponseQueue logQueue;         // Log: lines, kept apart so they never hold up a response
+    LinkDecoder link;               // framing and parsing, only touched by the reader thread
+    bool queued;                    // a response was queued during this read, so the consumer needs waking
+    char name[16];                  // of the reader thread in the trace log
+    int fileDescriptor;
+    int wakePipe[2];                // reader thread -> consumer: new events are queued
+    int stopPipe[2];                // consumer -> reader thread: stop now
+    pthread_t thread;
+    bool threadStarted;
+    _Atomic bool running;
+    _Atomic int lastError;
+    _Atomic uint64_t bytesRead;
+    _Atomic uint64_t logMessages;
+    _Atomic uint64_t telemetryFrames;
+    _Atomic uint64_t responsesDropped;  // the queues' and the decoder's own counters, which only the reader
+    _Atomic uint64_t logDropped;        // thread touches, copied here after every read for serialReaderGetStats
+    _Atomic uint64_t bytesDiscarded;
+    _Atomic uint64_t framesDecoded;
+    _Atomic uint64_t crcErrors;
+    _Atomic(TrafficCapture *) capture;
+    _Atomic(SensorRing *) sensorRing;
+};
+
+// -------------------------------------------------------------------------------------------
+
+static int openNonBlockingPipe(int fds[2])
+{
+    if (pipe(fds) == -1)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void closePipe(int fds[2])
+{
+    if (fds[0] != -1)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        fds[0] = fds[1] = -1;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Let the consumer know there is something in the queue. If the pipe is already full there are
+// wake-ups pending anyway, so EAGAIN can be ignored.
+static void wakeConsumer(SerialReader *reader)
+{
+    ssize_t ignored = write(reader->wakePipe[1], "", 1);
+    (void)ignored;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Log messages go to their own queue so they never hold up a response
+static void queueResponse(void *context, const ParsedResponse *parsed, uint8_t sequence)
+{
+    SerialReader *reader = context;
+    uint64_t now = monotonicNanos();
+
+    if (parsed->response == LogMessage)
+    {
+        atomic_fetch_add_explicit(&reader->logMessages, 1, memory_order_relaxed);
+        responseQueuePush(&reader->logQueue, parsed, sequence, now);
+        return;
+    }
+
+    // Sensor samples go to whoever asked for them. They're nothing the consumer needs waking for.
+    if (parsed->response == Telemetry)
+    {
+        SensorRing *ring = atomic_load_explicit(&reader->sensorRing, memory_order_acquire);
+
+        atomic_fetch_add_explicit(&reader->telemetryFrames, 1, memory_order_relaxed);
+        if (ring)
+        {
+            sensorRingPush(ring, parsed->text, parsed->textLength, now);
+        }
+        return;
+    }
+
+    responseQueuePush(&reader->queue, parsed, sequence, now);
+    reader->queued = true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Everything read goes to the trace log in traffic mode and to the capture file if there is one
+static void recordTraffic(void *context, const void *data, size_t length)
+{
+    SerialReader *reader = context;
+    TrafficCapture *capture = atomic_load_explicit(&reader->capture, memory_order_acquire);
+
+    traceLogTraffic(TraceReceived, data, length);
+    if (capture)
+    {
+        trafficCaptureRecord(capture, CaptureReceived, data, length);
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Copy the counters the reader thread keeps in plain fields to where other threads can read them
+static void publishCounters(SerialReader *reader)
+{
+    atomic_store_explicit(&reader->responsesDropped, reader->queue.dropped, memory_order_relaxed);
+    atomic_store_explicit(&reader->logDropped, reader->logQueue.dropped, memory_order_relaxed);
+    atomic_store_explicit(&reader->bytesDiscarded, reader->link.framer.discarded, memory_order_relaxed);
+    atomic_store_explicit(&reader->framesDecoded, reader->link.decoder.frames, memory_order_relaxed);
+    atomic_store_explicit(&reader->crcErrors, reader->link.decoder.crcErrors, memory_order_relaxed);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void *readerThread(void *context)
+{
+    SerialReader *reader = context;
+    int maxFd = reader->fileDescriptor > reader->stopPipe[0] ? reader->fileDescriptor : reader->stopPipe[0];
+    fd_set readSet;
+    ssize_t numBytes;
+    int result;
+    int error = 0;
+
+    // Get our log ring now, so the first read doesn't have to
+    traceLogRegisterThread(reader->name);
+
+    while (error == 0)
+    {
+        FD_ZERO(&readSet);
+        FD_SET(reader->fileDescriptor, &readSet);
+        FD_SET(reader->stopPipe[0], &readSet);
+
+        result = select(maxFd + 1, &readSet, NULL, NULL, NULL);
+        if (result == -1)
+        {
+            if (errno != EINTR)
+            {
+                error = errno;
+            }
+            continue;
+        }
+
+        if (FD_ISSET(reader->stopPipe[0], &readSet))
+        {
+            break;
+        }
+
+        reader->queued = false;
+        numBytes = linkDecoderReadFrom(&reader->link, reader->fileDescriptor);
+        publishCounters(reader);
+        if (reader->queued)
+        {
+            wakeConsumer(reader);
+        }
+
+        if (numBytes > 0)
+        {
+            atomic_fetch_add_explicit(&reader->bytesRead, (uint64_t)numBytes, memory_order_relaxed);
+        }
+        else if (numBytes == 0)
+        {
+            // Readable but nothing to read means the other end has gone away (e.g. USB unplugged)
+            error = EIO;
+        }
+        else if (errno != EINTR && errno != EAGAIN)
+        {
+            error = errno;
+        }
+    }
+
+    atomic_store(&reader->lastError, error);
+    atomic_store(&reader->running, false);
+
+    // Make sure a consumer waiting on us notices that we've gone
+    wakeConsumer(reader);
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+SerialReader *serialReaderCreate(int fileDescriptor)
+{
+    SerialReader *reader = NULL;
+
+    if (posix_memalign((void **)&reader, CACHE_LINE_SIZE, sizeof(SerialReader)) != 0)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    memset(reader, 0, sizeof(SerialReader));
+    responseQueueInit(&reader->queue);
+    responseQueueInit(&reader->logQueue);
+    linkDecoderInit(&reader->link, queueResponse, recordTraffic, reader);
+    atomic_init(&reader->capture, NULL);
+    atomic_init(&reader->sensorRing, NULL);
+    reader->fileDescriptor = fileDescriptor;
+    strcpy(reader->name, "reader");
+    reader->wakePipe[0] = reader->wakePipe[1] = -1;
+    reader->stopPipe[0] = reader->stopPipe[1] = -1;
+
+    if (openNonBlockingPipe(reader->wakePipe) == -1 || openNonBlockingPipe(reader->stopPipe) == -1)
+    {
+        int error = errno;
+
+        closePipe(reader->wakePipe);
+        free(reader);
+        errno = error;
+        return NULL;
+    }
+
+    return reader;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int serialReaderStart(SerialReader *reader)
+{
+    int result;
+
+    if (reader->threadStarted)
+    {
+        return 0;
+    }
+
+    atomic_store(&reader->running, true);
+    atomic_store(&reader->lastError, 0);
+
+    result = pthread_create(&reader->thread, NULL, readerThread, reader);
+    if (result != 0)
+    {
+        atomic_store(&reader->running, false);
+        errno = result;
+        return -1;
+    }
+
+    reader->threadStarted = true;
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialReaderStop(SerialReader *reader)
+{
+    ssize_t ignored;
+
+    if (!reader->threadStarted)
+    {
+        return;
+    }
+
+    ignored = write(reader->stopPipe[1], "", 1);
+    (void)ignored;
+    pthread_join(reader->thread, NULL);
+    reader->threadStarted = false;
+
+    // Empty the stop pipe so the reader can be started again
+    char drain[16];
+    while (read(reader->stopPipe[0], drain, sizeof(drain)) > 0)
+    {
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialReaderDestroy(SerialReader *reader)
+{
+    if (reader == NULL)
+    {
+        return;
+    }
+
+    serialReaderStop(reader);
+    closePipe(reader->wakePipe);
+    closePipe(reader->stopPipe);
+    free(reader);
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool serialReaderNext(SerialReader *reader, ResponseEvent *event, uint64_t deadline)
+{
+    char drain[64];
+
+    while (!responseQueuePop(&reader->queue, event))
+    {
+        if (!atomic_load(&reader->running))
+        {
+            // The thread may have queued something just before it stopped
+            return responseQueuePop(&reader->queue, event);
+        }
+
+        if (waitReadable(reader->wakePipe[0], deadline) != 1)
+        {
+            return false;
+        }
+
+        // The pipe only carries wake-ups, the events themselves are in the queue
+        while (read(reader->wakePipe[0], drain, sizeof(drain)) > 0)
+        {
+        }
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool serialReaderNextLog(SerialReader *reader, ResponseEvent *event)
+{
+    return responseQueuePop(&reader->logQueue, event);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialReaderSwitchToBinaryAfterOk(SerialReader *reader)
+{
+    linkDecoderSwitchToBinaryAfterOk(&reader->link);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialReaderSwitchToTextAfterOk(SerialReader *reader)
+{
+    linkDecoderSwitchToTextAfterOk(&reader->link);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialReaderCancelSwitch(SerialReader *reader)
+{
+    linkDecoderCancelSwitch(&reader->link);
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool serialReaderIsBinary(SerialReader *reader)
+{
+    return linkDecoderIsBinary(&reader->link);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialReaderSetName(SerialReader *reader, const char *name)
+{
+    strncpy(reader->name, name, sizeof(reader->name) - 1);
+    reader->name[sizeof(reader->name) - 1] = '\0';
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialReaderSetCapture(SerialReader *reader, TrafficCapture *capture)
+{
+    atomic_store_explicit(&reader->capture, capture, memory_order_release);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialReaderSetSensorRing(SerialReader *reader, SensorRing *ring)
+{
+    atomic_store_explicit(&reader->sensorRing, ring, memory_order_release);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialReaderGetStats(SerialReader *reader, SerialReaderStats *stats)
+{
+    stats->bytesRead = atomic_load_explicit(&reader->bytesRead, memory_order_relaxed);
+    stats->linesFramed = atomic_load_explicit(&reader->link.linesFramed, memory_order_relaxed);
+    stats->logMessages = atomic_load_explicit(&reader->logMessages, memory_order_relaxed);
+    stats->responsesDropped = atomic_load_explicit(&reader->responsesDropped, memory_order_relaxed);
+    stats->logDropped = atomic_load_explicit(&reader->logDropped, memory_order_relaxed);
+    stats->bytesDiscarded = atomic_load_explicit(&reader->bytesDiscarded, memory_order_relaxed);
+    stats->framesDecoded = atomic_load_explicit(&reader->framesDecoded, memory_order_relaxed);
+    stats->crcErrors = atomic_load_explicit(&reader->crcErrors, memory_order_relaxed);
+    stats->telemetryFrames = atomic_load_explicit(&reader->telemetryFrames, memory_order_relaxed);
+    stats->lastError = atomic_load(&reader->lastError);
+    stats->running = atomic_load(&reader->running);
+}
+
+// -------------------------------------------------------------------------------------------
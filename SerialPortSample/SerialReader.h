@@ -0,0 +1,78 @@
+//
+//  SerialReader.h
+//  Background thread that drains the serial port, frames and classifies lines and queues them up
+//  for the scan controller
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#ifndef SerialReader_h
+#define SerialReader_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ResponseQueue.h"
+#include "SensorStream.h"
+#include "TrafficCapture.h"
+
+typedef struct SerialReader SerialReader;
+
+typedef struct
+{
+    uint64_t bytesRead;         // bytes taken off the port
+    uint64_t linesFramed;       // complete lines seen
+    uint64_t logMessages;       // Log: lines (or OpLog frames) put on the log channel
+    uint64_t responsesDropped;  // responses lost because the consumer fell behind. Replies that never arrive
+    uint64_t logDropped;        // Log: lines lost the same way, which only costs the log
+    uint64_t bytesDiscarded;    // bytes thrown away because a line was too long
+    uint64_t framesDecoded;     // binary frames seen
+    uint64_t crcErrors;         // binary frames dropped because the CRC didn't match
+    uint64_t telemetryFrames;   // OpTelemetry frames, put in the sensor ring or thrown away if there is none
+    int lastError;              // errno that stopped the thread, 0 if it's still running or was stopped normally
+    bool running;
+} SerialReaderStats;
+
+// Create a reader for an open file descriptor. The descriptor stays owned by the caller.
+// Returns NULL if the reader could not be allocated (errno is set).
+SerialReader *serialReaderCreate(int fileDescriptor);
+
+// Start and stop the background thread. Start returns 0 on success or -1 (errno is set).
+int serialReaderStart(SerialReader *reader);
+void serialReaderStop(SerialReader *reader);
+
+// Stops the thread if needed and frees the reader
+void serialReaderDestroy(SerialReader *reader);
+
+// Consumer side. Take the next response, waiting until the deadline (in monotonicNanos() time) at most.
+// Returns false on timeout or when the reader thread has stopped and nothing is left in the queue.
+bool serialReaderNext(SerialReader *reader, ResponseEvent *event, uint64_t deadline);
+
+// The log channel. Log messages from the firmware are queued separately from responses, so they can be
+// shown whenever it suits without getting in the way of matching replies. Never waits.
+bool serialReaderNextLog(SerialReader *reader, ResponseEvent *event);
+
+// Protocol switches. The reader thread changes how it decodes the port at the exact byte the Arduino
+// changes over: straight after the CTS:OK (or binary OpOk) that acknowledges the switch command, so
+// nothing that arrives in the same read is decoded the wrong way. Arm the switch before sending the
+// command; cancel it if the command fails.
+void serialReaderSwitchToBinaryAfterOk(SerialReader *reader);
+void serialReaderSwitchToTextAfterOk(SerialReader *reader);
+void serialReaderCancelSwitch(SerialReader *reader);
+bool serialReaderIsBinary(SerialReader *reader);
+
+// What the reader thread is called in the trace log, "reader" unless set. Takes effect on the next start.
+void serialReaderSetName(SerialReader *reader, const char *name);
+
+// Record everything read into a capture, or stop with NULL. The capture must stay open until the reader
+// has been stopped or given a different one.
+void serialReaderSetCapture(SerialReader *reader, TrafficCapture *capture);
+
+// Put telemetry batches in a sensor ring, or throw them away with NULL. They never go in the response
+// queue. The ring must stay allocated until the reader has been stopped or given a different one.
+void serialReaderSetSensorRing(SerialReader *reader, SensorRing *ring);
+
+void serialReaderGetStats(SerialReader *reader, SerialReaderStats *stats);
+
+#endif /* SerialReader_h */
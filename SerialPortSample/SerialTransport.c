@@ -0,0 +1,342 @@
+//
+//  SerialTransport.c
+//  Pluggable serial port backends: how ports are discovered and how an opened port is set up
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "Deadline.h"
+#include "SerialTransport.h"
+
+typedef struct
+{
+    uint32_t rate;
+    speed_t speed;
+} BaudRate;
+
+// The rates termios can set on its own. Anything else is up to the backend.
+static const BaudRate kStandardRates[] =
+{
+    { 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 }, { 19200, B19200 },
+    { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 },
+#ifdef B460800
+    { 460800, B460800 },
+#endif
+#ifdef B500000
+    { 500000, B500000 },
+#endif
+#ifdef B921600
+    { 921600, B921600 },
+#endif
+#ifdef B1000000
+    { 1000000, B1000000 },
+#endif
+};
+
+// -------------------------------------------------------------------------------------------
+
+static bool lookupStandardRate(uint32_t rate, speed_t *speed)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(kStandardRates) / sizeof(kStandardRates[0]); i++)
+    {
+        if (kStandardRates[i].rate == rate)
+        {
+            *speed = kStandardRates[i].speed;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// -------------------------------------------------------------------------------------------
+
+const SerialTransportBackend *defaultSerialBackend(void)
+{
+#ifdef __APPLE__
+    return &kIOKitSerialBackend;
+#else
+    return &kPosixSerialBackend;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialPortDefaultOptions(SerialPortOptions *options)
+{
+    options->baudRate = 9600;
+    options->lowLatency = false;
+    options->hardwareFlowControl = false;
+    options->exclusive = true;
+    options->drainMillis = SERIAL_DRAIN_MILLIS;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialTransportInit(SerialTransport *transport, const SerialTransportBackend *backend)
+{
+    memset(transport, 0, sizeof(SerialTransport));
+    transport->backend = backend ? backend : defaultSerialBackend();
+    transport->fileDescriptor = -1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialTransportSetError(SerialTransport *transport, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(transport->lastError, sizeof(transport->lastError), format, args);
+    va_end(args);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialTransportSetWarning(SerialTransport *transport, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(transport->lastWarning, sizeof(transport->lastWarning), format, args);
+    va_end(args);
+}
+
+// -------------------------------------------------------------------------------------------
+
+int serialTransportOpen(SerialTransport *transport, const char *path, const SerialPortOptions *options)
+{
+    if (transport->fileDescriptor != -1)
+    {
+        serialTransportSetError(transport, "Port %s appears to be open already. Close it before opening", transport->path);
+        return -1;
+    }
+
+    transport->lastError[0] = '\0';
+    transport->lastWarning[0] = '\0';
+    snprintf(transport->path, sizeof(transport->path), "%s", path);
+
+    return transport->backend->open(transport, path, options);
+}
+
+// -------------------------------------------------------------------------------------------
+
+int serialTransportOpenTermios(SerialTransport *transport, const char *path, const SerialPortOptions *options,
+                               bool *standardBaud)
+{
+    struct termios attributes;
+    speed_t speed;
+    int handshake;
+
+    *standardBaud = false;
+
+    // Open the serial port read/write, with no controlling terminal, and don't wait for a connection.
+    // The O_NONBLOCK flag also causes subsequent I/O on the device to be non-blocking, which is how we
+    // want it: the reader thread waits in select(), and a write the port can't take is queued by
+    // CommandWriter rather than holding up the scan.
+    transport->fileDescriptor = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (transport->fileDescriptor == -1)
+    {
+        serialTransportSetError(transport, "Error opening serial port %s - %s(%d).", path, strerror(errno), errno);
+        return -1;
+    }
+
+    // open() follows POSIX semantics: multiple open() calls to the same file will succeed unless the
+    // TIOCEXCL ioctl is issued. This will prevent additional opens except by root-owned processes.
+    if (options->exclusive && ioctl(transport->fileDescriptor, TIOCEXCL) == -1)
+    {
+        serialTransportSetError(transport, "Error setting TIOCEXCL on %s - %s(%d).", path, strerror(errno), errno);
+        goto error;
+    }
+
+    // Get the current options and save them so we can restore the default settings later
+    if (tcgetattr(transport->fileDescriptor, &transport->originalAttributes) == -1)
+    {
+        serialTransportSetError(transport, "Error getting tty attributes %s - %s(%d).", path, strerror(errno), errno);
+        goto error;
+    }
+    transport->attributesSaved = true;
+    transport->drainMillis = options->drainMillis;
+
+    // Set raw input (non-canonical) mode. VMIN and VTIME only matter to a blocking read, which would
+    // wait until either a single character has been received or a one second timeout expires.
+    attributes = transport->originalAttributes;
+    cfmakeraw(&attributes);
+    attributes.c_cflag |= CS8 | CLOCAL | CREAD;
+    attributes.c_cc[VMIN] = 0;     // minimum characters to read
+    attributes.c_cc[VTIME] = 10;   // time out (10 = 1sec) before we give up
+
+    if (options->hardwareFlowControl)
+    {
+#ifdef CRTSCTS
+        attributes.c_cflag |= CRTSCTS;
+#else
+        attributes.c_cflag |= CCTS_OFLOW | CRTS_IFLOW;
+#endif
+    }
+
+    if (lookupStandardRate(options->baudRate, &speed))
+    {
+        cfsetispeed(&attributes, speed);
+        cfsetospeed(&attributes, speed);
+        *standardBaud = true;
+    }
+
+    // Cause the new options to take effect immediately
+    if (tcsetattr(transport->fileDescriptor, TCSANOW, &attributes) == -1)
+    {
+        serialTransportSetError(transport, "Error setting tty attributes %s - %s(%d).", path, strerror(errno), errno);
+        goto error;
+    }
+
+    // Pulse Data Terminal Ready (DTR), then leave DTR and RTS asserted. Pseudo-terminals don't have modem
+    // lines, so none of this is fatal.
+    handshake = TIOCM_DTR;
+    if (ioctl(transport->fileDescriptor, TIOCMBIS, &handshake) == -1 ||
+        ioctl(transport->fileDescriptor, TIOCMBIC, &handshake) == -1)
+    {
+        serialTransportSetWarning(transport, "Error toggling DTR %s - %s(%d).", path, strerror(errno), errno);
+    }
+
+    handshake = TIOCM_DTR | TIOCM_RTS | TIOCM_CTS | TIOCM_DSR;
+    if (ioctl(transport->fileDescriptor, TIOCMSET, &handshake) == -1)
+    {
+        serialTransportSetWarning(transport, "Error setting handshake lines %s - %s(%d).", path, strerror(errno), errno);
+    }
+
+    return transport->fileDescriptor;
+
+error:
+    close(transport->fileDescriptor);
+    transport->fileDescriptor = -1;
+    transport->attributesSaved = false;
+    return -1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int serialTransportSetStandardBaud(SerialTransport *transport, uint32_t baudRate)
+{
+    struct termios attributes;
+    speed_t speed;
+
+    if (!lookupStandardRate(baudRate, &speed))
+    {
+        return 0;
+    }
+
+    if (tcgetattr(transport->fileDescriptor, &attributes) == -1)
+    {
+        serialTransportSetError(transport, "Error getting tty attributes %s - %s(%d).", transport->path,
+                                strerror(errno), errno);
+        return -1;
+    }
+
+    cfsetispeed(&attributes, speed);
+    cfsetospeed(&attributes, speed);
+
+    if (tcsetattr(transport->fileDescriptor, TCSANOW, &attributes) == -1)
+    {
+        serialTransportSetError(transport, "Error setting %u baud on %s - %s(%d).", baudRate, transport->path,
+                                strerror(errno), errno);
+        return -1;
+    }
+
+    return 1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int serialTransportDrain(SerialTransport *transport, uint32_t timeoutMillis)
+{
+    uint64_t deadline = deadlineAfterMillis(timeoutMillis);
+    int pending = 0;
+
+    for (;;)
+    {
+        if (ioctl(transport->fileDescriptor, TIOCOUTQ, &pending) == -1)
+        {
+            // Not a port that can tell us. Nothing for it but to trust the driver
+            if (errno == ENOTTY || errno == EINVAL)
+            {
+                return 0;
+            }
+
+            serialTransportSetWarning(transport, "Error waiting for drain - %s(%d).", strerror(errno), errno);
+            return -1;
+        }
+
+        if (pending <= 0)
+        {
+            return 0;
+        }
+
+        if (monotonicNanos() >= deadline)
+        {
+            break;
+        }
+
+        usleep(SERIAL_DRAIN_POLL_MILLIS * 1000);
+    }
+
+    tcflush(transport->fileDescriptor, TCOFLUSH);
+    serialTransportSetWarning(transport, "Gave up waiting for %d bytes to go out to %s after %u ms.", pending,
+                              transport->path, timeoutMillis);
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int serialTransportSetBaud(SerialTransport *transport, uint32_t baudRate)
+{
+    if (transport->fileDescriptor == -1)
+    {
+        serialTransportSetError(transport, "Port is not open");
+        return -1;
+    }
+
+    transport->lastError[0] = '\0';
+
+    // The command that announced the change has to go out at the old rate
+    serialTransportDrain(transport, transport->drainMillis);
+
+    return transport->backend->setBaud(transport, baudRate);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void serialTransportClose(SerialTransport *transport)
+{
+    if (transport->fileDescriptor == -1)
+    {
+        return;
+    }
+
+    // Give the device a little while to send all written output, but not for ever
+    serialTransportDrain(transport, transport->drainMillis);
+
+    // Traditionally it is good practice to reset a serial port back to the state in which you found it
+    if (transport->attributesSaved &&
+        tcsetattr(transport->fileDescriptor, TCSANOW, &transport->originalAttributes) == -1)
+    {
+        serialTransportSetWarning(transport, "Error resetting tty attributes - %s(%d).", strerror(errno), errno);
+    }
+
+    close(transport->fileDescriptor);
+    transport->fileDescriptor = -1;
+    transport->attributesSaved = false;
+}
+
+// -------------------------------------------------------------------------------------------
@@ -0,0 +1,129 @@
+//
+//  SerialTransport.h
+//  Pluggable serial port backends: how ports are discovered and how an opened port is set up
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Two backends are available. The POSIX one only uses termios (plus termios2 and ASYNC_LOW_LATENCY on
+//  Linux) and finds ports through sysfs, so the host stack builds and runs on Linux. The IOKit one is
+//  macOS only: it finds ports through the IOKit registry and uses the IOSSIOSPEED and IOSSDATALAT ioctls.
+//  Once a port is open both just hand out a file descriptor, so reading and writing is the same for both.
+//
+
+#ifndef SerialTransport_h
+#define SerialTransport_h
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <termios.h>
+
+#define SERIAL_ERROR_LENGTH     256
+#define SERIAL_DRAIN_MILLIS     1000    // default time closing the port waits for the driver to send what it has
+#define SERIAL_DRAIN_POLL_MILLIS 2      // how often the driver's output queue is looked at while draining
+
+typedef struct
+{
+    uint32_t baudRate;              // any rate. Non-standard ones need driver support (termios2 or IOSSIOSPEED)
+    bool lowLatency;                // ask the driver to hand over received bytes straight away
+    bool hardwareFlowControl;       // RTS/CTS. The Arduino holds CTS down while it can't take more
+    bool exclusive;                 // TIOCEXCL, so nobody else can open the port while we have it
+    uint32_t drainMillis;           // longest closing the port or changing the baud rate waits for output to go out
+} SerialPortOptions;
+
+typedef struct
+{
+    char path[PATH_MAX];            // what to pass to open(), e.g. /dev/cu.usbserial-0001 or /dev/ttyUSB0
+    uint16_t vendorId;              // USB vendor and product ID, 0 if not a USB device or unknown
+    uint16_t productId;
+    char serialNumber[64];          // USB serial number, empty if unknown
+} SerialPortInfo;
+
+typedef struct SerialTransport SerialTransport;
+
+// Notifications of ports arriving and going away
+typedef struct
+{
+    int fileDescriptor;             // readable when the ports may have changed, -1 while not watching
+    void *platform;                 // the backend's own state
+} SerialPortWatch;
+
+typedef struct
+{
+    const char *name;
+
+    // List the serial ports that could have an Arduino on them. Fills at most maxPorts entries and returns
+    // the number of ports found (which can be more than maxPorts), or -1 on error.
+    int (*discover)(SerialPortInfo *ports, int maxPorts);
+
+    // Open and set up the port. Returns the file descriptor, or -1 with the reason in transport->lastError.
+    int (*open)(SerialTransport *transport, const char *path, const SerialPortOptions *options);
+
+    // Change the baud rate of an open port. Returns 0, or -1 with the reason in transport->lastError.
+    int (*setBaud)(SerialTransport *transport, uint32_t baudRate);
+
+    // Watch for ports arriving and going away (IOKit notifications, inotify on /dev). Returns 0, or -1 if
+    // the backend can't watch on this system, in which case the ports have to be polled with discover.
+    // Drain takes in the pending notifications, so the descriptor is only readable again after the next
+    // change. Discover tells what actually changed.
+    int (*watchStart)(SerialPortWatch *watch);
+    void (*watchDrain)(SerialPortWatch *watch);
+    void (*watchStop)(SerialPortWatch *watch);
+} SerialTransportBackend;
+
+struct SerialTransport
+{
+    const SerialTransportBackend *backend;
+    int fileDescriptor;                     // -1 while closed
+    struct termios originalAttributes;      // restored on close
+    bool attributesSaved;
+    uint32_t drainMillis;                   // from the options it was opened with
+    char path[PATH_MAX];
+    char lastError[SERIAL_ERROR_LENGTH];    // reason for the last failure
+    char lastWarning[SERIAL_ERROR_LENGTH];  // something that didn't work but isn't fatal, empty if none
+};
+
+extern const SerialTransportBackend kPosixSerialBackend;
+#ifdef __APPLE__
+extern const SerialTransportBackend kIOKitSerialBackend;
+#endif
+
+// The backend for the platform we're running on
+const SerialTransportBackend *defaultSerialBackend(void);
+
+// 9600 baud, exclusive, no flow control, no low latency, SERIAL_DRAIN_MILLIS. That's what the Arduino
+// defaults to.
+void serialPortDefaultOptions(SerialPortOptions *options);
+
+void serialTransportInit(SerialTransport *transport, const SerialTransportBackend *backend);
+int serialTransportOpen(SerialTransport *transport, const char *path, const SerialPortOptions *options);
+
+// Wait until the driver has sent everything written, for timeoutMillis at most. tcdrain() can't be given a
+// timeout, and with hardware flow control a device that holds CTS down makes it wait forever, so this
+// watches the output queue (TIOCOUTQ) instead. On timeout what's left is thrown away (tcflush) and -1 is
+// returned with errno set to ETIMEDOUT and a warning in transport->lastWarning.
+int serialTransportDrain(SerialTransport *transport, uint32_t timeoutMillis);
+
+// Wait until everything written has gone out at the old rate (for drainMillis at most), then switch to the
+// new one
+int serialTransportSetBaud(SerialTransport *transport, uint32_t baudRate);
+
+// Wait for pending output (for drainMillis at most), restore the original attributes and close the port
+void serialTransportClose(SerialTransport *transport);
+
+// Shared by the backends: open the port and put it into raw mode. The port is left non-blocking, reads
+// and writes wait in select() instead. Sets the baud rate if it is one termios knows about; *standardBaud
+// tells the backend whether it still has to set it itself.
+int serialTransportOpenTermios(SerialTransport *transport, const char *path, const SerialPortOptions *options,
+                               bool *standardBaud);
+
+// Shared by the backends: set the baud rate through termios. Returns 1 if it was set, 0 if it isn't a rate
+// termios knows about (so the backend has to set it itself) and -1 on error.
+int serialTransportSetStandardBaud(SerialTransport *transport, uint32_t baudRate);
+
+// Record the reason for a failure (or a non-fatal warning) in the transport
+void serialTransportSetError(SerialTransport *transport, const char *format, ...);
+void serialTransportSetWarning(SerialTransport *transport, const char *format, ...);
+
+#endif /* SerialTransport_h */
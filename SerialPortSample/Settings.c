@@ -0,0 +1,863 @@
+//
+//  Settings.c
+//  The scanner's settings: what there is, what each one may be set to, reading them from the settings
+//  file and noticing when the file changes
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#ifdef __APPLE__
+#include <sys/event.h>
+#endif
+
+#include "FrameCheck.h"
+#include "ReadyHandshake.h"
+#include "Settings.h"
+#include "TraceLog.h"
+
+#define NUMBER(name, field, minimum, maximum, fallback, live) \
+    { name, SettingNumber, offsetof(Settings, field), minimum, maximum, fallback, NULL, NULL, live }
+#define TEXT(name, field, fallback, check) \
+    { name, SettingText, offsetof(Settings, field), 0, 0, 0, fallback, check, false }
+
+static const char *checkNotEmpty(const char *text);
+static const char *checkImageSync(const char *text);
+
+static const SettingSpec gSchema[] =
+{
+    NUMBER("CELLS_TO_READ",     cellsToRead,        0, 10000000, 10, false),
+    TEXT("USB_PORT",            usbPort,            "/dev/cu.usbserial-0001", checkNotEmpty),
+    TEXT("LOGFILE_NAME",        logName,            "ScanBrain.log", checkNotEmpty),
+    TEXT("IMAGE_LOCATION",      imageLocation,      "~/ScanBrain/Images", checkNotEmpty),
+    TEXT("IMAGE_SYNC",          imageSync,          "end", checkImageSync),
+    NUMBER("IMAGE_WRITERS",     imageWriters,       1, 16, 2, false),
+    NUMBER("RESUME_REELS",      resumeReels,        0, 1, 1, false),
+    NUMBER("CAPTURE_PAUSE",     capturePause,       1, 600, 2, true),
+    NUMBER("ADAPTIVE_TIMING",   adaptiveTiming,     0, 1, 1, true),
+    TEXT("TIMING_PROFILES",     timingProfiles,     "~/ScanBrain/Profiles", checkNotEmpty),
+    NUMBER("STARTUP_TIMEOUT",   startupTimeout,     1, 600, HANDSHAKE_TIMEOUT_MILLIS / 1000, true),
+    NUMBER("BINARY_BAUD",       binaryBaud,         -1, 4000000, -1, false),
+    NUMBER("TRACE_TRAFFIC",     traceTraffic,       0, 1, 0, true),
+    TEXT("CAPTURE_FILE",        captureFile,        "", NULL),
+    NUMBER("FARM_THREADS",      farmThreads,        0, 256, 0, false),
+    NUMBER("RECONNECT_TIMEOUT", reconnectTimeout,   0, 3600, 30, true),     // RECONNECT_SECONDS
+    NUMBER("METRICS_INTERVAL",  metricsInterval,    0, 86400, 60, true),
+    NUMBER("HARDWARE_FLOW_CONTROL", hardwareFlowControl, 0, 1, 0, false),
+    NUMBER("DRAIN_TIMEOUT",     drainTimeout,       0, 60000, 1000, false), // SERIAL_DRAIN_MILLIS
+    NUMBER("TELEMETRY",         telemetry,          0, 1, 0, false),
+    NUMBER("FRAME_CHECK",       frameCheck,         0, 1, 1, true),
+    NUMBER("FRAME_READVANCES",  frameReadvances,    0, 5, 1, true),
+    NUMBER("BLANK_CONTRAST",    blankContrast,      0, 255, FRAME_BLANK_CONTRAST, true),
+    TEXT("FOLLOW_FILE",         followFile,         "", NULL),
+};
+
+#define SCHEMA_COUNT    (sizeof(gSchema) / sizeof(gSchema[0]))
+
+struct SettingsWatch
+{
+    char path[PATH_MAX];
+    char folder[PATH_MAX];
+    SettingsChanged changed;
+    void *context;
+    int stopPipe[2];
+    int fileDescriptor;         // inotify or kqueue, -1 if there's no platform watch
+    int watchedFolder;          // kqueue only: says when the file is replaced or created
+    int watchedFile;            // kqueue only: says when the file is written in place
+    struct stat last;           // the file when it was last looked at
+    bool existed;
+    pthread_t thread;
+    bool threadStarted;
+};
+
+// -------------------------------------------------------------------------------------------
+
+static const char *checkNotEmpty(const char *text)
+{
+    return text[0] ? NULL : "can't be empty";
+}
+
+// -------------------------------------------------------------------------------------------
+
+static const char *checkImageSync(const char *text)
+{
+    const char *digit = text;
+
+    if (strcasecmp(text, "frame") == 0 || strcasecmp(text, "end") == 0)
+    {
+        return NULL;
+    }
+
+    while (*digit >= '0' && *digit <= '9')
+    {
+        digit++;
+    }
+
+    return digit != text && *digit == '\0' && atol(text) > 0 ? NULL : "must be 'frame', 'end' or a number of frames";
+}
+
+// -------------------------------------------------------------------------------------------
+
+const SettingSpec *settingsSchema(size_t *count)
+{
+    *count = SCHEMA_COUNT;
+    return gSchema;
+}
+
+// -------------------------------------------------------------------------------------------
+
+const SettingSpec *settingsFind(const char *name, size_t length)
+{
+    for (size_t i = 0; i < SCHEMA_COUNT; i++)
+    {
+        if (strncmp(gSchema[i].name, name, length) == 0 && gSchema[i].name[length] == '\0')
+        {
+            return &gSchema[i];
+        }
+    }
+
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static long *numberField(const SettingSpec *spec, Settings *settings)
+{
+    return (long *)((char *)settings + spec->offset);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static char *textField(const SettingSpec *spec, Settings *settings)
+{
+    return (char *)settings + spec->offset;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void settingsDefaults(Settings *settings)
+{
+    const SettingSpec *spec;
+
+    memset(settings, 0, sizeof(Settings));
+    for (spec = gSchema; spec < gSchema + SCHEMA_COUNT; spec++)
+    {
+        if (spec->type == SettingNumber)
+        {
+            *numberField(spec, settings) = spec->defaultNumber;
+        }
+        else
+        {
+            strcpy(textField(spec, settings), spec->defaultText);
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+void settingsClearErrors(SettingsErrors *errors)
+{
+    errors->count = 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void addError(SettingsErrors *errors, unsigned int line, const char *format, ...)
+{
+    SettingsError *error;
+    va_list arguments;
+
+    if (errors->count < SETTINGS_ERRORS_MAX)
+    {
+        error = &errors->errors[errors->count];
+        error->line = line;
+        va_start(arguments, format);
+        vsnprintf(error->message, sizeof(error->message), format, arguments);
+        va_end(arguments);
+    }
+
+    errors->count++;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Parse a whole number from the span, without needing it terminated
+static bool parseNumber(const char *text, size_t length, long *number)
+{
+    const char *end = text + length;
+    bool negative = false;
+    unsigned long value = 0;
+    unsigned long limit;
+
+    if (text < end && (*text == '-' || *text == '+'))
+    {
+        negative = *text++ == '-';
+    }
+    if (text == end)
+    {
+        return false;
+    }
+
+    limit = negative ? (unsigned long)LONG_MAX + 1 : (unsigned long)LONG_MAX;
+    for (; text < end; text++)
+    {
+        if (*text < '0' || *text > '9' || value > (limit - (unsigned long)(*text - '0')) / 10)
+        {
+            return false;
+        }
+        value = value * 10 + (unsigned long)(*text - '0');
+    }
+
+    *number = negative ? (long)(0 - value) : (long)value;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool setValue(Settings *settings, const SettingSpec *spec, const char *value, size_t length, unsigned int line,
+                     SettingsErrors *errors)
+{
+    char text[SETTINGS_TEXT_MAX];
+    const char *problem;
+    long number;
+
+    if (spec->type == SettingNumber)
+    {
+        if (!parseNumber(value, length, &number))
+        {
+            addError(errors, line, "%s must be a whole number, not '%.*s'", spec->name, (int)(length > 40 ? 40 : length),
+                     value);
+            return false;
+        }
+        if (number < spec->minimum || number > spec->maximum)
+        {
+            addError(errors, line, "%s must be between %ld and %ld, not %ld", spec->name, spec->minimum, spec->maximum,
+                     number);
+            return false;
+        }
+
+        *numberField(spec, settings) = number;
+        return true;
+    }
+
+    if (length >= sizeof(text))
+    {
+        addError(errors, line, "%s is longer than %d characters", spec->name, SETTINGS_TEXT_MAX - 1);
+        return false;
+    }
+
+    memcpy(text, value, length);
+    text[length] = '\0';
+    if (spec->check && (problem = spec->check(text)) != NULL)
+    {
+        addError(errors, line, "%s %s", spec->name, problem);
+        return false;
+    }
+
+    memcpy(textField(spec, settings), text, length + 1);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool settingsSet(Settings *settings, const char *name, const char *value, unsigned int line, SettingsErrors *errors)
+{
+    const SettingSpec *spec = settingsFind(name, strlen(name));
+
+    if (spec == NULL)
+    {
+        addError(errors, line, "There is no setting called %s", name);
+        return false;
+    }
+
+    return setValue(settings, spec, value, strlen(value), line, errors);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// -------------------------------------------------------------------------------------------
+
+static bool isNameCharacter(char c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// -------------------------------------------------------------------------------------------
+
+// One NAME = 'value' line, from start up to (not including) end
+static void parseLine(Settings *settings, const char *start, const char *end, unsigned int line, SettingsErrors *errors)
+{
+    const SettingSpec *spec;
+    const char *name;
+    const char *value;
+    const char *close;
+    size_t nameLength;
+
+    while (start < end && isBlank(*start))
+    {
+        start++;
+    }
+    while (end > start && isBlank(end[-1]))
+    {
+        end--;
+    }
+
+    if (start == end || *start == '#' || (end - start >= 2 && start[0] == '/' && start[1] == '/'))
+    {
+        return;
+    }
+
+    name = start;
+    while (start < end && isNameCharacter(*start))
+    {
+        start++;
+    }
+    nameLength = (size_t)(start - name);
+
+    while (start < end && isBlank(*start))
+    {
+        start++;
+    }
+    if (nameLength == 0 || start == end || *start != '=')
+    {
+        addError(errors, line, "Expected NAME = 'value'");
+        return;
+    }
+
+    start++;
+    while (start < end && isBlank(*start))
+    {
+        start++;
+    }
+
+    value = start;
+    if (start < end && (*start == '\'' || *start == '"'))
+    {
+        close = memchr(start + 1, *start, (size_t)(end - start - 1));
+        if (close == NULL)
+        {
+            addError(errors, line, "The value of %.*s has no closing quote", (int)nameLength, name);
+            return;
+        }
+        value = start + 1;
+        end = close;
+    }
+
+    spec = settingsFind(name, nameLength);
+    if (spec == NULL)
+    {
+        addError(errors, line, "There is no setting called %.*s", (int)nameLength, name);
+        return;
+    }
+
+    setValue(settings, spec, value, (size_t)(end - value), line, errors);
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool settingsParse(Settings *settings, const char *text, size_t length, SettingsErrors *errors)
+{
+    const char *end = text + length;
+    const char *lineEnd;
+    unsigned int before = errors->count;
+    unsigned int line = 0;
+
+    while (text < end)
+    {
+        lineEnd = memchr(text, '\n', (size_t)(end - text));
+        if (lineEnd == NULL)
+        {
+            lineEnd = end;
+        }
+
+        parseLine(settings, text, lineEnd, ++line, errors);
+        text = lineEnd + 1;
+    }
+
+    return errors->count == before;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int settingsLoad(Settings *settings, const char *path, SettingsErrors *errors)
+{
+    struct stat info;
+    char *text;
+    ssize_t got;
+    size_t length = 0;
+    int fileDescriptor = open(path, O_RDONLY | O_CLOEXEC);
+    int error;
+
+    if (fileDescriptor == -1)
+    {
+        return -1;
+    }
+
+    if (fstat(fileDescriptor, &info) == -1)
+    {
+        error = errno;
+        close(fileDescriptor);
+        errno = error;
+        return -1;
+    }
+    if (info.st_size > SETTINGS_FILE_MAX)
+    {
+        close(fileDescriptor);
+        errno = EFBIG;
+        return -1;
+    }
+
+    // One more than its size, to notice if it grew while it was read
+    text = malloc((size_t)info.st_size + 1);
+    if (text == NULL)
+    {
+        close(fileDescriptor);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    while (length <= (size_t)info.st_size &&
+           (got = read(fileDescriptor, text + length, (size_t)info.st_size + 1 - length)) != 0)
+    {
+        if (got == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            error = errno;
+            free(text);
+            close(fileDescriptor);
+            errno = error;
+            return -1;
+        }
+        length += (size_t)got;
+    }
+    close(fileDescriptor);
+
+    if (length > (size_t)info.st_size)
+    {
+        // Being written right now. The watch will say when it's done.
+        free(text);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (!settingsParse(settings, text, length, errors))
+    {
+        free(text);
+        errno = EINVAL;
+        return -1;
+    }
+
+    free(text);
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+SettingsSource settingsResolvePath(const char *given, char *path, size_t size)
+{
+    const char *environment = getenv(SETTINGS_ENVIRONMENT);
+    const char *home = getenv("HOME");
+
+    if (given && given[0])
+    {
+        snprintf(path, size, "%s", given);
+        return SettingsFromCommandLine;
+    }
+
+    if (environment && environment[0])
+    {
+        snprintf(path, size, "%s", environment);
+        return SettingsFromEnvironment;
+    }
+
+    if (home && home[0] && (size_t)snprintf(path, size, "%s/%s", home, SETTINGS_FILE_HOME) < size &&
+        access(path, F_OK) == 0)
+    {
+        return SettingsFromHome;
+    }
+
+    snprintf(path, size, "%s", SETTINGS_FILE_FALLBACK);
+    return SettingsFromFallback;
+}
+
+// -------------------------------------------------------------------------------------------
+
+const char *settingsSourceName(SettingsSource source)
+{
+    static const char *names[] = { "the command line", SETTINGS_ENVIRONMENT, "the home folder", "the built-in path" };
+
+    return source <= SettingsFromFallback ? names[source] : "unknown";
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool settingsDiffer(const SettingSpec *spec, const Settings *a, const Settings *b)
+{
+    if (spec->type == SettingNumber)
+    {
+        return *numberField(spec, (Settings *)a) != *numberField(spec, (Settings *)b);
+    }
+
+    return strcmp(textField(spec, (Settings *)a), textField(spec, (Settings *)b)) != 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void settingsFormat(const SettingSpec *spec, const Settings *settings, char *text, size_t size)
+{
+    if (spec->type == SettingNumber)
+    {
+        snprintf(text, size, "%ld", *numberField(spec, (Settings *)settings));
+    }
+    else
+    {
+        snprintf(text, size, "'%s'", textField(spec, (Settings *)settings));
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+void settingsCopyLive(Settings *to, const Settings *from)
+{
+    const SettingSpec *spec;
+
+    for (spec = gSchema; spec < gSchema + SCHEMA_COUNT; spec++)
+    {
+        if (spec->live)
+        {
+            memcpy((char *)to + spec->offset, (const char *)from + spec->offset,
+                   spec->type == SettingNumber ? sizeof(long) : SETTINGS_TEXT_MAX);
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Whether the file is different from when it was last looked at: written, replaced, created or removed
+static bool fileChanged(SettingsWatch *watch)
+{
+    struct stat info;
+    bool exists = stat(watch->path, &info) == 0;
+    bool changed;
+
+    if (!exists || !watch->existed)
+    {
+        changed = exists != watch->existed;
+    }
+    else
+    {
+#ifdef __APPLE__
+        changed = info.st_mtimespec.tv_sec != watch->last.st_mtimespec.tv_sec ||
+                  info.st_mtimespec.tv_nsec != watch->last.st_mtimespec.tv_nsec;
+#else
+        changed = info.st_mtim.tv_sec != watch->last.st_mtim.tv_sec || info.st_mtim.tv_nsec != watch->last.st_mtim.tv_nsec;
+#endif
+        changed = changed || info.st_ino != watch->last.st_ino || info.st_dev != watch->last.st_dev ||
+                  info.st_size != watch->last.st_size;
+    }
+
+    watch->existed = exists;
+    if (exists)
+    {
+        watch->last = info;
+    }
+
+    return changed;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Watch the folder, which says when the file is replaced or created, and on macOS the file itself, which
+// says when it's written in place. inotify on the folder says both.
+static int platformWatchStart(SettingsWatch *watch)
+{
+#ifdef __linux__
+    watch->fileDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fileDescriptor == -1)
+    {
+        return -1;
+    }
+
+    if (inotify_add_watch(watch->fileDescriptor, watch->folder, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                          IN_CREATE | IN_DELETE | IN_ATTRIB) == -1)
+    {
+        int error = errno;
+
+        close(watch->fileDescriptor);
+        watch->fileDescriptor = -1;
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+#elif defined(__APPLE__)
+    struct kevent change;
+
+    watch->fileDescriptor = kqueue();
+    if (watch->fileDescriptor == -1)
+    {
+        return -1;
+    }
+
+    watch->watchedFolder = open(watch->folder, O_EVTONLY | O_CLOEXEC);
+    EV_SET(&change, watch->watchedFolder, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE, 0, NULL);
+    if (watch->watchedFolder == -1 || kevent(watch->fileDescriptor, &change, 1, NULL, 0, NULL) == -1)
+    {
+        int error = errno;
+
+        if (watch->watchedFolder != -1)
+        {
+            close(watch->watchedFolder);
+            watch->watchedFolder = -1;
+        }
+        close(watch->fileDescriptor);
+        watch->fileDescriptor = -1;
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+#else
+    watch->fileDescriptor = -1;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------
+
+// kqueue watches the file by descriptor, so after it's been replaced, watch the new one
+static void platformWatchFile(SettingsWatch *watch)
+{
+#ifdef __APPLE__
+    struct kevent change;
+
+    if (watch->fileDescriptor == -1)
+    {
+        return;
+    }
+
+    if (watch->watchedFile != -1)
+    {
+        close(watch->watchedFile);      // which also removes it from the kqueue
+    }
+
+    watch->watchedFile = open(watch->path, O_EVTONLY | O_CLOEXEC);
+    if (watch->watchedFile != -1)
+    {
+        EV_SET(&change, watch->watchedFile, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+               NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME, 0, NULL);
+        kevent(watch->fileDescriptor, &change, 1, NULL, 0, NULL);
+    }
+#else
+    (void)watch;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void platformWatchDrain(SettingsWatch *watch)
+{
+#ifdef __APPLE__
+    struct kevent events[8];
+    struct timespec now = { 0, 0 };
+
+    while (kevent(watch->fileDescriptor, NULL, 0, events, 8, &now) > 0)
+    {
+    }
+#else
+    char events[4096];
+
+    while (read(watch->fileDescriptor, events, sizeof(events)) > 0)
+    {
+    }
+#endif
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void *watchThread(void *context)
+{
+    SettingsWatch *watch = context;
+    struct pollfd fds[2];
+    nfds_t count = watch->fileDescriptor != -1 ? 2 : 1;
+    int ready;
+
+    traceLogRegisterThread("settings");
+
+    fds[0].fd = watch->stopPipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = watch->fileDescriptor;
+    fds[1].events = POLLIN;
+
+    for (;;)
+    {
+        if (poll(fds, count, SETTINGS_POLL_MILLIS) == -1 && errno != EINTR)
+        {
+            break;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            break;
+        }
+
+        // Wait for the writing to stop before reading it
+        if (count == 2 && (fds[1].revents & POLLIN))
+        {
+            do
+            {
+                platformWatchDrain(watch);
+                ready = poll(fds, count, SETTINGS_SETTLE_MILLIS);
+            }
+            while (ready > 0 && !(fds[0].revents & POLLIN));
+
+            if (fds[0].revents & POLLIN)
+            {
+                break;
+            }
+        }
+
+        if (fileChanged(watch))
+        {
+            platformWatchFile(watch);
+            watch->changed(watch->context);
+        }
+    }
+
+    traceLogUnregisterThread();
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+SettingsWatch *settingsWatchStart(const char *path, SettingsChanged changed, void *context)
+{
+    SettingsWatch *watch = calloc(1, sizeof(SettingsWatch));
+    char *slash;
+    int result;
+
+    if (watch == NULL)
+    {
+        return NULL;
+    }
+
+    if ((size_t)snprintf(watch->path, sizeof(watch->path), "%s", path) >= sizeof(watch->path))
+    {
+        free(watch);
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    strcpy(watch->folder, path);
+    slash = strrchr(watch->folder, '/');
+    if (slash == NULL)
+    {
+        strcpy(watch->folder, ".");
+    }
+    else
+    {
+        slash[slash == watch->folder ? 1 : 0] = '\0';
+    }
+
+    watch->changed = changed;
+    watch->context = context;
+    watch->watchedFolder = -1;
+    watch->watchedFile = -1;
+
+    if (pipe(watch->stopPipe) == -1)
+    {
+        free(watch);
+        return NULL;
+    }
+    fcntl(watch->stopPipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(watch->stopPipe[1], F_SETFD, FD_CLOEXEC);
+
+    // Without a platform watch the thread still looks at the file, just not as quickly
+    if (platformWatchStart(watch) == -1)
+    {
+        watch->fileDescriptor = -1;
+    }
+
+    fileChanged(watch);
+    platformWatchFile(watch);
+
+    result = pthread_create(&watch->thread, NULL, watchThread, watch);
+    if (result != 0)
+    {
+        settingsWatchStop(watch);
+        errno = result;
+        return NULL;
+    }
+
+    watch->threadStarted = true;
+    return watch;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool settingsWatchNative(const SettingsWatch *watch)
+{
+    return watch->fileDescriptor != -1;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void settingsWatchStop(SettingsWatch *watch)
+{
+    ssize_t ignored;
+
+    if (watch == NULL)
+    {
+        return;
+    }
+
+    if (watch->threadStarted)
+    {
+        ignored = write(watch->stopPipe[1], "", 1);
+        (void)ignored;
+        pthread_join(watch->thread, NULL);
+    }
+
+    if (watch->watchedFile != -1)
+    {
+        close(watch->watchedFile);
+    }
+    if (watch->watchedFolder != -1)
+    {
+        close(watch->watchedFolder);
+    }
+    if (watch->fileDescriptor != -1)
+    {
+        close(watch->fileDescriptor);
+    }
+    close(watch->stopPipe[0]);
+    close(watch->stopPipe[1]);
+    free(watch);
+}
+
+// -------------------------------------------------------------------------------------------
@@ -0,0 +1,153 @@
+//
+//  Settings.h
+//  The scanner's settings: what there is, what each one may be set to, reading them from the settings
+//  file and noticing when the file changes
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Every setting is described once, in the schema in Settings.c: its name in the file, its type, where
+//  it lives in Settings, its default and what it may be set to. Numbers are held as numbers and text in
+//  fixed buffers, so reading the file is one pass over it and one allocation for the whole file.
+//
+//  The file has one NAME = 'value' per line. The quotes can be single, double or left out, lines
+//  starting with // or # are comments. A value that doesn't parse or is out of range, or a name that
+//  isn't known, is an error with its line number. The value it would have replaced is left alone.
+//
+//  Which file is read: the one given on the command line, then SCANBRAIN_SETTINGS, then
+//  ~/ScanBrain/settings.xcconfig, then SETTINGS_FILE_FALLBACK.
+//
+//  Live settings take effect on a running scan when the file changes. The watch uses kqueue on macOS
+//  and inotify on Linux, and looks at the file every SETTINGS_POLL_MILLIS as well in case a change is
+//  missed. Anything else is only read at startup.
+//
+
+#ifndef Settings_h
+#define Settings_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SETTINGS_TEXT_MAX           1024    // longest text value, including the terminating NUL
+#define SETTINGS_ERRORS_MAX         16      // errors kept with their messages, the rest are only counted
+#define SETTINGS_MESSAGE_MAX        160
+#define SETTINGS_FILE_MAX           (1024 * 1024)
+
+#define SETTINGS_ENVIRONMENT        "SCANBRAIN_SETTINGS"
+#define SETTINGS_FILE_HOME          "ScanBrain/settings.xcconfig"  // in the home folder
+#define SETTINGS_FILE_FALLBACK      "/Users/Pius/dev/XCode/ModemCommTest/settings.xcconfig"
+
+#define SETTINGS_POLL_MILLIS        2000    // how often the file is looked at without being told it changed
+#define SETTINGS_SETTLE_MILLIS      100     // quiet time after a change before the file is read, editors
+                                            // write it in several steps
+
+typedef struct
+{
+    long cellsToRead;                       // CELLS_TO_READ
+    char usbPort[SETTINGS_TEXT_MAX];        // USB_PORT, a path or a pattern such as /dev/cu.usbserial-*
+    char logName[SETTINGS_TEXT_MAX];        // LOGFILE_NAME
+    char imageLocation[SETTINGS_TEXT_MAX];  // IMAGE_LOCATION
+    char imageSync[SETTINGS_TEXT_MAX];      // IMAGE_SYNC: "frame", "end" or a number of frames
+    long imageWriters;                      // IMAGE_WRITERS
+    long resumeReels;                       // RESUME_REELS
+    long capturePause;                      // CAPTURE_PAUSE, seconds (live)
+    long adaptiveTiming;                    // ADAPTIVE_TIMING (live)
+    char timingProfiles[SETTINGS_TEXT_MAX]; // TIMING_PROFILES
+    long startupTimeout;                    // STARTUP_TIMEOUT, seconds (live)
+    long binaryBaud;                        // BINARY_BAUD, -1 for the text protocol
+    long traceTraffic;                      // TRACE_TRAFFIC (live)
+    char captureFile[SETTINGS_TEXT_MAX];    // CAPTURE_FILE, empty for none
+    long farmThreads;                       // FARM_THREADS
+    long reconnectTimeout;                  // RECONNECT_TIMEOUT, seconds (live)
+    long metricsInterval;                   // METRICS_INTERVAL, seconds (live)
+    long hardwareFlowControl;               // HARDWARE_FLOW_CONTROL
+    long drainTimeout;                      // DRAIN_TIMEOUT, milliseconds
+    long telemetry;                         // TELEMETRY
+    long frameCheck;                        // FRAME_CHECK (live)
+    long frameReadvances;                   // FRAME_READVANCES (live)
+    long blankContrast;                     // BLANK_CONTRAST, grey levels (live)
+    char followFile[SETTINGS_TEXT_MAX];     // FOLLOW_FILE, empty for none
+} Settings;
+
+typedef enum
+{
+    SettingNumber,
+    SettingText
+} SettingType;
+
+typedef struct
+{
+    const char *name;
+    SettingType type;
+    size_t offset;                          // of the value in Settings
+    long minimum;                           // SettingNumber
+    long maximum;
+    long defaultNumber;
+    const char *defaultText;                // SettingText
+    const char *(*check)(const char *text); // SettingText, returns what's wrong with it or NULL
+    bool live;                              // takes effect on a running scan when the file changes
+} SettingSpec;
+
+typedef struct
+{
+    unsigned int line;                      // in the file, 0 for the command line
+    char message[SETTINGS_MESSAGE_MAX];
+} SettingsError;
+
+typedef struct
+{
+    unsigned int count;                     // may be more than were kept
+    SettingsError errors[SETTINGS_ERRORS_MAX];
+} SettingsErrors;
+
+typedef enum
+{
+    SettingsFromCommandLine,
+    SettingsFromEnvironment,
+    SettingsFromHome,
+    SettingsFromFallback
+} SettingsSource;
+
+// The schema, in the order the settings are listed
+const SettingSpec *settingsSchema(size_t *count);
+const SettingSpec *settingsFind(const char *name, size_t length);
+
+void settingsDefaults(Settings *settings);
+void settingsClearErrors(SettingsErrors *errors);
+
+// Set one setting from its text, as the file would. Returns false (with an error added) if the name
+// isn't known or the value isn't valid, leaving settings as they were.
+bool settingsSet(Settings *settings, const char *name, const char *value, unsigned int line, SettingsErrors *errors);
+
+// Apply every setting in text. Returns false if there were errors; the settings that were valid are
+// applied either way.
+bool settingsParse(Settings *settings, const char *text, size_t length, SettingsErrors *errors);
+
+// Read the file and apply it to settings. Returns 0, or -1 with errno set if it couldn't be read
+// (EFBIG if it's larger than SETTINGS_FILE_MAX) or EINVAL if it had errors.
+int settingsLoad(Settings *settings, const char *path, SettingsErrors *errors);
+
+// Work out which file to read. given is the one from the command line, or NULL. Returns where it came from.
+SettingsSource settingsResolvePath(const char *given, char *path, size_t size);
+const char *settingsSourceName(SettingsSource source);
+
+// Whether a setting differs between the two, and its value as text
+bool settingsDiffer(const SettingSpec *spec, const Settings *a, const Settings *b);
+void settingsFormat(const SettingSpec *spec, const Settings *settings, char *text, size_t size);
+
+// Copy the live settings from one to the other, leaving the rest alone
+void settingsCopyLive(Settings *to, const Settings *from);
+
+typedef void (*SettingsChanged)(void *context);
+typedef struct SettingsWatch SettingsWatch;
+
+// Call changed on a background thread whenever the file's contents may have changed: it was written,
+// replaced or created. Returns NULL on error (errno is set).
+SettingsWatch *settingsWatchStart(const char *path, SettingsChanged changed, void *context);
+
+// False if the platform watch couldn't be set up and the file is only looked at every SETTINGS_POLL_MILLIS
+bool settingsWatchNative(const SettingsWatch *watch);
+
+void settingsWatchStop(SettingsWatch *watch);
+
+#endif /* Settings_h */
@@ -0,0 +1,230 @@
+//
+//  TimingProfile.c
+//  Learns how long a rig takes to move the film a cell, so a move that has gone wrong is noticed after
+//  about as long as a good one takes rather than after the worst case
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Deadline.h"
+#include "TimingProfile.h"
+
+#define TIMING_PROFILE_VERSION  1
+
+// -------------------------------------------------------------------------------------------
+
+static int compareSamples(const void *a, const void *b)
+{
+    uint32_t left = *(const uint32_t *)a;
+    uint32_t right = *(const uint32_t *)b;
+
+    return left < right ? -1 : left > right;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Work the timeout out again from the samples. A move takes a second or so, sorting 256 numbers after
+// each one costs nothing in comparison.
+static void recalculate(TimingProfile *profile)
+{
+    uint32_t sorted[TIMING_WINDOW];
+    unsigned int index;
+    uint64_t timeout;
+
+    if (profile->count < TIMING_MIN_SAMPLES)
+    {
+        profile->percentileMillis = 0;
+        profile->timeoutMillis = profile->ceilingMillis;
+        return;
+    }
+
+    memcpy(sorted, profile->samples, profile->count * sizeof(uint32_t));
+    qsort(sorted, profile->count, sizeof(uint32_t), compareSamples);
+
+    index = (profile->count * TIMING_PERCENTILE + 99) / 100;
+    index = index > 0 ? index - 1 : 0;
+    profile->percentileMillis = (sorted[index] + 999) / 1000;
+
+    timeout = (uint64_t)profile->percentileMillis * (100 + TIMING_MARGIN_PERCENT) / 100 + TIMING_MARGIN_MILLIS;
+    if (timeout < TIMING_FLOOR_MILLIS)
+    {
+        timeout = TIMING_FLOOR_MILLIS;
+    }
+    if (timeout > profile->ceilingMillis)
+    {
+        timeout = profile->ceilingMillis;
+    }
+
+    profile->timeoutMillis = (uint32_t)timeout;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void timingProfileInit(TimingProfile *profile, uint32_t ceilingMillis)
+{
+    memset(profile, 0, sizeof(TimingProfile));
+    profile->ceilingMillis = ceilingMillis;
+    profile->timeoutMillis = ceilingMillis;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void timingProfileSetCeiling(TimingProfile *profile, uint32_t ceilingMillis)
+{
+    profile->ceilingMillis = ceilingMillis;
+    recalculate(profile);
+}
+
+// -------------------------------------------------------------------------------------------
+
+uint32_t timingProfileTimeout(const TimingProfile *profile)
+{
+    return profile->backoff > 0 ? profile->ceilingMillis : profile->timeoutMillis;
+}
+
+// -------------------------------------------------------------------------------------------
+
+uint32_t timingProfileGrace(const TimingProfile *profile)
+{
+    return profile->ceilingMillis - timingProfileTimeout(profile);
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void addSample(TimingProfile *profile, uint64_t nanos)
+{
+    uint64_t micros = nanos / 1000;
+
+    profile->samples[profile->next] = micros > UINT32_MAX ? UINT32_MAX : (uint32_t)micros;
+    profile->next = (profile->next + 1) % TIMING_WINDOW;
+    if (profile->count < TIMING_WINDOW)
+    {
+        profile->count++;
+    }
+    profile->stats.moves++;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool timingProfileRecord(TimingProfile *profile, uint64_t nanos)
+{
+    uint32_t timeout = timingProfileTimeout(profile);
+    bool late = nanos > (uint64_t)timeout * NANOS_PER_MILLI;
+
+    profile->stats.savedNanos += (uint64_t)(profile->ceilingMillis - timeout) * NANOS_PER_MILLI;
+    if (profile->backoff > 0)
+    {
+        profile->backoff--;
+    }
+
+    if (late)
+    {
+        profile->stats.late++;
+        profile->backoff = TIMING_BACKOFF_MOVES;
+    }
+
+    addSample(profile, nanos);
+    recalculate(profile);
+    return late;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void timingProfileFailed(TimingProfile *profile)
+{
+    profile->stats.failed++;
+    profile->backoff = TIMING_BACKOFF_MOVES;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int timingProfileSave(const TimingProfile *profile, const char *path)
+{
+    char temporary[PATH_MAX];
+    unsigned int oldest = (profile->next + TIMING_WINDOW - profile->count) % TIMING_WINDOW;
+    FILE *out;
+    int saved;
+
+    if (snprintf(temporary, sizeof(temporary), "%s.tmp", path) >= (int)sizeof(temporary))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    out = fopen(temporary, "w");
+    if (out == NULL)
+    {
+        return -1;
+    }
+
+    fprintf(out, "# Move times in microseconds, oldest first. Timeout %u ms, p%d %u ms.\n", profile->timeoutMillis,
+            TIMING_PERCENTILE, profile->percentileMillis);
+    fprintf(out, "version %d\nceiling %u\nsamples %u\n", TIMING_PROFILE_VERSION, profile->ceilingMillis,
+            profile->count);
+    for (unsigned int i = 0; i < profile->count; i++)
+    {
+        fprintf(out, "%u\n", profile->samples[(oldest + i) % TIMING_WINDOW]);
+    }
+
+    saved = ferror(out) ? -1 : 0;
+    if (fclose(out) != 0 || saved == -1 || rename(temporary, path) == -1)
+    {
+        saved = errno;
+        unlink(temporary);
+        errno = saved;
+        return -1;
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+int timingProfileLoad(TimingProfile *profile, const char *path)
+{
+    FILE *in = fopen(path, "r");
+    unsigned int version;
+    unsigned int ceiling;
+    unsigned int count;
+    unsigned int sample;
+    unsigned int loaded = 0;
+
+    if (in == NULL)
+    {
+        return -1;
+    }
+
+    if (fscanf(in, "# %*[^\n]\nversion %u\nceiling %u\nsamples %u", &version, &ceiling, &count) != 3 ||
+        version != TIMING_PROFILE_VERSION)
+    {
+        fclose(in);
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (loaded < count && fscanf(in, "%u", &sample) == 1)
+    {
+        addSample(profile, (uint64_t)sample * 1000);
+        loaded++;
+    }
+
+    fclose(in);
+    if (loaded < count)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    recalculate(profile);
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------
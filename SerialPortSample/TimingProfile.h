@@ -0,0 +1,78 @@
+//
+//  TimingProfile.h
+//  Learns how long a rig takes to move the film a cell, so a move that has gone wrong is noticed after
+//  about as long as a good one takes rather than after the worst case
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  The profile keeps the times of the last TIMING_WINDOW moves. The timeout for the next move is their
+//  TIMING_PERCENTILE plus a margin, never more than the ceiling (CAPTURE_PAUSE) and never less than
+//  TIMING_FLOOR_MILLIS. Until it has seen TIMING_MIN_SAMPLES moves, it uses the ceiling.
+//
+//  A move that outlasts its timeout isn't given up on: it gets what's left up to the ceiling as a grace
+//  period. A late move is kept like any other, so if the rig really has slowed down the timeout follows
+//  within a few moves, but it also puts the next TIMING_BACKOFF_MOVES moves back on the ceiling. A single
+//  slow move can't push the timeout up either, as it's above the percentile.
+//
+//  The profile can be saved and loaded again, so the next reel on the same rig starts with what this one
+//  learned. A profile belongs to the thread driving its device.
+//
+
+#ifndef TimingProfile_h
+#define TimingProfile_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMING_WINDOW           256     // most recent moves the timeout is worked out from
+#define TIMING_MIN_SAMPLES      16      // moves to see before the ceiling is no longer used
+#define TIMING_PERCENTILE       99
+#define TIMING_MARGIN_PERCENT   25      // added to the percentile
+#define TIMING_MARGIN_MILLIS    150     // and then this on top
+#define TIMING_FLOOR_MILLIS     250
+#define TIMING_BACKOFF_MOVES    32      // moves at the ceiling after one was late or failed
+
+typedef struct
+{
+    uint64_t moves;             // recorded, including ones loaded from a saved profile
+    uint64_t late;              // took longer than their timeout
+    uint64_t failed;            // never finished
+    uint64_t savedNanos;        // ceiling minus timeout, summed over the moves: how much sooner a stuck move
+                                // would have been noticed
+} TimingStats;
+
+typedef struct
+{
+    uint32_t ceilingMillis;             // longest a move may ever take, the fallback
+    uint32_t samples[TIMING_WINDOW];    // microseconds, oldest overwritten first
+    unsigned int count;
+    unsigned int next;
+    uint32_t timeoutMillis;             // for the next move
+    uint32_t percentileMillis;          // TIMING_PERCENTILE of the samples, 0 before there are enough
+    unsigned int backoff;               // moves left at the ceiling
+    TimingStats stats;
+} TimingProfile;
+
+void timingProfileInit(TimingProfile *profile, uint32_t ceilingMillis);
+
+// CAPTURE_PAUSE changed. The samples are kept, the timeout is worked out again within the new ceiling.
+void timingProfileSetCeiling(TimingProfile *profile, uint32_t ceilingMillis);
+
+// Timeout for the next move, and how much longer it may take after that before it's given up on
+uint32_t timingProfileTimeout(const TimingProfile *profile);
+uint32_t timingProfileGrace(const TimingProfile *profile);
+
+// A move finished after this long (write to OK). Returns true if it was late.
+bool timingProfileRecord(TimingProfile *profile, uint64_t nanos);
+
+// A move didn't finish within its timeout and grace period
+void timingProfileFailed(TimingProfile *profile);
+
+// Save the samples to a file, replacing it in one step. Load them again with the ceiling already set by
+// timingProfileInit; the saved ceiling isn't used. Both return 0, or -1 (errno is set, ENOENT if there's
+// no saved profile yet).
+int timingProfileSave(const TimingProfile *profile, const char *path);
+int timingProfileLoad(TimingProfile *profile, const char *path);
+
+#endif /* TimingProfile_h */
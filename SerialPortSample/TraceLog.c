@@ -0,0 +1,684 @@
+//
+//  TraceLog.c
+//  Binary log for the serial hot path. Threads drop fixed-size records into their own lock-free ring and a
+//  background thread formats and writes them.
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include "Deadline.h"
+#include "TraceLog.h"
+
+#define RING_MASK           (TRACE_RING_SLOTS - 1)
+#define TRACE_CACHE_LINE    64
+#define OUTPUT_SIZE         65536
+#define LINE_MAX_LENGTH     1024        // longest formatted record
+
+_Static_assert((TRACE_RING_SLOTS & RING_MASK) == 0, "TRACE_RING_SLOTS must be a power of two");
+
+typedef struct
+{
+    uint64_t timestamp;                 // monotonicNanos()
+    const char *format;                 // NULL for traffic
+    int64_t args[TRACE_MAX_ARGS];
+    uint16_t length;                    // bytes in data
+    uint8_t argCount;
+    uint8_t direction;                  // TraceDirection, for traffic
+    char data[TRACE_PAYLOAD_MAX];
+} TraceRecord;
+
+// One per thread that logs. Single producer (the owning thread), single consumer (the flusher).
+typedef struct
+{
+    _Alignas(TRACE_CACHE_LINE) _Atomic uint64_t head;   // next record to format, only written by the flusher
+    _Alignas(TRACE_CACHE_LINE) _Atomic uint64_t tail;   // next record to fill, only written by the owner
+    _Atomic uint64_t dropped;
+    _Atomic bool inUse;                                 // owned by a live thread
+    char name[16];
+    TraceRecord slots[TRACE_RING_SLOTS];
+} TraceRing;
+
+// Rings are handed out once and never freed. A thread that exits gives its ring back for the next one.
+static TraceRing *gRings[TRACE_MAX_THREADS];
+static _Atomic unsigned int gRingCount;
+static pthread_mutex_t gRegisterLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t gRingKey;
+static pthread_once_t gRingKeyOnce = PTHREAD_ONCE_INIT;
+
+static _Thread_local TraceRing *tRing;
+static _Thread_local bool tNoRing;              // every ring was taken, don't keep trying
+
+static _Atomic bool gTraffic;
+static _Atomic uint64_t gTrafficBytes;
+static _Atomic uint64_t gUnownedDrops;          // messages from threads that couldn't get a ring
+
+// The flusher's own state. Only touched by the flusher thread, or by traceLogStart/Stop while it isn't running.
+static struct
+{
+    bool running;
+    pthread_t thread;
+    int stopPipe[2];
+    int fileDescriptor;
+    uint64_t startedAt;
+    uint64_t records;
+    uint64_t bytesWritten;
+    uint64_t flushes;
+    uint64_t droppedReported;
+    size_t used;
+    char output[OUTPUT_SIZE];
+} gFlusher = { .stopPipe = { -1, -1 }, .fileDescriptor = -1 };
+
+// -------------------------------------------------------------------------------------------
+
+static void releaseRing(void *ring)
+{
+    atomic_store_explicit(&((TraceRing *)ring)->inUse, false, memory_order_release);
+}
+
+static void createRingKey(void)
+{
+    pthread_key_create(&gRingKey, releaseRing);
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool traceLogRegisterThread(const char *name)
+{
+    TraceRing *ring = NULL;
+    unsigned int count;
+    unsigned int index = 0;
+
+    if (tRing == NULL)
+    {
+        pthread_once(&gRingKeyOnce, createRingKey);
+        pthread_mutex_lock(&gRegisterLock);
+
+        count = atomic_load_explicit(&gRingCount, memory_order_relaxed);
+        for (unsigned int i = 0; i < count && ring == NULL; i++)
+        {
+            if (!atomic_load_explicit(&gRings[i]->inUse, memory_order_acquire))
+            {
+                ring = gRings[i];
+                index = i;
+            }
+        }
+
+        if (ring == NULL && count < TRACE_MAX_THREADS &&
+            posix_memalign((void **)&ring, TRACE_CACHE_LINE, sizeof(TraceRing)) == 0)
+        {
+            memset(ring, 0, sizeof(TraceRing));
+            gRings[count] = ring;
+            index = count;
+            atomic_store_explicit(&gRingCount, count + 1, memory_order_release);
+        }
+
+        if (ring != NULL)
+        {
+            snprintf(ring->name, sizeof(ring->name), "thread %u", index);
+            atomic_store_explicit(&ring->inUse, true, memory_order_relaxed);
+            pthread_setspecific(gRingKey, ring);
+            tRing = ring;
+        }
+
+        pthread_mutex_unlock(&gRegisterLock);
+    }
+
+    if (tRing == NULL)
+    {
+        tNoRing = true;
+        return false;
+    }
+
+    if (name)
+    {
+        // The flusher may be reading the old name, which at worst gets it half changed in one line
+        strncpy(tRing->name, name, sizeof(tRing->name) - 1);
+        tRing->name[sizeof(tRing->name) - 1] = '\0';
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void traceLogUnregisterThread(void)
+{
+    if (tRing)
+    {
+        pthread_setspecific(gRingKey, NULL);
+        releaseRing(tRing);
+        tRing = NULL;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+static TraceRing *threadRing(void)
+{
+    if (tRing == NULL && !tNoRing)
+    {
+        traceLogRegisterThread(NULL);
+    }
+
+    return tRing;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void pushRecord(TraceRing *ring, const char *format, const int64_t *args, unsigned int argCount,
+                       uint8_t direction, const void *data, size_t length)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    TraceRecord *record;
+
+    if (tail - head == TRACE_RING_SLOTS)
+    {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    if (argCount > TRACE_MAX_ARGS)
+    {
+        argCount = TRACE_MAX_ARGS;
+    }
+
+    if (length > TRACE_PAYLOAD_MAX)
+    {
+        length = TRACE_PAYLOAD_MAX;
+    }
+
+    record = &ring->slots[tail & RING_MASK];
+    record->timestamp = monotonicNanos();
+    record->format = format;
+    record->argCount = (uint8_t)argCount;
+    record->direction = direction;
+    record->length = (uint16_t)length;
+    if (argCount > 0)
+    {
+        memcpy(record->args, args, argCount * sizeof(int64_t));
+    }
+    if (length > 0)
+    {
+        memcpy(record->data, data, length);
+    }
+
+    // Publish the record. The release pairs with the acquire in the flusher so it sees the whole record.
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void traceLogWrite(const char *format, const int64_t *args, unsigned int argCount, const void *data, size_t length)
+{
+    TraceRing *ring = threadRing();
+
+    if (ring == NULL)
+    {
+        atomic_fetch_add_explicit(&gUnownedDrops, 1, memory_order_relaxed);
+        return;
+    }
+
+    pushRecord(ring, format, args, argCount, 0, data, length);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void traceLogSetTraffic(bool enabled)
+{
+    atomic_store_explicit(&gTraffic, enabled, memory_order_relaxed);
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool traceLogTrafficEnabled(void)
+{
+    return atomic_load_explicit(&gTraffic, memory_order_relaxed);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void traceLogTraffic(TraceDirection direction, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    TraceRing *ring;
+    size_t chunk;
+
+    if (!atomic_load_explicit(&gTraffic, memory_order_relaxed) || length == 0)
+    {
+        return;
+    }
+
+    ring = threadRing();
+    if (ring == NULL)
+    {
+        atomic_fetch_add_explicit(&gUnownedDrops, 1, memory_order_relaxed);
+        return;
+    }
+
+    atomic_fetch_add_explicit(&gTrafficBytes, length, memory_order_relaxed);
+    while (length > 0)
+    {
+        chunk = length < TRACE_PAYLOAD_MAX ? length : TRACE_PAYLOAD_MAX;
+        pushRecord(ring, NULL, NULL, 0, (uint8_t)direction, bytes, chunk);
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Escape one byte. Returns its length in out, which has room for 4.
+static size_t escapeByte(unsigned char c, char *out)
+{
+    switch (c)
+    {
+        case 27:    memcpy(out, "\\e", 2); return 2;
+        case '\t':  memcpy(out, "\\t", 2); return 2;
+        case '\n':  memcpy(out, "\\n", 2); return 2;
+        case '\r':  memcpy(out, "\\r", 2); return 2;
+        default:
+            if (c >= ' ' && c < 127)
+            {
+                *out = (char)c;
+                return 1;
+            }
+
+            out[0] = '\\';
+            out[1] = (char)('0' + (c >> 6));
+            out[2] = (char)('0' + ((c >> 3) & 7));
+            out[3] = (char)('0' + (c & 7));
+            return 4;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+size_t traceEscape(const void *data, size_t length, char *out, size_t outSize)
+{
+    const unsigned char *bytes = data;
+    size_t limit;
+    size_t used = 0;
+    size_t reserve;
+    size_t count;
+    char escaped[4];
+
+    if (outSize == 0)
+    {
+        return 0;
+    }
+
+    limit = outSize - 1;
+    for (size_t i = 0; i < length; i++)
+    {
+        count = escapeByte(bytes[i], escaped);
+
+        // Unless this is the last byte, leave room for the "..." in case the next one doesn't fit
+        reserve = i + 1 < length ? 3 : 0;
+        if (used + count + reserve > limit)
+        {
+            if (used + 3 <= limit)
+            {
+                memcpy(&out[used], "...", 3);
+                used += 3;
+            }
+            break;
+        }
+
+        memcpy(&out[used], escaped, count);
+        used += count;
+    }
+
+    out[used] = '\0';
+    return used;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Append to a line being formatted, never past its end
+static size_t appendText(char *out, size_t used, size_t size, const char *text, size_t length)
+{
+    if (used + length > size - 1)
+    {
+        length = size - 1 - used;
+    }
+
+    memcpy(&out[used], text, length);
+    return used + length;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static size_t formatMessage(const TraceRecord *record, char *out, size_t size)
+{
+    const char *next = record->format;
+    const char *string;
+    unsigned int argIndex = 0;
+    size_t used = 0;
+    int64_t arg;
+    char number[24];
+    int length;
+
+    while (*next && used < size - 1)
+    {
+        if (*next != '%')
+        {
+            out[used++] = *next++;
+            continue;
+        }
+
+        // Skip flags, widths and length modifiers, the arguments are all 64 bit anyway
+        next++;
+        while (*next && strchr("-+ #0123456789.lhzjqt", *next) != NULL)
+        {
+            next++;
+        }
+
+        if (*next == '\0')
+        {
+            break;
+        }
+
+        arg = (*next != '%' && *next != 'b' && argIndex < record->argCount) ? record->args[argIndex++] : 0;
+        switch (*next)
+        {
+            case 'd':
+            case 'i':
+                length = snprintf(number, sizeof(number), "%lld", (long long)arg);
+                used = appendText(out, used, size, number, (size_t)length);
+                break;
+
+            case 'u':
+                length = snprintf(number, sizeof(number), "%llu", (unsigned long long)arg);
+                used = appendText(out, used, size, number, (size_t)length);
+                break;
+
+            case 'x':
+                length = snprintf(number, sizeof(number), "%llx", (unsigned long long)arg);
+                used = appendText(out, used, size, number, (size_t)length);
+                break;
+
+            case 'c':
+                used += traceEscape(&(char){ (char)arg }, 1, &out[used], size - used);
+                break;
+
+            case 's':
+                string = (const char *)(intptr_t)arg;
+                string = string ? string : "(null)";
+                used = appendText(out, used, size, string, strlen(string));
+                break;
+
+            case 'b':
+                used += traceEscape(record->data, record->length, &out[used], size - used);
+                break;
+
+            default:
+                out[used++] = *next;
+                break;
+        }
+
+        next++;
+    }
+
+    return used;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void writeOutput(void)
+{
+    size_t written = 0;
+    ssize_t numBytes;
+
+    while (written < gFlusher.used)
+    {
+        numBytes = write(gFlusher.fileDescriptor, &gFlusher.output[written], gFlusher.used - written);
+        if (numBytes == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (numBytes <= 0)
+        {
+            // Nowhere to put it. Losing log output is better than holding up the flusher.
+            break;
+        }
+
+        written += (size_t)numBytes;
+    }
+
+    gFlusher.bytesWritten += written;
+    gFlusher.used = 0;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void appendLine(const TraceRing *ring, const TraceRecord *record)
+{
+    char *line;
+    size_t size;
+    size_t used;
+    uint64_t since;
+
+    if (OUTPUT_SIZE - gFlusher.used < LINE_MAX_LENGTH)
+    {
+        writeOutput();
+    }
+
+    line = &gFlusher.output[gFlusher.used];
+    size = LINE_MAX_LENGTH - 1;    // leave room for the NewLine
+    since = record->timestamp > gFlusher.startedAt ? record->timestamp - gFlusher.startedAt : 0;
+    used = (size_t)snprintf(line, size, "%llu.%06llu [%s] ", (unsigned long long)(since / NANOS_PER_SECOND),
+                            (unsigned long long)(since % NANOS_PER_SECOND / 1000), ring->name);
+    if (used > size - 1)
+    {
+        used = size - 1;
+    }
+
+    if (record->format == NULL)
+    {
+        used = appendText(line, used, size, record->direction == TraceSent ? "TX [" : "RX [", 4);
+        used += traceEscape(record->data, record->length, &line[used], size - used);
+        used = appendText(line, used, size, "]", 1);
+    }
+    else
+    {
+        used += formatMessage(record, &line[used], size - used);
+    }
+
+    line[used++] = '\n';
+    gFlusher.used += used;
+    gFlusher.records++;
+}
+
+// -------------------------------------------------------------------------------------------
+
+static uint64_t totalDropped(void)
+{
+    unsigned int count = atomic_load_explicit(&gRingCount, memory_order_acquire);
+    uint64_t dropped = atomic_load_explicit(&gUnownedDrops, memory_order_relaxed);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        dropped += atomic_load_explicit(&gRings[i]->dropped, memory_order_relaxed);
+    }
+
+    return dropped;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Write out what every ring holds right now, oldest first across all the rings
+static void flushRecords(void)
+{
+    uint64_t heads[TRACE_MAX_THREADS];
+    uint64_t tails[TRACE_MAX_THREADS];
+    unsigned int count = atomic_load_explicit(&gRingCount, memory_order_acquire);
+    const TraceRecord *record;
+    const TraceRecord *oldest;
+    unsigned int oldestRing = 0;
+    uint64_t dropped;
+    int length;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        heads[i] = atomic_load_explicit(&gRings[i]->head, memory_order_relaxed);
+        tails[i] = atomic_load_explicit(&gRings[i]->tail, memory_order_acquire);
+    }
+
+    for (;;)
+    {
+        oldest = NULL;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            if (heads[i] != tails[i])
+            {
+                record = &gRings[i]->slots[heads[i] & RING_MASK];
+                if (oldest == NULL || record->timestamp < oldest->timestamp)
+                {
+                    oldest = record;
+                    oldestRing = i;
+                }
+            }
+        }
+
+        if (oldest == NULL)
+        {
+            break;
+        }
+
+        appendLine(gRings[oldestRing], oldest);
+
+        // Hand the record back to its thread as soon as it's been formatted
+        heads[oldestRing]++;
+        atomic_store_explicit(&gRings[oldestRing]->head, heads[oldestRing], memory_order_release);
+    }
+
+    dropped = totalDropped();
+    if (dropped != gFlusher.droppedReported)
+    {
+        if (OUTPUT_SIZE - gFlusher.used < LINE_MAX_LENGTH)
+        {
+            writeOutput();
+        }
+
+        length = snprintf(&gFlusher.output[gFlusher.used], LINE_MAX_LENGTH, "Trace log dropped %llu records\n",
+                          (unsigned long long)(dropped - gFlusher.droppedReported));
+        gFlusher.used += (size_t)length;
+        gFlusher.droppedReported = dropped;
+    }
+
+    if (gFlusher.used > 0)
+    {
+        writeOutput();
+        gFlusher.flushes++;
+    }
+}
+
+// -------------------------------------------------------------------------------------------
+
+static void *flushThread(void *context)
+{
+    struct timeval timeout;
+    fd_set readSet;
+    int result;
+
+    (void)context;
+    for (;;)
+    {
+        FD_ZERO(&readSet);
+        FD_SET(gFlusher.stopPipe[0], &readSet);
+        timeout.tv_sec = 0;
+        timeout.tv_usec = TRACE_FLUSH_MILLIS * 1000;
+
+        result = select(gFlusher.stopPipe[0] + 1, &readSet, NULL, NULL, &timeout);
+        if (result > 0)
+        {
+            break;
+        }
+
+        flushRecords();
+    }
+
+    // Whatever came in while we were told to stop
+    flushRecords();
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool traceLogStart(int fileDescriptor)
+{
+    int result;
+
+    if (gFlusher.running)
+    {
+        return true;
+    }
+
+    if (pipe(gFlusher.stopPipe) == -1)
+    {
+        return false;
+    }
+
+    gFlusher.fileDescriptor = fileDescriptor;
+    gFlusher.startedAt = monotonicNanos();
+
+    result = pthread_create(&gFlusher.thread, NULL, flushThread, NULL);
+    if (result != 0)
+    {
+        close(gFlusher.stopPipe[0]);
+        close(gFlusher.stopPipe[1]);
+        gFlusher.stopPipe[0] = gFlusher.stopPipe[1] = -1;
+        errno = result;
+        return false;
+    }
+
+    gFlusher.running = true;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void traceLogStop(void)
+{
+    ssize_t ignored;
+
+    if (!gFlusher.running)
+    {
+        return;
+    }
+
+    ignored = write(gFlusher.stopPipe[1], "", 1);
+    (void)ignored;
+    pthread_join(gFlusher.thread, NULL);
+
+    close(gFlusher.stopPipe[0]);
+    close(gFlusher.stopPipe[1]);
+    gFlusher.stopPipe[0] = gFlusher.stopPipe[1] = -1;
+    gFlusher.running = false;
+}
+
+// -------------------------------------------------------------------------------------------
+
+// Exact once the flusher has stopped, a moment behind while it's running
+void traceLogGetStats(TraceLogStats *stats)
+{
+    stats->records = gFlusher.records;
+    stats->dropped = totalDropped();
+    stats->trafficBytes = atomic_load_explicit(&gTrafficBytes, memory_order_relaxed);
+    stats->bytesWritten = gFlusher.bytesWritten;
+    stats->flushes = gFlusher.flushes;
+    stats->threads = atomic_load_explicit(&gRingCount, memory_order_acquire);
+}
+
+// -------------------------------------------------------------------------------------------
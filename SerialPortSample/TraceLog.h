@@ -0,0 +1,98 @@
+//
+//  TraceLog.h
+//  Binary log for the serial hot path. Threads drop fixed-size records into their own lock-free ring and a
+//  background thread formats and writes them.
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  Logging a message copies the format pointer, up to TRACE_MAX_ARGS integer arguments and an optional
+//  run of bytes into the calling thread's ring. Nothing is formatted, allocated or written on the calling
+//  thread, and it never waits: if its ring is full the record is counted as dropped. The flusher thread
+//  wakes every TRACE_FLUSH_MILLIS, merges the rings in time order, formats the records and writes them out
+//  in one go.
+//
+//  Formatting is done later, so the format string and any %s arguments must live for the whole run
+//  (string literals, commandText()). The arguments are all passed as 64 bit integers. Formats understand
+//  %d %i %u %x %c %s %% and %b, which inserts the record's bytes with non-printable characters escaped.
+//  Flags, widths and length modifiers are accepted and ignored.
+//
+//  Traffic mode additionally records every byte sent to and received from the Arduino, shown as escaped
+//  text in the log.
+//
+
+#ifndef TraceLog_h
+#define TraceLog_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAX_ARGS          6
+#define TRACE_PAYLOAD_MAX       168     // bytes copied per record. Longer traffic is split over several
+#define TRACE_RING_SLOTS        512     // records per thread, must be a power of two
+#define TRACE_MAX_THREADS       64      // a farm of 16 devices runs up to four threads each
+#define TRACE_FLUSH_MILLIS      20
+
+typedef enum
+{
+    TraceReceived,
+    TraceSent
+} TraceDirection;
+
+typedef struct
+{
+    uint64_t records;           // written out
+    uint64_t dropped;           // lost because a thread's ring was full
+    uint64_t trafficBytes;      // bytes recorded in traffic mode
+    uint64_t bytesWritten;      // formatted output
+    uint64_t flushes;
+    unsigned int threads;       // rings handed out so far
+} TraceLogStats;
+
+// Start the flusher thread, writing to fileDescriptor (e.g. STDERR_FILENO). Returns false if it couldn't
+// be started. Records logged before this are kept until the calling thread's ring fills.
+bool traceLogStart(int fileDescriptor);
+
+// Write out everything logged so far and stop the flusher
+void traceLogStop(void);
+
+// Give the calling thread its ring now, rather than on its first message, and name it in the output.
+// Threads on the hot path should call this when they start so the first message doesn't allocate.
+bool traceLogRegisterThread(const char *name);
+
+// Hand back the calling thread's ring. Done automatically when a thread exits.
+void traceLogUnregisterThread(void);
+
+// Log a message. Use the TRACE macro rather than calling this directly.
+void traceLogWrite(const char *format, const int64_t *args, unsigned int argCount, const void *data, size_t length);
+
+// Traffic mode: every byte that goes over the serial link is logged too
+void traceLogSetTraffic(bool enabled);
+bool traceLogTrafficEnabled(void);
+
+// Record bytes sent or received. Cheap enough to call unconditionally, it returns straight away
+// unless traffic mode is on.
+void traceLogTraffic(TraceDirection direction, const void *data, size_t length);
+
+void traceLogGetStats(TraceLogStats *stats);
+
+// Copy length bytes of data to out with non-printable characters escaped (\n, \r, \t, \e, \ooo). Always
+// NUL terminates and never writes more than outSize bytes, cutting the text short with "..." if needed.
+// Returns the length of the text written.
+size_t traceEscape(const void *data, size_t length, char *out, size_t outSize);
+
+// Integers can be passed as they are. Strings for %s have to go through TRACE_STR.
+#define TRACE_STR(string)       ((int64_t)(intptr_t)(const char *)(string))
+
+// TRACE("Wrote %u bytes [%s]", length, TRACE_STR(commandText(command)))
+#define TRACE(format, ...) \
+    traceLogWrite((format), (const int64_t[]){ 0, ##__VA_ARGS__ } + 1, \
+                  sizeof((const int64_t[]){ 0, ##__VA_ARGS__ }) / sizeof(int64_t) - 1, NULL, 0)
+
+// The same with bytes for %b, e.g. TRACE_BYTES(line, length, "Read [%b]")
+#define TRACE_BYTES(data, length, format, ...) \
+    traceLogWrite((format), (const int64_t[]){ 0, ##__VA_ARGS__ } + 1, \
+                  sizeof((const int64_t[]){ 0, ##__VA_ARGS__ }) / sizeof(int64_t) - 1, (data), (length))
+
+#endif /* TraceLog_h */
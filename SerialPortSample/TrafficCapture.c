@@ -0,0 +1,299 @@
+//
+//  TrafficCapture.c
+//  Records every byte sent to and received from the Arduino, with timestamps, in a file that can be
+//  mapped and replayed later
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Deadline.h"
+#include "TrafficCapture.h"
+
+#define RECORD_ALIGNMENT    8
+
+_Static_assert(sizeof(CaptureFileHeader) == 64, "CaptureFileHeader is part of the file format");
+_Static_assert(sizeof(CaptureRecordHeader) == 16, "CaptureRecordHeader is part of the file format");
+
+struct TrafficCapture
+{
+    int fileDescriptor;
+    uint8_t *base;                  // the whole file, mapped
+    size_t capacity;                // bytes available for records
+    uint64_t startedAt;
+    _Atomic size_t used;            // bytes of records claimed so far
+    _Atomic uint64_t records;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t dropped;
+};
+
+// -------------------------------------------------------------------------------------------
+
+static size_t recordSize(size_t length)
+{
+    return (sizeof(CaptureRecordHeader) + length + RECORD_ALIGNMENT - 1) & ~(size_t)(RECORD_ALIGNMENT - 1);
+}
+
+// -------------------------------------------------------------------------------------------
+
+TrafficCapture *trafficCaptureOpen(const char *path, size_t capacity)
+{
+    TrafficCapture *capture;
+    CaptureFileHeader *header;
+    size_t fileLength = sizeof(CaptureFileHeader) + capacity;
+    int error;
+
+    capture = calloc(1, sizeof(TrafficCapture));
+    if (capture == NULL)
+    {
+        return NULL;
+    }
+
+    capture->fileDescriptor = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (capture->fileDescriptor == -1)
+    {
+        error = errno;
+        free(capture);
+        errno = error;
+        return NULL;
+    }
+
+    // Sparse, so only the pages actually written take up disk space
+    if (ftruncate(capture->fileDescriptor, (off_t)fileLength) == -1)
+    {
+        goto failed;
+    }
+
+    capture->base = mmap(NULL, fileLength, PROT_READ | PROT_WRITE, MAP_SHARED, capture->fileDescriptor, 0);
+    if (capture->base == MAP_FAILED)
+    {
+        goto failed;
+    }
+
+    capture->capacity = capacity;
+    capture->startedAt = monotonicNanos();
+    atomic_init(&capture->used, 0);
+
+    header = (CaptureFileHeader *)capture->base;
+    memcpy(header->magic, CAPTURE_MAGIC, sizeof(header->magic));
+    header->version = CAPTURE_VERSION;
+    header->headerLength = sizeof(CaptureFileHeader);
+    header->startedAt = capture->startedAt;
+    header->wallClockSeconds = (uint64_t)time(NULL);
+    header->recordsLength = 0;
+    return capture;
+
+failed:
+    error = errno;
+    close(capture->fileDescriptor);
+    unlink(path);
+    free(capture);
+    errno = error;
+    return NULL;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void trafficCaptureRecord(TrafficCapture *capture, CaptureDirection direction, const void *data, size_t length)
+{
+    size_t size = recordSize(length);
+    size_t offset = atomic_load_explicit(&capture->used, memory_order_relaxed);
+    CaptureRecordHeader *record;
+    uint64_t now = monotonicNanos();
+
+    if (length == 0)
+    {
+        return;
+    }
+
+    // Claim the space. Whoever wins the race gets the next bit of the file, the other thread tries again
+    // after it.
+    do
+    {
+        if (offset + size > capture->capacity || length > UINT32_MAX)
+        {
+            atomic_fetch_add_explicit(&capture->dropped, 1, memory_order_relaxed);
+            return;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&capture->used, &offset, offset + size,
+                                                    memory_order_relaxed, memory_order_relaxed));
+
+    record = (CaptureRecordHeader *)&capture->base[sizeof(CaptureFileHeader) + offset];
+    record->offsetNanos = now - capture->startedAt;
+    record->direction = (uint8_t)direction;
+    memcpy(&record[1], data, length);
+
+    // The length says the record is complete, so it goes in last
+    atomic_store_explicit((_Atomic uint32_t *)&record->length, (uint32_t)length, memory_order_release);
+
+    atomic_fetch_add_explicit(&capture->records, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&capture->bytes, length, memory_order_relaxed);
+}
+
+// -------------------------------------------------------------------------------------------
+
+void trafficCaptureGetStats(TrafficCapture *capture, TrafficCaptureStats *stats)
+{
+    stats->records = atomic_load_explicit(&capture->records, memory_order_relaxed);
+    stats->bytes = atomic_load_explicit(&capture->bytes, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&capture->dropped, memory_order_relaxed);
+    stats->used = atomic_load_explicit(&capture->used, memory_order_relaxed);
+    stats->capacity = capture->capacity;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void trafficCaptureClose(TrafficCapture *capture)
+{
+    size_t used;
+    int ignored;
+
+    if (capture == NULL)
+    {
+        return;
+    }
+
+    used = atomic_load(&capture->used);
+    ((CaptureFileHeader *)capture->base)->recordsLength = used;
+
+    munmap(capture->base, sizeof(CaptureFileHeader) + capture->capacity);
+
+    // If this fails the capture is still readable, just with a long sparse tail
+    ignored = ftruncate(capture->fileDescriptor, (off_t)(sizeof(CaptureFileHeader) + used));
+    (void)ignored;
+    close(capture->fileDescriptor);
+    free(capture);
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool captureFileOpen(CaptureFile *file, const char *path)
+{
+    struct stat info;
+    int fileDescriptor;
+    void *base;
+
+    memset(file, 0, sizeof(CaptureFile));
+
+    fileDescriptor = open(path, O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor == -1)
+    {
+        return false;
+    }
+
+    if (fstat(fileDescriptor, &info) == -1)
+    {
+        close(fileDescriptor);
+        return false;
+    }
+
+    if ((size_t)info.st_size < sizeof(CaptureFileHeader))
+    {
+        close(fileDescriptor);
+        errno = EINVAL;
+        return false;
+    }
+
+    base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    close(fileDescriptor);
+    if (base == MAP_FAILED)
+    {
+        return false;
+    }
+
+    file->base = base;
+    file->mappedLength = (size_t)info.st_size;
+    file->header = base;
+
+    if (memcmp(file->header->magic, CAPTURE_MAGIC, sizeof(file->header->magic)) != 0 ||
+        file->header->version != CAPTURE_VERSION || file->header->headerLength < sizeof(CaptureFileHeader) ||
+        file->header->headerLength > file->mappedLength)
+    {
+        captureFileClose(file);
+        errno = EINVAL;
+        return false;
+    }
+
+    // A capture that was never closed runs until the first unfinished record
+    file->end = file->mappedLength;
+    if (file->header->recordsLength != 0 && file->header->headerLength + file->header->recordsLength < file->end)
+    {
+        file->end = file->header->headerLength + file->header->recordsLength;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+void captureFileClose(CaptureFile *file)
+{
+    if (file->base)
+    {
+        munmap((void *)file->base, file->mappedLength);
+    }
+
+    memset(file, 0, sizeof(CaptureFile));
+}
+
+// -------------------------------------------------------------------------------------------
+
+bool captureFileNext(const CaptureFile *file, size_t *position, CaptureRecord *record)
+{
+    size_t offset = file->header->headerLength + *position;
+    const CaptureRecordHeader *header;
+
+    if (offset + sizeof(CaptureRecordHeader) > file->end)
+    {
+        return false;
+    }
+
+    header = (const CaptureRecordHeader *)&file->base[offset];
+    if (header->length == 0 || offset + sizeof(CaptureRecordHeader) + header->length > file->end)
+    {
+        return false;
+    }
+
+    record->offsetNanos = header->offsetNanos;
+    record->direction = (CaptureDirection)header->direction;
+    record->data = (const uint8_t *)&header[1];
+    record->length = header->length;
+
+    *position += recordSize(header->length);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------
+
+uint64_t captureFileDuration(const CaptureFile *file)
+{
+    CaptureRecord record;
+    size_t position = 0;
+    uint64_t first = 0;
+    uint64_t last = 0;
+    bool any = false;
+
+    while (captureFileNext(file, &position, &record))
+    {
+        if (!any)
+        {
+            first = record.offsetNanos;
+            any = true;
+        }
+        last = record.offsetNanos;
+    }
+
+    return last - first;
+}
+
+// -------------------------------------------------------------------------------------------
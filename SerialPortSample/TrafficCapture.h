@@ -0,0 +1,107 @@
+//
+//  TrafficCapture.h
+//  Records every byte sent to and received from the Arduino, with timestamps, in a file that can be
+//  mapped and replayed later
+//
+//  Created by Pius Ott on 16/10/2026.
+//  Copyright © 2026 WorldDom. All rights reserved.
+//
+//  The file is a CaptureFileHeader followed by records, each a CaptureRecordHeader and its bytes padded
+//  to a multiple of 8 so every header is aligned in memory. Records are only ever appended.
+//
+//  The whole file is mapped while capturing. Space for a record is claimed with a compare-and-swap, so the
+//  reader thread and the scan thread can both record at once without a lock and without a system call.
+//  A record's length is written last; a capture cut short by a crash ends at the first record whose length
+//  is still 0. Once the capacity is used up, further records are counted as dropped.
+//
+//  All values are in host byte order.
+//
+
+#ifndef TrafficCapture_h
+#define TrafficCapture_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CAPTURE_MAGIC               "SERCAP01"
+#define CAPTURE_VERSION             1
+#define CAPTURE_DEFAULT_CAPACITY    (256u * 1024 * 1024)    // the file is sparse, so this costs nothing up front
+
+typedef enum
+{
+    CaptureReceived,            // Arduino to host
+    CaptureSent                 // host to Arduino
+} CaptureDirection;
+
+typedef struct
+{
+    char magic[8];              // CAPTURE_MAGIC, not NUL terminated
+    uint32_t version;
+    uint32_t headerLength;      // sizeof(CaptureFileHeader), records start here
+    uint64_t startedAt;         // monotonicNanos() when the capture was opened
+    uint64_t wallClockSeconds;  // time() when the capture was opened
+    uint64_t recordsLength;     // bytes of records. 0 if the capture was never closed
+    uint8_t reserved[24];
+} CaptureFileHeader;
+
+typedef struct
+{
+    uint64_t offsetNanos;       // since startedAt
+    uint32_t length;            // bytes following the header, written last
+    uint8_t direction;          // CaptureDirection
+    uint8_t reserved[3];
+} CaptureRecordHeader;
+
+// A record in a mapped capture. The data points into the mapping.
+typedef struct
+{
+    uint64_t offsetNanos;
+    CaptureDirection direction;
+    const uint8_t *data;
+    size_t length;
+} CaptureRecord;
+
+typedef struct
+{
+    uint64_t records;
+    uint64_t bytes;             // data bytes, not counting headers
+    uint64_t dropped;           // records that didn't fit
+    size_t used;                // bytes of the file used so far
+    size_t capacity;
+} TrafficCaptureStats;
+
+typedef struct TrafficCapture TrafficCapture;
+
+// Writer. Create (or truncate) the file and map capacity bytes of it. Returns NULL on error (errno is set).
+TrafficCapture *trafficCaptureOpen(const char *path, size_t capacity);
+
+// Append a record. Safe to call from several threads at once. Never blocks.
+void trafficCaptureRecord(TrafficCapture *capture, CaptureDirection direction, const void *data, size_t length);
+
+void trafficCaptureGetStats(TrafficCapture *capture, TrafficCaptureStats *stats);
+
+// Finish the header, cut the file down to what was used and free the capture. Nobody may be recording
+// any more.
+void trafficCaptureClose(TrafficCapture *capture);
+
+// Reader. Maps a finished (or crashed) capture read-only.
+typedef struct
+{
+    const uint8_t *base;
+    size_t mappedLength;
+    const CaptureFileHeader *header;
+    size_t end;                 // offset one past the last record that can be read
+} CaptureFile;
+
+// Returns false if the file can't be mapped or isn't a capture (errno is set, EINVAL for a bad header)
+bool captureFileOpen(CaptureFile *file, const char *path);
+void captureFileClose(CaptureFile *file);
+
+// Step through the records. Start with *position set to 0. Returns false after the last record.
+bool captureFileNext(const CaptureFile *file, size_t *position, CaptureRecord *record);
+
+// Time from the first to the last record
+uint64_t captureFileDuration(const CaptureFile *file);
+
+#endif /* TrafficCapture_h */
@@ -17,8 +17,6 @@
 
 +(NSString *) convertCFTypeRefToNSString:(CFTypeRef)cfType;
 
-+(NSInteger) getNumberFromString:(NSString *)input;
-
 +(char *) logString:(char *)str;
 
 + (ArduinoResponse) translateResponse:(char *)str;
@@ -9,6 +9,8 @@
 #import <Foundation/Foundation.h>
 
 #import "Utilities.h"
+#import "ResponseParser.h"
+#import "TraceLog.h"
 
 @implementation Utilities
 
@@ -34,87 +36,14 @@
 
 // -------------------------------------------------------------------------------------------
 
-+(NSInteger) getNumberFromString:(NSString *)input
-{
-    NSInteger result = 0;
-    
-    NSNumberFormatter *formatter = [[NSNumberFormatter alloc] init];
-    formatter.numberStyle = NSNumberFormatterDecimalStyle;
-
-    NSNumber *number = [formatter numberFromString:input];
-
-    if (number)
-    {
-        result = [number integerValue];
-        //NSLog(@"The integer value is: %d", (int)result);
-    }
-    else
-    {
-        NSLog(@"Invalid number string: %@", input);
-    }
-
-    return result;
-}
-
-// -------------------------------------------------------------------------------------------
-
 // Replace non-printable characters in str with '\'-escaped equivalents.
-// This function is used for convenient logging of data traffic.
+// This function is used for convenient logging of data traffic. Each thread has its own buffer, and text
+// that doesn't fit is cut short with "...". The result is only valid until the thread calls it again.
 + (char *)logString:(char *)str
 {
-    static char     buf[2048];
-    char            *ptr = buf;
-    int             i;
-    
-    *ptr = '\0';
-    
-    while (*str)
-    {
-        if (isprint(*str))
-        {
-            *ptr++ = *str++;
-        }
-        else
-        {
-            switch(*str)
-            {
-                case ' ':
-                    *ptr++ = *str;
-                    break;
-                    
-                case 27:
-                    *ptr++ = '\\';
-                    *ptr++ = 'e';
-                    break;
-                    
-                case '\t':
-                    *ptr++ = '\\';
-                    *ptr++ = 't';
-                    break;
-                    
-                case '\n':
-                    *ptr++ = '\\';
-                    *ptr++ = 'n';
-                    break;
-                    
-                case '\r':
-                    *ptr++ = '\\';
-                    *ptr++ = 'r';
-                    break;
-                    
-                default:
-                    i = *str;
-                    (void)sprintf(ptr, "\\%03o", i);
-                    ptr += 4;
-                    break;
-            }
-            
-            str++;
-        }
-        
-        *ptr = '\0';
-    }
-    
+    static __thread char buf[2048];
+
+    traceEscape(str, strlen(str), buf, sizeof(buf));
     return buf;
 }
 
@@ -124,20 +53,9 @@
 // Translate the Arduino response to a valid command.
 + (ArduinoResponse) translateResponse:(char *)str
 {
-    // TODO: The RSP_ERR does not work with this yet because it will be followed by a code or text
-    //       of undefined length. If we get an RSP_ERR start, we need to read the rest of the buffer
-    //       until we get to a \n. Also, we need to somehow return that error text too.
-    
-    ArduinoResponse response = Unrecognised;
-    
-    if (strncmp(str, CMD_OK, strlen(CMD_OK)) == 0)
-        response = Ok;
-    else if (strncmp(str, RSP_ERR, strlen(RSP_ERR)) == 0)
-        response = Error;
-    else if (strncmp(str, CMD_READY, strlen(CMD_READY)) == 0)
-        response = Ready;
-    else if (strncmp(str, CMD_ATCELL, strlen(CMD_ATCELL)) == 0)
-        response = AtCell;
+    // The reader thread classifies lines too, so the matching itself lives in plain C. Use parseResponse
+    // for the error code and text that come with CTS:ERROR.
+    ArduinoResponse response = classifyResponse(str, strlen(str));
     
     return response;
 }